@@ -0,0 +1,438 @@
+#include "software_rasterizer/precompiled.h"
+
+#include "software_rasterizer/benchmark/scene.h"
+#include "software_rasterizer/demo/histogram.h"
+#include "software_rasterizer/demo/osal.h"
+#include "software_rasterizer/rasterizer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* A headless benchmark, renders a fixed number of frames of a scene and writes the timings of each frame.
+ * Everything but the timings is deterministic so runs of the same build can be compared to catch regressions,
+ * the rasterize areas don't depend on the thread count so the checksums match with any number of threads.
+ * SIMD and tiles are compile time options of the rasterizer, each combination needs its own build. */
+
+/* Without tiles the render target is split to areas of this size, interpolated values can differ in the lowest bits between splits */
+#define AREA_SIZE 256
+
+enum output_format
+{
+	OUTPUT_FORMAT_CSV = 0,
+	OUTPUT_FORMAT_JSON
+};
+
+struct options
+{
+	const char *scene_name;
+	const char *output_file; /* NULL writes to stdout */
+	struct vec2_int resolution;
+	uint32_t thread_count;
+	uint32_t frame_count;
+	uint32_t warmup_count;
+	enum output_format format;
+};
+
+struct frame_result
+{
+	uint32_t frame_mus;
+	uint32_t transform_mus;
+	uint32_t clear_mus;
+	uint32_t raster_mus;
+	/* FNV-1a of the render target, only comparable between builds with the same SIMD and tile options */
+	uint32_t checksum;
+	struct rasterizer_stats raster_stats;
+};
+
+struct thread_data
+{
+	const struct scene *scene;
+	uint32_t *render_target;
+	uint32_t *depth_buffer;
+	struct vec2_int target_size;
+	struct vec2_int *raster_area_mins;
+	struct vec2_int *raster_area_maxs;
+	uint32_t raster_area_count;
+	/* Collected after each task */
+	struct rasterizer_stats raster_stats;
+};
+
+bool parse_options(const int argc, char **argv, struct options *out_options);
+void print_usage(void);
+
+bool thread_data_init(struct thread_data *data, const unsigned int thread_count, const struct vec2_int *target_size);
+void thread_data_deinit(struct thread_data *data, const unsigned int thread_count);
+void rasterize_thread(void *data);
+
+uint32_t calculate_checksum(const uint32_t *buffer, const int count);
+
+void write_csv(FILE *file, const struct frame_result *frames, const uint32_t frame_count);
+void write_json(FILE *file, const struct options *options, const struct scene *scene, const struct frame_result *frames,
+	const struct histogram_recorder *frame_times, const struct histogram_recorder *raster_times);
+void write_json_summary(FILE *file, const char *name, const struct histogram_recorder *histogram, const char *separator);
+
+int main(int argc, char **argv)
+{
+	struct options options;
+	if (!parse_options(argc, argv, &options))
+	{
+		print_usage();
+		return 1;
+	}
+
+	struct scene *scene = scene_create(options.scene_name, (float)options.resolution.x / (float)options.resolution.y);
+	if (!scene)
+	{
+		fprintf(stderr, "Failed to create scene %s\n", options.scene_name);
+		return 1;
+	}
+
+	/* Same buffers as in the demo, with SIMD they are in blocks and with tiles padded to the tile size */
+	struct vec2_int buffer_size = options.resolution;
+	if (rasterizer_uses_simd() && rasterizer_uses_tiles())
+		rasterizer_get_padded_size(&options.resolution, &buffer_size);
+
+	const int buffer_pixels = buffer_size.x * buffer_size.y;
+	uint32_t *render_target = malloc(buffer_pixels * sizeof(uint32_t));
+	uint32_t *depth_buf = malloc(buffer_pixels * sizeof(uint32_t));
+	struct frame_result *frames = malloc(options.frame_count * sizeof(struct frame_result));
+	struct thread **threads = malloc(options.thread_count * sizeof(struct thread *));
+	struct thread_data *thread_data = malloc(options.thread_count * sizeof(struct thread_data));
+	struct histogram_recorder *frame_times = histogram_recorder_create(1);
+	struct histogram_recorder *raster_times = histogram_recorder_create(1);
+	if (!render_target || !depth_buf || !frames || !threads || !thread_data || !frame_times || !raster_times)
+		error_popup("Out of memory", true);
+
+	if (!thread_data_init(thread_data, options.thread_count, &options.resolution))
+		error_popup("Couldn't allocate the raster areas", true);
+
+	const unsigned int core_count = get_logical_core_count();
+	for (unsigned int i = 0; i < options.thread_count; ++i)
+	{
+		/* Any core will do for the threads beyond the core count */
+		threads[i] = thread_create(i < core_count ? (int)i : -1);
+		if (!threads[i])
+			error_popup("Failed to create a thread", true);
+
+		thread_data[i].scene = scene;
+		thread_data[i].render_target = render_target;
+		thread_data[i].depth_buffer = depth_buf;
+	}
+
+	rasterizer_clear_stencil_buffer(depth_buf, &buffer_size, 0);
+
+	/* The warmup runs the start of the camera path, the measured frames start over from frame 0 */
+	for (uint32_t frame = 0; frame < options.warmup_count + options.frame_count; ++frame)
+	{
+		const bool warmup = frame < options.warmup_count;
+		const uint32_t path_frame = warmup ? frame : frame - options.warmup_count;
+
+		const uint64_t frame_start = get_time();
+		scene_transform(scene, path_frame);
+
+		const uint64_t clear_start = get_time();
+		for (int i = 0; i < buffer_pixels; ++i)
+			render_target[i] = 0xFF0000;
+		rasterizer_clear_depth_buffer(depth_buf, &buffer_size);
+
+		const uint64_t raster_start = get_time();
+		for (unsigned int i = 0; i < options.thread_count; ++i)
+			thread_set_task(threads[i], &rasterize_thread, &thread_data[i]);
+
+		for (unsigned int i = 0; i < options.thread_count; ++i)
+			thread_wait_for_task(threads[i]);
+
+		const uint64_t frame_end = get_time();
+
+		struct rasterizer_stats raster_stats;
+		memset(&raster_stats, 0, sizeof(raster_stats));
+		for (unsigned int i = 0; i < options.thread_count; ++i)
+		{
+			rasterizer_add_stats(&raster_stats, &thread_data[i].raster_stats);
+			memset(&thread_data[i].raster_stats, 0, sizeof(thread_data[i].raster_stats));
+		}
+
+		if (warmup)
+			continue;
+
+		struct frame_result *result = &frames[path_frame];
+		result->frame_mus = (uint32_t)get_time_microseconds(frame_end - frame_start);
+		result->transform_mus = (uint32_t)get_time_microseconds(clear_start - frame_start);
+		result->clear_mus = (uint32_t)get_time_microseconds(raster_start - clear_start);
+		result->raster_mus = (uint32_t)get_time_microseconds(frame_end - raster_start);
+		result->checksum = calculate_checksum(render_target, buffer_pixels);
+		result->raster_stats = raster_stats;
+
+		histogram_record(frame_times, 0, result->frame_mus);
+		histogram_record(raster_times, 0, result->raster_mus);
+	}
+
+	histogram_merge(frame_times);
+	histogram_merge(raster_times);
+
+	FILE *file = options.output_file ? fopen(options.output_file, "w") : stdout;
+	if (file)
+	{
+		if (options.format == OUTPUT_FORMAT_JSON)
+			write_json(file, &options, scene, frames, frame_times, raster_times);
+		else
+			write_csv(file, frames, options.frame_count);
+
+		if (file != stdout)
+			fclose(file);
+	}
+	else
+		fprintf(stderr, "Failed to open %s\n", options.output_file);
+
+	fprintf(stderr, "%s %dx%d, %u threads, simd %d, tiles %d: frame avg %u us, p50 %u us, p99 %u us, raster p50 %u us\n",
+		options.scene_name, options.resolution.x, options.resolution.y, options.thread_count, rasterizer_uses_simd(), rasterizer_uses_tiles(),
+		histogram_get_avarage(frame_times), histogram_get_percentile(frame_times, 50.0f), histogram_get_percentile(frame_times, 99.0f),
+		histogram_get_percentile(raster_times, 50.0f));
+
+	/* Free resources */
+	for (unsigned int i = 0; i < options.thread_count; ++i)
+		thread_destroy(&threads[i]);
+	thread_data_deinit(thread_data, options.thread_count);
+
+	histogram_recorder_destroy(&raster_times);
+	histogram_recorder_destroy(&frame_times);
+	free(thread_data);
+	free(threads);
+	free(frames);
+	free(depth_buf);
+	free(render_target);
+	scene_destroy(&scene);
+
+	return file ? 0 : 1;
+}
+
+bool parse_options(const int argc, char **argv, struct options *out_options)
+{
+	assert(argv && "parse_options: argv is NULL");
+	assert(out_options && "parse_options: out_options is NULL");
+
+	out_options->scene_name = "box";
+	out_options->output_file = NULL;
+	out_options->resolution.x = 1280;
+	out_options->resolution.y = 720;
+	out_options->thread_count = get_logical_core_count();
+	out_options->frame_count = 300;
+	out_options->warmup_count = 30;
+	out_options->format = OUTPUT_FORMAT_CSV;
+
+	/* All the options have a value */
+	for (int i = 1; i < argc; i += 2)
+	{
+		if (i + 1 >= argc)
+			return false;
+
+		const char *option = argv[i];
+		const char *value = argv[i + 1];
+		uint32_t uint_value = 0;
+		if (strcmp(option, "-scene") == 0)
+			out_options->scene_name = value;
+		else if (strcmp(option, "-output") == 0)
+			out_options->output_file = value;
+		else if (strcmp(option, "-format") == 0)
+		{
+			if (strcmp(value, "csv") == 0)
+				out_options->format = OUTPUT_FORMAT_CSV;
+			else if (strcmp(value, "json") == 0)
+				out_options->format = OUTPUT_FORMAT_JSON;
+			else
+				return false;
+		}
+		else if (!parse_uint(value, &uint_value))
+			return false;
+		else if (strcmp(option, "-width") == 0)
+			out_options->resolution.x = (int)uint_value;
+		else if (strcmp(option, "-height") == 0)
+			out_options->resolution.y = (int)uint_value;
+		else if (strcmp(option, "-threads") == 0)
+			out_options->thread_count = uint_value;
+		else if (strcmp(option, "-frames") == 0)
+			out_options->frame_count = uint_value;
+		else if (strcmp(option, "-warmup") == 0)
+			out_options->warmup_count = uint_value;
+		else
+			return false;
+	}
+
+	/* Even sizes keep the 2x2 blocks of SIMD inside the render target */
+	return out_options->resolution.x >= 2 && out_options->resolution.y >= 2 && out_options->resolution.x <= 16384 && out_options->resolution.y <= 16384
+		&& out_options->resolution.x % 2 == 0 && out_options->resolution.y % 2 == 0
+		&& out_options->thread_count > 0 && out_options->frame_count > 0;
+}
+
+void print_usage(void)
+{
+	fprintf(stderr,
+		"usage: benchmark [-scene %s] [-width even] [-height even] [-threads n] [-frames n] [-warmup n] [-format csv|json] [-output file]\n"
+		"Defaults to the box scene at 1280x720 with a thread per logical core, 300 frames after 30 warmup frames, csv to stdout.\n",
+		scene_get_names());
+}
+
+/* Splits the render target to AREA_SIZE areas (or tiles) and hands them to the threads round robin */
+bool thread_data_init(struct thread_data *data, const unsigned int thread_count, const struct vec2_int *target_size)
+{
+	assert(data && "thread_data_init: data is NULL");
+	assert(target_size && "thread_data_init: target_size is NULL");
+
+	struct vec2_int area_size;
+	struct vec2_int buffer_size = *target_size;
+	if (rasterizer_uses_simd() && rasterizer_uses_tiles())
+	{
+		rasterizer_get_padded_size(target_size, &buffer_size);
+		area_size.x = (int)rasterizer_get_tile_size();
+		area_size.y = area_size.x;
+	}
+	else
+	{
+		/* The last column and row get what's left */
+		area_size.x = AREA_SIZE;
+		area_size.y = AREA_SIZE;
+	}
+
+	const unsigned int area_count = (unsigned int)(((buffer_size.x + area_size.x - 1) / area_size.x) * ((buffer_size.y + area_size.y - 1) / area_size.y));
+	const unsigned int areas_per_thread = (area_count + thread_count - 1) / thread_count;
+	bool success = true;
+	for (unsigned int i = 0; i < thread_count; ++i)
+	{
+		data[i].target_size = *target_size;
+		data[i].raster_area_mins = malloc(sizeof(struct vec2_int) * areas_per_thread);
+		data[i].raster_area_maxs = malloc(sizeof(struct vec2_int) * areas_per_thread);
+		data[i].raster_area_count = 0;
+		memset(&data[i].raster_stats, 0, sizeof(data[i].raster_stats));
+		success = success && data[i].raster_area_mins && data[i].raster_area_maxs;
+	}
+
+	if (!success)
+		return false;
+
+	unsigned int current_thread = 0;
+	for (int y = 0; y < buffer_size.y; y += area_size.y)
+	{
+		for (int x = 0; x < buffer_size.x; x += area_size.x)
+		{
+			struct thread_data *td = &data[current_thread];
+			td->raster_area_mins[td->raster_area_count].x = x;
+			td->raster_area_mins[td->raster_area_count].y = y;
+			td->raster_area_maxs[td->raster_area_count].x = min(x + area_size.x, buffer_size.x) - 1;
+			td->raster_area_maxs[td->raster_area_count].y = min(y + area_size.y, buffer_size.y) - 1;
+			++td->raster_area_count;
+
+			current_thread = (current_thread + 1) % thread_count;
+		}
+	}
+
+	return true;
+}
+
+void thread_data_deinit(struct thread_data *data, const unsigned int thread_count)
+{
+	assert(data && "thread_data_deinit: data is NULL");
+
+	for (unsigned int i = 0; i < thread_count; ++i)
+	{
+		free(data[i].raster_area_mins);
+		free(data[i].raster_area_maxs);
+	}
+}
+
+void rasterize_thread(void *data)
+{
+	assert(data && "rasterize_thread: data is NULL");
+
+	struct thread_data *td = (struct thread_data *)data;
+	for (unsigned int area = 0; area < td->raster_area_count; ++area)
+		scene_rasterize(td->scene, td->render_target, td->depth_buffer, &td->target_size, &td->raster_area_mins[area], &td->raster_area_maxs[area]);
+
+	rasterizer_collect_stats(&td->raster_stats);
+}
+
+uint32_t calculate_checksum(const uint32_t *buffer, const int count)
+{
+	assert(buffer && "calculate_checksum: buffer is NULL");
+
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < count; ++i)
+	{
+		hash = (hash ^ buffer[i]) * 16777619u;
+	}
+
+	return hash;
+}
+
+/* The rasterizer stats are summed over the areas, so the triangle counts include a tri once for each area it was passed to */
+void write_csv(FILE *file, const struct frame_result *frames, const uint32_t frame_count)
+{
+	assert(file && "write_csv: file is NULL");
+	assert(frames && "write_csv: frames is NULL");
+
+	const bool stats = rasterizer_uses_stats();
+	fprintf(file, "frame,frame_us,transform_us,clear_us,raster_us,checksum");
+	if (stats)
+		fprintf(file, ",triangles,triangles_rasterized,quads_tested,quads_covered,pixels_written,setup_cycles,raster_cycles");
+	fprintf(file, "\n");
+
+	for (uint32_t i = 0; i < frame_count; ++i)
+	{
+		const struct frame_result *frame = &frames[i];
+		fprintf(file, "%u,%u,%u,%u,%u,%08x", i, frame->frame_mus, frame->transform_mus, frame->clear_mus, frame->raster_mus, frame->checksum);
+		if (stats)
+		{
+			const struct rasterizer_stats *s = &frame->raster_stats;
+			fprintf(file, ",%llu,%llu,%llu,%llu,%llu,%llu,%llu", (unsigned long long)s->triangles, (unsigned long long)s->triangles_rasterized,
+				(unsigned long long)s->quads_tested, (unsigned long long)s->quads_covered, (unsigned long long)s->pixels_written,
+				(unsigned long long)s->setup_cycles, (unsigned long long)s->raster_cycles);
+		}
+		fprintf(file, "\n");
+	}
+}
+
+void write_json(FILE *file, const struct options *options, const struct scene *scene, const struct frame_result *frames,
+	const struct histogram_recorder *frame_times, const struct histogram_recorder *raster_times)
+{
+	assert(file && "write_json: file is NULL");
+	assert(options && "write_json: options is NULL");
+	assert(scene && "write_json: scene is NULL");
+	assert(frames && "write_json: frames is NULL");
+
+	const bool stats = rasterizer_uses_stats();
+	fprintf(file, "{\n\"scene\":\"%s\",\"triangles\":%llu,\"width\":%d,\"height\":%d,\"threads\":%u,\n", options->scene_name,
+		(unsigned long long)scene_get_triangle_count(scene), options->resolution.x, options->resolution.y, options->thread_count);
+	fprintf(file, "\"simd\":%s,\"tiles\":%s,\"raster_stats\":%s,\"warmup_frames\":%u,\"frame_count\":%u,\n", rasterizer_uses_simd() ? "true" : "false",
+		rasterizer_uses_tiles() ? "true" : "false", stats ? "true" : "false", options->warmup_count, options->frame_count);
+	fprintf(file, "\"summary\":{\n");
+	write_json_summary(file, "frame_us", frame_times, ",\n");
+	write_json_summary(file, "raster_us", raster_times, "\n");
+	fprintf(file, "},\n\"frames\":[\n");
+
+	for (uint32_t i = 0; i < options->frame_count; ++i)
+	{
+		const struct frame_result *frame = &frames[i];
+		fprintf(file, "{\"frame\":%u,\"frame_us\":%u,\"transform_us\":%u,\"clear_us\":%u,\"raster_us\":%u,\"checksum\":\"%08x\"", i, frame->frame_mus,
+			frame->transform_mus, frame->clear_mus, frame->raster_mus, frame->checksum);
+		if (stats)
+		{
+			const struct rasterizer_stats *s = &frame->raster_stats;
+			fprintf(file, ",\"triangles\":%llu,\"triangles_rasterized\":%llu,\"quads_tested\":%llu,\"quads_covered\":%llu,\"pixels_written\":%llu,\"setup_cycles\":%llu,\"raster_cycles\":%llu",
+				(unsigned long long)s->triangles, (unsigned long long)s->triangles_rasterized, (unsigned long long)s->quads_tested,
+				(unsigned long long)s->quads_covered, (unsigned long long)s->pixels_written, (unsigned long long)s->setup_cycles, (unsigned long long)s->raster_cycles);
+		}
+		fprintf(file, "}%s\n", i + 1 < options->frame_count ? "," : "");
+	}
+	fprintf(file, "]\n}\n");
+}
+
+void write_json_summary(FILE *file, const char *name, const struct histogram_recorder *histogram, const char *separator)
+{
+	assert(file && "write_json_summary: file is NULL");
+	assert(name && "write_json_summary: name is NULL");
+	assert(histogram && "write_json_summary: histogram is NULL");
+	assert(separator && "write_json_summary: separator is NULL");
+
+	fprintf(file, "\"%s\":{\"avg\":%u,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u}%s", name, histogram_get_avarage(histogram),
+		histogram_get_percentile(histogram, 50.0f), histogram_get_percentile(histogram, 90.0f), histogram_get_percentile(histogram, 99.0f),
+		histogram_get_percentile(histogram, 100.0f), separator);
+}
@@ -0,0 +1,431 @@
+#include "software_rasterizer/precompiled.h"
+
+#include "software_rasterizer/demo/osal.h"
+#include "software_rasterizer/rasterizer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Kernel level microbenchmarks, single threaded.
+ * The stages (clip, winding_2d, the coverage loop, texture fetch) are inlined to the kernels specialized for the pipeline state,
+ * so they are measured through rasterizer_rasterize with triangle distributions and states which leave only the stage of interest.
+ * The differences between consecutive stages give the cost of what the later one adds:
+ * reject:  the tris are fully outside of the rasterize area (projection and the view reject of clip)
+ * cull:    back faces (projection, clip and winding_2d)
+ * depth:   depth only (setup, the coverage loop and the depth test and write)
+ * color:   vertex colors (adds the interpolation of the attributes and the color writes)
+ * texture: texturing (adds the texture fetch)
+ * Each stage reports the best time of its repetitions per triangle and per covered pixel. */
+
+#define TEXTURE_SIZE 1024
+/* Distance of the verts outside of the view for the guard-band and reject cases, in multiples of the target width */
+#define GUARD_BAND_REACH 30.0f
+#define REJECT_OFFSET 50.0f
+
+enum stage
+{
+	STAGE_REJECT = 0,
+	STAGE_CULL,
+	STAGE_DEPTH,
+	STAGE_COLOR,
+	STAGE_TEXTURE,
+	STAGE_COUNT
+};
+
+static const char *stage_names[STAGE_COUNT] = { "reject", "cull", "depth", "color", "texture" };
+
+enum distribution_type
+{
+	DISTRIBUTION_TINY = 0,
+	DISTRIBUTION_HUGE,
+	DISTRIBUTION_SLIVER,
+	DISTRIBUTION_GUARD_BAND,
+	DISTRIBUTION_COUNT
+};
+
+static const char *distribution_names[DISTRIBUTION_COUNT] = { "tiny", "huge", "sliver", "guard_band" };
+
+/* Non-indexed CCW tris which don't overlap, so every covered pixel passes the depth test */
+struct distribution
+{
+	struct vec4_float *verts;
+	struct vec4_float *outside_verts; /* Shifted right, out of the rasterize area */
+	struct vec2_float *uvs;
+	float *colors;
+	unsigned int *indices;
+	unsigned int *back_face_indices;
+	unsigned int tri_count;
+	uint64_t pixel_count; /* Covered by one draw */
+};
+
+struct target
+{
+	uint32_t *render_target;
+	uint32_t *depth_buf;
+	uint32_t *texture;
+	struct vec2_int size;
+	struct vec2_int buffer_size; /* Padded with tiles */
+	struct vec2_int texture_size;
+};
+
+bool distribution_init(struct distribution *distribution, const enum distribution_type type, const struct vec2_int *target_size);
+void distribution_deinit(struct distribution *distribution);
+unsigned int distribution_generate(struct distribution *distribution, const enum distribution_type type, const struct vec2_int *target_size);
+void distribution_set_tri(struct distribution *distribution, const unsigned int tri, const struct vec2_float *p0, const struct vec2_float *p1, const struct vec2_float *p2,
+	const struct vec2_int *target_size);
+
+void draw(const struct target *target, const struct distribution *distribution, const enum stage stage);
+uint64_t count_covered_pixels(const struct target *target, const struct distribution *distribution);
+uint64_t measure_stage(const struct target *target, const struct distribution *distribution, const enum stage stage, const uint64_t min_time_us);
+
+int main(int argc, char **argv)
+{
+	struct target target;
+	target.size.x = 1024;
+	target.size.y = 1024;
+	uint32_t min_time_ms = 200;
+	bool csv = false;
+
+	bool options_ok = true;
+	for (int i = 1; i < argc && options_ok; i += 2)
+	{
+		uint32_t value = 0;
+		if (i + 1 >= argc)
+			options_ok = false;
+		else if (strcmp(argv[i], "-format") == 0)
+		{
+			csv = strcmp(argv[i + 1], "csv") == 0;
+			options_ok = csv || strcmp(argv[i + 1], "text") == 0;
+		}
+		else if (!parse_uint(argv[i + 1], &value))
+			options_ok = false;
+		else if (strcmp(argv[i], "-width") == 0)
+			target.size.x = (int)value;
+		else if (strcmp(argv[i], "-height") == 0)
+			target.size.y = (int)value;
+		else if (strcmp(argv[i], "-time") == 0)
+			min_time_ms = value;
+		else
+			options_ok = false;
+	}
+
+	/* Even sizes keep the 2x2 blocks of SIMD inside the render target */
+	if (!options_ok || target.size.x < 64 || target.size.y < 64 || target.size.x > 16384 || target.size.y > 16384
+		|| target.size.x % 2 != 0 || target.size.y % 2 != 0)
+	{
+		fprintf(stderr, "usage: microbenchmark [-width even] [-height even] [-time min_ms_per_stage] [-format text|csv]\n"
+			"Defaults to 1024x1024 and 200ms per stage, text to stdout.\n");
+		return 1;
+	}
+
+	target.buffer_size = target.size;
+	if (rasterizer_uses_simd() && rasterizer_uses_tiles())
+		rasterizer_get_padded_size(&target.size, &target.buffer_size);
+
+	const int buffer_pixels = target.buffer_size.x * target.buffer_size.y;
+	target.render_target = malloc(buffer_pixels * sizeof(uint32_t));
+	target.depth_buf = malloc(buffer_pixels * sizeof(uint32_t));
+	target.texture = malloc(TEXTURE_SIZE * TEXTURE_SIZE * sizeof(uint32_t));
+	if (!target.render_target || !target.depth_buf || !target.texture)
+		error_popup("Out of memory", true);
+
+	target.texture_size.x = TEXTURE_SIZE;
+	target.texture_size.y = TEXTURE_SIZE;
+	/* Noise, so the fetches can't be told apart from real textures by the caches */
+	uint32_t seed = 0x12345678;
+	for (int i = 0; i < TEXTURE_SIZE * TEXTURE_SIZE; ++i)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		target.texture[i] = 0xFF000000 | (seed >> 8);
+	}
+
+	for (int i = 0; i < buffer_pixels; ++i)
+		target.render_target[i] = 0xFF0000;
+	rasterizer_clear_stencil_buffer(target.depth_buf, &target.buffer_size, 0);
+
+	if (csv)
+		printf("distribution,stage,triangles,pixels,best_ns,ns_per_triangle,ns_per_pixel\n");
+	else
+		printf("%dx%d, simd %d, tiles %d, stats %d\n%-12s %-8s %10s %10s %12s %10s %10s\n", target.size.x, target.size.y, rasterizer_uses_simd(),
+			rasterizer_uses_tiles(), rasterizer_uses_stats(), "distribution", "stage", "tris", "pixels", "best_us", "ns/tri", "ns/pixel");
+
+	for (unsigned int type = 0; type < DISTRIBUTION_COUNT; ++type)
+	{
+		struct distribution distribution;
+		if (!distribution_init(&distribution, (enum distribution_type)type, &target.size))
+			error_popup("Out of memory", true);
+
+		distribution.pixel_count = count_covered_pixels(&target, &distribution);
+		for (unsigned int stage = 0; stage < STAGE_COUNT; ++stage)
+		{
+			const uint64_t best_ns = get_time_microseconds(measure_stage(&target, &distribution, (enum stage)stage, (uint64_t)min_time_ms * 1000) * 1000);
+			const double ns_per_tri = (double)best_ns / (double)distribution.tri_count;
+			/* The rejected and culled tris don't cover anything */
+			const bool has_pixels = stage >= STAGE_DEPTH && distribution.pixel_count > 0;
+			const double ns_per_pixel = has_pixels ? (double)best_ns / (double)distribution.pixel_count : 0.0;
+			if (csv)
+			{
+				printf("%s,%s,%u,%llu,%llu,%.3f,", distribution_names[type], stage_names[stage], distribution.tri_count,
+					(unsigned long long)distribution.pixel_count, (unsigned long long)best_ns, ns_per_tri);
+				if (has_pixels)
+					printf("%.3f", ns_per_pixel);
+				printf("\n");
+			}
+			else
+			{
+				printf("%-12s %-8s %10u %10llu %12.1f %10.2f ", distribution_names[type], stage_names[stage], distribution.tri_count,
+					(unsigned long long)distribution.pixel_count, (double)best_ns / 1000.0, ns_per_tri);
+				if (has_pixels)
+					printf("%10.3f\n", ns_per_pixel);
+				else
+					printf("%10s\n", "-");
+			}
+			fflush(stdout);
+		}
+
+		distribution_deinit(&distribution);
+	}
+
+	free(target.texture);
+	free(target.depth_buf);
+	free(target.render_target);
+
+	return 0;
+}
+
+bool distribution_init(struct distribution *distribution, const enum distribution_type type, const struct vec2_int *target_size)
+{
+	assert(distribution && "distribution_init: distribution is NULL");
+	assert(target_size && "distribution_init: target_size is NULL");
+
+	/* The first pass only counts the tris */
+	memset(distribution, 0, sizeof(struct distribution));
+	const unsigned int tri_count = distribution_generate(distribution, type, target_size);
+	const unsigned int vert_count = tri_count * 3;
+
+	distribution->verts = malloc(vert_count * sizeof(struct vec4_float));
+	distribution->outside_verts = malloc(vert_count * sizeof(struct vec4_float));
+	distribution->uvs = malloc(vert_count * sizeof(struct vec2_float));
+	distribution->colors = malloc(vert_count * 4 * sizeof(float));
+	distribution->indices = malloc(vert_count * sizeof(unsigned int));
+	distribution->back_face_indices = malloc(vert_count * sizeof(unsigned int));
+	distribution->tri_count = tri_count;
+	if (!distribution->verts || !distribution->outside_verts || !distribution->uvs || !distribution->colors || !distribution->indices || !distribution->back_face_indices)
+	{
+		distribution_deinit(distribution);
+		return false;
+	}
+
+	distribution_generate(distribution, type, target_size);
+	for (unsigned int i = 0; i < vert_count; i += 3)
+	{
+		distribution->indices[i] = i;
+		distribution->indices[i + 1] = i + 1;
+		distribution->indices[i + 2] = i + 2;
+		distribution->back_face_indices[i] = i;
+		distribution->back_face_indices[i + 1] = i + 2;
+		distribution->back_face_indices[i + 2] = i + 1;
+	}
+
+	return true;
+}
+
+void distribution_deinit(struct distribution *distribution)
+{
+	assert(distribution && "distribution_deinit: distribution is NULL");
+
+	free(distribution->verts);
+	free(distribution->outside_verts);
+	free(distribution->uvs);
+	free(distribution->colors);
+	free(distribution->indices);
+	free(distribution->back_face_indices);
+	memset(distribution, 0, sizeof(struct distribution));
+}
+
+/* Returns the tri count, the tris are only stored when the distribution has its buffers. Positions are in pixels. */
+unsigned int distribution_generate(struct distribution *distribution, const enum distribution_type type, const struct vec2_int *target_size)
+{
+	assert(distribution && "distribution_generate: distribution is NULL");
+	assert(target_size && "distribution_generate: target_size is NULL");
+
+	const bool store = distribution->verts != NULL;
+	const float width = (float)target_size->x;
+	const float height = (float)target_size->y;
+	unsigned int tri = 0;
+	struct vec2_float p0;
+	struct vec2_float p1;
+	struct vec2_float p2;
+
+	switch (type)
+	{
+	case DISTRIBUTION_TINY:
+		/* A tri of about 3 pixels in each 4x4 cell */
+		for (int y = 0; y + 4 <= target_size->y; y += 4)
+		{
+			for (int x = 0; x + 4 <= target_size->x; x += 4, ++tri)
+			{
+				p0.x = (float)x + 0.5f; p0.y = (float)y + 0.5f;
+				p1.x = (float)x + 3.0f; p1.y = (float)y + 0.5f;
+				p2.x = (float)x + 0.5f; p2.y = (float)y + 3.0f;
+				if (store)
+					distribution_set_tri(distribution, tri, &p0, &p1, &p2, target_size);
+			}
+		}
+		break;
+	case DISTRIBUTION_HUGE:
+		/* Two tris for each quarter of the target */
+		for (int quarter = 0; quarter < 4; ++quarter)
+		{
+			const float x0 = (quarter & 1) ? width * 0.5f : 0.0f;
+			const float y0 = (quarter & 2) ? height * 0.5f : 0.0f;
+			p0.x = x0; p0.y = y0;
+			p1.x = x0 + width * 0.5f; p1.y = y0;
+			p2.x = x0; p2.y = y0 + height * 0.5f;
+			if (store)
+				distribution_set_tri(distribution, tri, &p0, &p1, &p2, target_size);
+			++tri;
+
+			p0 = p2;
+			p2.x = p1.x; p2.y = p0.y;
+			if (store)
+				distribution_set_tri(distribution, tri, &p0, &p1, &p2, target_size);
+			++tri;
+		}
+		break;
+	case DISTRIBUTION_SLIVER:
+		/* Leaning over half the width from a 2 pixel base at the bottom to a point at the top, the bounding boxes are mostly empty */
+		for (float x = 0.0f; x + width * 0.5f + 2.0f <= width; x += 4.0f, ++tri)
+		{
+			p0.x = x; p0.y = 0.0f;
+			p1.x = x + 2.0f; p1.y = 0.0f;
+			p2.x = x + width * 0.5f; p2.y = height;
+			if (store)
+				distribution_set_tri(distribution, tri, &p0, &p1, &p2, target_size);
+		}
+		break;
+	case DISTRIBUTION_GUARD_BAND:
+		/* 8 pixel high bands across the target, the bottom corners are far outside of the guard-band so every tri is clipped */
+		for (int y = 0; y + 8 <= target_size->y; y += 8, ++tri)
+		{
+			p0.x = -GUARD_BAND_REACH * width; p0.y = (float)y;
+			p1.x = (GUARD_BAND_REACH + 1.0f) * width; p1.y = (float)y;
+			p2.x = width * 0.5f; p2.y = (float)y + 8.0f;
+			if (store)
+				distribution_set_tri(distribution, tri, &p0, &p1, &p2, target_size);
+		}
+		break;
+	default:
+		assert(false && "distribution_generate: unknown type");
+		break;
+	}
+
+	return tri;
+}
+
+/* The positions are converted from pixels to clip space (w = 1), the uvs and the colors map the target to [0, 1] */
+void distribution_set_tri(struct distribution *distribution, const unsigned int tri, const struct vec2_float *p0, const struct vec2_float *p1, const struct vec2_float *p2,
+	const struct vec2_int *target_size)
+{
+	assert(distribution && "distribution_set_tri: distribution is NULL");
+	assert(tri < distribution->tri_count && "distribution_set_tri: too big tri");
+
+	const struct vec2_float *points[3];
+	points[0] = p0;
+	points[1] = p1;
+	points[2] = p2;
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		const unsigned int vert = tri * 3 + i;
+		struct vec4_float *pos = &distribution->verts[vert];
+		pos->x = points[i]->x / (float)target_size->x * 2.0f - 1.0f;
+		pos->y = points[i]->y / (float)target_size->y * 2.0f - 1.0f;
+		pos->z = 0.5f;
+		pos->w = 1.0f;
+
+		distribution->outside_verts[vert] = *pos;
+		distribution->outside_verts[vert].x += REJECT_OFFSET * 2.0f;
+
+		distribution->uvs[vert].x = clamp(points[i]->x / (float)target_size->x, 0.0f, 1.0f);
+		distribution->uvs[vert].y = clamp(points[i]->y / (float)target_size->y, 0.0f, 1.0f);
+
+		float *color = &distribution->colors[vert * 4];
+		color[0] = distribution->uvs[vert].x;
+		color[1] = distribution->uvs[vert].y;
+		color[2] = 0.5f;
+		color[3] = 1.0f;
+	}
+}
+
+/* Draws the distribution with the state of the stage to all the rasterize areas of the target */
+void draw(const struct target *target, const struct distribution *distribution, const enum stage stage)
+{
+	assert(target && "draw: target is NULL");
+	assert(distribution && "draw: distribution is NULL");
+
+	struct rasterizer_state state;
+	rasterizer_state_init(&state);
+	state.color_write = stage >= STAGE_COLOR;
+	state.texturing = stage == STAGE_TEXTURE;
+	state.vertex_colors = stage == STAGE_COLOR;
+
+	const struct vec4_float *verts = stage == STAGE_REJECT ? distribution->outside_verts : distribution->verts;
+	const unsigned int *indices = stage == STAGE_CULL ? distribution->back_face_indices : distribution->indices;
+	const float *colors = stage == STAGE_COLOR ? distribution->colors : NULL;
+	const uint32_t attribute_count = stage == STAGE_COLOR ? 4 : 0;
+
+	/* Tiles require tile sized raster areas */
+	const int area_size = (int)(rasterizer_uses_simd() && rasterizer_uses_tiles() ? rasterizer_get_tile_size() : rasterizer_get_max_area_size());
+	struct vec2_int area_min;
+	struct vec2_int area_max;
+	for (area_min.y = 0; area_min.y < target->buffer_size.y; area_min.y += area_size)
+	{
+		for (area_min.x = 0; area_min.x < target->buffer_size.x; area_min.x += area_size)
+		{
+			area_max.x = min(area_min.x + area_size, target->buffer_size.x) - 1;
+			area_max.y = min(area_min.y + area_size, target->buffer_size.y) - 1;
+			rasterizer_rasterize(target->render_target, target->depth_buf, &target->size, &area_min, &area_max, verts, distribution->uvs, colors, attribute_count,
+				indices, distribution->tri_count * 3, target->texture, &target->texture_size, &state);
+		}
+	}
+}
+
+/* The tris don't overlap so the pixels covered by a draw are the depth values it changed */
+uint64_t count_covered_pixels(const struct target *target, const struct distribution *distribution)
+{
+	assert(target && "count_covered_pixels: target is NULL");
+	assert(distribution && "count_covered_pixels: distribution is NULL");
+
+	rasterizer_clear_depth_buffer(target->depth_buf, &target->buffer_size);
+	draw(target, distribution, STAGE_DEPTH);
+
+	uint64_t count = 0;
+	for (int i = 0; i < target->buffer_size.x * target->buffer_size.y; ++i)
+		count += (target->depth_buf[i] & 0x00FFFFFF) != 0x00FFFFFF;
+
+	return count;
+}
+
+/* Returns the best time of the repetitions in get_time() ticks, repeats at least 5 times and for min_time_us.
+ * The depth buffer is cleared between the repetitions without timing it. */
+uint64_t measure_stage(const struct target *target, const struct distribution *distribution, const enum stage stage, const uint64_t min_time_us)
+{
+	assert(target && "measure_stage: target is NULL");
+	assert(distribution && "measure_stage: distribution is NULL");
+
+	uint64_t best = UINT64_MAX;
+	uint64_t total = 0;
+	for (unsigned int repetition = 0; repetition < 5 || get_time_microseconds(total) < min_time_us; ++repetition)
+	{
+		rasterizer_clear_depth_buffer(target->depth_buf, &target->buffer_size);
+
+		const uint64_t start = get_time();
+		draw(target, distribution, stage);
+		const uint64_t time = get_time() - start;
+
+		best = min(best, time);
+		total += time;
+	}
+
+	return best;
+}
@@ -0,0 +1,350 @@
+#include "software_rasterizer/precompiled.h"
+
+#include "scene.h"
+
+#include "software_rasterizer/demo/box.h"
+#include "software_rasterizer/rasterizer.h"
+
+#include <math.h>
+#include <string.h>
+
+#define SCENE_FOV_DEG 59.0f
+#define SCENE_TEXTURE_SIZE 256
+#define SCENE_CHECKER_SIZE 32
+#define BOX_SCENE_DRAWS 5
+#define BOX_SCENE_LARGE_BOXES 8
+/* The grid layers are this much larger than the view so the camera path never shows their edges */
+#define GRID_MARGIN 1.25f
+#define GRID_NEAREST_LAYER 10.0f
+#define GRID_LAYER_SPACING 4.0f
+
+struct scene_draw
+{
+	const struct vec3_float *verts;
+	const struct vec2_float *uvs;
+	const float *attributes;
+	uint32_t attribute_count;
+	const unsigned int *indices;
+	unsigned int index_count;
+	unsigned int vert_count;
+	struct vec4_float *final_verts;
+	struct matrix_3x4 world;
+	struct rasterizer_state state;
+};
+
+struct scene
+{
+	struct scene_draw *draws;
+	unsigned int draw_count;
+	/* The draws point to these */
+	struct vec3_float *verts;
+	struct vec2_float *uvs;
+	float *attributes;
+	unsigned int *indices;
+	struct vec4_float *final_verts;
+	uint32_t *texture;
+	struct vec2_int texture_size;
+	struct matrix_4x4 perspective;
+	/* The camera sways around camera_start, see scene_transform */
+	struct vec3_float camera_start;
+	struct vec3_float camera_sway;
+};
+
+struct scene_grid_preset
+{
+	const char *name;
+	unsigned int quads_per_side;
+	unsigned int layer_count;
+};
+
+static const struct scene_grid_preset grid_presets[] =
+{
+	{ "tiny", 707, 1 },
+	{ "medium", 112, 4 },
+	{ "huge", 4, 16 }
+};
+
+bool scene_alloc(struct scene *scene, const unsigned int draw_count, const unsigned int vert_count, const unsigned int index_count,
+	const unsigned int final_vert_count, const unsigned int attribute_float_count);
+void scene_create_texture(struct scene *scene);
+void scene_create_box(struct scene *scene);
+void scene_create_grid(struct scene *scene, const struct scene_grid_preset *preset, const float aspect_ratio);
+
+struct scene *scene_create(const char *name, const float aspect_ratio)
+{
+	assert(name && "scene_create: name is NULL");
+	assert(aspect_ratio > 0.0f && "scene_create: aspect_ratio must be positive");
+
+	struct scene *scene = malloc(sizeof(struct scene));
+	if (!scene)
+		return NULL;
+
+	memset(scene, 0, sizeof(struct scene));
+	scene->perspective = mat44_get_perspective_lh_fov(DEG_TO_RAD(SCENE_FOV_DEG), aspect_ratio, 1.0f, 1000.0f);
+
+	const struct scene_grid_preset *preset = NULL;
+	for (unsigned int i = 0; i < sizeof(grid_presets) / sizeof(grid_presets[0]); ++i)
+	{
+		if (strcmp(name, grid_presets[i].name) == 0)
+			preset = &grid_presets[i];
+	}
+
+	bool success = false;
+	if (strcmp(name, "box") == 0)
+	{
+		success = scene_alloc(scene, BOX_SCENE_DRAWS, VERTS_IN_BOX * (BOX_SCENE_LARGE_BOXES + 1), INDICES_IN_BOX * (BOX_SCENE_LARGE_BOXES + 1),
+			VERTS_IN_BOX * (2 + 3 * BOX_SCENE_LARGE_BOXES), VERTS_IN_BOX * 4);
+		if (success)
+			scene_create_box(scene);
+	}
+	else if (preset)
+	{
+		const unsigned int verts_per_side = preset->quads_per_side + 1;
+		const unsigned int vert_count = verts_per_side * verts_per_side;
+		success = scene_alloc(scene, preset->layer_count, vert_count, preset->quads_per_side * preset->quads_per_side * 6, vert_count * preset->layer_count, 0);
+		if (success)
+			scene_create_grid(scene, preset, aspect_ratio);
+	}
+
+	if (!success)
+	{
+		scene_destroy(&scene);
+		return NULL;
+	}
+
+	scene_create_texture(scene);
+	return scene;
+}
+
+void scene_destroy(struct scene **scene)
+{
+	assert(scene && "scene_destroy: scene is NULL");
+	assert(*scene && "scene_destroy: *scene is NULL");
+
+	free((*scene)->draws);
+	free((*scene)->verts);
+	free((*scene)->uvs);
+	free((*scene)->attributes);
+	free((*scene)->indices);
+	free((*scene)->final_verts);
+	free((*scene)->texture);
+	free(*scene);
+	*scene = NULL;
+}
+
+const char *scene_get_names(void)
+{
+	return "box|tiny|medium|huge";
+}
+
+uint64_t scene_get_triangle_count(const struct scene *scene)
+{
+	assert(scene && "scene_get_triangle_count: scene is NULL");
+
+	uint64_t count = 0;
+	for (unsigned int i = 0; i < scene->draw_count; ++i)
+		count += scene->draws[i].index_count / 3;
+
+	return count;
+}
+
+void scene_transform(struct scene *scene, const uint32_t frame)
+{
+	assert(scene && "scene_transform: scene is NULL");
+
+	/* Incommensurable periods so the path doesn't repeat during a run */
+	const float t = (float)frame;
+	struct vec3_float camera_trans;
+	camera_trans.x = scene->camera_start.x + scene->camera_sway.x * sinf(t * 0.05f);
+	camera_trans.y = scene->camera_start.y + scene->camera_sway.y * sinf(t * 0.031f);
+	camera_trans.z = scene->camera_start.z + scene->camera_sway.z * sinf(t * 0.017f);
+
+	struct matrix_3x4 camera_mat = mat34_get_translation(&camera_trans);
+	camera_mat = mat34_get_inverse(&camera_mat);
+	const struct matrix_4x4 camera_projection = mat44_mul_mat34(&scene->perspective, &camera_mat);
+
+	for (unsigned int i = 0; i < scene->draw_count; ++i)
+	{
+		struct scene_draw *draw = &scene->draws[i];
+		const struct matrix_4x4 final_transform = mat44_mul_mat34(&camera_projection, &draw->world);
+		for (unsigned int j = 0; j < draw->vert_count; ++j)
+			draw->final_verts[j] = mat44_mul_vec3(&final_transform, &draw->verts[j]);
+	}
+}
+
+void scene_rasterize(const struct scene *scene, uint32_t *render_target, uint32_t *depth_buf, const struct vec2_int *target_size,
+	const struct vec2_int *area_min, const struct vec2_int *area_max)
+{
+	assert(scene && "scene_rasterize: scene is NULL");
+
+	for (unsigned int i = 0; i < scene->draw_count; ++i)
+	{
+		const struct scene_draw *draw = &scene->draws[i];
+		rasterizer_rasterize(render_target, depth_buf, target_size, area_min, area_max, draw->final_verts, draw->uvs, draw->attributes, draw->attribute_count,
+			draw->indices, draw->index_count, scene->texture, &scene->texture_size, &draw->state);
+	}
+}
+
+bool scene_alloc(struct scene *scene, const unsigned int draw_count, const unsigned int vert_count, const unsigned int index_count,
+	const unsigned int final_vert_count, const unsigned int attribute_float_count)
+{
+	assert(scene && "scene_alloc: scene is NULL");
+
+	scene->draws = malloc(sizeof(struct scene_draw) * draw_count);
+	scene->verts = malloc(sizeof(struct vec3_float) * vert_count);
+	scene->uvs = malloc(sizeof(struct vec2_float) * vert_count);
+	scene->indices = malloc(sizeof(unsigned int) * index_count);
+	scene->final_verts = malloc(sizeof(struct vec4_float) * final_vert_count);
+	scene->texture = malloc(sizeof(uint32_t) * SCENE_TEXTURE_SIZE * SCENE_TEXTURE_SIZE);
+	if (attribute_float_count > 0)
+		scene->attributes = malloc(sizeof(float) * attribute_float_count);
+
+	scene->draw_count = draw_count;
+	return scene->draws && scene->verts && scene->uvs && scene->indices && scene->final_verts && scene->texture && (scene->attributes || attribute_float_count == 0);
+}
+
+/* A checker board over red and green gradients, the gradients show if the uvs are off */
+void scene_create_texture(struct scene *scene)
+{
+	assert(scene && "scene_create_texture: scene is NULL");
+
+	scene->texture_size.x = SCENE_TEXTURE_SIZE;
+	scene->texture_size.y = SCENE_TEXTURE_SIZE;
+	for (uint32_t y = 0; y < SCENE_TEXTURE_SIZE; ++y)
+	{
+		for (uint32_t x = 0; x < SCENE_TEXTURE_SIZE; ++x)
+		{
+			const uint32_t blue = ((x / SCENE_CHECKER_SIZE + y / SCENE_CHECKER_SIZE) & 1) ? 0xFF : 0x40;
+			scene->texture[y * SCENE_TEXTURE_SIZE + x] = 0xFF000000 | (x << 16) | (y << 8) | blue;
+		}
+	}
+}
+
+/* Same boxes, transforms and states as in the demo */
+void scene_create_box(struct scene *scene)
+{
+	assert(scene && "scene_create_box: scene is NULL");
+
+	struct vec3_float *vert_buf = &scene->verts[0];
+	struct vec2_float *uv = &scene->uvs[0];
+	unsigned int *ind_buf = &scene->indices[0];
+	create_box_buffers(vert_buf, uv, ind_buf);
+
+	/* Vertex colors (rgba) for the second box, they tint its texture */
+	for (unsigned int i = 0; i < VERTS_IN_BOX; ++i)
+	{
+		scene->attributes[i * 4] = vert_buf[i].x * 0.25f + 0.5f;
+		scene->attributes[i * 4 + 1] = vert_buf[i].y * 0.25f + 0.5f;
+		scene->attributes[i * 4 + 2] = vert_buf[i].z * 0.25f + 0.5f;
+		scene->attributes[i * 4 + 3] = 1.0f;
+	}
+
+	struct vec3_float *vert_buf_large = &scene->verts[VERTS_IN_BOX];
+	struct vec2_float *uv_large = &scene->uvs[VERTS_IN_BOX];
+	unsigned int *ind_buf_large = &scene->indices[INDICES_IN_BOX];
+	const struct vec3_float box_offsets[BOX_SCENE_LARGE_BOXES] = { { .x = -6.0f, .y = 6.0f, .z = 6.0f }, { .x = 2.0f, .y = 4.0f, .z = 6.0f }, { .x = -2.0f, .y = -2.0f, .z = 2.0f }, { .x = 0.0f, .y = 0.0f, .z = 0.0f },
+	                                                               { .x = -6.0f, .y = 2.0f, .z = -2.0f }, { .x = -4.0f, .y = -4.0f, .z = -8.0f }, { .x = 4.0f, .y = 6.0f, .z = -6.0f }, { .x = 2.0f, .y = 10.0f, .z = -8.0f } };
+	generate_large_test_buffers(vert_buf, uv, ind_buf, vert_buf_large, uv_large, ind_buf_large, &box_offsets[0], BOX_SCENE_LARGE_BOXES);
+
+	/* Each draw is offset from the previous one */
+	const struct vec3_float offsets[BOX_SCENE_DRAWS] = { { .x = -5.5f, .y = -8.0f, .z = 10.0f }, { .x = 2.0f, .y = 0.0f, .z = 3.0f }, { .x = 2.0f, .y = 4.0f, .z = 15.0f },
+	                                                     { .x = 26.0f, .y = -8.0f, .z = 10.0f }, { .x = 10.0f, .y = 18.0f, .z = 50.0f } };
+	const float rotations[BOX_SCENE_DRAWS] = { 40.0f, 38.0f, 30.0f, -45.0f, -45.0f };
+	struct vec3_float translation = { .x = 0.0f, .y = 0.0f, .z = 0.0f };
+	struct vec4_float *final_verts = scene->final_verts;
+	for (unsigned int i = 0; i < BOX_SCENE_DRAWS; ++i)
+	{
+		struct scene_draw *draw = &scene->draws[i];
+		const bool large = i >= 2;
+		draw->verts = large ? vert_buf_large : vert_buf;
+		draw->uvs = large ? uv_large : uv;
+		draw->attributes = NULL;
+		draw->attribute_count = 0;
+		draw->indices = large ? ind_buf_large : ind_buf;
+		draw->index_count = large ? INDICES_IN_BOX * BOX_SCENE_LARGE_BOXES : INDICES_IN_BOX;
+		draw->vert_count = large ? VERTS_IN_BOX * BOX_SCENE_LARGE_BOXES : VERTS_IN_BOX;
+		draw->final_verts = final_verts;
+		final_verts += draw->vert_count;
+
+		translation.x += offsets[i].x; translation.y += offsets[i].y; translation.z += offsets[i].z;
+		const struct matrix_3x4 trans_mat = mat34_get_translation(&translation);
+		const struct matrix_3x4 rot_mat = mat34_get_rotation_y(DEG_TO_RAD(rotations[i]));
+		draw->world = mat34_mul_mat34(&trans_mat, &rot_mat);
+		rasterizer_state_init(&draw->state);
+	}
+
+	scene->draws[1].attributes = scene->attributes;
+	scene->draws[1].attribute_count = 4;
+	scene->draws[1].state.vertex_colors = true;
+	/* See-through boxes, blended draws are done last without depth writes */
+	scene->draws[4].state.blend_mode = RASTERIZER_BLEND_ALPHA;
+	scene->draws[4].state.blend_alpha = 160;
+	scene->draws[4].state.depth_write = false;
+
+	/* Around the starting position of the demo camera */
+	scene->camera_start.x = 2.0f; scene->camera_start.y = -4.0f; scene->camera_start.z = 0.0f;
+	scene->camera_sway.x = 3.0f; scene->camera_sway.y = 1.0f; scene->camera_sway.z = 4.0f;
+}
+
+/* A grid of quads_per_side x quads_per_side quads in [-1, 1] facing the camera, each layer scales it to cover the view at its depth */
+void scene_create_grid(struct scene *scene, const struct scene_grid_preset *preset, const float aspect_ratio)
+{
+	assert(scene && "scene_create_grid: scene is NULL");
+	assert(preset && "scene_create_grid: preset is NULL");
+
+	const unsigned int quads = preset->quads_per_side;
+	const unsigned int verts_per_side = quads + 1;
+	for (unsigned int y = 0; y < verts_per_side; ++y)
+	{
+		for (unsigned int x = 0; x < verts_per_side; ++x)
+		{
+			const unsigned int vert = y * verts_per_side + x;
+			scene->uvs[vert].x = (float)x / (float)quads;
+			scene->uvs[vert].y = (float)y / (float)quads;
+			scene->verts[vert].x = scene->uvs[vert].x * 2.0f - 1.0f;
+			scene->verts[vert].y = scene->uvs[vert].y * 2.0f - 1.0f;
+			scene->verts[vert].z = 0.0f;
+		}
+	}
+
+	/* CCW as seen from -z */
+	unsigned int *ind = scene->indices;
+	for (unsigned int y = 0; y < quads; ++y)
+	{
+		for (unsigned int x = 0; x < quads; ++x)
+		{
+			const unsigned int bottom_left = y * verts_per_side + x;
+			const unsigned int top_left = bottom_left + verts_per_side;
+			ind[0] = bottom_left; ind[1] = bottom_left + 1; ind[2] = top_left;
+			ind[3] = top_left; ind[4] = bottom_left + 1; ind[5] = top_left + 1;
+			ind += 6;
+		}
+	}
+
+	/* Back to front so every layer passes the depth test */
+	const float half_height_per_depth = tanf(DEG_TO_RAD(SCENE_FOV_DEG) * 0.5f) * GRID_MARGIN;
+	for (unsigned int i = 0; i < preset->layer_count; ++i)
+	{
+		struct scene_draw *draw = &scene->draws[i];
+		const float depth = GRID_NEAREST_LAYER + (float)(preset->layer_count - 1 - i) * GRID_LAYER_SPACING;
+		draw->verts = scene->verts;
+		draw->uvs = scene->uvs;
+		draw->attributes = NULL;
+		draw->attribute_count = 0;
+		draw->indices = scene->indices;
+		draw->index_count = quads * quads * 6;
+		draw->vert_count = verts_per_side * verts_per_side;
+		draw->final_verts = &scene->final_verts[i * draw->vert_count];
+
+		const struct vec3_float translation = { .x = 0.0f, .y = 0.0f, .z = depth };
+		draw->world = mat34_get_translation(&translation);
+		draw->world.mat[0][0] = depth * half_height_per_depth * aspect_ratio;
+		draw->world.mat[1][1] = depth * half_height_per_depth;
+		rasterizer_state_init(&draw->state);
+	}
+
+	/* The margin covers the sway at the nearest layer */
+	scene->camera_sway.x = 0.5f * aspect_ratio;
+	scene->camera_sway.y = 0.5f;
+	scene->camera_sway.z = 1.0f;
+}
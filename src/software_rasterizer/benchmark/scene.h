@@ -0,0 +1,28 @@
+#ifndef RPLNN_SCENE_H
+#define RPLNN_SCENE_H
+
+/* Deterministic scenes for the benchmark.
+ * box is the demo scene (without the shadow pass and the pixel shader).
+ * The generated scenes are textured grid layers covering the view, drawn back to front with depth test:
+ * tiny has 1M tris of a few pixels, medium 100k tris with 4x overdraw and huge 512 tris with 16x overdraw.
+ * The camera follows a fixed path driven by the frame index, so every run renders the same frames. */
+
+struct scene;
+
+/* Returns NULL for an unknown name or when out of memory */
+struct scene *scene_create(const char *name, const float aspect_ratio);
+void scene_destroy(struct scene **scene);
+
+/* Names of the scenes for usage texts, separated by '|' */
+const char *scene_get_names(void);
+uint64_t scene_get_triangle_count(const struct scene *scene);
+
+/* Transforms the verts of every draw for the camera at frame */
+void scene_transform(struct scene *scene, const uint32_t frame);
+
+/* Does all the draws of the scene in order to a single rasterize area (see rasterizer_rasterize for the area rules).
+ * The verts must be transformed first, calls for separate areas can run concurrently. */
+void scene_rasterize(const struct scene *scene, uint32_t *render_target, uint32_t *depth_buf, const struct vec2_int *target_size,
+	const struct vec2_int *area_min, const struct vec2_int *area_max);
+
+#endif /* RPLNN_SCENE_H */
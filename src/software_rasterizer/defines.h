@@ -20,6 +20,27 @@
 	#define _CRT_SECURE_NO_WARNINGS 1
 #endif
 
+/* Functions that have to be inlined, for example to get constant arguments folded */
+#if defined(_MSC_VER)
+	#define RPLNN_FORCE_INLINE __forceinline
+#else
+	#define RPLNN_FORCE_INLINE static inline __attribute__((always_inline))
+#endif
+
+/* Small functions defined in headers */
+#if defined(_MSC_VER)
+	#define RPLNN_INLINE static __inline
+#else
+	#define RPLNN_INLINE static inline
+#endif
+
+/* Variables with a separate instance for each thread */
+#if defined(_MSC_VER)
+	#define RPLNN_THREAD_LOCAL __declspec(thread)
+#else
+	#define RPLNN_THREAD_LOCAL __thread
+#endif
+
 /* Generic includes */
 #include <stdbool.h>
 #include <assert.h>
@@ -0,0 +1,121 @@
+#include "software_rasterizer/precompiled.h"
+
+#include "blend.h"
+
+/* Blends four pixels at a time using SSE2, the remaining pixels use the same math so the results are identical. */
+#define USE_SIMD 1
+
+#ifdef USE_SIMD
+#include <emmintrin.h>
+#endif
+
+#ifdef USE_SIMD
+/* (color * alpha + dst * (255 - alpha)) / 255 rounded, for two pixels with their channels unpacked to 16bits.
+ * The sum fits in unsigned 16bits so only a single rounding is needed. */
+RPLNN_FORCE_INLINE __m128i blend_lerp_epi16(const __m128i color, const __m128i dst, const __m128i alpha)
+{
+	const __m128i max_channel = _mm_set_epi32(0x00FF00FF, 0x00FF00FF, 0x00FF00FF, 0x00FF00FF);
+	const __m128i half = _mm_set_epi32(0x00800080, 0x00800080, 0x00800080, 0x00800080);
+	__m128i temp = _mm_add_epi16(_mm_mullo_epi16(color, alpha), _mm_mullo_epi16(dst, _mm_sub_epi16(max_channel, alpha)));
+	temp = _mm_add_epi16(temp, half);
+	return _mm_srli_epi16(_mm_add_epi16(temp, _mm_srli_epi16(temp, 8)), 8);
+}
+
+/* Blends 4 packed pixels, alpha_low and alpha_high have the alphas of the first and last two pixels in all of their 16bit channels */
+RPLNN_FORCE_INLINE __m128i blend_lerp_block(const __m128i color16, const __m128i dst, const __m128i alpha_low, const __m128i alpha_high)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i low = blend_lerp_epi16(color16, _mm_unpacklo_epi8(dst, zero), alpha_low);
+	__m128i high = blend_lerp_epi16(color16, _mm_unpackhi_epi8(dst, zero), alpha_high);
+	return _mm_packus_epi16(low, high);
+}
+#endif
+
+RPLNN_FORCE_INLINE uint32_t blend_lerp_color(const uint32_t color, const uint32_t dst, const uint32_t alpha)
+{
+	uint32_t result = 0;
+	for (uint32_t shift = 0; shift < 32; shift += 8)
+	{
+		const uint32_t temp = ((color >> shift) & 0xFF) * alpha + ((dst >> shift) & 0xFF) * (255 - alpha) + 128;
+		result |= ((temp + (temp >> 8)) >> 8) << shift;
+	}
+	return result;
+}
+
+void blend_mask_span(uint32_t *dst, const uint8_t *mask, const uint32_t color, const int count)
+{
+	assert(dst && "blend_mask_span: dst is NULL");
+	assert(mask && "blend_mask_span: mask is NULL");
+
+	int i = 0;
+#ifdef USE_SIMD
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i color_block = _mm_set_epi32(color, color, color, color);
+	const __m128i color16 = _mm_unpacklo_epi8(color_block, zero);
+	for (; i + 4 <= count; i += 4)
+	{
+		const int32_t mask4 = *(const int32_t *)&mask[i];
+		/* Coverage masks are mostly empty or full */
+		if (mask4 == 0)
+			continue;
+		if (mask4 == -1)
+		{
+			_mm_storeu_si128((__m128i *)&dst[i], color_block);
+			continue;
+		}
+
+		/* Spread the alphas to all channels of their pixels */
+		__m128i alpha = _mm_unpacklo_epi8(_mm_cvtsi32_si128(mask4), zero);
+		alpha = _mm_unpacklo_epi16(alpha, alpha);
+		const __m128i alpha_low = _mm_unpacklo_epi32(alpha, alpha);
+		const __m128i alpha_high = _mm_unpackhi_epi32(alpha, alpha);
+		const __m128i pixels = _mm_loadu_si128((const __m128i *)&dst[i]);
+		_mm_storeu_si128((__m128i *)&dst[i], blend_lerp_block(color16, pixels, alpha_low, alpha_high));
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		if (mask[i] != 0)
+			dst[i] = blend_lerp_color(color, dst[i], mask[i]);
+	}
+}
+
+void blend_solid_span(uint32_t *dst, const uint32_t color, const uint8_t alpha, const int count)
+{
+	assert(dst && "blend_solid_span: dst is NULL");
+
+	int i = 0;
+#ifdef USE_SIMD
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i color16 = _mm_unpacklo_epi8(_mm_set_epi32(color, color, color, color), zero);
+	const __m128i alpha16 = _mm_set_epi32(alpha * 0x00010001, alpha * 0x00010001, alpha * 0x00010001, alpha * 0x00010001);
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128i pixels = _mm_loadu_si128((const __m128i *)&dst[i]);
+		_mm_storeu_si128((__m128i *)&dst[i], blend_lerp_block(color16, pixels, alpha16, alpha16));
+	}
+#endif
+
+	for (; i < count; ++i)
+		dst[i] = blend_lerp_color(color, dst[i], alpha);
+}
+
+void blend_solid_rect(uint32_t *render_target, const struct vec2_int *target_size, const struct vec2_int *rect_min, const struct vec2_int *rect_max,
+	const uint32_t color, const uint8_t alpha)
+{
+	assert(render_target && "blend_solid_rect: render_target is NULL");
+	assert(target_size && "blend_solid_rect: target_size is NULL");
+	assert(rect_min && "blend_solid_rect: rect_min is NULL");
+	assert(rect_max && "blend_solid_rect: rect_max is NULL");
+
+	const int min_x = max(rect_min->x, 0);
+	const int min_y = max(rect_min->y, 0);
+	const int max_x = min(rect_max->x, target_size->x - 1);
+	const int max_y = min(rect_max->y, target_size->y - 1);
+	if (min_x > max_x)
+		return;
+
+	for (int y = min_y; y <= max_y; ++y)
+		blend_solid_span(&render_target[y * target_size->x + min_x], color, alpha, max_x - min_x + 1);
+}
@@ -0,0 +1,18 @@
+#ifndef RPLNN_BLEND_H
+#define RPLNN_BLEND_H
+
+/* Integer alpha blending for text and overlays drawn on linear 0xAARRGGBB targets (like the backbuffer).
+ * All four channels are blended as (color * alpha + dst * (255 - alpha)) / 255 rounded, alpha 255 is opaque. */
+
+/* Blends color over count pixels using a per pixel 8bit alpha mask (glyph coverage and such). */
+void blend_mask_span(uint32_t *dst, const uint8_t *mask, const uint32_t color, const int count);
+
+/* Blends color over count pixels with a constant alpha. */
+void blend_solid_span(uint32_t *dst, const uint32_t color, const uint8_t alpha, const int count);
+
+/* Blends color over the inclusive rect [rect_min, rect_max] of a target with rows of target_size->x pixels.
+ * The rect is clipped to the target. */
+void blend_solid_rect(uint32_t *render_target, const struct vec2_int *target_size, const struct vec2_int *rect_min, const struct vec2_int *rect_max,
+	const uint32_t color, const uint8_t alpha);
+
+#endif /* RPLNN_BLEND_H */
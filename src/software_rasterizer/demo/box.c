@@ -0,0 +1,89 @@
+#include "software_rasterizer/precompiled.h"
+
+#include "box.h"
+
+void create_box_buffers(struct vec3_float *out_vert_buf, struct vec2_float *out_uv_buf, unsigned int *out_ind_buf)
+{
+	assert(out_vert_buf && "create_box_buffers: out_vert_buf is NULL");
+	assert(out_uv_buf && "create_box_buffers: out_uv_buf is NULL");
+	assert(out_ind_buf && "create_box_buffers: out_ind_buf is NULL");
+
+	out_vert_buf[0].x = -2.0f;  out_vert_buf[0].y = 2.0f;   out_vert_buf[0].z = 2.0f; 
+	out_vert_buf[1].x = -2.0f;  out_vert_buf[1].y = -2.0f;  out_vert_buf[1].z = 2.0f;
+	out_vert_buf[2].x = -2.0f;  out_vert_buf[2].y = 2.0f;   out_vert_buf[2].z = 2.0f;
+	out_vert_buf[3].x = -2.0f;  out_vert_buf[3].y = 2.0f;   out_vert_buf[3].z = -2.0f;
+	out_vert_buf[4].x = -2.0f;  out_vert_buf[4].y = -2.0f;  out_vert_buf[4].z = -2.0f;
+	out_vert_buf[5].x = -2.0f;  out_vert_buf[5].y = -2.0f;  out_vert_buf[5].z = 2.0f;
+	out_vert_buf[6].x = 2.0f;   out_vert_buf[6].y = 2.0f;   out_vert_buf[6].z = 2.0f;
+	out_vert_buf[7].x = 2.0f;   out_vert_buf[7].y = 2.0f;   out_vert_buf[7].z = -2.0f;
+	out_vert_buf[8].x = 2.0f;   out_vert_buf[8].y = -2.0f;  out_vert_buf[8].z = -2.0f;
+	out_vert_buf[9].x = 2.0f;   out_vert_buf[9].y = -2.0f;  out_vert_buf[9].z = 2.0f;
+	out_vert_buf[10].x = 2.0f;  out_vert_buf[10].y = 2.0f;  out_vert_buf[10].z = 2.0f;
+	out_vert_buf[11].x = 2.0f;  out_vert_buf[11].y = -2.0f; out_vert_buf[11].z = 2.0f;
+	out_vert_buf[12].x = -2.0f; out_vert_buf[12].y = 2.0f;  out_vert_buf[12].z = 2.0f;
+	out_vert_buf[13].x = -2.0f; out_vert_buf[13].y = -2.0f; out_vert_buf[13].z = 2.0f;
+
+	out_uv_buf[0].x = 0.0f; out_uv_buf[0].y = 0.33f;
+	out_uv_buf[1].x = 0.0f; out_uv_buf[1].y = 0.66f;
+	out_uv_buf[2].x = 0.25f; out_uv_buf[2].y = 0.0f;
+	out_uv_buf[3].x = 0.25f; out_uv_buf[3].y = 0.33f;
+	out_uv_buf[4].x = 0.25f; out_uv_buf[4].y = 0.66f;
+	out_uv_buf[5].x = 0.25f; out_uv_buf[5].y = 1.0f;
+	out_uv_buf[6].x = 0.5f; out_uv_buf[6].y = 0.0f;
+	out_uv_buf[7].x = 0.5f; out_uv_buf[7].y = 0.33f;
+	out_uv_buf[8].x = 0.5f; out_uv_buf[8].y = 0.66f;
+	out_uv_buf[9].x = 0.5f; out_uv_buf[9].y = 1.0f;
+	out_uv_buf[10].x = 0.75f; out_uv_buf[10].y = 0.33f;
+	out_uv_buf[11].x = 0.75f; out_uv_buf[11].y = 0.66f;
+	out_uv_buf[12].x = 1.0f; out_uv_buf[12].y = 0.33f;
+	out_uv_buf[13].x = 1.0f; out_uv_buf[13].y = 0.66f;
+
+	/* front */
+	out_ind_buf[0] = 3; out_ind_buf[1] =  4; out_ind_buf[2] = 7;
+	out_ind_buf[3] = 7; out_ind_buf[4] =  4; out_ind_buf[5] = 8; 
+	/* top */
+	out_ind_buf[6] = 2; out_ind_buf[7] = 3; out_ind_buf[8] = 6;
+	out_ind_buf[9] = 6; out_ind_buf[10] = 3; out_ind_buf[11] = 7;
+	/* bottom */
+	out_ind_buf[12] = 4; out_ind_buf[13] = 5; out_ind_buf[14] = 8;
+	out_ind_buf[15] = 8; out_ind_buf[16] = 5; out_ind_buf[17] = 9;
+	/* left */
+	out_ind_buf[18] = 0; out_ind_buf[19] = 1; out_ind_buf[20] = 3;
+	out_ind_buf[21] = 3; out_ind_buf[22] = 1; out_ind_buf[23] = 4;
+	/* right */
+	out_ind_buf[24] = 7; out_ind_buf[25] = 8; out_ind_buf[26] = 10;
+	out_ind_buf[27] = 10; out_ind_buf[28] = 8; out_ind_buf[29] = 11;
+	/* back */
+	out_ind_buf[30] = 10; out_ind_buf[31] = 11; out_ind_buf[32] = 12;
+	out_ind_buf[33] = 12; out_ind_buf[34] = 11; out_ind_buf[35] = 13;
+}
+
+/* Generates something horrible, but I just need a bit larger vert buffer for testing */
+void generate_large_test_buffers(const struct vec3_float *vert_buf_box, const struct vec2_float *uv_box, const unsigned int *ind_buf_box,
+                                 struct vec3_float *out_vert_buf, struct vec2_float *out_uv, unsigned int *out_ind_buf, const struct vec3_float *box_offsets, const unsigned int box_count_out)
+{
+	assert(vert_buf_box && "generate_large_test_buffers: vert_buf_box is NULL");
+	assert(uv_box && "generate_large_test_buffers: uv_box is NULL");
+	assert(ind_buf_box && "generate_large_test_buffers: ind_buf_box is NULL");
+	assert(out_vert_buf && "generate_large_test_buffers: out_vert_buf is NULL");
+	assert(out_uv && "generate_large_test_buffers: out_uv is NULL");
+	assert(out_ind_buf && "generate_large_test_buffers: out_ind_buf is NULL");
+	assert(box_offsets && "generate_large_test_buffers: box_offsets is NULL");
+
+	struct matrix_3x4 trans_mat;
+	
+	for (unsigned int box = 0; box < box_count_out; ++box)
+	{
+		trans_mat = mat34_get_translation(&(box_offsets[box]));
+		for (unsigned int i = 0; i < VERTS_IN_BOX; ++i)
+		{
+			unsigned int vert_ind = box * VERTS_IN_BOX + i;
+			out_vert_buf[vert_ind] = mat34_mul_vec3(&trans_mat, &(vert_buf_box[i]));
+			out_uv[vert_ind] = uv_box[i];
+		}
+		for (unsigned int i = 0; i < INDICES_IN_BOX; ++i)
+		{
+			out_ind_buf[box * INDICES_IN_BOX + i] = ind_buf_box[i] + box * VERTS_IN_BOX;
+		}
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef RPLNN_BOX_H
+#define RPLNN_BOX_H
+
+/* Test box geometry, shared by the demo and the benchmark */
+
+#define VERTS_IN_BOX 14
+#define INDICES_IN_BOX 36
+
+/* A 4x4x4 box around the origin, CCW.
+ * The out buffers need room for VERTS_IN_BOX verts and uvs and INDICES_IN_BOX indices. */
+void create_box_buffers(struct vec3_float *out_vert_buf, struct vec2_float *out_uv_buf, unsigned int *out_ind_buf);
+
+/* Copies the box to each of the box_offsets, the out buffers need room for box_count_out boxes */
+void generate_large_test_buffers(const struct vec3_float *vert_buf_box, const struct vec2_float *uv_box, const unsigned int *ind_buf_box,
+	struct vec3_float *out_vert_buf, struct vec2_float *out_uv, unsigned int *out_ind_buf, const struct vec3_float *box_offsets, const unsigned int box_count_out);
+
+#endif /* RPLNN_BOX_H */
@@ -1,6 +1,7 @@
 #include "software_rasterizer/precompiled.h"
 
 #include "font.h"
+#include "blend.h"
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #pragma warning(push)
@@ -8,7 +9,70 @@
 #include <stb/stb_truetype.h>
 #pragma warning(pop)
 
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
+
+/* Glyphs for the printable ascii range are rasterized into an atlas once per line height,
+ * characters outside of the range are skipped when rendering */
+#define FONT_FIRST_CHAR 32
+#define FONT_LAST_CHAR 126
+#define FONT_CHAR_COUNT (FONT_LAST_CHAR - FONT_FIRST_CHAR + 1)
+#define FONT_ATLAS_WIDTH 256
+/* Empty texels between the glyphs in the atlas */
+#define FONT_ATLAS_PADDING 1
+
+/* Signed distance field glyphs are generated on the first distance field draw for FONT_SDF_LINE_HEIGHT and scaled when rendering.
+ * Distances are stored up to FONT_SDF_SPREAD texels away from the glyph edges, this also limits outline widths.
+ * Glyphs are rasterized FONT_SDF_UPSAMPLE times larger for the distance transform. */
+#define FONT_SDF_LINE_HEIGHT 32.0f
+#define FONT_SDF_SPREAD 4
+#define FONT_SDF_UPSAMPLE 4
+#define FONT_SDF_ATLAS_WIDTH 512
+/* Pixels per coverage span when rendering distance field text */
+#define FONT_SDF_SPAN 64
+
+/* Computes distance field coverage four pixels at a time using SSE2 */
+#define USE_SIMD 1
+
+#ifdef USE_SIMD
+#include <emmintrin.h>
+#endif
+
+struct font_glyph
+{
+	/* Position of the glyph bitmap in the atlas */
+	int atlas_x;
+	int atlas_y;
+	int width;
+	int height;
+	/* Offset of the bitmap from the pen position, y is relative to the ascent */
+	int x_offset;
+	int y_offset;
+	/* Scaled advance to the next pen position */
+	int advance;
+};
+
+struct font_sdf_glyph
+{
+	/* Position of the distance field in the sdf atlas */
+	int atlas_x;
+	int atlas_y;
+	int width;
+	int height;
+	/* Offset of the distance field from the pen position and the baseline, in texels */
+	int x_offset;
+	int y_offset;
+	/* Advance in font units */
+	int advance;
+};
+
+/* Offset from a cell to its closest seed cell in a distance transform */
+struct font_edt_cell
+{
+	int16_t x;
+	int16_t y;
+};
 
 struct font
 {
@@ -18,28 +82,259 @@ struct font
 	int descent;
 	int line_gap;
 	void *buffer;
+	/* 8bit coverage of all the glyphs, FONT_ATLAS_WIDTH wide */
+	uint8_t *atlas;
+	int atlas_height;
+	struct font_glyph glyphs[FONT_CHAR_COUNT];
+	/* Scaled kerning, indexed with [first char * FONT_CHAR_COUNT + second char] */
+	int8_t kerning[FONT_CHAR_COUNT * FONT_CHAR_COUNT];
+	/* Incremented whenever the atlas is rebuilt, layouts made with an older atlas are stale */
+	uint32_t generation;
+	/* Distance fields of all the glyphs, FONT_SDF_ATLAS_WIDTH wide, 128 is the edge and larger values are inside.
+	 * NULL until the first distance field draw, sdf_failed stops retrying when building them failed. */
+	uint8_t *sdf_atlas;
+	bool sdf_failed;
+	int sdf_atlas_height;
+	/* Scale the distance fields were generated with */
+	float sdf_scale;
+	int ascent_units;
+	struct font_sdf_glyph sdf_glyphs[FONT_CHAR_COUNT];
+	/* Kerning in font units, indexed like kerning */
+	int16_t kerning_units[FONT_CHAR_COUNT * FONT_CHAR_COUNT];
+};
+
+struct font_layout
+{
+	/* Font, atlas generation and text the layout was made with */
+	const struct font *font;
+	uint32_t generation;
+	char *text;
+	size_t text_capacity;
+	/* Coverage of the whole run, size.x * size.y */
+	uint8_t *coverage;
+	size_t coverage_capacity;
+	/* Top left corner of the coverage relative to the position the text is drawn at */
+	struct vec2_int offset;
+	struct vec2_int size;
 };
 
+void font_edt_compare(struct font_edt_cell *grid, const int width, const int x, const int y, const int offset_x, const int offset_y)
+{
+	struct font_edt_cell *cell = &(grid[y * width + x]);
+	const struct font_edt_cell *other = &(grid[(y + offset_y) * width + x + offset_x]);
+	const int other_x = other->x + offset_x;
+	const int other_y = other->y + offset_y;
+	if (other_x * other_x + other_y * other_y < cell->x * cell->x + cell->y * cell->y)
+	{
+		cell->x = (int16_t)other_x;
+		cell->y = (int16_t)other_y;
+	}
+}
+
+/* 8SSEDT, after this every cell has the offset to its (approximately) closest seed cell.
+ * Seed cells are expected to have a zero offset and the others a large one. */
+void font_distance_transform(struct font_edt_cell *grid, const int width, const int height)
+{
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			if (x > 0)
+				font_edt_compare(grid, width, x, y, -1, 0);
+			if (y > 0)
+			{
+				font_edt_compare(grid, width, x, y, 0, -1);
+				if (x > 0)
+					font_edt_compare(grid, width, x, y, -1, -1);
+				if (x < width - 1)
+					font_edt_compare(grid, width, x, y, 1, -1);
+			}
+		}
+		for (int x = width - 2; x >= 0; --x)
+			font_edt_compare(grid, width, x, y, 1, 0);
+	}
+
+	for (int y = height - 1; y >= 0; --y)
+	{
+		for (int x = width - 1; x >= 0; --x)
+		{
+			if (x < width - 1)
+				font_edt_compare(grid, width, x, y, 1, 0);
+			if (y < height - 1)
+			{
+				font_edt_compare(grid, width, x, y, 0, 1);
+				if (x > 0)
+					font_edt_compare(grid, width, x, y, -1, 1);
+				if (x < width - 1)
+					font_edt_compare(grid, width, x, y, 1, 1);
+			}
+		}
+		for (int x = 1; x < width; ++x)
+			font_edt_compare(grid, width, x, y, -1, 0);
+	}
+}
+
+/* Builds the distance field atlas and caches the unscaled metrics needed to render at any size */
+bool font_build_sdf_atlas(struct font *font)
+{
+	assert(font && "font_build_sdf_atlas: font is NULL");
+
+	stbtt_fontinfo *font_info = &(font->font_info);
+	int descent, line_gap;
+	stbtt_GetFontVMetrics(font_info, &(font->ascent_units), &descent, &line_gap);
+	font->sdf_scale = stbtt_ScaleForPixelHeight(font_info, FONT_SDF_LINE_HEIGHT);
+	const float high_scale = font->sdf_scale * FONT_SDF_UPSAMPLE;
+
+	/* Bitmap boxes at the upsampled scale, the distance fields are aligned to whole texels around them */
+	int high_x0[FONT_CHAR_COUNT], high_y0[FONT_CHAR_COUNT], high_x1[FONT_CHAR_COUNT], high_y1[FONT_CHAR_COUNT];
+	int shelf_x = FONT_ATLAS_PADDING;
+	int shelf_y = FONT_ATLAS_PADDING;
+	int shelf_height = 0;
+	for (int i = 0; i < FONT_CHAR_COUNT; ++i)
+	{
+		struct font_sdf_glyph *glyph = &(font->sdf_glyphs[i]);
+		stbtt_GetCodepointBitmapBox(font_info, FONT_FIRST_CHAR + i, high_scale, high_scale, &high_x0[i], &high_y0[i], &high_x1[i], &high_y1[i]);
+		stbtt_GetCodepointHMetrics(font_info, FONT_FIRST_CHAR + i, &(glyph->advance), 0);
+		for (int j = 0; j < FONT_CHAR_COUNT; ++j)
+			font->kerning_units[i * FONT_CHAR_COUNT + j] = (int16_t)stbtt_GetCodepointKernAdvance(font_info, FONT_FIRST_CHAR + i, FONT_FIRST_CHAR + j);
+
+		if (high_x1[i] <= high_x0[i] || high_y1[i] <= high_y0[i])
+		{
+			glyph->width = 0;
+			glyph->height = 0;
+			continue;
+		}
+
+		glyph->x_offset = (int)floorf((float)high_x0[i] / FONT_SDF_UPSAMPLE) - FONT_SDF_SPREAD;
+		glyph->y_offset = (int)floorf((float)high_y0[i] / FONT_SDF_UPSAMPLE) - FONT_SDF_SPREAD;
+		glyph->width = (int)ceilf((float)high_x1[i] / FONT_SDF_UPSAMPLE) + FONT_SDF_SPREAD - glyph->x_offset;
+		glyph->height = (int)ceilf((float)high_y1[i] / FONT_SDF_UPSAMPLE) + FONT_SDF_SPREAD - glyph->y_offset;
+
+		if (shelf_x + glyph->width + FONT_ATLAS_PADDING > FONT_SDF_ATLAS_WIDTH)
+		{
+			shelf_x = FONT_ATLAS_PADDING;
+			shelf_y += shelf_height + FONT_ATLAS_PADDING;
+			shelf_height = 0;
+		}
+
+		glyph->atlas_x = shelf_x;
+		glyph->atlas_y = shelf_y;
+		shelf_x += glyph->width + FONT_ATLAS_PADDING;
+		shelf_height = max(shelf_height, glyph->height);
+	}
+
+	font->sdf_atlas_height = shelf_y + shelf_height + FONT_ATLAS_PADDING;
+	font->sdf_atlas = calloc((size_t)(FONT_SDF_ATLAS_WIDTH * font->sdf_atlas_height), 1);
+	if (!font->sdf_atlas)
+		return false;
+
+	for (int i = 0; i < FONT_CHAR_COUNT; ++i)
+	{
+		const struct font_sdf_glyph *glyph = &(font->sdf_glyphs[i]);
+		if (glyph->width == 0)
+			continue;
+
+		const int high_width = glyph->width * FONT_SDF_UPSAMPLE;
+		const int high_height = glyph->height * FONT_SDF_UPSAMPLE;
+		const int high_cells = high_width * high_height;
+		uint8_t *bitmap = calloc((size_t)high_cells, 1);
+		/* Distances from the inside to the outside and vice versa */
+		struct font_edt_cell *to_outside = malloc(sizeof(struct font_edt_cell) * high_cells);
+		struct font_edt_cell *to_inside = malloc(sizeof(struct font_edt_cell) * high_cells);
+		if (!bitmap || !to_outside || !to_inside)
+		{
+			free(bitmap);
+			free(to_outside);
+			free(to_inside);
+			free(font->sdf_atlas);
+			font->sdf_atlas = NULL;
+			return false;
+		}
+
+		const int bitmap_x = high_x0[i] - glyph->x_offset * FONT_SDF_UPSAMPLE;
+		const int bitmap_y = high_y0[i] - glyph->y_offset * FONT_SDF_UPSAMPLE;
+		stbtt_MakeCodepointBitmap(font_info, &(bitmap[bitmap_y * high_width + bitmap_x]), high_x1[i] - high_x0[i], high_y1[i] - high_y0[i], high_width,
+			high_scale, high_scale, FONT_FIRST_CHAR + i);
+
+		const struct font_edt_cell seed = { .x = 0, .y = 0 };
+		const struct font_edt_cell far_away = { .x = INT16_MAX / 4, .y = INT16_MAX / 4 };
+		for (int cell = 0; cell < high_cells; ++cell)
+		{
+			const bool inside = bitmap[cell] >= 128;
+			to_outside[cell] = inside ? far_away : seed;
+			to_inside[cell] = inside ? seed : far_away;
+		}
+		font_distance_transform(to_outside, high_width, high_height);
+		font_distance_transform(to_inside, high_width, high_height);
+
+		/* Texel centers fall between the upsampled pixels, average the four around them.
+		 * Distances are between pixel centers so the edge is half a pixel closer. */
+		for (int texel_y = 0; texel_y < glyph->height; ++texel_y)
+		{
+			uint8_t *sdf_row = &(font->sdf_atlas[(glyph->atlas_y + texel_y) * FONT_SDF_ATLAS_WIDTH + glyph->atlas_x]);
+			for (int texel_x = 0; texel_x < glyph->width; ++texel_x)
+			{
+				float distance = 0.0f;
+				for (int sample = 0; sample < 4; ++sample)
+				{
+					const int high_x = texel_x * FONT_SDF_UPSAMPLE + FONT_SDF_UPSAMPLE / 2 - 1 + (sample & 1);
+					const int high_y = texel_y * FONT_SDF_UPSAMPLE + FONT_SDF_UPSAMPLE / 2 - 1 + (sample >> 1);
+					const int cell = high_y * high_width + high_x;
+					const struct font_edt_cell *nearest = bitmap[cell] >= 128 ? &(to_outside[cell]) : &(to_inside[cell]);
+					const float sample_distance = sqrtf((float)(nearest->x * nearest->x + nearest->y * nearest->y)) - 0.5f;
+					distance += bitmap[cell] >= 128 ? sample_distance : -sample_distance;
+				}
+
+				const float encoded = 128.0f + distance * (0.25f / FONT_SDF_UPSAMPLE) * (127.0f / FONT_SDF_SPREAD);
+				sdf_row[texel_x] = (uint8_t)clamp(encoded + 0.5f, 0.0f, 255.0f);
+			}
+		}
+
+		free(bitmap);
+		free(to_outside);
+		free(to_inside);
+	}
+
+	return true;
+}
+
 struct font *font_create(const char *file_name)
 {
 	assert(file_name && "font_create: file_name is NULL");
 
 	struct font *font = malloc(sizeof(struct font));
+	if (!font)
+		return NULL;
+
+	font->buffer = NULL;
+	font->atlas = NULL;
+	font->atlas_height = 0;
+	font->generation = 0;
+	font->sdf_atlas = NULL;
+	font->sdf_atlas_height = 0;
+	font->sdf_failed = false;
 	FILE *font_file = fopen(file_name, "rb");
 	if (!font_file)
+	{
+		font_destroy(&font);
 		return NULL;
+	}
 
 	fseek(font_file, 0, SEEK_END);
 	int size = ftell(font_file);
 	fseek(font_file, 0, SEEK_SET);
 
-	font->buffer = malloc(size);
+	if (size > 0)
+		font->buffer = malloc(size);
 
-	fread(font->buffer, size, 1, font_file);
+	const bool loaded = font->buffer && fread(font->buffer, size, 1, font_file) == 1;
 	fclose(font_file);
 
-	if (!stbtt_InitFont(&font->font_info, font->buffer, 0))
+	if (!loaded || !stbtt_InitFont(&font->font_info, font->buffer, 0))
+	{
+		font_destroy(&font);
 		return NULL;
+	}
 
 	return font;
 }
@@ -49,6 +344,8 @@ void font_destroy(struct font **font)
 	assert(font && "font_destroy: font is NULL");
 	assert(*font && "font_destroy: *font is NULL");
 
+	free((*font)->atlas);
+	free((*font)->sdf_atlas);
 	free((*font)->buffer);
 	free(*font);
 	*font = NULL;
@@ -66,6 +363,84 @@ void font_set_line_height(struct font *font, float line_height)
 	font->ascent = (int)(ascent * scale);
 	font->descent = (int)(descent * scale);
 	font->scale = scale;
+
+	/* Pack the glyphs on shelves, the atlas height is known only after all of them have been placed */
+	stbtt_fontinfo *font_info = &(font->font_info);
+	int shelf_x = FONT_ATLAS_PADDING;
+	int shelf_y = FONT_ATLAS_PADDING;
+	int shelf_height = 0;
+	for (int i = 0; i < FONT_CHAR_COUNT; ++i)
+	{
+		struct font_glyph *glyph = &(font->glyphs[i]);
+		int char_x0, char_x1;
+		int char_y0, char_y1;
+		stbtt_GetCodepointBitmapBox(font_info, FONT_FIRST_CHAR + i, scale, scale, &char_x0, &char_y0, &char_x1, &char_y1);
+
+		glyph->width = char_x1 - char_x0;
+		glyph->height = char_y1 - char_y0;
+		glyph->x_offset = char_x0;
+		glyph->y_offset = font->ascent + char_y0;
+		assert(glyph->width + FONT_ATLAS_PADDING * 2 <= FONT_ATLAS_WIDTH && "font_set_line_height: glyph does not fit in the atlas");
+
+		if (shelf_x + glyph->width + FONT_ATLAS_PADDING > FONT_ATLAS_WIDTH)
+		{
+			shelf_x = FONT_ATLAS_PADDING;
+			shelf_y += shelf_height + FONT_ATLAS_PADDING;
+			shelf_height = 0;
+		}
+
+		glyph->atlas_x = shelf_x;
+		glyph->atlas_y = shelf_y;
+		shelf_x += glyph->width + FONT_ATLAS_PADDING;
+		shelf_height = max(shelf_height, glyph->height);
+
+		int advance_x;
+		stbtt_GetCodepointHMetrics(font_info, FONT_FIRST_CHAR + i, &advance_x, 0);
+		glyph->advance = (int)(advance_x * scale);
+
+		for (int j = 0; j < FONT_CHAR_COUNT; ++j)
+		{
+			int kerning = (int)(stbtt_GetCodepointKernAdvance(font_info, FONT_FIRST_CHAR + i, FONT_FIRST_CHAR + j) * scale);
+			assert(kerning >= INT8_MIN && kerning <= INT8_MAX && "font_set_line_height: kerning does not fit in 8 bits");
+			font->kerning[i * FONT_CHAR_COUNT + j] = (int8_t)kerning;
+		}
+	}
+
+	++font->generation;
+	free(font->atlas);
+	font->atlas_height = shelf_y + shelf_height + FONT_ATLAS_PADDING;
+	font->atlas = calloc((size_t)(FONT_ATLAS_WIDTH * font->atlas_height), 1);
+	if (!font->atlas)
+	{
+		font->atlas_height = 0;
+		return;
+	}
+
+	for (int i = 0; i < FONT_CHAR_COUNT; ++i)
+	{
+		struct font_glyph *glyph = &(font->glyphs[i]);
+		if (glyph->width > 0 && glyph->height > 0)
+			stbtt_MakeCodepointBitmap(font_info, &(font->atlas[glyph->atlas_y * FONT_ATLAS_WIDTH + glyph->atlas_x]), glyph->width, glyph->height, FONT_ATLAS_WIDTH, scale, scale, FONT_FIRST_CHAR + i);
+	}
+}
+
+/* Returns the glyph for *c or NULL if it is not in the atlas.
+ * glyph_x is set to the left edge of the glyph bitmap and pen_x is advanced to the next character, kerning included. */
+const struct font_glyph *font_get_glyph(const struct font *font, const char *c, int *pen_x, int *glyph_x)
+{
+	int char_index = (int)(unsigned char)*c - FONT_FIRST_CHAR;
+	if (char_index < 0 || char_index >= FONT_CHAR_COUNT)
+		return NULL;
+
+	const struct font_glyph *glyph = &(font->glyphs[char_index]);
+	*glyph_x = *pen_x + glyph->x_offset;
+
+	*pen_x += glyph->advance;
+	int next_index = (int)(unsigned char)c[1] - FONT_FIRST_CHAR;
+	if (next_index >= 0 && next_index < FONT_CHAR_COUNT)
+		*pen_x += font->kerning[char_index * FONT_CHAR_COUNT + next_index];
+
+	return glyph;
 }
 
 void font_render_text(void *render_target, const struct vec2_int *target_size, struct font *font, const char *text, const struct vec2_int *pos, const uint32_t text_color)
@@ -76,73 +451,322 @@ void font_render_text(void *render_target, const struct vec2_int *target_size, s
 	assert(text && "font_render_text: text is NULL");
 	assert(pos && "font_render_text: pos is NULL");
 
-	stbtt_fontinfo *font_info = &(font->font_info);
-	float scale = font->scale;
+	if (!font->atlas)
+		return;
+
+	int x = pos->x;
+	for (const char *c = text; *c != '\0' && x < target_size->x; ++c)
+	{
+		int glyph_x;
+		const struct font_glyph *glyph = font_get_glyph(font, c, &x, &glyph_x);
+		if (!glyph)
+			continue;
+
+		/* Clip the glyph rect against the target, the rows are counted down from line target_size->y */
+		int glyph_y = pos->y + glyph->y_offset;
+		int start_x = max(0, -glyph_x);
+		int end_x = min(glyph->width, target_size->x - glyph_x);
+		int start_y = max(0, 1 - glyph_y);
+		int end_y = min(glyph->height, target_size->y + 1 - glyph_y);
+
+		for (int char_y = start_y; char_y < end_y; ++char_y)
+		{
+			const uint8_t *coverage = &(font->atlas[(glyph->atlas_y + char_y) * FONT_ATLAS_WIDTH + glyph->atlas_x]);
+			uint32_t *row = &((uint32_t*)render_target)[(target_size->y - (glyph_y + char_y)) * target_size->x + glyph_x];
+
+			if (start_x < end_x)
+				blend_mask_span(&(row[start_x]), &(coverage[start_x]), text_color, end_x - start_x);
+		}
+	}
+}
+
+struct font_layout *font_layout_create(void)
+{
+	struct font_layout *layout = malloc(sizeof(struct font_layout));
+	if (!layout)
+		return NULL;
+
+	layout->font = NULL;
+	layout->generation = 0;
+	layout->text = NULL;
+	layout->text_capacity = 0;
+	layout->coverage = NULL;
+	layout->coverage_capacity = 0;
+	layout->offset.x = 0;
+	layout->offset.y = 0;
+	layout->size.x = 0;
+	layout->size.y = 0;
+
+	return layout;
+}
+
+void font_layout_destroy(struct font_layout **layout)
+{
+	assert(layout && "font_layout_destroy: layout is NULL");
+	assert(*layout && "font_layout_destroy: *layout is NULL");
+
+	free((*layout)->text);
+	free((*layout)->coverage);
+	free(*layout);
+	*layout = NULL;
+}
 
+bool font_layout_set_text(struct font_layout *layout, const struct font *font, const char *text)
+{
+	assert(layout && "font_layout_set_text: layout is NULL");
+	assert(font && "font_layout_set_text: font is NULL");
+	assert(text && "font_layout_set_text: text is NULL");
+
+	if (layout->font == font && layout->generation == font->generation && layout->text && strcmp(layout->text, text) == 0)
+		return false;
+
+	/* Grow the buffers only when needed, slowly changing strings settle to a fixed capacity */
+	size_t text_size = strlen(text) + 1;
+	if (text_size > layout->text_capacity)
+	{
+		free(layout->text);
+		layout->text = malloc(text_size);
+		layout->text_capacity = layout->text ? text_size : 0;
+	}
+
+	layout->font = font;
+	layout->generation = font->generation;
+	layout->size.x = 0;
+	layout->size.y = 0;
+	if (!layout->text)
+		return true;
+
+	memcpy(layout->text, text, text_size);
+	if (!font->atlas)
+		return true;
+
+	/* Bounds of the run */
+	int min_x = INT32_MAX, min_y = INT32_MAX;
+	int max_x = INT32_MIN, max_y = INT32_MIN;
 	int x = 0;
-	unsigned int text_len = (unsigned int)strlen(text);
-	/* This sorely needs optimization */
-	for (unsigned int i = 0; i < text_len; ++i)
+	for (const char *c = text; *c != '\0'; ++c)
 	{
-		int char_x0, char_x1;
-		int char_y0, char_y1;
-		stbtt_GetCodepointBitmapBox(font_info, text[i], scale, scale, &char_x0, &char_y0, &char_x1, &char_y1);
+		int glyph_x;
+		const struct font_glyph *glyph = font_get_glyph(font, c, &x, &glyph_x);
+		if (!glyph || glyph->width == 0 || glyph->height == 0)
+			continue;
+
+		min_x = min(min_x, glyph_x);
+		min_y = min(min_y, glyph->y_offset);
+		max_x = max(max_x, glyph_x + glyph->width);
+		max_y = max(max_y, glyph->y_offset + glyph->height);
+	}
+
+	if (min_x >= max_x)
+		return true;
+
+	size_t coverage_size = (size_t)((max_x - min_x) * (max_y - min_y));
+	if (coverage_size > layout->coverage_capacity)
+	{
+		free(layout->coverage);
+		layout->coverage = malloc(coverage_size);
+		layout->coverage_capacity = layout->coverage ? coverage_size : 0;
+		if (!layout->coverage)
+			return true;
+	}
+
+	layout->offset.x = min_x;
+	layout->offset.y = min_y;
+	layout->size.x = max_x - min_x;
+	layout->size.y = max_y - min_y;
+	memset(layout->coverage, 0, coverage_size);
 
-		int y = font->ascent + char_y0;
-		int char_width, char_height;
-		int x_offset, y_offset;
-		/* NOTE: This allocates memory, should do something about that */
-		unsigned char *bitmap = stbtt_GetCodepointBitmap(font_info, scale, scale, (int)text[i], &char_width, &char_height, &x_offset, &y_offset);
+	/* Overlapping glyphs (kerned pairs) keep the larger coverage */
+	x = 0;
+	for (const char *c = text; *c != '\0'; ++c)
+	{
+		int glyph_x;
+		const struct font_glyph *glyph = font_get_glyph(font, c, &x, &glyph_x);
+		if (!glyph)
+			continue;
 
-		for (int char_y = 0; char_y < char_height; ++char_y)
+		for (int char_y = 0; char_y < glyph->height; ++char_y)
 		{
-			int line = target_size->y - (pos->y + char_y + y);
-			if (line >= target_size->y)
-				break;
+			const uint8_t *src = &(font->atlas[(glyph->atlas_y + char_y) * FONT_ATLAS_WIDTH + glyph->atlas_x]);
+			uint8_t *dst = &(layout->coverage[(glyph->y_offset - min_y + char_y) * layout->size.x + glyph_x - min_x]);
+			for (int char_x = 0; char_x < glyph->width; ++char_x)
+				dst[char_x] = max(dst[char_x], src[char_x]);
+		}
+	}
 
-			for (int char_x = 0; char_x < char_width; ++char_x)
-			{
-				int pos_x = pos->x + char_x + x;
-				if (pos_x >= target_size->x)
-					break;
-
-				uint8_t alpha = bitmap[char_y * char_width + char_x];	
-				uint32_t *pixel = &((uint32_t*)render_target)[line * target_size->x + pos_x];
-				/* This needs to be calculated using a macro or something as this depends on the target format */
-				/* Colors of the original pixel */
-				uint32_t s_r = (*pixel >> 16) & 0xFF;
-				uint32_t s_g = (*pixel >> 8) & 0xFF;
-				uint32_t s_b = (*pixel) & 0xFF;
-				/* Colors for the text */
-				uint32_t t_r = (text_color >> 16) & 0xFF;
-				uint32_t t_g = (text_color >> 8) & 0xFF;
-				uint32_t t_b = (text_color) & 0xFF;
-				/* 255 = opaque, 0 = transparent */
-				float alpha_float = (float)(alpha / 255.0f);
-				uint32_t n_r = ((uint32_t)(s_r * (1.0f - alpha_float)) + (uint32_t)(t_r * alpha_float)) << 16;
-				uint32_t n_g = ((uint32_t)(s_g * (1.0f - alpha_float)) + (uint32_t)(t_g * alpha_float)) << 8;
-				uint32_t n_b = ((uint32_t)(s_b * (1.0f - alpha_float)) + (uint32_t)(t_b * alpha_float));
-				/* Calculate target pixel */
-				uint32_t target_pixel = 0;
-				target_pixel |= n_r & 0xFF0000;
-				target_pixel |= n_g & 0xFF00;
-				target_pixel |= n_b & 0xFF;
-				*pixel = target_pixel;
-			}
+	return true;
+}
+
+void font_render_layout(void *render_target, const struct vec2_int *target_size, const struct font_layout *layout, const struct vec2_int *pos, const uint32_t text_color)
+{
+	assert(render_target && "font_render_layout: render_target is NULL");
+	assert(target_size && "font_render_layout: target_size is NULL");
+	assert(layout && "font_render_layout: layout is NULL");
+	assert(pos && "font_render_layout: pos is NULL");
+
+	/* Same clipping as with the glyphs in font_render_text */
+	int run_x = pos->x + layout->offset.x;
+	int run_y = pos->y + layout->offset.y;
+	int start_x = max(0, -run_x);
+	int end_x = min(layout->size.x, target_size->x - run_x);
+	int start_y = max(0, 1 - run_y);
+	int end_y = min(layout->size.y, target_size->y + 1 - run_y);
+	if (start_x >= end_x)
+		return;
+
+	for (int run_row = start_y; run_row < end_y; ++run_row)
+	{
+		const uint8_t *coverage = &(layout->coverage[run_row * layout->size.x]);
+		uint32_t *row = &((uint32_t*)render_target)[(target_size->y - (run_y + run_row)) * target_size->x + run_x];
+		blend_mask_span(&(row[start_x]), &(coverage[start_x]), text_color, end_x - start_x);
+	}
+}
+
+/* Coverage of count pixels on a distance field glyph row, row_0 and row_1 are the texel rows around the pixel centers.
+ * u is the texel coordinate of the first pixel, step the texel step per pixel and distance_scale converts texel values to pixels.
+ * Outline coverage (distance grown by outline_width) is written to outline_mask if it isn't NULL. */
+void font_sdf_coverage_span(uint8_t *mask, uint8_t *outline_mask, const uint8_t *row_0, const uint8_t *row_1, const float weight_y, const int width,
+	const float u, const float step, const float distance_scale, const float outline_width, const int count)
+{
+	const float max_u = (float)(width - 1);
+	int i = 0;
+#ifdef USE_SIMD
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set_ps(1.0f, 1.0f, 1.0f, 1.0f);
+	const __m128 half = _mm_set_ps(0.5f, 0.5f, 0.5f, 0.5f);
+	const __m128 max_coverage = _mm_set_ps(255.0f, 255.0f, 255.0f, 255.0f);
+	const __m128 edge = _mm_set_ps(128.0f, 128.0f, 128.0f, 128.0f);
+	const __m128 max_u_vec = _mm_set_ps(max_u, max_u, max_u, max_u);
+	const __m128 weight_y_vec = _mm_set_ps(weight_y, weight_y, weight_y, weight_y);
+	const __m128 scale_vec = _mm_set_ps(distance_scale, distance_scale, distance_scale, distance_scale);
+	const __m128 outline_vec = _mm_set_ps(outline_width, outline_width, outline_width, outline_width);
+	const __m128 u_vec = _mm_set_ps(u, u, u, u);
+	const __m128 step_vec = _mm_set_ps(step, step, step, step);
+	const __m128 lane_offset = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	for (; i + 4 <= count; i += 4)
+	{
+		/* Evaluated directly rather than incrementally to match the scalar pixels exactly */
+		const float first = (float)i;
+		const __m128 pixel = _mm_add_ps(_mm_set_ps(first, first, first, first), lane_offset);
+		const __m128 clamped_u = _mm_min_ps(_mm_max_ps(_mm_add_ps(u_vec, _mm_mul_ps(step_vec, pixel)), zero), max_u_vec);
+		const __m128i index_vec = _mm_cvttps_epi32(clamped_u);
+		const __m128 weight_x = _mm_sub_ps(clamped_u, _mm_cvtepi32_ps(index_vec));
+		int32_t index[4];
+		_mm_storeu_si128((__m128i *)index, index_vec);
+		int32_t next[4];
+		for (int lane = 0; lane < 4; ++lane)
+			next[lane] = min(index[lane] + 1, width - 1);
+
+		const __m128 a = _mm_set_ps(row_0[index[3]], row_0[index[2]], row_0[index[1]], row_0[index[0]]);
+		const __m128 b = _mm_set_ps(row_0[next[3]], row_0[next[2]], row_0[next[1]], row_0[next[0]]);
+		const __m128 c = _mm_set_ps(row_1[index[3]], row_1[index[2]], row_1[index[1]], row_1[index[0]]);
+		const __m128 d = _mm_set_ps(row_1[next[3]], row_1[next[2]], row_1[next[1]], row_1[next[0]]);
+		const __m128 top = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), weight_x));
+		const __m128 bottom = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), weight_x));
+		const __m128 value = _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), weight_y_vec));
+		/* Distance in pixels, the coverage ramp is one pixel wide */
+		const __m128 distance = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(value, edge), scale_vec), half);
+
+		__m128 coverage = _mm_min_ps(_mm_max_ps(distance, zero), one);
+		__m128i coverage_i = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(coverage, max_coverage), half));
+		coverage_i = _mm_packs_epi32(coverage_i, coverage_i);
+		*(int32_t *)&mask[i] = _mm_cvtsi128_si32(_mm_packus_epi16(coverage_i, coverage_i));
+		if (outline_mask)
+		{
+			coverage = _mm_min_ps(_mm_max_ps(_mm_add_ps(distance, outline_vec), zero), one);
+			coverage_i = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(coverage, max_coverage), half));
+			coverage_i = _mm_packs_epi32(coverage_i, coverage_i);
+			*(int32_t *)&outline_mask[i] = _mm_cvtsi128_si32(_mm_packus_epi16(coverage_i, coverage_i));
 		}
+	}
+#endif
 
-		free(bitmap);
+	for (; i < count; ++i)
+	{
+		const float clamped_u = clamp(u + step * i, 0.0f, max_u);
+		const int index = (int)clamped_u;
+		const int next = min(index + 1, width - 1);
+		const float weight_x = clamped_u - (float)index;
+		const float top = row_0[index] + (row_0[next] - row_0[index]) * weight_x;
+		const float bottom = row_1[index] + (row_1[next] - row_1[index]) * weight_x;
+		const float value = top + (bottom - top) * weight_y;
+		const float distance = (value - 128.0f) * distance_scale + 0.5f;
+		mask[i] = (uint8_t)(clamp(distance, 0.0f, 1.0f) * 255.0f + 0.5f);
+		if (outline_mask)
+			outline_mask[i] = (uint8_t)(clamp(distance + outline_width, 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+}
 
-		/* Advance character width */
-		int advance_x;
-		stbtt_GetCodepointHMetrics(font_info, text[i], &advance_x, 0);
-		x = x + (int)(advance_x * scale);
+void font_render_text_sdf(void *render_target, const struct vec2_int *target_size, struct font *font, const char *text, const struct vec2_int *pos,
+	const float line_height, const uint32_t text_color, const float outline_width, const uint32_t outline_color)
+{
+	assert(render_target && "font_render_text_sdf: render_target is NULL");
+	assert(target_size && "font_render_text_sdf: target_size is NULL");
+	assert(font && "font_render_text_sdf: font is NULL");
+	assert(text && "font_render_text_sdf: text is NULL");
+	assert(pos && "font_render_text_sdf: pos is NULL");
+	assert(line_height > 0.0f && "font_render_text_sdf: line_height must be positive");
+
+	/* Built on the first draw so the fonts only rendered from the atlas don't pay for it */
+	if (!font->sdf_atlas && (font->sdf_failed || !font_build_sdf_atlas(font)))
+	{
+		font->sdf_failed = true;
+		return;
+	}
 
-		/* Add kerning */
-		int kerning = stbtt_GetCodepointKernAdvance(font_info, text[i], text[i + 1]);
-		x = x + (int)(kerning * scale);
+	const float scale = stbtt_ScaleForPixelHeight(&(font->font_info), line_height);
+	/* Pixels per distance field texel */
+	const float texel_size = scale / font->sdf_scale;
+	const float step = 1.0f / texel_size;
+	const float distance_scale = texel_size * FONT_SDF_SPREAD / 127.0f;
+	/* The field only reaches FONT_SDF_SPREAD texels outside of the glyphs */
+	const float outline = clamp(outline_width, 0.0f, FONT_SDF_SPREAD * texel_size - 0.5f);
+	const float baseline = (float)pos->y + font->ascent_units * scale;
 
-		if (x >= target_size->x)
-			break;
+	uint8_t mask[FONT_SDF_SPAN];
+	uint8_t outline_mask[FONT_SDF_SPAN];
+	float pen_x = (float)pos->x;
+	for (const char *c = text; *c != '\0' && pen_x < target_size->x; ++c)
+	{
+		int char_index = (int)(unsigned char)*c - FONT_FIRST_CHAR;
+		if (char_index < 0 || char_index >= FONT_CHAR_COUNT)
+			continue;
+
+		const struct font_sdf_glyph *glyph = &(font->sdf_glyphs[char_index]);
+		const float left = pen_x + glyph->x_offset * texel_size;
+		const float top = baseline + glyph->y_offset * texel_size;
+
+		pen_x += glyph->advance * scale;
+		int next_index = (int)(unsigned char)c[1] - FONT_FIRST_CHAR;
+		if (next_index >= 0 && next_index < FONT_CHAR_COUNT)
+			pen_x += font->kerning_units[char_index * FONT_CHAR_COUNT + next_index] * scale;
+
+		if (glyph->width == 0)
+			continue;
+
+		/* Pixels whose centers are on the glyph, clipped like in font_render_text */
+		const int start_x = max((int)ceilf(left - 0.5f), 0);
+		const int end_x = min((int)ceilf(left + glyph->width * texel_size - 0.5f), target_size->x);
+		const int start_y = max((int)ceilf(top - 0.5f), 1);
+		const int end_y = min((int)ceilf(top + glyph->height * texel_size - 0.5f), target_size->y + 1);
+
+		for (int y = start_y; y < end_y; ++y)
+		{
+			const float v = clamp(((float)y + 0.5f - top) * step - 0.5f, 0.0f, (float)(glyph->height - 1));
+			const int texel_y = (int)v;
+			const uint8_t *row_0 = &(font->sdf_atlas[(glyph->atlas_y + texel_y) * FONT_SDF_ATLAS_WIDTH + glyph->atlas_x]);
+			const uint8_t *row_1 = texel_y + 1 < glyph->height ? row_0 + FONT_SDF_ATLAS_WIDTH : row_0;
+			uint32_t *row = &((uint32_t*)render_target)[(target_size->y - y) * target_size->x];
+
+			for (int x = start_x; x < end_x; x += FONT_SDF_SPAN)
+			{
+				const int count = min(end_x - x, FONT_SDF_SPAN);
+				const float u = ((float)x + 0.5f - left) * step - 0.5f;
+				font_sdf_coverage_span(mask, outline > 0.0f ? outline_mask : NULL, row_0, row_1, v - (float)texel_y, glyph->width, u, step, distance_scale, outline, count);
+				if (outline > 0.0f)
+					blend_mask_span(&(row[x]), outline_mask, outline_color, count);
+				blend_mask_span(&(row[x]), mask, text_color, count);
+			}
+		}
 	}
 }
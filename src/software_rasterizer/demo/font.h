@@ -8,8 +8,33 @@ struct font *font_create(const char *file_name);
 
 void font_destroy(struct font **font);
 
+/* Rasterizes the printable ascii glyphs into the font's atlas and caches their metrics and kerning.
+ * This is slow, call it once per size rather than every frame. */
 void font_set_line_height(struct font *font, float line_height);
 
+/* Blends glyphs from the atlas, nothing is rendered before font_set_line_height has been called.
+ * Characters outside of the printable ascii range are skipped. */
 void font_render_text(void *render_target, const struct vec2_int *target_size, struct font *font, const char *text, const struct vec2_int *pos, const uint32_t text_color);
 
+/* Renders text from signed distance fields, any line_height works without rasterizing glyphs again.
+ * The distance fields are generated on the first call, nothing is rendered if that fails.
+ * outline_width is in pixels (0 disables the outline) and is limited by the spread of the distance fields. */
+void font_render_text_sdf(void *render_target, const struct vec2_int *target_size, struct font *font, const char *text, const struct vec2_int *pos,
+	const float line_height, const uint32_t text_color, const float outline_width, const uint32_t outline_color);
+
+/* Text layouts cache the laid out coverage of a whole string so that drawing it is a single masked blit.
+ * Use these for labels and other strings that change rarely compared to how often they are drawn. */
+struct font_layout;
+
+struct font_layout *font_layout_create(void);
+
+void font_layout_destroy(struct font_layout **layout);
+
+/* Lays out text with font unless the layout already has the same text laid out with the current atlas of the font.
+ * Returns true if the text was laid out again. */
+bool font_layout_set_text(struct font_layout *layout, const struct font *font, const char *text);
+
+/* Draws a laid out string, pos and clipping work the same way as with font_render_text. */
+void font_render_layout(void *render_target, const struct vec2_int *target_size, const struct font_layout *layout, const struct vec2_int *pos, const uint32_t text_color);
+
 #endif /* RPLNN_FONT_H */
@@ -0,0 +1,229 @@
+#include "software_rasterizer/precompiled.h"
+
+#include "histogram.h"
+
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/* Values are split to the most significant bit and the HISTOGRAM_SUB_BUCKET_BITS - 1 bits below it */
+#define HISTOGRAM_SUB_BUCKET_BITS 8
+#define HISTOGRAM_SUB_BUCKET_COUNT (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_HALF_SUB_BUCKET_COUNT (HISTOGRAM_SUB_BUCKET_COUNT >> 1)
+/* Linear buckets for the values below HISTOGRAM_SUB_BUCKET_COUNT and half of the sub buckets for each larger power of two */
+#define HISTOGRAM_BUCKET_COUNT ((32 - HISTOGRAM_SUB_BUCKET_BITS + 2) * HISTOGRAM_HALF_SUB_BUCKET_COUNT)
+
+struct histogram
+{
+	uint32_t counts[HISTOGRAM_BUCKET_COUNT];
+	uint64_t total_count;
+	uint64_t sum;
+};
+
+struct histogram_thread
+{
+	/* Written only by the recording thread between merges */
+	struct histogram pending;
+	uint32_t pending_min_bucket;
+	uint32_t pending_max_bucket;
+	/* Written only by histogram_merge */
+	struct histogram merged;
+};
+
+struct histogram_recorder
+{
+	struct histogram total;
+	struct histogram_thread *threads;
+	unsigned int thread_count;
+};
+
+uint32_t histogram_get_msb(const uint32_t value)
+{
+	assert(value != 0 && "histogram_get_msb: value is zero");
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse(&index, value);
+	return (uint32_t)index;
+#else
+	return 31 - (uint32_t)__builtin_clz(value);
+#endif
+}
+
+uint32_t histogram_get_bucket(const uint32_t value)
+{
+	if (value < HISTOGRAM_SUB_BUCKET_COUNT)
+		return value;
+
+	const uint32_t msb = histogram_get_msb(value);
+	const uint32_t shift = msb - (HISTOGRAM_SUB_BUCKET_BITS - 1);
+	/* The bits below the msb select the sub bucket */
+	const uint32_t sub_bucket = (value >> shift) - HISTOGRAM_HALF_SUB_BUCKET_COUNT;
+	return (shift + 1) * HISTOGRAM_HALF_SUB_BUCKET_COUNT + sub_bucket;
+}
+
+/* Returns the midpoint of the values in bucket */
+uint32_t histogram_get_bucket_value(const uint32_t bucket)
+{
+	if (bucket < HISTOGRAM_SUB_BUCKET_COUNT)
+		return bucket;
+
+	const uint32_t shift = bucket / HISTOGRAM_HALF_SUB_BUCKET_COUNT - 1;
+	const uint32_t sub_bucket = bucket % HISTOGRAM_HALF_SUB_BUCKET_COUNT + HISTOGRAM_HALF_SUB_BUCKET_COUNT;
+	return (sub_bucket << shift) + ((1U << shift) - 1) / 2;
+}
+
+void histogram_clear(struct histogram *histogram)
+{
+	memset(histogram->counts, 0, sizeof(histogram->counts));
+	histogram->total_count = 0;
+	histogram->sum = 0;
+}
+
+uint32_t histogram_percentile(const struct histogram *histogram, const float percentile)
+{
+	if (histogram->total_count == 0)
+		return 0;
+
+	/* Smallest value with at least percentile of the values at or below it */
+	uint64_t target = (uint64_t)((double)histogram->total_count * clamp(percentile, 0.0f, 100.0f) * 0.01 + 0.5);
+	target = clamp(target, 1, histogram->total_count);
+	uint64_t count = 0;
+	for (uint32_t bucket = 0; bucket < HISTOGRAM_BUCKET_COUNT; ++bucket)
+	{
+		count += histogram->counts[bucket];
+		if (count >= target)
+			return histogram_get_bucket_value(bucket);
+	}
+
+	assert(false && "histogram_percentile: bucket counts don't add up to the total count");
+	return 0;
+}
+
+struct histogram_recorder *histogram_recorder_create(const unsigned int thread_count)
+{
+	assert(thread_count > 0 && "histogram_recorder_create: thread_count is zero");
+
+	struct histogram_recorder *recorder = malloc(sizeof(struct histogram_recorder));
+	if (!recorder)
+		return NULL;
+
+	recorder->threads = malloc(sizeof(struct histogram_thread) * thread_count);
+	if (!recorder->threads)
+	{
+		free(recorder);
+		return NULL;
+	}
+
+	recorder->thread_count = thread_count;
+	histogram_reset(recorder);
+
+	return recorder;
+}
+
+void histogram_recorder_destroy(struct histogram_recorder **recorder)
+{
+	assert(recorder && "histogram_recorder_destroy: recorder is NULL");
+	assert(*recorder && "histogram_recorder_destroy: *recorder is NULL");
+
+	free((*recorder)->threads);
+	free(*recorder);
+	*recorder = NULL;
+}
+
+void histogram_record(struct histogram_recorder *recorder, const unsigned int thread_index, const uint32_t value)
+{
+	assert(recorder && "histogram_record: recorder is NULL");
+	assert(thread_index < recorder->thread_count && "histogram_record: Too big thread_index");
+
+	struct histogram_thread *thread = &(recorder->threads[thread_index]);
+	const uint32_t bucket = histogram_get_bucket(value);
+	++(thread->pending.counts[bucket]);
+	++(thread->pending.total_count);
+	thread->pending.sum += value;
+	/* Keeps merging cheap as latencies of a frame tend to be close to each other */
+	thread->pending_min_bucket = min(thread->pending_min_bucket, bucket);
+	thread->pending_max_bucket = max(thread->pending_max_bucket, bucket);
+}
+
+void histogram_merge(struct histogram_recorder *recorder)
+{
+	assert(recorder && "histogram_merge: recorder is NULL");
+
+	for (unsigned int i = 0; i < recorder->thread_count; ++i)
+	{
+		struct histogram_thread *thread = &(recorder->threads[i]);
+		if (thread->pending.total_count == 0)
+			continue;
+
+		for (uint32_t bucket = thread->pending_min_bucket; bucket <= thread->pending_max_bucket; ++bucket)
+		{
+			const uint32_t count = thread->pending.counts[bucket];
+			recorder->total.counts[bucket] += count;
+			thread->merged.counts[bucket] += count;
+			thread->pending.counts[bucket] = 0;
+		}
+
+		recorder->total.total_count += thread->pending.total_count;
+		recorder->total.sum += thread->pending.sum;
+		thread->merged.total_count += thread->pending.total_count;
+		thread->merged.sum += thread->pending.sum;
+		thread->pending.total_count = 0;
+		thread->pending.sum = 0;
+		thread->pending_min_bucket = HISTOGRAM_BUCKET_COUNT - 1;
+		thread->pending_max_bucket = 0;
+	}
+}
+
+void histogram_reset(struct histogram_recorder *recorder)
+{
+	assert(recorder && "histogram_reset: recorder is NULL");
+
+	histogram_clear(&(recorder->total));
+	for (unsigned int i = 0; i < recorder->thread_count; ++i)
+	{
+		struct histogram_thread *thread = &(recorder->threads[i]);
+		histogram_clear(&(thread->pending));
+		histogram_clear(&(thread->merged));
+		thread->pending_min_bucket = HISTOGRAM_BUCKET_COUNT - 1;
+		thread->pending_max_bucket = 0;
+	}
+}
+
+uint64_t histogram_get_count(const struct histogram_recorder *recorder)
+{
+	assert(recorder && "histogram_get_count: recorder is NULL");
+
+	return recorder->total.total_count;
+}
+
+uint32_t histogram_get_percentile(const struct histogram_recorder *recorder, const float percentile)
+{
+	assert(recorder && "histogram_get_percentile: recorder is NULL");
+
+	return histogram_percentile(&(recorder->total), percentile);
+}
+
+uint32_t histogram_get_avarage(const struct histogram_recorder *recorder)
+{
+	assert(recorder && "histogram_get_avarage: recorder is NULL");
+
+	return recorder->total.total_count ? (uint32_t)(recorder->total.sum / recorder->total.total_count) : 0;
+}
+
+uint64_t histogram_get_thread_count(const struct histogram_recorder *recorder, const unsigned int thread_index)
+{
+	assert(recorder && "histogram_get_thread_count: recorder is NULL");
+	assert(thread_index < recorder->thread_count && "histogram_get_thread_count: Too big thread_index");
+
+	return recorder->threads[thread_index].merged.total_count;
+}
+
+uint32_t histogram_get_thread_percentile(const struct histogram_recorder *recorder, const unsigned int thread_index, const float percentile)
+{
+	assert(recorder && "histogram_get_thread_percentile: recorder is NULL");
+	assert(thread_index < recorder->thread_count && "histogram_get_thread_percentile: Too big thread_index");
+
+	return histogram_percentile(&(recorder->threads[thread_index].merged), percentile);
+}
@@ -0,0 +1,35 @@
+#ifndef RPLNN_HISTOGRAM_H
+#define RPLNN_HISTOGRAM_H
+
+/* Log-linear latency histograms (like HDR histogram) with per thread recording.
+ * Values below 256 are counted exactly, larger values go to buckets at most 1/128 of the value wide.
+ * Percentiles report bucket midpoints so the relative error is at most 1/256 for any uint32_t value,
+ * and the memory use doesn't depend on the number of recorded values. */
+
+struct histogram_recorder;
+
+/* Should create a version of this which doesn't malloc (basically just give memory block as a parameter). */
+struct histogram_recorder *histogram_recorder_create(const unsigned int thread_count);
+void histogram_recorder_destroy(struct histogram_recorder **recorder);
+
+/* Records a value into the buffer of thread_index, each thread must use its own index.
+ * Recording takes no locks and doesn't write to anything shared with the other threads. */
+void histogram_record(struct histogram_recorder *recorder, const unsigned int thread_index, const uint32_t value);
+
+/* Merges the values recorded since the previous merge into the totals.
+ * Call this from the main thread once the threads are done recording for the frame (thread_wait_for_task),
+ * it must not run concurrently with histogram_record. */
+void histogram_merge(struct histogram_recorder *recorder);
+
+/* Clears all the recorded values */
+void histogram_reset(struct histogram_recorder *recorder);
+
+/* These only see merged values */
+uint64_t histogram_get_count(const struct histogram_recorder *recorder);
+uint32_t histogram_get_percentile(const struct histogram_recorder *recorder, const float percentile);
+uint32_t histogram_get_avarage(const struct histogram_recorder *recorder);
+/* Values recorded by a single thread */
+uint64_t histogram_get_thread_count(const struct histogram_recorder *recorder, const unsigned int thread_index);
+uint32_t histogram_get_thread_percentile(const struct histogram_recorder *recorder, const unsigned int thread_index, const float percentile);
+
+#endif /* RPLNN_HISTOGRAM_H */
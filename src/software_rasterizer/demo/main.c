@@ -1,14 +1,24 @@
 #include "software_rasterizer/precompiled.h"
 
+#include "software_rasterizer/demo/blend.h"
+#include "software_rasterizer/demo/box.h"
 #include "software_rasterizer/demo/font.h"
+#include "software_rasterizer/demo/histogram.h"
 #include "software_rasterizer/demo/osal.h"
 #include "software_rasterizer/demo/stats.h"
 #include "software_rasterizer/demo/texture.h"
+#include "software_rasterizer/demo/trace.h"
 #include "software_rasterizer/rasterizer.h"
 
 #define USE_THREADING 1
-#define VERTS_IN_BOX 14
+#define USE_SHADOWS 1
+//#define USE_MSAA 1
+#define SHADOW_MAP_SIZE 1024
 #define LARGE_VERT_BUF_BOXES 8
+/* The timeline written at the end of the profiling run keeps this many of the last events of each thread */
+#define TRACE_EVENTS_PER_THREAD 32768
+/* Without tiles the render target is split to areas of this size for the threads */
+#define RASTER_AREA_SIZE 256
 
 #ifdef USE_THREADING
 struct thread_data
@@ -21,32 +31,62 @@ struct thread_data
 	uint32_t raster_area_count;
 	struct vec4_float **vert_bufs;
 	struct vec2_float **uv_bufs;
+	const float **attribute_bufs;
+	uint32_t *attribute_counts;
 	unsigned int **ind_bufs;
 	unsigned int *ind_counts;
 	uint32_t **textures;
 	struct vec2_int **texture_sizes;
+	const struct rasterizer_state **states;
 	uint32_t buffer_count;
+	/* Time spent on each raster area, recorded to the buffer of thread_index */
+	struct histogram_recorder *area_times;
+	/* Timeline of the tasks and areas, recorded to the buffer of thread_index */
+	struct trace_recorder *trace;
+	unsigned int thread_index;
 };
 
 void thread_data_init(struct thread_data *data, const uint32_t buffer_count, const uint32_t raster_area_count);
 void thread_data_deinit(struct thread_data *data);
+int get_raster_area_split(const struct vec2_int *backbuffer_size, struct vec2_int *out_split_size);
+uint32_t get_raster_area_count(const struct vec2_int *backbuffer_size);
 void thread_data_calculate_areas(struct thread_data *data, const unsigned int core_count, const struct vec2_int *backbuffer_size);
 void rasterize_thread(void *data);
 #endif
 
+#ifdef USE_SHADOWS
+void render_shadow_map(uint32_t *shadow_map, const struct vec2_int *map_size, struct vec4_float **vert_bufs, unsigned int **ind_bufs, const unsigned int *ind_counts, const unsigned int buffer_count);
+#endif
+
 void transform_vertices(const struct vec3_float *in_verts, struct vec4_float *out_verts, unsigned int vert_count,
                      struct matrix_3x4 *translation, struct matrix_3x4 *rotation, struct matrix_4x4 *camera_projection);
 void handle_input(struct api_info *api_info, float dt, struct vec3_float *camera_trans);
 
-void create_box_buffers(struct vec3_float *out_vert_buf, struct vec2_float *out_uv_buf, unsigned int *out_ind_buf);
-void generate_large_test_buffers(const struct vec3_float *vert_buf_box, const struct vec2_float *uv_box, const unsigned int *ind_buf_box,
-	struct vec3_float *out_vert_buf, struct vec2_float *out_uv, unsigned int *out_ind_buf, const struct vec3_float *box_offsets, const unsigned int box_count_out);
+void scanline_shader(struct rasterizer_quad_packet *packet, const void *data);
+
+/* Text layouts for the stats overlay, the labels are laid out once and the values only when they change */
+#define STAT_COLUMN_COUNT 5
+/* The stats and the area time histogram */
+#define STAT_ROW_COUNT (STAT_COUNT + 1)
+#define STAT_ROW_AREA_TIMES STAT_COUNT
+struct stat_texts
+{
+	struct font_layout *column_names[STAT_COLUMN_COUNT];
+	struct font_layout *stat_names[STAT_ROW_COUNT];
+	struct font_layout *values[STAT_ROW_COUNT][STAT_COLUMN_COUNT];
+};
 
-void render_stats(struct stats *stats, struct font *font, void *render_target, struct vec2_int *target_size);
-void render_stat_line_ms(struct stats *stats, struct font *font, void *render_target, struct vec2_int *target_size, 
+bool stat_texts_init(struct stat_texts *texts);
+void stat_texts_deinit(struct stat_texts *texts);
+void render_cached_text(struct font_layout *layout, struct font *font, void *render_target, struct vec2_int *target_size, const char *text, const struct vec2_int *pos);
+
+void render_stats(struct stats *stats, const struct histogram_recorder *area_times, struct stat_texts *texts, struct font *font, void *render_target, struct vec2_int *target_size);
+void render_stat_line_ms(struct stats *stats, struct stat_texts *texts, struct font *font, void *render_target, struct vec2_int *target_size, 
                          const char *stat_name, const unsigned char stat_id, const int row_y, const int stat_name_x, const int first_val_x, const int x_increment);
-void render_stat_line_mus(struct stats *stats, struct font *font, void *render_target, struct vec2_int *target_size,
+void render_stat_line_mus(struct stats *stats, struct stat_texts *texts, struct font *font, void *render_target, struct vec2_int *target_size,
                           const char *stat_name, const unsigned char stat_id, const int row_y, const int stat_name_x, const int first_val_x, const int x_increment);
+void render_histogram_line_mus(const struct histogram_recorder *histogram, struct stat_texts *texts, struct font *font, void *render_target, struct vec2_int *target_size,
+                               const char *name, const unsigned int row, const int row_y, const int name_x, const int first_val_x, const int x_increment);
 
 /* A generic platform independent main function.
  * See osal.c for platform specific main. */
@@ -73,6 +113,8 @@ void main(struct api_info *api_info, struct renderer_info *renderer_info)
 		error_popup("Failed to initialize the font", false);
 
 	struct stats *stats = stats_create(STAT_COUNT, 1000, true);
+	struct stat_texts stat_texts;
+	const bool stat_texts_ok = stat_texts_init(&stat_texts);
 	unsigned int stabilizing_delay = 500;
 
 	/* Test box, CCW */
@@ -82,6 +124,16 @@ void main(struct api_info *api_info, struct renderer_info *renderer_info)
 	const unsigned int ind_buf_size = sizeof(ind_buf) / sizeof(ind_buf[0]);
 	create_box_buffers(&(vert_buf[0]), &(uv[0]), &(ind_buf[0]));
 
+	/* Vertex colors (rgba) for the second box, they tint its texture */
+	float color_attributes[VERTS_IN_BOX * 4];
+	for (unsigned int i = 0; i < VERTS_IN_BOX; ++i)
+	{
+		color_attributes[i * 4] = vert_buf[i].x * 0.25f + 0.5f;
+		color_attributes[i * 4 + 1] = vert_buf[i].y * 0.25f + 0.5f;
+		color_attributes[i * 4 + 2] = vert_buf[i].z * 0.25f + 0.5f;
+		color_attributes[i * 4 + 3] = 1.0f;
+	}
+
 	struct vec3_float vert_buf_large[VERTS_IN_BOX * LARGE_VERT_BUF_BOXES];
 	struct vec2_float uv_large[VERTS_IN_BOX * LARGE_VERT_BUF_BOXES];
 	unsigned int ind_buf_large[36 * LARGE_VERT_BUF_BOXES];
@@ -129,12 +181,85 @@ void main(struct api_info *api_info, struct renderer_info *renderer_info)
 	if (!render_target)
 		error_popup("Couldn't get back buffer", true);
 
-	/* Get correctly sized depth buffer */
-	uint32_t *depth_buf = NULL;
-	if (rasterizer_uses_simd() && rasterizer_uses_tiles())
-		depth_buf = malloc(padded_size.x * padded_size.y * sizeof(uint32_t));
-	else
-		depth_buf = malloc(rendertarget_size.x * rendertarget_size.y * sizeof(uint32_t));
+	/* Get correctly sized depth buffer, with multisampling it has an entry per sample */
+	struct vec2_int depth_buf_size = rasterizer_uses_simd() && rasterizer_uses_tiles() ? padded_size : rendertarget_size;
+#ifdef USE_MSAA
+	depth_buf_size.x *= RASTERIZER_MSAA_SAMPLES;
+#endif
+	uint32_t *depth_buf = malloc(depth_buf_size.x * depth_buf_size.y * sizeof(uint32_t));
+	if (!depth_buf)
+		error_popup("Couldn't allocate the depth buffer", true);
+
+	/* Depth is cleared every frame, stencil only here as it isn't used by the demo */
+	rasterizer_clear_stencil_buffer(depth_buf, &depth_buf_size, 0);
+
+	/* Draws go to the color buffer, with multisampling it has the samples which are resolved to the render target */
+	uint32_t *color_buf = render_target;
+#ifdef USE_MSAA
+	color_buf = malloc(depth_buf_size.x * depth_buf_size.y * sizeof(uint32_t));
+	if (!color_buf)
+		error_popup("Couldn't allocate the sample buffer", true);
+#endif
+
+	struct rasterizer_state state;
+	rasterizer_state_init(&state);
+
+#ifdef USE_SHADOWS
+	/* A spot light looking down at the boxes */
+	struct vec3_float light_trans = { .x = -10.0f, .y = 30.0f, .z = 0.0f };
+	struct matrix_3x4 light_mat = mat34_get_translation(&light_trans);
+	struct matrix_3x4 light_rot_x = mat34_get_rotation_x(DEG_TO_RAD(40.0f));
+	struct matrix_3x4 light_rot_y = mat34_get_rotation_y(DEG_TO_RAD(20.0f));
+	struct matrix_3x4 light_rot = mat34_mul_mat34(&light_rot_y, &light_rot_x);
+	light_mat = mat34_mul_mat34(&light_mat, &light_rot);
+	light_mat = mat34_get_inverse(&light_mat);
+	struct matrix_4x4 light_projection = mat44_get_perspective_lh_fov(DEG_TO_RAD(60.0f), 1.0f, 1.0f, 1000.0f);
+	light_projection = mat44_mul_mat34(&light_projection, &light_mat);
+
+	const struct vec2_int shadow_map_size = { .x = SHADOW_MAP_SIZE, .y = SHADOW_MAP_SIZE };
+	struct vec2_int shadow_map_padded_size;
+	rasterizer_get_padded_size(&shadow_map_size, &shadow_map_padded_size);
+	uint32_t *shadow_map = malloc(shadow_map_padded_size.x * shadow_map_padded_size.y * sizeof(uint32_t));
+	if (!shadow_map)
+		error_popup("Couldn't allocate the shadow map", true);
+	rasterizer_clear_stencil_buffer(shadow_map, &shadow_map_padded_size, 0);
+
+	struct vec4_float light_vert_buf[VERTS_IN_BOX];
+	struct vec4_float light_vert_buf2[VERTS_IN_BOX];
+	struct vec4_float light_vert_buf_large[VERTS_IN_BOX * LARGE_VERT_BUF_BOXES];
+	struct vec4_float light_vert_buf_large2[VERTS_IN_BOX * LARGE_VERT_BUF_BOXES];
+	struct vec4_float light_vert_buf_large3[VERTS_IN_BOX * LARGE_VERT_BUF_BOXES];
+	struct vec4_float *light_vert_bufs[5] = { &light_vert_buf[0], &light_vert_buf2[0], &light_vert_buf_large[0], &light_vert_buf_large2[0], &light_vert_buf_large3[0] };
+	unsigned int *shadow_ind_bufs[5] = { &ind_buf[0], &ind_buf[0], &ind_buf_large[0], &ind_buf_large[0], &ind_buf_large[0] };
+	const unsigned int shadow_ind_counts[5] = { ind_buf_size, ind_buf_size, ind_buf_large_size, ind_buf_large_size, ind_buf_large_size };
+
+	/* Each vertex buffer needs its own light space vertices */
+	struct rasterizer_shadow shadows[5];
+	struct rasterizer_state states[5];
+	for (unsigned int i = 0; i < 5; ++i)
+	{
+		shadows[i].map = shadow_map;
+		shadows[i].map_size = shadow_map_size;
+		shadows[i].vert_buf = light_vert_bufs[i];
+		shadows[i].bias = 0.0005f;
+		shadows[i].ambient = 0.4f;
+		states[i] = state;
+		states[i].shadow = &shadows[i];
+	}
+#else
+	struct rasterizer_state states[5] = { state, state, state, state, state };
+#endif
+#ifdef USE_MSAA
+	/* The shadow map pass has its own state and isn't multisampled */
+	for (unsigned int i = 0; i < 5; ++i)
+		states[i].multisample = true;
+#endif
+	/* See-through boxes, blended draws are done last without depth writes */
+	states[4].blend_mode = RASTERIZER_BLEND_ALPHA;
+	states[4].blend_alpha = 160;
+	states[4].depth_write = false;
+	states[1].vertex_colors = true;
+	states[3].pixel_shader = scanline_shader;
 
 	struct matrix_4x4 perspective_mat = mat44_get_perspective_lh_fov(DEG_TO_RAD(59.0f), (float)rendertarget_size.x / (float)rendertarget_size.y, 1.0f, 1000.0f);
 
@@ -142,12 +267,24 @@ void main(struct api_info *api_info, struct renderer_info *renderer_info)
 	uint64_t frame_start = get_time();
 
 	const int32_t tile_size = rasterizer_get_tile_size();
+	struct histogram_recorder *area_times = NULL;
+	/* The main thread records its events after the worker threads */
+	unsigned int trace_thread_count = 1;
 #ifdef USE_THREADING
 	const unsigned int core_count = get_logical_core_count();
+	area_times = histogram_recorder_create(core_count);
+	trace_thread_count += core_count;
+#endif
+	struct trace_recorder *trace = trace_recorder_create(trace_thread_count, TRACE_EVENTS_PER_THREAD);
+	const unsigned int trace_main_thread = trace_thread_count - 1;
+	if (trace)
+		trace_set_thread_name(trace, trace_main_thread, "main");
+	uint64_t traced_blit_end = 0;
+#ifdef USE_THREADING
 	struct thread **threads = malloc(sizeof(struct thread *) * core_count);
 	struct thread_data *thread_data = malloc(sizeof(struct thread_data) * core_count);
 
-	unsigned int tile_count = (padded_size.x / tile_size) * (padded_size.y / tile_size);
+	const uint32_t area_count = get_raster_area_count(&rendertarget_size);
 	/* Not a good way to do this.
 	 * Should try to pass only the relevant vertex info to the thread.
 	 * Just passing every tri to all raster areas is really bad when using small raster areas (tiling enabled).
@@ -156,13 +293,20 @@ void main(struct api_info *api_info, struct renderer_info *renderer_info)
 	for (unsigned int i = 0; i < core_count; ++i)
 	{
 		threads[i] = thread_create(i);
-		thread_data_init(&thread_data[i], 5, tile_count / core_count + 1);
-		thread_data[i].render_target = render_target;
+		thread_data_init(&thread_data[i], 5, area_count / core_count + 1);
+		thread_data[i].render_target = color_buf;
 		thread_data[i].depth_buffer = depth_buf;
 		thread_data[i].target_size = rendertarget_size;
+		for (unsigned int j = 0; j < 5; ++j)
+			thread_data[i].states[j] = &states[j];
+		thread_data[i].area_times = area_times;
+		thread_data[i].trace = trace;
+		thread_data[i].thread_index = i;
 
 		thread_data[i].vert_bufs[0] = &final_vert_buf[0];
 		thread_data[i].uv_bufs[0] = &uv[0];
+		thread_data[i].attribute_bufs[0] = NULL;
+		thread_data[i].attribute_counts[0] = 0;
 		thread_data[i].ind_bufs[0] = &ind_buf[0];
 		thread_data[i].ind_counts[0] = ind_buf_size;
 		thread_data[i].textures[0] = &texture_data[0];
@@ -170,6 +314,8 @@ void main(struct api_info *api_info, struct renderer_info *renderer_info)
 
 		thread_data[i].vert_bufs[1] = &final_vert_buf2[0];
 		thread_data[i].uv_bufs[1] = &uv[0];
+		thread_data[i].attribute_bufs[1] = &color_attributes[0];
+		thread_data[i].attribute_counts[1] = 4;
 		thread_data[i].ind_bufs[1] = &ind_buf[0];
 		thread_data[i].ind_counts[1] = ind_buf_size;
 		thread_data[i].textures[1] = &texture_data[0];
@@ -177,6 +323,8 @@ void main(struct api_info *api_info, struct renderer_info *renderer_info)
 
 		thread_data[i].vert_bufs[2] = &final_vert_buf_large[0];
 		thread_data[i].uv_bufs[2] = &uv_large[0];
+		thread_data[i].attribute_bufs[2] = NULL;
+		thread_data[i].attribute_counts[2] = 0;
 		thread_data[i].ind_bufs[2] = &ind_buf_large[0];
 		thread_data[i].ind_counts[2] = ind_buf_large_size;
 		thread_data[i].textures[2] = &texture_data[0];
@@ -184,6 +332,8 @@ void main(struct api_info *api_info, struct renderer_info *renderer_info)
 
 		thread_data[i].vert_bufs[3] = &final_vert_buf_large2[0];
 		thread_data[i].uv_bufs[3] = &uv_large[0];
+		thread_data[i].attribute_bufs[3] = NULL;
+		thread_data[i].attribute_counts[3] = 0;
 		thread_data[i].ind_bufs[3] = &ind_buf_large[0];
 		thread_data[i].ind_counts[3] = ind_buf_large_size;
 		thread_data[i].textures[3] = &texture_data[0];
@@ -191,6 +341,8 @@ void main(struct api_info *api_info, struct renderer_info *renderer_info)
 
 		thread_data[i].vert_bufs[4] = &final_vert_buf_large3[0];
 		thread_data[i].uv_bufs[4] = &uv_large[0];
+		thread_data[i].attribute_bufs[4] = NULL;
+		thread_data[i].attribute_counts[4] = 0;
 		thread_data[i].ind_bufs[4] = &ind_buf_large[0];
 		thread_data[i].ind_counts[4] = ind_buf_large_size;
 		thread_data[i].textures[4] = &texture_data[0];
@@ -204,7 +356,29 @@ void main(struct api_info *api_info, struct renderer_info *renderer_info)
 	{
 		if (stabilizing_delay > 0)
 			--stabilizing_delay;
-		
+
+		if (trace)
+		{
+			/* The threads are idle, events from the stabilizing frames are dropped */
+			if (stabilizing_delay > 0)
+				trace_reset(trace);
+
+			/* The previous frame was blitted by the event loop */
+			uint64_t blit_start;
+			uint64_t blit_end;
+			get_blit_time(renderer_info, &blit_start, &blit_end);
+			if (blit_end != traced_blit_end)
+			{
+				trace_record(trace, trace_main_thread, "blit", -1, blit_start, blit_end);
+				traced_blit_end = blit_end;
+			}
+		}
+
+		const uint64_t clear_start = get_time();
+#ifdef USE_MSAA
+		for (int i = 0; i < depth_buf_size.x * depth_buf_size.y; ++i)
+			color_buf[i] = 0xFF0000;
+#else
 		if (rasterizer_uses_simd())
 		{
 			if (rasterizer_uses_tiles())
@@ -220,6 +394,9 @@ void main(struct api_info *api_info, struct renderer_info *renderer_info)
 		}
 		else
 			renderer_clear_backbuffer(renderer_info, 0xFF0000);
+#endif
+		if (trace)
+			trace_record(trace, trace_main_thread, "clear", -1, clear_start, get_time());
 
 		float dt = (float)frame_time_mus / 1000000.0f;
 
@@ -245,34 +422,71 @@ void main(struct api_info *api_info, struct renderer_info *renderer_info)
 
 		transform_vertices(&(vert_buf_large[0]), &(final_vert_buf_large3[0]), sizeof(vert_buf_large) / sizeof(vert_buf_large[0]), &trans_mat_large3, &rot_mat, &camera_projection);
 
-		if (rasterizer_uses_tiles())
-			rasterizer_clear_depth_buffer(depth_buf, &padded_size);
-		else
-			rasterizer_clear_depth_buffer(depth_buf, &rendertarget_size);
+#ifdef USE_SHADOWS
+		/* Light space */
+		rot_mat = mat34_get_rotation_y(DEG_TO_RAD(40.0f));
+		transform_vertices(&(vert_buf[0]), &(light_vert_buf[0]), sizeof(vert_buf) / sizeof(vert_buf[0]), &trans_mat, &rot_mat, &light_projection);
+
+		rot_mat = mat34_get_rotation_y(DEG_TO_RAD(38.0f));
+		transform_vertices(&(vert_buf[0]), &(light_vert_buf2[0]), sizeof(vert_buf) / sizeof(vert_buf[0]), &trans_mat2, &rot_mat, &light_projection);
+
+		rot_mat = mat34_get_rotation_y(DEG_TO_RAD(30.0f));
+		transform_vertices(&(vert_buf_large[0]), &(light_vert_buf_large[0]), sizeof(vert_buf_large) / sizeof(vert_buf_large[0]), &trans_mat_large, &rot_mat, &light_projection);
+
+		rot_mat = mat34_get_rotation_y(DEG_TO_RAD(-45.0f));
+		transform_vertices(&(vert_buf_large[0]), &(light_vert_buf_large2[0]), sizeof(vert_buf_large) / sizeof(vert_buf_large[0]), &trans_mat_large2, &rot_mat, &light_projection);
+
+		transform_vertices(&(vert_buf_large[0]), &(light_vert_buf_large3[0]), sizeof(vert_buf_large) / sizeof(vert_buf_large[0]), &trans_mat_large3, &rot_mat, &light_projection);
+#endif
+
+		const uint64_t depth_clear_start = get_time();
+		rasterizer_clear_depth_buffer(depth_buf, &depth_buf_size);
+		if (trace)
+			trace_record(trace, trace_main_thread, "depth clear", -1, depth_clear_start, get_time());
 
 		uint64_t raster_duration = get_time();
+#ifdef USE_SHADOWS
+		/* The shadow map has to be complete before the main pass */
+		render_shadow_map(shadow_map, &shadow_map_size, &light_vert_bufs[0], &shadow_ind_bufs[0], &shadow_ind_counts[0], 5);
+		if (trace)
+			trace_record(trace, trace_main_thread, "shadow map", -1, raster_duration, get_time());
+#endif
 #ifdef USE_THREADING
 		for (unsigned int i = 0; i < core_count; ++i)
 			thread_set_task(threads[i], &rasterize_thread, &thread_data[i]);
 
 		for (unsigned int i = 0; i < core_count; ++i)
 			thread_wait_for_task(threads[i]);
+
+		/* The threads are idle so their recorded area times can be merged, the ones from the stabilizing frames are dropped */
+		if (area_times)
+		{
+			if (stabilizing_delay == 0)
+				histogram_merge(area_times);
+			else
+				histogram_reset(area_times);
+		}
 #else
 		const struct vec2_int area_min = { .x = 0, .y = 0 };
 		struct vec2_int area_max;
 		area_max.x = rendertarget_size.x - 1;
 		area_max.y = rendertarget_size.y - 1;
-		rasterizer_rasterize(render_target, depth_buf, &rendertarget_size, &area_min, &area_max, &final_vert_buf[0], &uv[0], &ind_buf[0], ind_buf_size, texture_data, texture_size);
-		rasterizer_rasterize(render_target, depth_buf, &rendertarget_size, &area_min, &area_max, &final_vert_buf2[0], &uv[0], &ind_buf[0], ind_buf_size, texture_data, texture_size);
-		rasterizer_rasterize(render_target, depth_buf, &rendertarget_size, &area_min, &area_max, &final_vert_buf_large[0], &uv_large[0], &ind_buf_large[0], ind_buf_large_size, texture_data, texture_size);
-		rasterizer_rasterize(render_target, depth_buf, &rendertarget_size, &area_min, &area_max, &final_vert_buf_large2[0], &uv_large[0], &ind_buf_large[0], ind_buf_large_size, texture_data, texture_size);
-		rasterizer_rasterize(render_target, depth_buf, &rendertarget_size, &area_min, &area_max, &final_vert_buf_large3[0], &uv_large[0], &ind_buf_large[0], ind_buf_large_size, texture_data, texture_size);
+		rasterizer_rasterize(color_buf, depth_buf, &rendertarget_size, &area_min, &area_max, &final_vert_buf[0], &uv[0], NULL, 0, &ind_buf[0], ind_buf_size, texture_data, texture_size, &states[0]);
+		rasterizer_rasterize(color_buf, depth_buf, &rendertarget_size, &area_min, &area_max, &final_vert_buf2[0], &uv[0], &color_attributes[0], 4, &ind_buf[0], ind_buf_size, texture_data, texture_size, &states[1]);
+		rasterizer_rasterize(color_buf, depth_buf, &rendertarget_size, &area_min, &area_max, &final_vert_buf_large[0], &uv_large[0], NULL, 0, &ind_buf_large[0], ind_buf_large_size, texture_data, texture_size, &states[2]);
+		rasterizer_rasterize(color_buf, depth_buf, &rendertarget_size, &area_min, &area_max, &final_vert_buf_large2[0], &uv_large[0], NULL, 0, &ind_buf_large[0], ind_buf_large_size, texture_data, texture_size, &states[3]);
+		rasterizer_rasterize(color_buf, depth_buf, &rendertarget_size, &area_min, &area_max, &final_vert_buf_large3[0], &uv_large[0], NULL, 0, &ind_buf_large[0], ind_buf_large_size, texture_data, texture_size, &states[4]);
+#endif
+#ifdef USE_MSAA
+		const struct vec2_int resolve_size = { .x = depth_buf_size.x / RASTERIZER_MSAA_SAMPLES, .y = depth_buf_size.y };
+		rasterizer_resolve(render_target, color_buf, &resolve_size);
 #endif
 		raster_duration = get_time() - raster_duration;
 
 		if (rasterizer_uses_simd())
 		{
 			/* Deswizzle the backbuffer here */
+			const uint64_t deswizzle_start = get_time();
 			uint32_t *bb = get_backbuffer(renderer_info);
 			if (rasterizer_uses_tiles())
 			{
@@ -320,12 +534,26 @@ void main(struct api_info *api_info, struct renderer_info *renderer_info)
 					}
 				}
 			}
+			if (trace)
+				trace_record(trace, trace_main_thread, "deswizzle", -1, deswizzle_start, get_time());
+		}
+
+		/* The timeline of the profiling run is written once when it completes, the threads are idle here */
+		if (trace && stats && stats_profiling_run_complete(stats))
+		{
+			if (!trace_write_json(trace, "trace.json"))
+				error_popup("Failed to write trace.json", false);
+			trace_recorder_destroy(&trace);
+#ifdef USE_THREADING
+			for (unsigned int i = 0; i < core_count; ++i)
+				thread_data[i].trace = NULL;
+#endif
 		}
 
 		/* Stat rendering should be easy to disable/modify.
 		 * Maybe a bit field for what should be shown, uint32_t would be easily enough. */
-		if (stats && font && stats_profiling_run_complete(stats))
-			render_stats(stats, font, get_backbuffer(renderer_info), &rendertarget_size);
+		if (stats && font && stat_texts_ok && stats_profiling_run_complete(stats))
+			render_stats(stats, area_times, &stat_texts, font, get_backbuffer(renderer_info), &rendertarget_size);
 
 		finish_drawing(api_info);
 
@@ -357,9 +585,23 @@ void main(struct api_info *api_info, struct renderer_info *renderer_info)
 		free(render_target);
 	
 	free(depth_buf);
+#ifdef USE_MSAA
+	free(color_buf);
+#endif
+#ifdef USE_SHADOWS
+	free(shadow_map);
+#endif
 
 	if (stats)
 		stats_destroy(&stats);
+
+	stat_texts_deinit(&stat_texts);
+
+	if (area_times)
+		histogram_recorder_destroy(&area_times);
+
+	if (trace)
+		trace_recorder_destroy(&trace);
 	
 	if (font)
 		font_destroy(&font);
@@ -400,93 +642,81 @@ void handle_input(struct api_info *api_info, float dt, struct vec3_float *camera
 		camera_trans->z -= camera_speed * dt;
 }
 
-void create_box_buffers(struct vec3_float *out_vert_buf, struct vec2_float *out_uv_buf, unsigned int *out_ind_buf)
+/* Halves the brightness of every other pixel row */
+void scanline_shader(struct rasterizer_quad_packet *packet, const void *data)
 {
-	assert(out_vert_buf && "create_box_buffers: out_vert_buf is NULL");
-	assert(out_uv_buf && "create_box_buffers: out_uv_buf is NULL");
-	assert(out_ind_buf && "create_box_buffers: out_ind_buf is NULL");
-
-	out_vert_buf[0].x = -2.0f;  out_vert_buf[0].y = 2.0f;   out_vert_buf[0].z = 2.0f; 
-	out_vert_buf[1].x = -2.0f;  out_vert_buf[1].y = -2.0f;  out_vert_buf[1].z = 2.0f;
-	out_vert_buf[2].x = -2.0f;  out_vert_buf[2].y = 2.0f;   out_vert_buf[2].z = 2.0f;
-	out_vert_buf[3].x = -2.0f;  out_vert_buf[3].y = 2.0f;   out_vert_buf[3].z = -2.0f;
-	out_vert_buf[4].x = -2.0f;  out_vert_buf[4].y = -2.0f;  out_vert_buf[4].z = -2.0f;
-	out_vert_buf[5].x = -2.0f;  out_vert_buf[5].y = -2.0f;  out_vert_buf[5].z = 2.0f;
-	out_vert_buf[6].x = 2.0f;   out_vert_buf[6].y = 2.0f;   out_vert_buf[6].z = 2.0f;
-	out_vert_buf[7].x = 2.0f;   out_vert_buf[7].y = 2.0f;   out_vert_buf[7].z = -2.0f;
-	out_vert_buf[8].x = 2.0f;   out_vert_buf[8].y = -2.0f;  out_vert_buf[8].z = -2.0f;
-	out_vert_buf[9].x = 2.0f;   out_vert_buf[9].y = -2.0f;  out_vert_buf[9].z = 2.0f;
-	out_vert_buf[10].x = 2.0f;  out_vert_buf[10].y = 2.0f;  out_vert_buf[10].z = 2.0f;
-	out_vert_buf[11].x = 2.0f;  out_vert_buf[11].y = -2.0f; out_vert_buf[11].z = 2.0f;
-	out_vert_buf[12].x = -2.0f; out_vert_buf[12].y = 2.0f;  out_vert_buf[12].z = 2.0f;
-	out_vert_buf[13].x = -2.0f; out_vert_buf[13].y = -2.0f; out_vert_buf[13].z = 2.0f;
-
-	out_uv_buf[0].x = 0.0f; out_uv_buf[0].y = 0.33f;
-	out_uv_buf[1].x = 0.0f; out_uv_buf[1].y = 0.66f;
-	out_uv_buf[2].x = 0.25f; out_uv_buf[2].y = 0.0f;
-	out_uv_buf[3].x = 0.25f; out_uv_buf[3].y = 0.33f;
-	out_uv_buf[4].x = 0.25f; out_uv_buf[4].y = 0.66f;
-	out_uv_buf[5].x = 0.25f; out_uv_buf[5].y = 1.0f;
-	out_uv_buf[6].x = 0.5f; out_uv_buf[6].y = 0.0f;
-	out_uv_buf[7].x = 0.5f; out_uv_buf[7].y = 0.33f;
-	out_uv_buf[8].x = 0.5f; out_uv_buf[8].y = 0.66f;
-	out_uv_buf[9].x = 0.5f; out_uv_buf[9].y = 1.0f;
-	out_uv_buf[10].x = 0.75f; out_uv_buf[10].y = 0.33f;
-	out_uv_buf[11].x = 0.75f; out_uv_buf[11].y = 0.66f;
-	out_uv_buf[12].x = 1.0f; out_uv_buf[12].y = 0.33f;
-	out_uv_buf[13].x = 1.0f; out_uv_buf[13].y = 0.66f;
-
-	/* front */
-	out_ind_buf[0] = 3; out_ind_buf[1] =  4; out_ind_buf[2] = 7;
-	out_ind_buf[3] = 7; out_ind_buf[4] =  4; out_ind_buf[5] = 8; 
-	/* top */
-	out_ind_buf[6] = 2; out_ind_buf[7] = 3; out_ind_buf[8] = 6;
-	out_ind_buf[9] = 6; out_ind_buf[10] = 3; out_ind_buf[11] = 7;
-	/* bottom */
-	out_ind_buf[12] = 4; out_ind_buf[13] = 5; out_ind_buf[14] = 8;
-	out_ind_buf[15] = 8; out_ind_buf[16] = 5; out_ind_buf[17] = 9;
-	/* left */
-	out_ind_buf[18] = 0; out_ind_buf[19] = 1; out_ind_buf[20] = 3;
-	out_ind_buf[21] = 3; out_ind_buf[22] = 1; out_ind_buf[23] = 4;
-	/* right */
-	out_ind_buf[24] = 7; out_ind_buf[25] = 8; out_ind_buf[26] = 10;
-	out_ind_buf[27] = 10; out_ind_buf[28] = 8; out_ind_buf[29] = 11;
-	/* back */
-	out_ind_buf[30] = 10; out_ind_buf[31] = 11; out_ind_buf[32] = 12;
-	out_ind_buf[33] = 12; out_ind_buf[34] = 11; out_ind_buf[35] = 13;
+	assert(packet && "scanline_shader: packet is NULL");
+	(void)data;
+
+	for (uint32_t quad = 0; quad < packet->quad_count; ++quad)
+	{
+		/* The top pixels of a quad are on the next row */
+		for (uint32_t pixel = 0; pixel < 4; ++pixel)
+		{
+			if (((packet->y[quad] + (pixel >> 1)) & 1) != 0)
+			{
+				const uint32_t color = packet->colors[quad * 4 + pixel];
+				packet->colors[quad * 4 + pixel] = (color & 0xFF000000) | ((color >> 1) & 0x007F7F7F);
+			}
+		}
+	}
 }
 
-/* Generates something horrible, but I just need a bit larger vert buffer for testing */
-void generate_large_test_buffers(const struct vec3_float *vert_buf_box, const struct vec2_float *uv_box, const unsigned int *ind_buf_box,
-                                 struct vec3_float *out_vert_buf, struct vec2_float *out_uv, unsigned int *out_ind_buf, const struct vec3_float *box_offsets, const unsigned int box_count_out)
+bool stat_texts_init(struct stat_texts *texts)
 {
-	assert(vert_buf_box && "generate_large_test_buffers: vert_buf_box is NULL");
-	assert(uv_box && "generate_large_test_buffers: uv_box is NULL");
-	assert(ind_buf_box && "generate_large_test_buffers: ind_buf_box is NULL");
-	assert(out_vert_buf && "generate_large_test_buffers: out_vert_buf is NULL");
-	assert(out_uv && "generate_large_test_buffers: out_uv is NULL");
-	assert(out_ind_buf && "generate_large_test_buffers: out_ind_buf is NULL");
-	assert(box_offsets && "generate_large_test_buffers: box_offsets is NULL");
-
-	struct matrix_3x4 trans_mat;
-	
-	for (unsigned int box = 0; box < box_count_out; ++box)
+	assert(texts && "stat_texts_init: texts is NULL");
+
+	bool success = true;
+	for (unsigned int i = 0; i < STAT_COLUMN_COUNT; ++i)
 	{
-		trans_mat = mat34_get_translation(&(box_offsets[box]));
-		for (unsigned int i = 0; i < VERTS_IN_BOX; ++i)
+		texts->column_names[i] = font_layout_create();
+		success = success && texts->column_names[i];
+	}
+
+	for (unsigned int i = 0; i < STAT_ROW_COUNT; ++i)
+	{
+		texts->stat_names[i] = font_layout_create();
+		success = success && texts->stat_names[i];
+		for (unsigned int j = 0; j < STAT_COLUMN_COUNT; ++j)
 		{
-			unsigned int vert_ind = box * VERTS_IN_BOX + i;
-			out_vert_buf[vert_ind] = mat34_mul_vec3(&trans_mat, &(vert_buf_box[i]));
-			out_uv[vert_ind] = uv_box[i];
+			texts->values[i][j] = font_layout_create();
+			success = success && texts->values[i][j];
 		}
-		for (unsigned int i = 0; i < 36; ++i)
+	}
+
+	return success;
+}
+
+void stat_texts_deinit(struct stat_texts *texts)
+{
+	assert(texts && "stat_texts_deinit: texts is NULL");
+
+	for (unsigned int i = 0; i < STAT_COLUMN_COUNT; ++i)
+	{
+		if (texts->column_names[i])
+			font_layout_destroy(&(texts->column_names[i]));
+	}
+
+	for (unsigned int i = 0; i < STAT_ROW_COUNT; ++i)
+	{
+		if (texts->stat_names[i])
+			font_layout_destroy(&(texts->stat_names[i]));
+		for (unsigned int j = 0; j < STAT_COLUMN_COUNT; ++j)
 		{
-			out_ind_buf[box * 36 + i] = ind_buf_box[i] + box * VERTS_IN_BOX;
+			if (texts->values[i][j])
+				font_layout_destroy(&(texts->values[i][j]));
 		}
 	}
 }
 
-void render_stats(struct stats *stats, struct font *font, void *render_target, struct vec2_int *target_size)
+/* Lays the text out only if it differs from what the layout already has */
+void render_cached_text(struct font_layout *layout, struct font *font, void *render_target, struct vec2_int *target_size, const char *text, const struct vec2_int *pos)
+{
+	font_layout_set_text(layout, font, text);
+	font_render_layout(render_target, target_size, layout, pos, 0);
+}
+
+void render_stats(struct stats *stats, const struct histogram_recorder *area_times, struct stat_texts *texts, struct font *font, void *render_target, struct vec2_int *target_size)
 {
 #define STAT_COLUMN_X 5
 #define FIRST_VAL_COLUMN_X 100
@@ -495,6 +725,7 @@ void render_stats(struct stats *stats, struct font *font, void *render_target, s
 #define ROW_Y_INCREMENT 20
 
 	assert(stats && "render_stats: stats is NULL");
+	assert(texts && "render_stats: texts is NULL");
 	assert(font && "render_stats: font is NULL");
 	assert(render_target && "render_stats: render_target is NULL");
 	assert(target_size && "render_stats: target_size is NULL");
@@ -502,6 +733,12 @@ void render_stats(struct stats *stats, struct font *font, void *render_target, s
 	if (!stats)
 		return;
 
+	/* Translucent backdrop so the stats stay readable, the backbuffer rows go from bottom to top */
+	const int row_count = area_times ? STAT_ROW_COUNT + 1 : STAT_COUNT + 1;
+	const struct vec2_int backdrop_min = { .x = 0, .y = target_size->y - (INFO_ROW_Y * 2 + ROW_Y_INCREMENT * row_count) };
+	const struct vec2_int backdrop_max = { .x = FIRST_VAL_COLUMN_X + COLUMN_X_INCREMENT * 5, .y = target_size->y - 1 };
+	blend_solid_rect(render_target, target_size, &backdrop_min, &backdrop_max, 0x00FFFFFF, 160);
+
 	const struct vec2_int pos_avarage = { .x = FIRST_VAL_COLUMN_X, .y = INFO_ROW_Y };
 	const struct vec2_int pos_median = { .x = FIRST_VAL_COLUMN_X + COLUMN_X_INCREMENT, .y = INFO_ROW_Y };
 	const struct vec2_int pos_percentile_90 = { .x = FIRST_VAL_COLUMN_X + COLUMN_X_INCREMENT * 2, .y = INFO_ROW_Y };
@@ -509,18 +746,25 @@ void render_stats(struct stats *stats, struct font *font, void *render_target, s
 	const struct vec2_int pos_percentile_99 = { .x = FIRST_VAL_COLUMN_X + COLUMN_X_INCREMENT * 4, .y = INFO_ROW_Y };
 
 	/* Info line */
-	font_render_text(render_target, target_size, font, "avg", &pos_avarage, 0);
-	font_render_text(render_target, target_size, font, "mdn", &pos_median, 0);
-	font_render_text(render_target, target_size, font, "90%", &pos_percentile_90, 0);
-	font_render_text(render_target, target_size, font, "95%", &pos_percentile_95, 0);
-	font_render_text(render_target, target_size, font, "99%", &pos_percentile_99, 0);
+	render_cached_text(texts->column_names[0], font, render_target, target_size, "avg", &pos_avarage);
+	render_cached_text(texts->column_names[1], font, render_target, target_size, "mdn", &pos_median);
+	render_cached_text(texts->column_names[2], font, render_target, target_size, "90%", &pos_percentile_90);
+	render_cached_text(texts->column_names[3], font, render_target, target_size, "95%", &pos_percentile_95);
+	render_cached_text(texts->column_names[4], font, render_target, target_size, "99%", &pos_percentile_99);
 
 	/* Frame time */
-	render_stat_line_ms(stats, font, render_target, target_size, "frame (ms):", STAT_FRAME, INFO_ROW_Y + ROW_Y_INCREMENT, STAT_COLUMN_X, FIRST_VAL_COLUMN_X, COLUMN_X_INCREMENT);
+	render_stat_line_ms(stats, texts, font, render_target, target_size, "frame (ms):", STAT_FRAME, INFO_ROW_Y + ROW_Y_INCREMENT, STAT_COLUMN_X, FIRST_VAL_COLUMN_X, COLUMN_X_INCREMENT);
 	/* Rasterize */
-	render_stat_line_ms(stats, font, render_target, target_size, "rast (ms):", STAT_RASTER, INFO_ROW_Y + ROW_Y_INCREMENT * 2, STAT_COLUMN_X, FIRST_VAL_COLUMN_X, COLUMN_X_INCREMENT);
+	render_stat_line_ms(stats, texts, font, render_target, target_size, "rast (ms):", STAT_RASTER, INFO_ROW_Y + ROW_Y_INCREMENT * 2, STAT_COLUMN_X, FIRST_VAL_COLUMN_X, COLUMN_X_INCREMENT);
 	/* Blit*/
-	render_stat_line_mus(stats, font, render_target, target_size, "blit (mus):", STAT_BLIT, INFO_ROW_Y + ROW_Y_INCREMENT * 3, STAT_COLUMN_X, FIRST_VAL_COLUMN_X, COLUMN_X_INCREMENT);
+	render_stat_line_mus(stats, texts, font, render_target, target_size, "blit (mus):", STAT_BLIT, INFO_ROW_Y + ROW_Y_INCREMENT * 3, STAT_COLUMN_X, FIRST_VAL_COLUMN_X, COLUMN_X_INCREMENT);
+	/* Raster areas of all the threads */
+	if (area_times)
+		render_histogram_line_mus(area_times, texts, font, render_target, target_size, "area (mus):", STAT_ROW_AREA_TIMES, INFO_ROW_Y + ROW_Y_INCREMENT * 4, STAT_COLUMN_X, FIRST_VAL_COLUMN_X, COLUMN_X_INCREMENT);
+
+	/* Outlined title under the backdrop, scaled from the distance fields */
+	const struct vec2_int pos_title = { .x = STAT_COLUMN_X, .y = INFO_ROW_Y * 2 + ROW_Y_INCREMENT * row_count };
+	font_render_text_sdf(render_target, target_size, font, "profiling run complete", &pos_title, 28.0f, 0x00FFFFFF, 1.5f, 0);
 
 #undef STAT_COLUMN_X
 #undef FIRST_VAL_COLUMN_X
@@ -529,10 +773,11 @@ void render_stats(struct stats *stats, struct font *font, void *render_target, s
 #undef ROW_Y_INCREMENT
 }
 
-void render_stat_line_ms(struct stats *stats, struct font *font, void *render_target, struct vec2_int *target_size,
+void render_stat_line_ms(struct stats *stats, struct stat_texts *texts, struct font *font, void *render_target, struct vec2_int *target_size,
                          const char *stat_name, const unsigned char stat_id, const int row_y, const int stat_name_x, const int first_val_x, const int x_increment)
 {
 	assert(stats && "render_stat_line_ms: stats is NULL");
+	assert(texts && "render_stat_line_ms: texts is NULL");
 	assert(font && "render_stat_line_ms: font is NULL");
 	assert(render_target && "render_stat_line_ms: render_target is NULL");
 	assert(target_size && "render_stat_line_ms: target_size is NULL");
@@ -543,35 +788,36 @@ void render_stat_line_ms(struct stats *stats, struct font *font, void *render_ta
 	pos.y = row_y;
 
 	/* Render stat name*/
-	font_render_text(render_target, target_size, font, stat_name, &pos, 0);
+	render_cached_text(texts->stat_names[stat_id], font, render_target, target_size, stat_name, &pos);
 
 	char str[10];
 	/* Avarage */
 	pos.x = first_val_x;
 	if (!float_to_string((float)stats_get_avarage(stats, stat_id) / 1000.0f, str, 10)) { /* The value has been truncated, do something?? */ }
-	font_render_text(render_target, target_size, font, str, &pos, 0);
+	render_cached_text(texts->values[stat_id][0], font, render_target, target_size, str, &pos);
 	/* Median */
 	pos.x += x_increment;
 	if (!float_to_string((float)stats_get_stat_percentile(stats, stat_id, 50.0f) / 1000.0f, str, 10)) { /* The value has been truncated, do something?? */ }
-	font_render_text(render_target, target_size, font, str, &pos, 0);
+	render_cached_text(texts->values[stat_id][1], font, render_target, target_size, str, &pos);
 	/* 90th percentile */
 	pos.x += x_increment;
 	if (!float_to_string((float)stats_get_stat_percentile(stats, stat_id, 90.0f) / 1000.0f, str, 10)) { /* The value has been truncated, do something?? */ }
-	font_render_text(render_target, target_size, font, str, &pos, 0);
+	render_cached_text(texts->values[stat_id][2], font, render_target, target_size, str, &pos);
 	/* 95th percentile */
 	pos.x += x_increment;
 	if (!float_to_string((float)stats_get_stat_percentile(stats, stat_id, 95.0f) / 1000.0f, str, 10)) { /* The value has been truncated, do something?? */ }
-	font_render_text(render_target, target_size, font, str, &pos, 0);
+	render_cached_text(texts->values[stat_id][3], font, render_target, target_size, str, &pos);
 	/* 99th percentile */
 	pos.x += x_increment;
 	if (!float_to_string((float)stats_get_stat_percentile(stats, stat_id, 99.0f) / 1000.0f, str, 10)) { /* The value has been truncated, do something?? */ }
-	font_render_text(render_target, target_size, font, str, &pos, 0);
+	render_cached_text(texts->values[stat_id][4], font, render_target, target_size, str, &pos);
 }
 
-void render_stat_line_mus(struct stats *stats, struct font *font, void *render_target, struct vec2_int *target_size,
+void render_stat_line_mus(struct stats *stats, struct stat_texts *texts, struct font *font, void *render_target, struct vec2_int *target_size,
                           const char *stat_name, const unsigned char stat_id, const int row_y, const int stat_name_x, const int first_val_x, const int x_increment)
 {
 	assert(stats && "render_stat_line_mus: stats is NULL");
+	assert(texts && "render_stat_line_mus: texts is NULL");
 	assert(font && "render_stat_line_mus: font is NULL");
 	assert(render_target && "render_stat_line_mus: render_target is NULL");
 	assert(target_size && "render_stat_line_mus: target_size is NULL");
@@ -582,30 +828,62 @@ void render_stat_line_mus(struct stats *stats, struct font *font, void *render_t
 	pos.y = row_y;
 
 	/* Render stat name*/
-	font_render_text(render_target, target_size, font, stat_name, &pos, 0);
+	render_cached_text(texts->stat_names[stat_id], font, render_target, target_size, stat_name, &pos);
 
 	char str[10];
 
 	/* Avarage */
 	pos.x = first_val_x;
 	if (uint64_to_string((uint64_t)stats_get_avarage(stats, stat_id), str, 10))
-		font_render_text(render_target, target_size, font, str, &pos, 0);
+		render_cached_text(texts->values[stat_id][0], font, render_target, target_size, str, &pos);
 	/* Median */
 	pos.x += x_increment;
 	if (uint64_to_string((uint64_t)stats_get_stat_percentile(stats, stat_id, 50.0f), str, 10))
-		font_render_text(render_target, target_size, font, str, &pos, 0);
+		render_cached_text(texts->values[stat_id][1], font, render_target, target_size, str, &pos);
 	/* 90th percentile */
 	pos.x += x_increment;
 	if (uint64_to_string((uint64_t)stats_get_stat_percentile(stats, stat_id, 90.0f), str, 10))
-		font_render_text(render_target, target_size, font, str, &pos, 0);
+		render_cached_text(texts->values[stat_id][2], font, render_target, target_size, str, &pos);
 	/* 95th percentile */
 	pos.x += x_increment;
 	if (uint64_to_string((uint64_t)stats_get_stat_percentile(stats, stat_id, 95.0f), str, 10))
-		font_render_text(render_target, target_size, font, str, &pos, 0);
+		render_cached_text(texts->values[stat_id][3], font, render_target, target_size, str, &pos);
 	/* 99th percentile */
 	pos.x += x_increment;
 	if (uint64_to_string((uint64_t)stats_get_stat_percentile(stats, stat_id, 99.0f), str, 10))
-		font_render_text(render_target, target_size, font, str, &pos, 0);
+		render_cached_text(texts->values[stat_id][4], font, render_target, target_size, str, &pos);
+}
+
+void render_histogram_line_mus(const struct histogram_recorder *histogram, struct stat_texts *texts, struct font *font, void *render_target, struct vec2_int *target_size,
+                               const char *name, const unsigned int row, const int row_y, const int name_x, const int first_val_x, const int x_increment)
+{
+	assert(histogram && "render_histogram_line_mus: histogram is NULL");
+	assert(texts && "render_histogram_line_mus: texts is NULL");
+	assert(font && "render_histogram_line_mus: font is NULL");
+	assert(render_target && "render_histogram_line_mus: render_target is NULL");
+	assert(target_size && "render_histogram_line_mus: target_size is NULL");
+	assert(name && "render_histogram_line_mus: name is NULL");
+
+	struct vec2_int pos;
+	pos.x = name_x;
+	pos.y = row_y;
+
+	render_cached_text(texts->stat_names[row], font, render_target, target_size, name, &pos);
+
+	const uint32_t values[STAT_COLUMN_COUNT] = {
+		histogram_get_avarage(histogram),
+		histogram_get_percentile(histogram, 50.0f),
+		histogram_get_percentile(histogram, 90.0f),
+		histogram_get_percentile(histogram, 95.0f),
+		histogram_get_percentile(histogram, 99.0f) };
+
+	char str[10];
+	pos.x = first_val_x;
+	for (unsigned int i = 0; i < STAT_COLUMN_COUNT; ++i, pos.x += x_increment)
+	{
+		if (uint64_to_string((uint64_t)values[i], str, 10))
+			render_cached_text(texts->values[row][i], font, render_target, target_size, str, &pos);
+	}
 }
 
 #ifdef USE_THREADING
@@ -614,24 +892,18 @@ void thread_data_init(struct thread_data *data, const uint32_t buffer_count, con
 	assert(data && "thread_data_init: data is NULL");
 
 	data->buffer_count = buffer_count;
-	if (rasterizer_uses_tiles())
-	{
-		data->raster_area_mins = malloc(sizeof(struct vec2_int) * raster_area_count);
-		data->raster_area_maxs = malloc(sizeof(struct vec2_int) * raster_area_count);
-		data->raster_area_count = raster_area_count;
-	}
-	else
-	{
-		data->raster_area_mins = malloc(sizeof(struct vec2_int));
-		data->raster_area_maxs = malloc(sizeof(struct vec2_int));
-		data->raster_area_count = 1;
-	}
+	data->raster_area_mins = malloc(sizeof(struct vec2_int) * raster_area_count);
+	data->raster_area_maxs = malloc(sizeof(struct vec2_int) * raster_area_count);
+	data->raster_area_count = raster_area_count;
 	data->vert_bufs = malloc(sizeof(struct vec4_float *) * buffer_count);
 	data->uv_bufs = malloc(sizeof(struct vec2_float *) * buffer_count);
+	data->attribute_bufs = malloc(sizeof(float *) * buffer_count);
+	data->attribute_counts = malloc(sizeof(uint32_t) * buffer_count);
 	data->ind_bufs = malloc(sizeof(unsigned int *) * buffer_count);
 	data->ind_counts = malloc(sizeof(unsigned int) * buffer_count);
 	data->textures = malloc(sizeof(uint32_t *) * buffer_count);
 	data->texture_sizes = malloc(sizeof(struct vec2_int *) * buffer_count);
+	data->states = malloc(sizeof(struct rasterizer_state *) * buffer_count);
 }
 
 void thread_data_deinit(struct thread_data *data)
@@ -642,10 +914,36 @@ void thread_data_deinit(struct thread_data *data)
 	free(data->raster_area_maxs);
 	free(data->vert_bufs);
 	free(data->uv_bufs);
+	free(data->attribute_bufs);
+	free(data->attribute_counts);
 	free(data->ind_bufs);
 	free(data->ind_counts);
 	free(data->textures);
 	free(data->texture_sizes);
+	free(data->states);
+}
+
+/* Tiles when tiling, otherwise RASTER_AREA_SIZE areas. Returns the area size and the size of the split render target. */
+int get_raster_area_split(const struct vec2_int *backbuffer_size, struct vec2_int *out_split_size)
+{
+	assert(backbuffer_size && "get_raster_area_split: backbuffer_size is NULL");
+	assert(out_split_size && "get_raster_area_split: out_split_size is NULL");
+
+	if (rasterizer_uses_tiles())
+	{
+		rasterizer_get_padded_size(backbuffer_size, out_split_size);
+		return (int)rasterizer_get_tile_size();
+	}
+
+	*out_split_size = *backbuffer_size;
+	return RASTER_AREA_SIZE;
+}
+
+uint32_t get_raster_area_count(const struct vec2_int *backbuffer_size)
+{
+	struct vec2_int split_size;
+	const int area_size = get_raster_area_split(backbuffer_size, &split_size);
+	return (uint32_t)(((split_size.x + area_size - 1) / area_size) * ((split_size.y + area_size - 1) / area_size));
 }
 
 void thread_data_calculate_areas(struct thread_data *data, const unsigned int core_count, const struct vec2_int *backbuffer_size)
@@ -653,58 +951,37 @@ void thread_data_calculate_areas(struct thread_data *data, const unsigned int co
 	assert(data && "thread_data_calculate_areas: data is NULL");
 	assert(backbuffer_size && "thread_data_calculate_areas: backbuffer_size is NULL");
 
-	if (rasterizer_uses_tiles())
+	/* The areas don't depend on the thread count, interpolated values can differ in the lowest bits between splits.
+	 * Should have proper load balancing for threads.
+	 * For example a task manager which would give a new task to 
+	 * which ever thread got finished first until all tasks were completed.
+	 * Giving all threads tasks from all around the screen in an attempt for even some load balancing. */
+	struct vec2_int split_size;
+	const int area_size = get_raster_area_split(backbuffer_size, &split_size);
+	/* Threads can be left without areas when there are more of them than areas */
+	for (unsigned int i = 0; i < core_count; ++i)
+		data[i].raster_area_count = 0;
+
+	unsigned int current_core = 0;
+	int area_index = 0;
+	for (int y = 0; y < split_size.y; y += area_size)
 	{
-		/* Should have proper load balancing for threads.
-		 * For example a task manager which would give a new task to 
-		 * which ever thread got finished first until all tasks were completed.
-		 * Giving all threads tasks from all around the screen in an attempt for even some load balancing. */
-		int tile_size = rasterizer_get_tile_size();
-		struct vec2_int padded_size;
-		rasterizer_get_padded_size(backbuffer_size, &padded_size);
-		unsigned int current_core = 0;
-		int area_index = 0;
-		for (int y = 0; y < padded_size.y; y += tile_size)
+		for (int x = 0; x < split_size.x; x += area_size)
 		{
-			for (int x = 0; x < padded_size.x; x += tile_size)
+			data[current_core].raster_area_mins[area_index].x = x;
+			data[current_core].raster_area_mins[area_index].y = y;
+			data[current_core].raster_area_maxs[area_index].x = min(x + area_size, split_size.x) - 1;
+			data[current_core].raster_area_maxs[area_index].y = min(y + area_size, split_size.y) - 1;
+			data[current_core].raster_area_count = area_index + 1;
+
+			++current_core;
+			if (current_core >= core_count)
 			{
-				data[current_core].raster_area_mins[area_index].x = x;
-				data[current_core].raster_area_mins[area_index].y = y;
-				data[current_core].raster_area_maxs[area_index].x = x + tile_size - 1;
-				data[current_core].raster_area_maxs[area_index].y = y + tile_size - 1;
-				data[current_core].raster_area_count = area_index + 1;
-
-				++current_core;
-				if (current_core >= core_count)
-				{
-					current_core = 0;
-					++area_index;
-				}
+				current_core = 0;
+				++area_index;
 			}
 		}
 	}
-	else
-	{
-		unsigned int columns = core_count / 2;
-		unsigned int width = backbuffer_size->x / columns;
-		unsigned int i;
-		for (i = 0; i < columns; ++i)
-		{
-			data[i].raster_area_mins[0].x = i * width;
-			data[i].raster_area_maxs[0].x = i == columns - 1 ? backbuffer_size->x - 1 : i * width + width - 1;
-			data[i].raster_area_mins[0].y = 0;
-			data[i].raster_area_maxs[0].y = backbuffer_size->y / 2 - 1;
-		}
-
-		columns = core_count - columns;
-		for (unsigned int j = 0; i < core_count; ++i, ++j)
-		{
-			data[i].raster_area_mins[0].x = j * width;
-			data[i].raster_area_maxs[0].x = i == core_count - 1 ? backbuffer_size->x - 1 : j * width + width - 1;
-			data[i].raster_area_mins[0].y = backbuffer_size->y / 2;
-			data[i].raster_area_maxs[0].y = backbuffer_size->y - 1;
-		}
-	}
 }
 
 void rasterize_thread(void *data)
@@ -712,14 +989,62 @@ void rasterize_thread(void *data)
 	assert(data && "rasterize_thread: data is NULL");
 
 	struct thread_data *td = (struct thread_data *)data;
+	/* Areas belong to a single thread and the draws are done in order for each area,
+	 * with the fixed areas of thread_data_calculate_areas this keeps the image the same no matter how many threads there are. */
+	const uint64_t task_start = get_time();
 	for (unsigned int area = 0; area < td->raster_area_count; ++area)
 	{
+		const uint64_t area_start = get_time();
 		for (unsigned int i = 0; i < td->buffer_count; ++i)
 		{
 			rasterizer_rasterize(td->render_target, td->depth_buffer, &td->target_size, &td->raster_area_mins[area], &td->raster_area_maxs[area],
-				&td->vert_bufs[i][0], &td->uv_bufs[i][0], &td->ind_bufs[i][0], td->ind_counts[i],
-				td->textures[i], td->texture_sizes[i]);
+				&td->vert_bufs[i][0], &td->uv_bufs[i][0], td->attribute_bufs[i], td->attribute_counts[i], &td->ind_bufs[i][0], td->ind_counts[i],
+				td->textures[i], td->texture_sizes[i], td->states[i]);
 		}
+
+		const uint64_t area_end = get_time();
+		if (td->area_times)
+			histogram_record(td->area_times, td->thread_index, (uint32_t)get_time_microseconds(area_end - area_start));
+		if (td->trace)
+			trace_record(td->trace, td->thread_index, "area", (int32_t)area, area_start, area_end);
 	}
+
+	if (td->trace)
+		trace_record(td->trace, td->thread_index, "raster task", -1, task_start, get_time());
 }
-#endif
\ No newline at end of file
+#endif
+
+#ifdef USE_SHADOWS
+void render_shadow_map(uint32_t *shadow_map, const struct vec2_int *map_size, struct vec4_float **vert_bufs, unsigned int **ind_bufs, const unsigned int *ind_counts, const unsigned int buffer_count)
+{
+	assert(shadow_map && "render_shadow_map: shadow_map is NULL");
+	assert(map_size && "render_shadow_map: map_size is NULL");
+	assert(vert_bufs && "render_shadow_map: vert_bufs is NULL");
+	assert(ind_bufs && "render_shadow_map: ind_bufs is NULL");
+	assert(ind_counts && "render_shadow_map: ind_counts is NULL");
+
+	struct vec2_int padded_size;
+	rasterizer_get_padded_size(map_size, &padded_size);
+	rasterizer_clear_depth_buffer(shadow_map, &padded_size);
+
+	/* Depth only */
+	struct rasterizer_state state;
+	rasterizer_state_init(&state);
+	state.color_write = false;
+
+	/* Tiles require tile sized raster areas */
+	const int area_size = rasterizer_uses_tiles() ? (int)rasterizer_get_tile_size() : max(map_size->x, map_size->y);
+	struct vec2_int area_min;
+	struct vec2_int area_max;
+	for (area_min.y = 0; area_min.y < padded_size.y; area_min.y += area_size)
+	{
+		for (area_min.x = 0; area_min.x < padded_size.x; area_min.x += area_size)
+		{
+			area_max.x = min(area_min.x + area_size, padded_size.x) - 1;
+			area_max.y = min(area_min.y + area_size, padded_size.y) - 1;
+			for (unsigned int i = 0; i < buffer_count; ++i)
+				rasterizer_rasterize(NULL, shadow_map, map_size, &area_min, &area_max, vert_bufs[i], NULL, NULL, 0, ind_bufs[i], ind_counts[i], NULL, NULL, &state);
+		}
+	}
+}
+#endif
@@ -8,6 +8,9 @@ struct renderer_info;
 
 void error_popup(const char *msg, const bool kill_program);
 
+/* Headless builds (RPLNN_HEADLESS, console programs like the benchmark) have the standard main
+ * and only the time, string and threading functions, there is no window, renderer or input. */
+#ifndef RPLNN_HEADLESS
 /* This should be defined in main.c and only contain non platform specific code */
 void main(struct api_info *api_info, struct renderer_info *renderer_info);
 
@@ -18,8 +21,11 @@ void finish_drawing(struct api_info *api_info);
 void *get_backbuffer(struct renderer_info *info);
 struct vec2_int get_backbuffer_size(struct renderer_info *info);
 uint32_t get_blit_duration_ms(struct renderer_info *info);
+/* get_time() at the start and the end of the last blit, both are 0 before the first one */
+void get_blit_time(struct renderer_info *info, uint64_t *out_start, uint64_t *out_end);
 
 void renderer_clear_backbuffer(struct renderer_info *info, const uint32_t color);
+#endif
 
 uint64_t get_time(void);
 uint64_t get_time_microseconds(const uint64_t time);
@@ -38,6 +44,7 @@ bool thread_set_task(struct thread *thread, void(*func)(void *), void *data);
 bool thread_has_task(struct thread *thread);
 void thread_wait_for_task(struct thread *thread);
 
+#ifndef RPLNN_HEADLESS
 /* Input */
 bool is_key_down(struct api_info *api_info, enum keycodes keycode);
 
@@ -71,6 +78,7 @@ enum keycodes
 	KEY_Z,
 	KEY_COUNT
 };
+#endif
 
 
 #endif /* RPLNN_OSAL_H */
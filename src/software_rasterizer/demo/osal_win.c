@@ -44,6 +44,7 @@ int c99_snprintf(char *outBuf, size_t size, const char *format, ...)
 }
 #endif
 
+#ifndef RPLNN_HEADLESS
 struct renderer_info
 {
 #if RPLNN_RENDERER == RPLNN_RENDERER_GDI
@@ -51,6 +52,9 @@ struct renderer_info
 	unsigned int width;
 	unsigned int height;
 	uint32_t blit_duration_mus;
+	/* get_time() at the start and the end of the last blit */
+	uint64_t blit_start;
+	uint64_t blit_end;
 	void *buffer;
 #endif
 };
@@ -63,6 +67,7 @@ struct api_info
 	uint32_t key_states[(MAX_KEYCODE + KEY_STATE_TYPE_BITS - 1) / KEY_STATE_TYPE_BITS];
 	struct renderer_info *renderer_info;
 };
+#endif
 
 struct thread
 {
@@ -76,6 +81,17 @@ struct thread
 	bool quit;
 };
 
+#ifdef RPLNN_HEADLESS
+/* Console programs report errors to stderr */
+void error_popup(const char *msg, const bool kill_program)
+{
+	assert(msg && "error_popup: msg is NULL");
+
+	fprintf(stderr, "%s: %s\n", kill_program ? "Fatal Error" : "Error", msg);
+	if (kill_program)
+		ExitProcess(~(UINT)0);
+}
+#else
 LPCWSTR class_name = TEXT("TestClass");
 LPCWSTR window_name = TEXT("Rasterizer");
 static LRESULT CALLBACK WindowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
@@ -218,6 +234,21 @@ uint32_t get_blit_duration_ms(struct renderer_info *info)
 #endif
 }
 
+void get_blit_time(struct renderer_info *info, uint64_t *out_start, uint64_t *out_end)
+{
+	assert(info && "get_blit_time: info is NULL");
+	assert(out_start && "get_blit_time: out_start is NULL");
+	assert(out_end && "get_blit_time: out_end is NULL");
+
+#if RPLNN_RENDERER == RPLNN_RENDERER_GDI
+	*out_start = info->blit_start;
+	*out_end = info->blit_end;
+#else
+	*out_start = 0;
+	*out_end = 0;
+#endif
+}
+
 struct vec2_int get_backbuffer_size(struct renderer_info *info)
 {
 	assert(info && "get_backbuffer_size: info is NULL");
@@ -241,6 +272,7 @@ void renderer_clear_backbuffer(struct renderer_info *info, const uint32_t color)
 		((int*)info->buffer)[i] = color;
 #endif
 }
+#endif
 
 uint64_t get_time(void)
 {
@@ -496,6 +528,7 @@ void thread_wait_for_task(struct thread *thread)
 	}
 }
 
+#ifndef RPLNN_HEADLESS
 static const uint8_t keycode_table[KEY_COUNT] = 
 { 
 	0x41, /* A */
@@ -583,7 +616,9 @@ static LRESULT CALLBACK WindowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lP
 				SRCCOPY);
 
 			EndPaint(hwnd, &ps);
-			renderer_info->blit_duration_mus = (uint32_t)get_time_microseconds(get_time() - blit_start);
+			renderer_info->blit_start = blit_start;
+			renderer_info->blit_end = get_time();
+			renderer_info->blit_duration_mus = (uint32_t)get_time_microseconds(renderer_info->blit_end - blit_start);
 		}
 #endif
 		return 0;
@@ -602,6 +637,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	struct renderer_info renderer_info;
 #if RPLNN_RENDERER == RPLNN_RENDERER_GDI
 	renderer_info.buffer = NULL;
+	renderer_info.blit_start = 0;
+	renderer_info.blit_end = 0;
 #endif
 
 	struct api_info api_info;
@@ -619,5 +656,6 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	return TRUE;
 }
 #pragma warning(pop)
+#endif
 
 #endif
@@ -4,6 +4,31 @@
 
 #include <string.h>
 
+/* Index of the sentinel node, it has a zero size so leaves need no special casing */
+#define STATS_NIL 0
+
+/* Node of an order statistic treap, equal values share a node */
+struct stats_node
+{
+	uint32_t value;
+	/* Number of samples with this value */
+	uint32_t count;
+	/* Number of samples in this subtree */
+	uint32_t size;
+	uint32_t priority;
+	uint32_t left;
+	uint32_t right;
+};
+
+/* Sorted samples of a single stat, nodes come from a fixed pool so updates never allocate */
+struct stats_tree
+{
+	struct stats_node *nodes;
+	uint32_t root;
+	/* Unused nodes are linked through their right child */
+	uint32_t free_list;
+};
+
 struct stats
 {
 	/* When using microseconds uint32_t can store 71 minutes, 
@@ -11,9 +36,12 @@ struct stats
 	 * Could store the time in 1/10 milliseconds or something like,
 	 * it should be ok for any normal frame time but not worth the trouble right now. */
 	uint32_t *stats;
-	/* When ever a stat is updated the value is also added to this sorted array and the old value is removed.
-	 * This allows efficient checking of percentile values. However this doubles memory consumption. */
-	uint32_t *stats_sorted;
+	/* When ever a stat is updated the value is also added to a tree of the stat and the old value is removed.
+	 * Both updates and percentile queries are O(log frames_in_buffer). */
+	struct stats_tree *trees;
+	struct stats_node *nodes;
+	/* State of the xorshift generator used for the node priorities */
+	uint32_t random_state;
 	/* The sum of all the stats, used for fast calculation of avarages. */
 	uint64_t *sums;
 	/* We use the stats array like a circular buffer
@@ -26,14 +54,186 @@ struct stats
 	bool profiling_run;
 };
 
+uint32_t stats_next_priority(struct stats *stats)
+{
+	uint32_t x = stats->random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	stats->random_state = x;
+	return x;
+}
+
+void stats_tree_update_size(struct stats_node *nodes, const uint32_t node)
+{
+	nodes[node].size = nodes[nodes[node].left].size + nodes[nodes[node].right].size + nodes[node].count;
+}
+
+uint32_t stats_tree_rotate_right(struct stats_node *nodes, const uint32_t node)
+{
+	const uint32_t left = nodes[node].left;
+	nodes[node].left = nodes[left].right;
+	nodes[left].right = node;
+	stats_tree_update_size(nodes, node);
+	stats_tree_update_size(nodes, left);
+	return left;
+}
+
+uint32_t stats_tree_rotate_left(struct stats_node *nodes, const uint32_t node)
+{
+	const uint32_t right = nodes[node].right;
+	nodes[node].right = nodes[right].left;
+	nodes[right].left = node;
+	stats_tree_update_size(nodes, node);
+	stats_tree_update_size(nodes, right);
+	return right;
+}
+
+/* Returns the new root of the subtree */
+uint32_t stats_tree_insert(struct stats *stats, struct stats_tree *tree, const uint32_t node, const uint32_t value)
+{
+	struct stats_node *nodes = tree->nodes;
+	if (node == STATS_NIL)
+	{
+		const uint32_t new_node = tree->free_list;
+		assert(new_node != STATS_NIL && "stats_tree_insert: node pool is empty");
+		tree->free_list = nodes[new_node].right;
+		nodes[new_node].value = value;
+		nodes[new_node].count = 1;
+		nodes[new_node].size = 1;
+		nodes[new_node].priority = stats_next_priority(stats);
+		nodes[new_node].left = STATS_NIL;
+		nodes[new_node].right = STATS_NIL;
+		return new_node;
+	}
+
+	uint32_t root = node;
+	if (value < nodes[node].value)
+	{
+		nodes[node].left = stats_tree_insert(stats, tree, nodes[node].left, value);
+		if (nodes[nodes[node].left].priority > nodes[node].priority)
+			root = stats_tree_rotate_right(nodes, node);
+	}
+	else if (value > nodes[node].value)
+	{
+		nodes[node].right = stats_tree_insert(stats, tree, nodes[node].right, value);
+		if (nodes[nodes[node].right].priority > nodes[node].priority)
+			root = stats_tree_rotate_left(nodes, node);
+	}
+	else
+	{
+		++(nodes[node].count);
+	}
+
+	stats_tree_update_size(nodes, node);
+	if (root != node)
+		stats_tree_update_size(nodes, root);
+	return root;
+}
+
+/* Returns the new root of the subtree */
+uint32_t stats_tree_remove(struct stats_tree *tree, const uint32_t node, const uint32_t value)
+{
+	struct stats_node *nodes = tree->nodes;
+	assert(node != STATS_NIL && "stats_tree_remove: value not found");
+	if (node == STATS_NIL)
+		return STATS_NIL;
+
+	uint32_t root = node;
+	if (value < nodes[node].value)
+	{
+		nodes[node].left = stats_tree_remove(tree, nodes[node].left, value);
+	}
+	else if (value > nodes[node].value)
+	{
+		nodes[node].right = stats_tree_remove(tree, nodes[node].right, value);
+	}
+	else if (nodes[node].count > 1)
+	{
+		--(nodes[node].count);
+	}
+	else if (nodes[node].left == STATS_NIL || nodes[node].right == STATS_NIL)
+	{
+		/* Replace the node with its only child */
+		const uint32_t child = nodes[node].left != STATS_NIL ? nodes[node].left : nodes[node].right;
+		nodes[node].right = tree->free_list;
+		tree->free_list = node;
+		return child;
+	}
+	else
+	{
+		/* Rotate the node down until it has at most one child */
+		if (nodes[nodes[node].left].priority > nodes[nodes[node].right].priority)
+		{
+			root = stats_tree_rotate_right(nodes, node);
+			nodes[root].right = stats_tree_remove(tree, node, value);
+		}
+		else
+		{
+			root = stats_tree_rotate_left(nodes, node);
+			nodes[root].left = stats_tree_remove(tree, node, value);
+		}
+	}
+
+	stats_tree_update_size(nodes, root);
+	return root;
+}
+
+/* Returns the sample at rank in ascending order, rank 0 is the smallest */
+uint32_t stats_tree_get_by_rank(const struct stats_tree *tree, uint32_t rank)
+{
+	const struct stats_node *nodes = tree->nodes;
+	uint32_t node = tree->root;
+	assert(rank < nodes[node].size && "stats_tree_get_by_rank: rank out of range");
+	while (node != STATS_NIL)
+	{
+		const uint32_t left_size = nodes[nodes[node].left].size;
+		if (rank < left_size)
+		{
+			node = nodes[node].left;
+		}
+		else if (rank < left_size + nodes[node].count)
+		{
+			return nodes[node].value;
+		}
+		else
+		{
+			rank -= left_size + nodes[node].count;
+			node = nodes[node].right;
+		}
+	}
+
+	return 0;
+}
+
 struct stats *stats_create(const unsigned char stat_count, const unsigned int frames_in_buffer, const bool profiling_run)
 {
 	struct stats *stats = malloc(sizeof(struct stats));
 
 	stats->stats = malloc(stat_count * frames_in_buffer * sizeof(uint32_t));
 	memset(stats->stats, 0, stat_count * frames_in_buffer * sizeof(uint32_t));
-	stats->stats_sorted = malloc(stat_count * frames_in_buffer * sizeof(uint32_t));
-	memset(stats->stats_sorted, 0, stat_count * frames_in_buffer * sizeof(uint32_t));
+	/* There can't be more distinct values than frames, one extra for the sentinel */
+	const unsigned int nodes_per_stat = frames_in_buffer + 1;
+	stats->trees = malloc(stat_count * sizeof(struct stats_tree));
+	stats->nodes = malloc(stat_count * nodes_per_stat * sizeof(struct stats_node));
+	memset(stats->nodes, 0, stat_count * nodes_per_stat * sizeof(struct stats_node));
+	stats->random_state = 0x9E3779B9;
+	for (unsigned char i = 0; i < stat_count; ++i)
+	{
+		struct stats_tree *tree = &(stats->trees[i]);
+		tree->nodes = &(stats->nodes[i * nodes_per_stat]);
+		/* All the stats start as zeros */
+		tree->root = 1;
+		tree->nodes[1].count = frames_in_buffer;
+		tree->nodes[1].size = frames_in_buffer;
+		tree->nodes[1].priority = stats_next_priority(stats);
+		tree->free_list = STATS_NIL;
+		for (unsigned int node = nodes_per_stat - 1; node > 1; --node)
+		{
+			tree->nodes[node].right = tree->free_list;
+			tree->free_list = node;
+		}
+	}
 	stats->sums = malloc(stat_count * sizeof(uint64_t));
 	memset(stats->sums, 0, stat_count * sizeof(uint64_t));
 
@@ -51,7 +251,8 @@ void stats_destroy(struct stats **stats)
 	assert(*stats && "stats_destroy: *stats is NULL");
 
 	free((*stats)->sums);
-	free((*stats)->stats_sorted);
+	free((*stats)->nodes);
+	free((*stats)->trees);
 	free((*stats)->stats);
 	free(*stats);
 }
@@ -64,81 +265,6 @@ bool stats_profiling_run_complete(const struct stats *stats)
 	return stats->profiling_run && stats->current_index >= stats->frames_in_buffer;
 }
 
-void update_sorted(uint32_t *data, unsigned int data_size, const uint32_t new_val, const uint32_t prev_val)
-{
-	assert(data && "update_sorted: data is NULL");
-
-	unsigned int index = ~0U;
-	for (unsigned i = 0; i < data_size; ++i)
-	{
-		if (data[i] == prev_val)
-		{
-			index = i;
-			break;
-		}
-	}
-
-	assert(index != ~0U && "update_sorted: prev_val not found");
-	if (index == ~0U)
-		return;
-
-	/* Should sort these from smallest to largest instead. (remember to change get percentile func too. */
-	if (new_val > prev_val)
-	{
-		if (index == 0)
-		{
-			data[index] = new_val;
-			return;
-		}
-
-		while (index > 0)
-		{
-			if (data[index - 1] >= new_val)
-			{
-				data[index] = new_val;
-				return;
-			}
-			else
-			{
-				data[index] = data[index - 1];
-				--index;
-				if (index == 0)
-				{
-					data[0] = new_val;
-					return;
-				}
-			}
-		}
-	}
-	else
-	{
-		if (index == data_size - 1)
-		{
-			data[index] = new_val;
-			return;
-		}
-
-		while (index < data_size - 1)
-		{
-			if (data[index + 1] <= new_val)
-			{
-				data[index] = new_val;
-				return;
-			}
-			else
-			{
-				data[index] = data[index + 1];
-				++index;
-				if (index == data_size - 1)
-				{
-					data[index] = new_val;
-					return;
-				}
-			}
-		}
-	}
-}
-
 void stats_update_stat(struct stats *stats, const unsigned char stat_id, const uint32_t time)
 {
 	assert(stats && "stats_update_stat: stats is NULL");
@@ -157,12 +283,10 @@ void stats_update_stat(struct stats *stats, const unsigned char stat_id, const u
 	stats->sums[stat_id] -= prev_value;
 	stats->sums[stat_id] += time;
 
-	update_sorted(&(stats->stats_sorted[stat_id * stats->frames_in_buffer]), stats->frames_in_buffer, time, prev_value);
-#if RPLNN_BUILD_TYPE == RPLNN_DEBUG
-	uint32_t *data = &(stats->stats_sorted[stat_id * stats->frames_in_buffer]);
-	for (unsigned int i = 0; i < stats->frames_in_buffer - 1; ++i)
-		assert(data[i] >= data[i + 1] && "sort: stats not properly sorted after running insertion");
-#endif
+	struct stats_tree *tree = &(stats->trees[stat_id]);
+	tree->root = stats_tree_remove(tree, tree->root, prev_value);
+	tree->root = stats_tree_insert(stats, tree, tree->root, time);
+	assert(tree->nodes[tree->root].size == stats->frames_in_buffer && "stats_update_stat: tree lost or gained samples");
 }
 
 void stats_frame_complete(struct stats *stats)
@@ -190,8 +314,9 @@ uint32_t stats_get_stat_percentile(struct stats *stats, const unsigned char stat
 {
 	assert(stats && "stats_get_stat_percentile: stats in NULL");
 
+	/* Index counted from the largest value */
 	unsigned int index = (unsigned int)((stats->frames_in_buffer - 1) * (1.0f - (percentile * 0.01f)));
-	return stats->stats_sorted[(stat_id * stats->frames_in_buffer) + index];
+	return stats_tree_get_by_rank(&(stats->trees[stat_id]), stats->frames_in_buffer - 1 - index);
 }
 
 uint32_t stats_get_avarage(struct stats *stats, const unsigned char stat_id)
@@ -23,7 +23,7 @@ struct texture *texture_create(const char *file_name)
 	struct texture *texture = malloc(sizeof(struct texture));
 
 	int n;
-	unsigned char *data = stbi_load(file_name, &texture->size.x, &texture->size.y, &n, 3);
+	unsigned char *data = stbi_load(file_name, &texture->size.x, &texture->size.y, &n, 4);
 	if (!data)
 	{
 		free(texture);
@@ -31,8 +31,8 @@ struct texture *texture_create(const char *file_name)
 	}
 
 	texture->buf = malloc(texture->size.x * texture->size.y * sizeof(uint32_t));
-	for (int i = 0, j = 0; i < texture->size.x * texture->size.y; ++i, j += 3)
-		texture->buf[i] = (data[j] << 16) | (data[j + 1] << 8) | data[j + 2];
+	for (int i = 0, j = 0; i < texture->size.x * texture->size.y; ++i, j += 4)
+		texture->buf[i] = ((uint32_t)data[j + 3] << 24) | (data[j] << 16) | (data[j + 1] << 8) | data[j + 2];
 
 	stbi_image_free(data);
 
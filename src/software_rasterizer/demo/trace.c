@@ -0,0 +1,173 @@
+#include "software_rasterizer/precompiled.h"
+
+#include "trace.h"
+
+#include "software_rasterizer/demo/osal.h"
+
+#include <stdio.h>
+
+struct trace_event
+{
+	const char *name;
+	uint64_t begin;
+	uint64_t end;
+	int32_t index;
+};
+
+struct trace_thread
+{
+	/* Written only by the recording thread */
+	struct trace_event *events;
+	/* Total recorded since the reset, the ring buffer index is this modulo events_per_thread */
+	uint64_t recorded_count;
+	const char *name;
+};
+
+struct trace_recorder
+{
+	struct trace_thread *threads;
+	struct trace_event *events;
+	unsigned int thread_count;
+	uint32_t events_per_thread;
+};
+
+struct trace_recorder *trace_recorder_create(const unsigned int thread_count, const uint32_t events_per_thread)
+{
+	assert(thread_count > 0 && "trace_recorder_create: thread_count is zero");
+	assert(events_per_thread > 0 && "trace_recorder_create: events_per_thread is zero");
+
+	struct trace_recorder *recorder = malloc(sizeof(struct trace_recorder));
+	if (!recorder)
+		return NULL;
+
+	recorder->threads = malloc(sizeof(struct trace_thread) * thread_count);
+	recorder->events = malloc(sizeof(struct trace_event) * events_per_thread * thread_count);
+	if (!recorder->threads || !recorder->events)
+	{
+		free(recorder->threads);
+		free(recorder->events);
+		free(recorder);
+		return NULL;
+	}
+
+	recorder->thread_count = thread_count;
+	recorder->events_per_thread = events_per_thread;
+	for (unsigned int i = 0; i < thread_count; ++i)
+	{
+		recorder->threads[i].events = &(recorder->events[i * events_per_thread]);
+		recorder->threads[i].name = NULL;
+	}
+	trace_reset(recorder);
+
+	return recorder;
+}
+
+void trace_recorder_destroy(struct trace_recorder **recorder)
+{
+	assert(recorder && "trace_recorder_destroy: recorder is NULL");
+	assert(*recorder && "trace_recorder_destroy: *recorder is NULL");
+
+	free((*recorder)->threads);
+	free((*recorder)->events);
+	free(*recorder);
+	*recorder = NULL;
+}
+
+void trace_record(struct trace_recorder *recorder, const unsigned int thread_index, const char *name, const int32_t index, const uint64_t begin, const uint64_t end)
+{
+	assert(recorder && "trace_record: recorder is NULL");
+	assert(thread_index < recorder->thread_count && "trace_record: Too big thread_index");
+	assert(name && "trace_record: name is NULL");
+	assert(begin <= end && "trace_record: begin is after end");
+
+	struct trace_thread *thread = &(recorder->threads[thread_index]);
+	/* The oldest event is overwritten when the buffer is full */
+	struct trace_event *event = &(thread->events[thread->recorded_count % recorder->events_per_thread]);
+	event->name = name;
+	event->begin = begin;
+	event->end = end;
+	event->index = index;
+	++(thread->recorded_count);
+}
+
+void trace_set_thread_name(struct trace_recorder *recorder, const unsigned int thread_index, const char *name)
+{
+	assert(recorder && "trace_set_thread_name: recorder is NULL");
+	assert(thread_index < recorder->thread_count && "trace_set_thread_name: Too big thread_index");
+
+	recorder->threads[thread_index].name = name;
+}
+
+void trace_reset(struct trace_recorder *recorder)
+{
+	assert(recorder && "trace_reset: recorder is NULL");
+
+	for (unsigned int i = 0; i < recorder->thread_count; ++i)
+		recorder->threads[i].recorded_count = 0;
+}
+
+/* Events left in the ring buffer of thread */
+uint32_t trace_get_event_count(const struct trace_recorder *recorder, const struct trace_thread *thread)
+{
+	return (uint32_t)min(thread->recorded_count, (uint64_t)recorder->events_per_thread);
+}
+
+/* Events in the recording order, 0 is the oldest one left */
+const struct trace_event *trace_get_event(const struct trace_recorder *recorder, const struct trace_thread *thread, const uint32_t event)
+{
+	const uint64_t first = thread->recorded_count - trace_get_event_count(recorder, thread);
+	return &(thread->events[(first + event) % recorder->events_per_thread]);
+}
+
+bool trace_write_json(const struct trace_recorder *recorder, const char *file_name)
+{
+	assert(recorder && "trace_write_json: recorder is NULL");
+	assert(file_name && "trace_write_json: file_name is NULL");
+
+	FILE *file = fopen(file_name, "w");
+	if (!file)
+		return false;
+
+	uint64_t start = UINT64_MAX;
+	for (unsigned int i = 0; i < recorder->thread_count; ++i)
+	{
+		const struct trace_thread *thread = &(recorder->threads[i]);
+		if (trace_get_event_count(recorder, thread) > 0)
+			start = min(start, trace_get_event(recorder, thread, 0)->begin);
+	}
+
+	/* The timer frequency isn't exposed, a long enough interval gives it without overflowing */
+	const uint64_t frequency_ticks = 1000000000;
+	const double microseconds_per_tick = (double)get_time_microseconds(frequency_ticks) / (double)frequency_ticks;
+
+	/* Thread names first, they also make sure there is an entry before each event */
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (unsigned int i = 0; i < recorder->thread_count; ++i)
+	{
+		const struct trace_thread *thread = &(recorder->threads[i]);
+		if (thread->name)
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", i > 0 ? ",\n" : "", i, thread->name);
+		else
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}", i > 0 ? ",\n" : "", i, i);
+	}
+
+	/* Complete events, the viewers sort them by time */
+	for (unsigned int i = 0; i < recorder->thread_count; ++i)
+	{
+		const struct trace_thread *thread = &(recorder->threads[i]);
+		const uint32_t event_count = trace_get_event_count(recorder, thread);
+		for (uint32_t j = 0; j < event_count; ++j)
+		{
+			const struct trace_event *event = trace_get_event(recorder, thread, j);
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f", event->name, i,
+				(double)(event->begin - start) * microseconds_per_tick, (double)(event->end - event->begin) * microseconds_per_tick);
+			if (event->index >= 0)
+				fprintf(file, ",\"args\":{\"index\":%d}", event->index);
+			fprintf(file, "}");
+		}
+	}
+	fprintf(file, "\n]}\n");
+
+	const bool write_ok = !ferror(file);
+	return fclose(file) == 0 && write_ok;
+}
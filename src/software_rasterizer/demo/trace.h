@@ -0,0 +1,31 @@
+#ifndef RPLNN_TRACE_H
+#define RPLNN_TRACE_H
+
+/* Timeline of timed events with a ring buffer per thread, written as Chrome trace JSON
+ * which can be opened in chrome://tracing or https://ui.perfetto.dev.
+ * Begin and end times are from get_time(). */
+
+struct trace_recorder;
+
+/* Each thread keeps its last events_per_thread events.
+ * Should create a version of this which doesn't malloc (basically just give memory block as a parameter). */
+struct trace_recorder *trace_recorder_create(const unsigned int thread_count, const uint32_t events_per_thread);
+void trace_recorder_destroy(struct trace_recorder **recorder);
+
+/* Records an event into the ring buffer of thread_index, each thread must use its own index.
+ * Recording takes no locks and doesn't write to anything shared with the other threads.
+ * name is not copied, it must stay valid until the trace is written (a string literal for example).
+ * index is written as an argument of the event when it is not negative. */
+void trace_record(struct trace_recorder *recorder, const unsigned int thread_index, const char *name, const int32_t index, const uint64_t begin, const uint64_t end);
+
+/* Name shown for the thread instead of "thread <thread_index>", it is not copied either */
+void trace_set_thread_name(struct trace_recorder *recorder, const unsigned int thread_index, const char *name);
+
+/* Drops all the recorded events */
+void trace_reset(struct trace_recorder *recorder);
+
+/* Writes the events of all threads, times are relative to the earliest recorded event.
+ * Must not run concurrently with trace_record. Returns false if the file couldn't be written. */
+bool trace_write_json(const struct trace_recorder *recorder, const char *file_name);
+
+#endif /* RPLNN_TRACE_H */
@@ -2,6 +2,7 @@
 #include "rasterizer.h"
 
 #include <math.h>
+#include <string.h>
 
 #include "software_rasterizer/vector.h"
 
@@ -16,29 +17,106 @@
  * unless tris are properly binned to the raster areas. */
 //#define USE_TILES 1
 #endif
-#define TILE_SIZE 64
+#define TILE_SIZE_BITS 6
+#define TILE_SIZE (1 << TILE_SIZE_BITS)
 
 #ifdef USE_SIMD
 #include <emmintrin.h>
 #endif
 
-/* 4 sub bits gives us [-2048, 2047] max render target.
- * It should be possible to get something similar out of 8 sub bits. */
+/* Accuracy of 1/w used in perspective correction when using SIMD.
+ * 0: _mm_rcp_ps only, ~12 bits of precision, can cause visible texel jitter on large textures.
+ * 1: _mm_rcp_ps with a Newton-Raphson step, ~22 bits of precision.
+ * 2: _mm_div_ps, exact but notably slower. */
+#define PERSPECTIVE_ACCURACY 1
+
+/* Collects per thread counters and cycle timers of the rasterizer stages, see rasterizer_collect_stats.
+ * When not defined the counting and the time stamp reads are compiled out. */
+//#define USE_RASTER_STATS 1
+
+/* Uses 8 sub bits instead of 4, removes cracks and jitter from small triangles.
+ * Triangle setup is done with 64bit math, the inner loop stays 32bit.
+ * To keep the edge functions in 32bit range the guard band (and the max rasterize area) is halved. */
+//#define USE_8_SUB_BITS 1
+
+/* 4 sub bits gives us [-2048, 2047] around the raster origin, 8 sub bits [-1024, 1023].
+ * The origin is placed in the middle of each rasterize area so this limits the size of a single rasterize area,
+ * the render target itself can be larger as long as it is split to multiple areas.
+ * The origin is rounded down to even, MAX_AREA_SIZE keeps all the pixel centers of an area inside the guard band. */
+#ifdef USE_8_SUB_BITS
+#define SUB_BITS 8
+#define GB_MIN -1024
+#define GB_MAX 1023
+#else
 #define SUB_BITS 4
-#define TO_FIXED(val, multip) (int32_t)((val) * (multip) + 0.5f)
+#define GB_MIN -2048
+#define GB_MAX 2047
+#endif
+#define MAX_AREA_SIZE (2 * -(GB_MIN) - 4)
+/* Rounds to nearest (half up) with floor, truncating would round negative values differently than positive ones */
+#define TO_FIXED(val, multip) (int32_t)floorf((val) * (multip) + 0.5f)
 #define MUL_FIXED(val1, val2, multip) (((val1) * (val2)) / (multip))
 
 /* Number of bits reserved for depth
- * The rest are reserved for future use (stencil) */
+ * The top 8 bits of each depth buffer value are the stencil */
 #define DEPTH_BITS 24
 
-#define GB_MIN -2048
-#define GB_MAX 2047
+/* When using SIMD depth is interpolated in fixed point.
+ * The amount of fractional bits is selected per triangle based on the depth range inside the bounding box,
+ * slivers can have huge values outside of the triangle and get less (or even negative) fractional bits. */
+#define Z_MAX_FRACT_BITS 6
+#define Z_MIN_FRACT_BITS -8
+
 #define GB_LEFT (TO_FIXED(GB_MIN, (1 << SUB_BITS)))
 #define GB_BOTTOM (TO_FIXED(GB_MIN, (1 << SUB_BITS)))
 #define GB_RIGHT (TO_FIXED(GB_MAX, (1 << SUB_BITS)))
 #define GB_TOP (TO_FIXED(GB_MAX, (1 << SUB_BITS)))
 
+/* Per vertex values interpolated with perspective correction: the texture coordinates,
+ * the position in the light's clip space (for shadows) and the vertex attributes. */
+#define VARYING_UV 0
+#define VARYING_LIGHT 2
+#define VARYING_ATTRIBUTES 6
+#define VARYING_COUNT (VARYING_ATTRIBUTES + RASTERIZER_MAX_ATTRIBUTES)
+
+/* Rotated grid multisample positions relative to the pixel center in 1/16 pixels.
+ * They sum to zero so the average of the edge functions of the samples is the value at the pixel center. */
+const struct vec2_int msaa_sample_positions[RASTERIZER_MSAA_SAMPLES] = { { .x = -2, .y = -6 }, { .x = 6, .y = -2 }, { .x = -6, .y = 2 }, { .x = 2, .y = 6 } };
+
+#ifdef USE_RASTER_STATS
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+/* The inner loops count to locals which are added to these once per tri */
+RPLNN_THREAD_LOCAL struct rasterizer_stats raster_stats;
+
+#define RASTER_STATS_ADD(stats, field, value) ((stats).field += (uint64_t)(value))
+#define RASTER_STATS_TIMER(time) uint64_t time = __rdtsc()
+/* Adds the cycles since time to field and restarts from there */
+#define RASTER_STATS_LAP(stats, field, time) do { const uint64_t lap_end = __rdtsc(); (stats).field += lap_end - (time); (time) = lap_end; } while (0)
+
+/* Pixels in a 2x2 block for each coverage mask */
+const uint8_t block_pixel_counts[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+/* Any sample of the pixel inside the tri, only evaluated for the stats */
+bool pixel_covered(const int32_t *w0, const int32_t *w1, const int32_t *w2, const uint32_t sample_count)
+{
+	for (uint32_t sample = 0; sample < sample_count; ++sample)
+	{
+		if ((w0[sample] | w1[sample] | w2[sample]) >= 0)
+			return true;
+	}
+	return false;
+}
+#else
+#define RASTER_STATS_ADD(stats, field, value) ((void)0)
+#define RASTER_STATS_TIMER(time)
+#define RASTER_STATS_LAP(stats, field, time) ((void)0)
+#endif
+
 #ifdef USE_SIMD
 /* From http://stackoverflow.com/questions/10500766/sse-multiplication-of-4-32-bit-integers */
 __m128i mul_epi32(const __m128i a, const __m128i b)
@@ -47,19 +125,325 @@ __m128i mul_epi32(const __m128i a, const __m128i b)
 	__m128i tmp2 = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4)); /* mul 3,1 */
 	return _mm_unpacklo_epi32(_mm_shuffle_epi32(tmp1, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(tmp2, _MM_SHUFFLE(0, 0, 2, 0))); /* shuffle results to [63..0] and pack */
 }
+
+/* mask ? a : b */
+__m128i select_si128(const __m128i mask, const __m128i a, const __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+__m128i clamp_epi32(const __m128i val, const __m128i min_val, const __m128i max_val)
+{
+	__m128i result = select_si128(_mm_cmplt_epi32(val, min_val), min_val, val);
+	return select_si128(_mm_cmpgt_epi32(result, max_val), max_val, result);
+}
+
+/* No gather in SSE2 */
+__m128i gather_epi32(const uint32_t *buf, const __m128i index)
+{
+	return _mm_set_epi32(buf[((int32_t *)&index)[3]], buf[((int32_t *)&index)[2]], buf[((int32_t *)&index)[1]], buf[((int32_t *)&index)[0]]);
+}
+
+/* Multiplies each 8bit color channel with factor [0, 256], alpha is left as is */
+__m128i modulate_block(const __m128i color, const __m128i factor)
+{
+	const __m128i low_mask = _mm_set_epi32(0x00FF00FF, 0x00FF00FF, 0x00FF00FF, 0x00FF00FF);
+	const __m128i alpha_mask = _mm_set_epi32(0xFF000000, 0xFF000000, 0xFF000000, 0xFF000000);
+	const __m128i factor16 = _mm_or_si128(factor, _mm_slli_epi32(factor, 16));
+	__m128i even = _mm_srli_epi16(_mm_mullo_epi16(_mm_and_si128(color, low_mask), factor16), 8);
+	__m128i odd = _mm_andnot_si128(low_mask, _mm_mullo_epi16(_mm_srli_epi16(color, 8), factor16));
+	return select_si128(alpha_mask, color, _mm_or_si128(even, odd));
+}
+
+/* a * b / 255 rounded, for 16bit values in [0, 255] */
+__m128i mul_div_255_epi16(const __m128i a, const __m128i b)
+{
+	const __m128i half = _mm_set_epi32(0x00800080, 0x00800080, 0x00800080, 0x00800080);
+	__m128i temp = _mm_add_epi16(_mm_mullo_epi16(a, b), half);
+	return _mm_srli_epi16(_mm_add_epi16(temp, _mm_srli_epi16(temp, 8)), 8);
+}
+
+/* Blends two pixels with their channels unpacked to 16bits,
+ * blend_alpha is expected to be in all 16bit lanes. Results can be over 255. */
+__m128i blend_pixels_epi16(const __m128i src, const __m128i dst, const __m128i blend_alpha, const enum rasterizer_blend_mode mode)
+{
+	const __m128i max_channel = _mm_set_epi32(0x00FF00FF, 0x00FF00FF, 0x00FF00FF, 0x00FF00FF);
+	/* Alpha of both pixels to all of their channels */
+	__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	alpha = mul_div_255_epi16(alpha, blend_alpha);
+	switch (mode)
+	{
+	case RASTERIZER_BLEND_ALPHA: return _mm_add_epi16(mul_div_255_epi16(src, alpha), mul_div_255_epi16(dst, _mm_sub_epi16(max_channel, alpha)));
+	case RASTERIZER_BLEND_ADDITIVE: return _mm_add_epi16(mul_div_255_epi16(src, alpha), dst);
+	case RASTERIZER_BLEND_PREMULTIPLIED: return _mm_add_epi16(mul_div_255_epi16(src, blend_alpha), mul_div_255_epi16(dst, _mm_sub_epi16(max_channel, alpha)));
+	default: return src;
+	}
+}
+
+/* Blends 4 packed 0xAARRGGBB pixels */
+__m128i blend_block(const __m128i src, const __m128i dst, const __m128i blend_alpha, const enum rasterizer_blend_mode mode)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i low = blend_pixels_epi16(_mm_unpacklo_epi8(src, zero), _mm_unpacklo_epi8(dst, zero), blend_alpha, mode);
+	__m128i high = blend_pixels_epi16(_mm_unpackhi_epi8(src, zero), _mm_unpackhi_epi8(dst, zero), blend_alpha, mode);
+	/* Pack saturates */
+	return _mm_packus_epi16(low, high);
+}
+
+/* Packs colors with channels in [0, 1] to 0xAARRGGBB, channels are clamped */
+__m128i pack_color_block(const __m128 r, const __m128 g, const __m128 b, const __m128 a)
+{
+	const __m128 max_channel = _mm_set_ps(255.0f, 255.0f, 255.0f, 255.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128i r8 = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(r, max_channel), zero), max_channel));
+	const __m128i g8 = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(g, max_channel), zero), max_channel));
+	const __m128i b8 = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(b, max_channel), zero), max_channel));
+	const __m128i a8 = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(a, max_channel), zero), max_channel));
+	return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(a8, 24), _mm_slli_epi32(r8, 16)), _mm_or_si128(_mm_slli_epi32(g8, 8), b8));
+}
+
+/* Multiplies 4 packed 0xAARRGGBB colors channel by channel */
+__m128i multiply_colors_block(const __m128i a, const __m128i b)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i low = mul_div_255_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+	__m128i high = mul_div_255_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+	return _mm_packus_epi16(low, high);
+}
+
+/* a + (b - a) * f for 4 packed 0xAARRGGBB colors, f is per color in [0, 128] */
+__m128i lerp_colors_block(const __m128i a, const __m128i b, const __m128i f)
+{
+	const __m128i zero = _mm_setzero_si128();
+	/* Weight of each color to its 4 channels */
+	const __m128i f16 = _mm_packs_epi32(f, f);
+	const __m128i f_pairs = _mm_unpacklo_epi16(f16, f16);
+	const __m128i a_low = _mm_unpacklo_epi8(a, zero);
+	const __m128i a_high = _mm_unpackhi_epi8(a, zero);
+	__m128i low = _mm_mullo_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(b, zero), a_low), _mm_unpacklo_epi32(f_pairs, f_pairs));
+	__m128i high = _mm_mullo_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(b, zero), a_high), _mm_unpackhi_epi32(f_pairs, f_pairs));
+	low = _mm_add_epi16(a_low, _mm_srai_epi16(low, 7));
+	high = _mm_add_epi16(a_high, _mm_srai_epi16(high, 7));
+	return _mm_packus_epi16(low, high);
+}
+
+/* Buffer indices for pixel coordinates, takes the 2x2 blocks and tiles into account.
+ * width is the width of the buffer, or the amount of tiles in a row when using tiles. */
+__m128i get_pixel_index_block(const __m128i x, const __m128i y, const __m128i width)
+{
+	const __m128i one = _mm_set_epi32(1, 1, 1, 1);
+#ifdef USE_TILES
+	const __m128i tile_mask = _mm_set_epi32(TILE_SIZE - 2, TILE_SIZE - 2, TILE_SIZE - 2, TILE_SIZE - 2);
+	__m128i index = _mm_add_epi32(mul_epi32(_mm_srli_epi32(y, TILE_SIZE_BITS), width), _mm_srli_epi32(x, TILE_SIZE_BITS));
+	index = _mm_slli_epi32(index, TILE_SIZE_BITS * 2);
+	index = _mm_add_epi32(index, _mm_slli_epi32(_mm_and_si128(y, tile_mask), TILE_SIZE_BITS));
+	index = _mm_add_epi32(index, _mm_slli_epi32(_mm_and_si128(x, tile_mask), 1));
+#else
+	__m128i index = mul_epi32(_mm_andnot_si128(one, y), width);
+	index = _mm_add_epi32(index, _mm_slli_epi32(_mm_andnot_si128(one, x), 1));
+#endif
+	index = _mm_add_epi32(index, _mm_slli_epi32(_mm_and_si128(y, one), 1));
+	return _mm_add_epi32(index, _mm_and_si128(x, one));
+}
+
+/* Returns the amount of lit texels [0, 4] in the 2x2 texel blocks starting at x, y.
+ * Coordinates are clamped to the map. */
+__m128i get_shadow_lit_count_block(const uint32_t *map, const __m128i x, const __m128i y, const __m128i depth,
+	const __m128i max_x, const __m128i max_y, const __m128i width)
+{
+	assert(map && "get_shadow_lit_count_block: map is NULL");
+
+	const __m128i one = _mm_set_epi32(1, 1, 1, 1);
+	const __m128i depth_mask = _mm_set_epi32(0x00ffffff, 0x00ffffff, 0x00ffffff, 0x00ffffff);
+	const __m128i x0 = clamp_epi32(x, _mm_setzero_si128(), max_x);
+	const __m128i x1 = clamp_epi32(_mm_add_epi32(x, one), _mm_setzero_si128(), max_x);
+	const __m128i y0 = clamp_epi32(y, _mm_setzero_si128(), max_y);
+	const __m128i y1 = clamp_epi32(_mm_add_epi32(y, one), _mm_setzero_si128(), max_y);
+
+	/* Compare masks are -1 for shadowed texels */
+	__m128i lit = _mm_set_epi32(4, 4, 4, 4);
+	__m128i texel = _mm_and_si128(gather_epi32(map, get_pixel_index_block(x0, y0, width)), depth_mask);
+	lit = _mm_add_epi32(lit, _mm_cmpgt_epi32(depth, texel));
+	texel = _mm_and_si128(gather_epi32(map, get_pixel_index_block(x1, y0, width)), depth_mask);
+	lit = _mm_add_epi32(lit, _mm_cmpgt_epi32(depth, texel));
+	texel = _mm_and_si128(gather_epi32(map, get_pixel_index_block(x0, y1, width)), depth_mask);
+	lit = _mm_add_epi32(lit, _mm_cmpgt_epi32(depth, texel));
+	texel = _mm_and_si128(gather_epi32(map, get_pixel_index_block(x1, y1, width)), depth_mask);
+	return _mm_add_epi32(lit, _mm_cmpgt_epi32(depth, texel));
+}
+#endif
+
+/* Multiplies each 8bit color channel with factor [0, 256], alpha is left as is */
+uint32_t modulate_color(const uint32_t color, const uint32_t factor)
+{
+	const uint32_t result = ((((color & 0x00FF00FF) * factor) >> 8) & 0x00FF00FF) | ((((color >> 8) & 0x00FF00FF) * factor) & 0xFF00FF00);
+	return (color & 0xFF000000) | (result & 0x00FFFFFF);
+}
+
+/* a * b / 255 rounded, for values in [0, 255] */
+uint32_t mul_div_255(const uint32_t a, const uint32_t b)
+{
+	const uint32_t temp = a * b + 128;
+	return (temp + (temp >> 8)) >> 8;
+}
+
+/* Blends packed 0xAARRGGBB colors */
+uint32_t blend_color(const uint32_t src, const uint32_t dst, const uint32_t blend_alpha, const enum rasterizer_blend_mode mode)
+{
+	const uint32_t alpha = mul_div_255(src >> 24, blend_alpha);
+	uint32_t result = 0;
+	for (uint32_t shift = 0; shift < 32; shift += 8)
+	{
+		const uint32_t src_channel = (src >> shift) & 0xFF;
+		const uint32_t dst_channel = (dst >> shift) & 0xFF;
+		uint32_t channel;
+		switch (mode)
+		{
+		case RASTERIZER_BLEND_ALPHA: channel = mul_div_255(src_channel, alpha) + mul_div_255(dst_channel, 255 - alpha); break;
+		case RASTERIZER_BLEND_ADDITIVE: channel = mul_div_255(src_channel, alpha) + dst_channel; break;
+		case RASTERIZER_BLEND_PREMULTIPLIED: channel = mul_div_255(src_channel, blend_alpha) + mul_div_255(dst_channel, 255 - alpha); break;
+		default: channel = src_channel; break;
+		}
+		result |= min(channel, 0xFF) << shift;
+	}
+	return result;
+}
+
+/* Packs a color with channels in [0, 1] to 0xAARRGGBB, channels are clamped */
+uint32_t pack_color(const float r, const float g, const float b, const float a)
+{
+	return ((uint32_t)(clamp(a, 0.0f, 1.0f) * 255.0f + 0.5f) << 24) | ((uint32_t)(clamp(r, 0.0f, 1.0f) * 255.0f + 0.5f) << 16)
+		| ((uint32_t)(clamp(g, 0.0f, 1.0f) * 255.0f + 0.5f) << 8) | (uint32_t)(clamp(b, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+/* Multiplies packed 0xAARRGGBB colors channel by channel */
+uint32_t multiply_colors(const uint32_t a, const uint32_t b)
+{
+	uint32_t result = 0;
+	for (uint32_t shift = 0; shift < 32; shift += 8)
+		result |= mul_div_255((a >> shift) & 0xFF, (b >> shift) & 0xFF) << shift;
+	return result;
+}
+
+/* a + (b - a) * f for packed 0xAARRGGBB colors, f is in [0, 128] */
+uint32_t lerp_colors(const uint32_t a, const uint32_t b, const int32_t f)
+{
+	uint32_t result = 0;
+	for (uint32_t shift = 0; shift < 32; shift += 8)
+	{
+		const int32_t a_channel = (int32_t)((a >> shift) & 0xFF);
+		const int32_t b_channel = (int32_t)((b >> shift) & 0xFF);
+		result |= (uint32_t)(a_channel + (((b_channel - a_channel) * f) >> 7)) << shift;
+	}
+	return result;
+}
+
+/* Returns the amount of lit texels [0, 4] in the 2x2 texel block starting at x, y.
+ * Coordinates are clamped to the map, the map is expected to be linear (no SIMD). */
+uint32_t get_shadow_lit_count(const uint32_t *map, const struct vec2_int *map_size, const int32_t x, const int32_t y, const uint32_t depth)
+{
+	assert(map && "get_shadow_lit_count: map is NULL");
+	assert(map_size && "get_shadow_lit_count: map_size is NULL");
+
+	const int32_t x0 = clamp(x, 0, map_size->x - 1);
+	const int32_t x1 = clamp(x + 1, 0, map_size->x - 1);
+	const int32_t y0 = clamp(y, 0, map_size->y - 1);
+	const int32_t y1 = clamp(y + 1, 0, map_size->y - 1);
+
+	uint32_t lit = 0;
+	lit += depth <= (map[y0 * map_size->x + x0] & 0x00FFFFFF) ? 1 : 0;
+	lit += depth <= (map[y0 * map_size->x + x1] & 0x00FFFFFF) ? 1 : 0;
+	lit += depth <= (map[y1 * map_size->x + x0] & 0x00FFFFFF) ? 1 : 0;
+	lit += depth <= (map[y1 * map_size->x + x1] & 0x00FFFFFF) ? 1 : 0;
+	return lit;
+}
+
+bool stencil_test_passes(const enum rasterizer_compare_func func, const uint32_t ref, const uint32_t stencil)
+{
+	switch (func)
+	{
+	case RASTERIZER_COMPARE_NEVER: return false;
+	case RASTERIZER_COMPARE_LESS: return ref < stencil;
+	case RASTERIZER_COMPARE_EQUAL: return ref == stencil;
+	case RASTERIZER_COMPARE_LESS_EQUAL: return ref <= stencil;
+	case RASTERIZER_COMPARE_GREATER: return ref > stencil;
+	case RASTERIZER_COMPARE_NOT_EQUAL: return ref != stencil;
+	case RASTERIZER_COMPARE_GREATER_EQUAL: return ref >= stencil;
+	default: return true;
+	}
+}
+
+uint32_t stencil_op(const enum rasterizer_stencil_op op, const uint32_t stencil, const uint32_t ref)
+{
+	switch (op)
+	{
+	case RASTERIZER_STENCIL_ZERO: return 0;
+	case RASTERIZER_STENCIL_REPLACE: return ref;
+	case RASTERIZER_STENCIL_INCR: return stencil < 0xFF ? stencil + 1 : stencil;
+	case RASTERIZER_STENCIL_DECR: return stencil > 0 ? stencil - 1 : stencil;
+	case RASTERIZER_STENCIL_INVERT: return ~stencil & 0xFF;
+	case RASTERIZER_STENCIL_INCR_WRAP: return (stencil + 1) & 0xFF;
+	case RASTERIZER_STENCIL_DECR_WRAP: return (stencil - 1) & 0xFF;
+	default: return stencil;
+	}
+}
+
+#ifdef USE_SIMD
+/* Stencil values are in the low 8 bits of each 32bit lane, returns a mask of the lanes that pass */
+__m128i stencil_test_passes_block(const enum rasterizer_compare_func func, const __m128i ref, const __m128i stencil)
+{
+	const __m128i all = _mm_set_epi32(~(uint32_t)0, ~(uint32_t)0, ~(uint32_t)0, ~(uint32_t)0);
+	switch (func)
+	{
+	case RASTERIZER_COMPARE_NEVER: return _mm_setzero_si128();
+	case RASTERIZER_COMPARE_LESS: return _mm_cmplt_epi32(ref, stencil);
+	case RASTERIZER_COMPARE_EQUAL: return _mm_cmpeq_epi32(ref, stencil);
+	case RASTERIZER_COMPARE_LESS_EQUAL: return _mm_xor_si128(_mm_cmpgt_epi32(ref, stencil), all);
+	case RASTERIZER_COMPARE_GREATER: return _mm_cmpgt_epi32(ref, stencil);
+	case RASTERIZER_COMPARE_NOT_EQUAL: return _mm_xor_si128(_mm_cmpeq_epi32(ref, stencil), all);
+	case RASTERIZER_COMPARE_GREATER_EQUAL: return _mm_xor_si128(_mm_cmplt_epi32(ref, stencil), all);
+	default: return all;
+	}
+}
+
+__m128i stencil_op_block(const enum rasterizer_stencil_op op, const __m128i stencil, const __m128i ref)
+{
+	const __m128i max_val = _mm_set_epi32(0xFF, 0xFF, 0xFF, 0xFF);
+	const __m128i one = _mm_set_epi32(1, 1, 1, 1);
+	switch (op)
+	{
+	case RASTERIZER_STENCIL_ZERO: return _mm_setzero_si128();
+	case RASTERIZER_STENCIL_REPLACE: return ref;
+	/* The compare masks are -1 where the value can be changed */
+	case RASTERIZER_STENCIL_INCR: return _mm_sub_epi32(stencil, _mm_cmplt_epi32(stencil, max_val));
+	case RASTERIZER_STENCIL_DECR: return _mm_add_epi32(stencil, _mm_cmpgt_epi32(stencil, _mm_setzero_si128()));
+	case RASTERIZER_STENCIL_INVERT: return _mm_xor_si128(stencil, max_val);
+	case RASTERIZER_STENCIL_INCR_WRAP: return _mm_and_si128(_mm_add_epi32(stencil, one), max_val);
+	case RASTERIZER_STENCIL_DECR_WRAP: return _mm_and_si128(_mm_sub_epi32(stencil, one), max_val);
+	default: return stencil;
+	}
+}
 #endif
 
 /* Taken straight from https://fgiesen.wordpress.com/2013/02/08/triangle-rasterization-in-practice/ 
- * Returns the signed A*2 of the triangle formed by the three points. 
- * The sign is positive with CCW tri in a coordinate system with up-right positive axes. */
-int32_t winding_2d(const struct vec2_int *p1, const struct vec2_int *p2, const struct vec2_int *p3)
+ * Returns the signed A*2 of the triangle formed by the three points in sub-pixels squared, exact.
+ * The sign is positive with CCW tri in a coordinate system with up-right positive axes.
+ * It is computed from the edges relative to p1 so moving the raster origin doesn't change it. */
+int64_t winding_2d_exact(const struct vec2_int *p1, const struct vec2_int *p2, const struct vec2_int *p3)
 {
-	assert(p1 && "winding_2d: p1 is NULL");
-	assert(p2 && "winding_2d: p2 is NULL");
-	assert(p3 && "winding_2d: p3 is NULL");
+	assert(p1 && "winding_2d_exact: p1 is NULL");
+	assert(p2 && "winding_2d_exact: p2 is NULL");
+	assert(p3 && "winding_2d_exact: p3 is NULL");
 
-	const int32_t sub_multip = 1 << SUB_BITS;
-	return MUL_FIXED(p1->y - p2->y, p3->x, sub_multip) + MUL_FIXED(p2->x - p1->x, p3->y, sub_multip) + (MUL_FIXED(p1->x, p2->y, sub_multip) - MUL_FIXED(p1->y, p2->x, sub_multip));
+	return (int64_t)(p2->x - p1->x) * (p3->y - p1->y) - (int64_t)(p2->y - p1->y) * (p3->x - p1->x);
+}
+
+/* The signed A*2 in sub-pixels, rounded down.
+ * The products don't fit in 32bits with large coordinates (or 8 sub bits) so they are done in 64bits,
+ * the result itself fits in 32bits as long as the points are inside the guard band. */
+int32_t winding_2d(const struct vec2_int *p1, const struct vec2_int *p2, const struct vec2_int *p3)
+{
+	return (int32_t)(winding_2d_exact(p1, p2, p3) >> SUB_BITS);
 }
 
 bool is_top_or_left(const struct vec2_int *p1, const struct vec2_int *p2)
@@ -71,6 +455,81 @@ bool is_top_or_left(const struct vec2_int *p1, const struct vec2_int *p2)
 	return ((p2->y < p1->y) || (p2->x < p1->x && p1->y == p2->y));
 }
 
+/* Edge function of p1 -> p2 at p in sub-pixels, >= 0 when p is covered by the edge.
+ * The top or left bias is applied to the exact value before rounding down,
+ * this keeps the fill rule exact for shared edges and the result the same wherever the raster origin is. */
+int32_t edge_function(const struct vec2_int *p1, const struct vec2_int *p2, const struct vec2_int *p)
+{
+	return (int32_t)((winding_2d_exact(p1, p2, p) - (is_top_or_left(p1, p2) ? 0 : 1)) >> SUB_BITS);
+}
+
+/* Screen space plane equation for an attribute, value = a * x + b * y + c.
+ * x and y are in pixels relative to the raster origin. */
+struct plane_equation
+{
+	float a, b, c;
+};
+
+/* p0 is the position of the first vertex in pixels, d10 and d20 the edges from it.
+ * one_over_det is the reciprocal of the cross product of the edges. */
+struct plane_equation get_plane_equation(const struct vec2_float *p0, const struct vec2_float *d10, const struct vec2_float *d20, const float one_over_det,
+	const float val0, const float val1, const float val2)
+{
+	assert(p0 && "get_plane_equation: p0 is NULL");
+	assert(d10 && "get_plane_equation: d10 is NULL");
+	assert(d20 && "get_plane_equation: d20 is NULL");
+
+	const float val10 = val1 - val0;
+	const float val20 = val2 - val0;
+
+	struct plane_equation result;
+	result.a = (val10 * d20->y - val20 * d10->y) * one_over_det;
+	result.b = (val20 * d10->x - val10 * d20->x) * one_over_det;
+	result.c = val0 - result.a * p0->x - result.b * p0->y;
+	return result;
+}
+
+float plane_equation_get_value(const struct plane_equation *plane, const float x, const float y)
+{
+	assert(plane && "plane_equation_get_value: plane is NULL");
+
+	return plane->a * x + plane->b * y + plane->c;
+}
+
+#ifdef USE_SIMD
+/* Returns 1 / val with the precision selected by PERSPECTIVE_ACCURACY */
+__m128 reciprocal(const __m128 val)
+{
+#if PERSPECTIVE_ACCURACY == 0
+	return _mm_rcp_ps(val);
+#elif PERSPECTIVE_ACCURACY == 1
+	/* x1 = x0 * (2 - val * x0) */
+	const __m128 estimate = _mm_rcp_ps(val);
+	return _mm_sub_ps(_mm_add_ps(estimate, estimate), _mm_mul_ps(val, _mm_mul_ps(estimate, estimate)));
+#else
+	return _mm_div_ps(_mm_set_ps(1.0f, 1.0f, 1.0f, 1.0f), val);
+#endif
+}
+
+/* Returns the values for a 2x2 block with its bottom left pixel at x, y */
+__m128 plane_equation_get_block(const struct plane_equation *plane, const float x, const float y)
+{
+	assert(plane && "plane_equation_get_block: plane is NULL");
+
+	return _mm_set_ps(plane_equation_get_value(plane, x + 1.0f, y + 1.0f), plane_equation_get_value(plane, x, y + 1.0f),
+		plane_equation_get_value(plane, x + 1.0f, y), plane_equation_get_value(plane, x, y));
+}
+
+/* Stores the value of a plane at an offset in blocks from the bottom left pixel of a block, only the first lanes are used.
+ * block has the values of the pixels of the block, steps are per block. */
+RPLNN_FORCE_INLINE void store_plane_value_at_offset(float *dst, const __m128 block, const __m128 step_x, const __m128 step_y, const __m128 offset_x, const __m128 offset_y)
+{
+	assert(dst && "store_plane_value_at_offset: dst is NULL");
+
+	_mm_store_ss(dst, _mm_add_ss(block, _mm_add_ss(_mm_mul_ss(step_x, offset_x), _mm_mul_ss(step_y, offset_y))));
+}
+#endif
+
 #define OC_INSIDE 0 // 0000
 #define OC_LEFT 1   // 0001
 #define OC_RIGHT 2  // 0010
@@ -109,18 +568,18 @@ struct vec2_int get_gb_intersection_point(const unsigned int oc, const struct ve
 	{
 	case OC_LEFT:
 		result.x = GB_LEFT;
-		result.y = p1->y + ((GB_LEFT - p1->x) * (p2->y - p1->y)) / (p2->x - p1->x);
+		result.y = p1->y + (int32_t)(((int64_t)(GB_LEFT - p1->x) * (p2->y - p1->y)) / (p2->x - p1->x));
 		break;
 	case OC_RIGHT:
 		result.x = GB_RIGHT;
-		result.y = p1->y + ((GB_RIGHT - p1->x) * (p2->y - p1->y)) / (p2->x - p1->x);
+		result.y = p1->y + (int32_t)(((int64_t)(GB_RIGHT - p1->x) * (p2->y - p1->y)) / (p2->x - p1->x));
 		break;
 	case OC_BOTTOM:
-		result.x = p1->x + ((GB_BOTTOM - p1->y) * (p2->x - p1->x)) / (p2->y - p1->y);
+		result.x = p1->x + (int32_t)(((int64_t)(GB_BOTTOM - p1->y) * (p2->x - p1->x)) / (p2->y - p1->y));
 		result.y = GB_BOTTOM;
 		break;
 	case OC_TOP:
-		result.x = p1->x + ((GB_TOP - p1->y) * (p2->x - p1->x)) / (p2->y - p1->y);
+		result.x = p1->x + (int32_t)(((int64_t)(GB_TOP - p1->y) * (p2->x - p1->x)) / (p2->y - p1->y));
 		result.y = GB_TOP;
 		break;
 	default:
@@ -131,27 +590,36 @@ struct vec2_int get_gb_intersection_point(const unsigned int oc, const struct ve
 	return result;
 }
 
-void lerp_vert_attributes(const struct vec2_int* vec_arr, const float *z_arr, const float *w_arr, const struct vec2_float *uv_arr, unsigned int p0i, unsigned int p1i, 
-	const struct vec2_int *clip, float *out_clipz, float *out_clipw, struct vec2_float *out_clipuv)
+void copy_varyings(float *dst, const float *src, const unsigned int varying_count)
+{
+	assert(dst && "copy_varyings: dst is NULL");
+	assert(src && "copy_varyings: src is NULL");
+
+	for (unsigned int j = 0; j < varying_count; ++j)
+		dst[j] = src[j];
+}
+
+void lerp_vert_attributes(const struct vec2_int* vec_arr, const float *z_arr, const float *w_arr, float (*varying_arr)[VARYING_COUNT], const unsigned int varying_count,
+	unsigned int p0i, unsigned int p1i, const struct vec2_int *clip, float *out_clipz, float *out_clipw, float *out_clipvaryings)
 {
 	assert(vec_arr && "lerp_vert_attributes: vec_arr is NULL");
 	assert(z_arr && "lerp_vert_attributes: z_arr is NULL");
 	assert(w_arr && "lerp_vert_attributes: w_arr is NULL");
-	assert(uv_arr && "lerp_vert_attributes: uv_arr is NULL");
+	assert(varying_arr && "lerp_vert_attributes: varying_arr is NULL");
 	assert(clip && "lerp_vert_attributes: clip is NULL");
 	assert(out_clipz && "lerp_vert_attributes: out_clipz is NULL");
 	assert(out_clipw && "lerp_vert_attributes: out_clipw is NULL");
-	assert(out_clipuv && "lerp_vert_attributes: out_clipuv is NULL");
+	assert(out_clipvaryings && "lerp_vert_attributes: out_clipvaryings is NULL");
 
-	const int32_t sub_multip = 1 << SUB_BITS;
+	const int64_t sub_multip = 1 << SUB_BITS;
 
 	/* Calculate weight */
-	uint32_t temp_x = vec_arr[p1i].x - vec_arr[p0i].x;
-	uint32_t temp_y = vec_arr[p1i].y - vec_arr[p0i].y;
-	uint32_t len_org = MUL_FIXED(temp_x, temp_x, sub_multip) + MUL_FIXED(temp_y, temp_y, sub_multip);
+	int64_t temp_x = vec_arr[p1i].x - vec_arr[p0i].x;
+	int64_t temp_y = vec_arr[p1i].y - vec_arr[p0i].y;
+	int64_t len_org = MUL_FIXED(temp_x, temp_x, sub_multip) + MUL_FIXED(temp_y, temp_y, sub_multip);
 	temp_x = clip->x - vec_arr[p0i].x;
 	temp_y = clip->y - vec_arr[p0i].y;
-	uint32_t len_int = MUL_FIXED(temp_x, temp_x, sub_multip) + MUL_FIXED(temp_y, temp_y, sub_multip);
+	int64_t len_int = MUL_FIXED(temp_x, temp_x, sub_multip) + MUL_FIXED(temp_y, temp_y, sub_multip);
 	float weight = (float)len_int / (float)len_org;
 	weight = sqrtf(weight);
 	assert(weight >= 0.0f && weight <= 1.0f && "lerp_vert_attributes: invalid weight");
@@ -165,29 +633,28 @@ void lerp_vert_attributes(const struct vec2_int* vec_arr, const float *z_arr, co
 	float interp_w = w_arr[p0i] + (w_arr[p1i] - w_arr[p0i]) * weight;
 	*out_clipw = interp_w;
 
-	/* Interpolate uv */
-	float uv0 = uv_arr[p0i].x * w_arr[p0i];
-	float uv1 = uv_arr[p1i].x * w_arr[p1i];
-	out_clipuv->x = (uv0 + (uv1 - uv0) * weight) / interp_w;
-	assert(out_clipuv->x >= 0.0f && out_clipuv->x <= 1.0f && "lerp_vert_attributes: Invalid interpolated u");
-
-	uv0 = uv_arr[p0i].y * w_arr[p0i];
-	uv1 = uv_arr[p1i].y * w_arr[p1i];
-	out_clipuv->y = (uv0 + (uv1 - uv0) * weight) / interp_w;
-	assert(out_clipuv->y >= 0.0f && out_clipuv->y <= 1.0f && "lerp_vert_attributes: Invalid interpolated v");
+	/* Interpolate the varyings with perspective correction */
+	for (unsigned int j = 0; j < varying_count; ++j)
+	{
+		const float val0 = varying_arr[p0i][j] * w_arr[p0i];
+		const float val1 = varying_arr[p1i][j] * w_arr[p1i];
+		out_clipvaryings[j] = (val0 + (val1 - val0) * weight) / interp_w;
+	}
+	assert(out_clipvaryings[VARYING_UV] >= 0.0f && out_clipvaryings[VARYING_UV] <= 1.0f && "lerp_vert_attributes: Invalid interpolated u");
+	assert(out_clipvaryings[VARYING_UV + 1] >= 0.0f && out_clipvaryings[VARYING_UV + 1] <= 1.0f && "lerp_vert_attributes: Invalid interpolated v");
 }
 
 /* Handles viewport and guard-band clipping.
  * Returns true when the triangle(s) should be rasterized, 
  * false if it/they can be discarded. */
-bool clip(struct vec2_int *work_poly, float *work_z, float *work_w, struct vec2_float *work_uv, 
+bool clip(struct vec2_int *work_poly, float *work_z, float *work_w, float (*work_varyings)[VARYING_COUNT], const unsigned int varying_count,
 	unsigned int *work_vert_count, unsigned int *work_index_count, unsigned int *work_poly_indices,
 	const struct vec2_int *target_min, const struct vec2_int *target_max)
 {
 	assert(work_poly && "clip: work_poly is NULL");
 	assert(work_z && "clip: work_z is NULL");
 	assert(work_w && "clip: work_w is NULL");
-	assert(work_uv && "clip: work_uv is NULL");
+	assert(work_varyings && "clip: work_varyings is NULL");
 	assert(work_vert_count && "clip: work_vert_count is NULL");
 	assert(work_index_count && "clip: work_index_count is NULL");
 	assert(work_poly_indices && "clip: work_poly_indices is NULL");
@@ -246,7 +713,7 @@ bool clip(struct vec2_int *work_poly, float *work_z, float *work_w, struct vec2_
 			struct vec2_int clipped_poly[7];
 			float clipped_z[7];
 			float clipped_w[7];
-			struct vec2_float clipped_uv[7];
+			float clipped_varyings[7][VARYING_COUNT];
 			unsigned int clipped_index_count = 0;
 			unsigned int clipped_poly_indices[15];
 
@@ -267,7 +734,7 @@ bool clip(struct vec2_int *work_poly, float *work_z, float *work_w, struct vec2_
 							clipped_poly[clipped_vert_count] = work_poly[work_poly_indices[vert_index + 1]];
 							clipped_z[clipped_vert_count] = work_z[work_poly_indices[vert_index + 1]];
 							clipped_w[clipped_vert_count] = work_w[work_poly_indices[vert_index + 1]];
-							clipped_uv[clipped_vert_count] = work_uv[work_poly_indices[vert_index + 1]];
+							copy_varyings(&clipped_varyings[clipped_vert_count][0], &work_varyings[work_poly_indices[vert_index + 1]][0], varying_count);
 							clipped_poly_indices[clipped_index_count] = clipped_vert_count;
 							++clipped_vert_count;
 							++clipped_index_count;
@@ -278,8 +745,8 @@ bool clip(struct vec2_int *work_poly, float *work_z, float *work_w, struct vec2_
 							clipped_poly[clipped_vert_count] = get_gb_intersection_point(oc, &work_poly[work_poly_indices[vert_index]], &work_poly[work_poly_indices[vert_index + 1]]);
 							clipped_poly_indices[clipped_index_count] = clipped_vert_count;
 
-							lerp_vert_attributes(&work_poly[0], &work_z[0], &work_w[0], &work_uv[0], work_poly_indices[vert_index], work_poly_indices[vert_index + 1]
-								, &clipped_poly[clipped_vert_count], &clipped_z[clipped_vert_count], &clipped_w[clipped_vert_count], &clipped_uv[clipped_vert_count]);
+							lerp_vert_attributes(&work_poly[0], &work_z[0], &work_w[0], work_varyings, varying_count, work_poly_indices[vert_index], work_poly_indices[vert_index + 1]
+								, &clipped_poly[clipped_vert_count], &clipped_z[clipped_vert_count], &clipped_w[clipped_vert_count], &clipped_varyings[clipped_vert_count][0]);
 
 							++clipped_vert_count;
 							++clipped_index_count;
@@ -293,8 +760,8 @@ bool clip(struct vec2_int *work_poly, float *work_z, float *work_w, struct vec2_
 							clipped_poly[clipped_vert_count] = get_gb_intersection_point(oc, &work_poly[work_poly_indices[vert_index + 1]], &work_poly[work_poly_indices[vert_index]]);
 							clipped_poly_indices[clipped_index_count] = clipped_vert_count;
 
-							lerp_vert_attributes(&work_poly[0], &work_z[0], &work_w[0], &work_uv[0], work_poly_indices[vert_index + 1], work_poly_indices[vert_index]
-								, &clipped_poly[clipped_vert_count], &clipped_z[clipped_vert_count], &clipped_w[clipped_vert_count], &clipped_uv[clipped_vert_count]);
+							lerp_vert_attributes(&work_poly[0], &work_z[0], &work_w[0], work_varyings, varying_count, work_poly_indices[vert_index + 1], work_poly_indices[vert_index]
+								, &clipped_poly[clipped_vert_count], &clipped_z[clipped_vert_count], &clipped_w[clipped_vert_count], &clipped_varyings[clipped_vert_count][0]);
 
 							++clipped_vert_count;
 							++clipped_index_count;
@@ -302,7 +769,7 @@ bool clip(struct vec2_int *work_poly, float *work_z, float *work_w, struct vec2_
 							clipped_poly[clipped_vert_count] = work_poly[work_poly_indices[vert_index + 1]];
 							clipped_z[clipped_vert_count] = work_z[work_poly_indices[vert_index + 1]];
 							clipped_w[clipped_vert_count] = work_w[work_poly_indices[vert_index + 1]];
-							clipped_uv[clipped_vert_count] = work_uv[work_poly_indices[vert_index + 1]];
+							copy_varyings(&clipped_varyings[clipped_vert_count][0], &work_varyings[work_poly_indices[vert_index + 1]][0], varying_count);
 							clipped_poly_indices[clipped_index_count] = clipped_vert_count;
 							++clipped_vert_count;
 							++clipped_index_count;
@@ -321,7 +788,7 @@ bool clip(struct vec2_int *work_poly, float *work_z, float *work_w, struct vec2_
 					work_poly[j] = clipped_poly[j];
 					work_z[j] = clipped_z[j];
 					work_w[j] = clipped_w[j];
-					work_uv[j] = clipped_uv[j];
+					copy_varyings(&work_varyings[j][0], &clipped_varyings[j][0], varying_count);
 				}
 
 				*work_index_count = clipped_index_count;
@@ -353,132 +820,1303 @@ bool clip(struct vec2_int *work_poly, float *work_z, float *work_w, struct vec2_
 	}
 }
 
-void rasterizer_rasterize(uint32_t *render_target, uint32_t *depth_buf, const struct vec2_int *target_size, const struct vec2_int *rasterize_area_min, const struct vec2_int *rasterize_area_max,
-	const struct vec4_float *vert_buf, const struct vec2_float *uv_buf, const unsigned int *ind_buf, const unsigned int index_count, 
-	const uint32_t *texture, const struct vec2_int *texture_size)
+/* Covered quads waiting for the pixel shader */
+struct quad_queue
 {
-	assert(render_target && "rasterizer_rasterize: render_target is NULL");
-	assert(depth_buf && "rasterizer_rasterize: depth_buf is NULL");
-	assert(target_size && "rasterizer_rasterize: target_size is NULL");
-	assert(rasterize_area_min && "rasterizer_rasterize: rasterize_area_min is NULL");
-	assert(rasterize_area_max && "rasterizer_rasterize: rasterize_area_max is NULL");
-	assert(vert_buf && "rasterizer_rasterize: vert_buf is NULL");
-	assert(uv_buf && "rasterizer_rasterize: uv_buf is NULL");
-	assert(ind_buf && "rasterizer_rasterize: ind_buf is NULL");
-	assert(texture && "rasterizer_rasterize: texture is NULL");
-	assert(texture_size && "rasterizer_rasterize: texture_size is NULL");
-	assert(index_count % 3 == 0 && "rasterizer_rasterize: index count is not valid");
-	assert(SUB_BITS == 4 && "rasterizer_rasterize: SUB_BITS has changed, check the assert below.");
-	assert(target_size->x <= (2 * -(GB_MIN)) && target_size->y <= (2 * -(GB_MIN)) && "rasterizer_rasterize: render target is too large");
-	assert(rasterize_area_min->x >= 0 && rasterize_area_min->y >= 0 && "rasterizer_rasterize: invalid rasterize_area_min");
-#ifndef USE_TILES
-	assert(rasterize_area_max->x < target_size->x && rasterize_area_max->y < target_size->y && "rasterizer_rasterize: invalid rasterize_are_max");
+	struct rasterizer_quad_packet packet;
+	uint32_t pixel_index[RASTERIZER_PACKET_QUADS]; /* Of the first pixel of each quad */
+	uint32_t sample_mask[RASTERIZER_PACKET_QUADS]; /* Bit sample * 4 + pixel is set for the covered samples */
+	uint32_t sample_count;
+	uint32_t *render_target;
+	rasterizer_pixel_shader pixel_shader;
+	const void *pixel_shader_data;
+	enum rasterizer_blend_mode blend_mode;
+	uint32_t blend_alpha;
+#ifdef USE_SIMD
+	__m128i blend_alpha_vec; /* For 16bit channels */
 #endif
-	assert(rasterize_area_min->x < rasterize_area_max->x && rasterize_area_min->y < rasterize_area_max->y && "rasterizer_rasterize: rasterize_area_min must be smaller than rasterize_area_max");
+};
+
+/* Runs the pixel shader for the queued quads, blends and writes its output */
+void flush_quad_queue(struct quad_queue *queue)
+{
+	assert(queue && "flush_quad_queue: queue is NULL");
+
+	struct rasterizer_quad_packet *packet = &queue->packet;
+	if (packet->quad_count == 0)
+		return;
+
+	queue->pixel_shader(packet, queue->pixel_shader_data);
+
+	uint32_t *render_target = queue->render_target;
+	const uint32_t sample_count = queue->sample_count;
+	for (uint32_t quad = 0; quad < packet->quad_count; ++quad)
+	{
+		const uint32_t pixel_index = queue->pixel_index[quad];
+		const uint32_t sample_mask = queue->sample_mask[quad];
 #ifdef USE_SIMD
-	assert(rasterize_area_min->x % 2 == 0 && "rasterizer_rasterize: rasterize_area_min must be even");
-	assert(rasterize_area_min->y % 2 == 0 && "rasterizer_rasterize: rasterize_area_min must be even");
-	assert(rasterize_area_max->x % 2 == 1 && "rasterizer_rasterize: rasterize_area_max must be odd");
-	assert(rasterize_area_max->y % 2 == 1 && "rasterizer_rasterize: rasterize_area_max must be odd");
-#ifdef USE_TILES
-	assert(rasterize_area_min->x % TILE_SIZE == 0 && "rasterizer_rasterize: When using tiles rasterize areas must be aligned to tiles.");
-	assert(rasterize_area_min->y % TILE_SIZE == 0 && "rasterizer_rasterize: When using tiles rasterize areas must be aligned to tiles.");
-	assert(rasterize_area_max->x - rasterize_area_min->x == TILE_SIZE - 1 && "rasterizer_rasterize: When using tiles rasterize areas must be tile sized.");
-	assert(rasterize_area_max->y - rasterize_area_min->y == TILE_SIZE - 1 && "rasterizer_rasterize: When using tiles rasterize areas must be tile sized.");
+		const __m128i color = _mm_loadu_si128((const __m128i *)&packet->colors[quad * 4]);
+		for (uint32_t sample = 0; sample < sample_count; ++sample)
+		{
+			const uint32_t mask = (sample_mask >> (sample * 4)) & 0xF;
+			if (mask == 0)
+				continue;
+
+			/* The pixels of a block are next to each other in the render target, the samples of the block follow them */
+			uint32_t *target = &render_target[pixel_index * sample_count + sample * 4];
+			uint32_t sample_colors[4];
+			if (queue->blend_mode != RASTERIZER_BLEND_NONE)
+				_mm_storeu_si128((__m128i *)sample_colors, blend_block(color, _mm_loadu_si128((const __m128i *)target), queue->blend_alpha_vec, queue->blend_mode));
+			else
+				_mm_storeu_si128((__m128i *)sample_colors, color);
+			for (uint32_t pixel = 0; pixel < 4; ++pixel)
+			{
+				if (mask & (1 << pixel))
+					target[pixel] = sample_colors[pixel];
+			}
+		}
+#else
+		for (uint32_t pixel = 0; pixel < 4; ++pixel)
+		{
+			for (uint32_t sample = 0; sample < sample_count; ++sample)
+			{
+				if ((sample_mask & (1 << (sample * 4 + pixel))) == 0)
+					continue;
+
+				/* The samples of a pixel are next to each other */
+				const uint32_t sample_index = (pixel_index + pixel) * sample_count + sample;
+				uint32_t color = packet->colors[quad * 4 + pixel];
+				if (queue->blend_mode != RASTERIZER_BLEND_NONE)
+					color = blend_color(color, render_target[sample_index], queue->blend_alpha, queue->blend_mode);
+				render_target[sample_index] = color;
+			}
+		}
 #endif
+	}
+	packet->quad_count = 0;
+}
+
+#ifdef USE_SIMD
+#define SIMD_QUAD_BUFFER_SIZE 64
+
+/* Quads which passed the depth and stencil tests, waiting to be colored.
+ * Only the varyings used by the draw are set, they are still multiplied by 1/w.
+ * With coarse shading the varyings are not set, they are in the coarse pixels instead. */
+struct simd_quad_buffer
+{
+	uint32_t count;
+	uint32_t coarse_count;
+	uint32_t pixel_index[SIMD_QUAD_BUFFER_SIZE];
+	uint32_t coarse_index[SIMD_QUAD_BUFFER_SIZE]; /* Coarse pixel of the quad with coarse shading */
+	int32_t x[SIMD_QUAD_BUFFER_SIZE];
+	int32_t y[SIMD_QUAD_BUFFER_SIZE];
+	__m128i mask[RASTERIZER_MSAA_SAMPLES][SIMD_QUAD_BUFFER_SIZE]; /* Per sample, only the first is used without multisampling */
+	__m128 w[SIMD_QUAD_BUFFER_SIZE];
+	__m128 varyings[VARYING_COUNT][SIMD_QUAD_BUFFER_SIZE];
+};
+
+struct simd_constants;
+typedef void(*simd_color_function)(const struct simd_constants *c);
+
+/* Values shared by all tris of a rasterizer_rasterize call */
+struct simd_constants
+{
+	uint32_t *render_target;
+	uint32_t *depth_buf;
+	const uint32_t *texture;
+	const struct rasterizer_shadow *shadow;
+	struct quad_queue *queue;
+	struct simd_quad_buffer *quads;
+	struct simd_quad_buffer *coarse; /* Values of the coarse pixels packed 4 to a vector, only w and the varyings are used */
+	simd_color_function color_quads;
+	struct vec2_int origin; /* Of the rasterize area, for the pixel coordinates of the queued quads */
+	uint32_t attribute_count; /* Interpolated attributes */
+	uint32_t sample_count;
+	uint32_t shading_rate; /* log2 of the coarse pixel size */
+	bool depth_bounds_test;
+	bool depth_write;
+	bool stencil_test;
+	enum rasterizer_compare_func stencil_func;
+	enum rasterizer_stencil_op stencil_fail_op;
+	enum rasterizer_stencil_op depth_fail_op;
+	enum rasterizer_stencil_op pass_op;
+	uint32_t pixel_row_step; /* Between rows of 2x2 blocks */
+	uint32_t pixel_count;
+	uint32_t texel_count;
+	__m128i step_size;
+	__m128i stencil_ref;
+	__m128i depth_bounds_min; /* In DEPTH_BITS fixed point */
+	__m128i depth_bounds_max;
+	__m128i stencil_ref_masked;
+	__m128i stencil_read_mask;
+	__m128i stencil_write_mask;
+	__m128i texture_width;
+	__m128 tex_coor_x_max;
+	__m128 tex_coor_y_max;
+	__m128 shadow_scale_x;
+	__m128 shadow_scale_y;
+	__m128 shadow_offset_x;
+	__m128 shadow_offset_y;
+	__m128 shadow_depth_offset;
+	__m128i shadow_max_x;
+	__m128i shadow_max_y;
+	__m128i shadow_width;
+	__m128i shadow_ambient;
+	__m128i shadow_light;
+	__m128i blend_alpha; /* For 16bit channels */
+};
+
+/* Per tri setup, the edge functions and plane equations are for the first 2x2 block.
+ * Only the varyings used by the kernel are set. */
+struct simd_triangle
+{
+	struct vec2_int min;
+	struct vec2_int max;
+	int32_t w0_row[RASTERIZER_MSAA_SAMPLES]; /* Per sample, only the first is used without multisampling */
+	int32_t w1_row[RASTERIZER_MSAA_SAMPLES];
+	int32_t w2_row[RASTERIZER_MSAA_SAMPLES];
+	int32_t step_x_12;
+	int32_t step_x_20;
+	int32_t step_x_01;
+	int32_t step_y_12;
+	int32_t step_y_20;
+	int32_t step_y_01;
+	int32_t double_area; /* For the inside test of the coarse pixel centers */
+	uint32_t pixel_index_row;
+	__m128 z_row;
+	__m128i z_step_x;
+	__m128 z_step_y;
+	__m128i z_shift_right;
+	__m128i z_shift_left;
+	__m128i z_sample_offset[RASTERIZER_MSAA_SAMPLES]; /* From the pixel center, only with multisampling */
+	__m128 w_row;
+	__m128 w_step_x;
+	__m128 w_step_y;
+	__m128 varying_row[VARYING_COUNT];
+	__m128 varying_step_x[VARYING_COUNT];
+	__m128 varying_step_y[VARYING_COUNT];
+};
+
+/* The first covered pixel of a 2x2 block for each coverage mask */
+const uint8_t coarse_first_lane[16] = { 0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0 };
+
+/* Rasterizes a tri in 2x2 blocks, only coverage, depth and stencil are done here.
+ * The surviving quads are queued to c->quads and colored by c->color_quads when the buffer is full and at the end of the draw.
+ * With multisampling coverage, depth and stencil are done for each sample, the varyings are only needed at the pixel centers.
+ * Only called by the kernels generated below with compile time constant flags,
+ * once this is inlined to them the branches depending on the flags are gone from the inner loop.
+ * Stencil, depth write and shadows are rarely used and are left as branches. */
+RPLNN_FORCE_INLINE void rasterize_triangle_simd(const struct simd_constants *c, const struct simd_triangle *tri,
+	const bool multisample, const bool depth_test, const bool color_write, const bool texturing, const bool attributes)
+{
+	assert(c && "rasterize_triangle_simd: c is NULL");
+	assert(tri && "rasterize_triangle_simd: tri is NULL");
+
+	const unsigned int attribute_count = attributes ? c->attribute_count : 0;
+	const unsigned int sample_count = multisample ? RASTERIZER_MSAA_SAMPLES : 1;
+
+	/* Local copies, the compiler would have to reload them after every write to the buffers */
+	uint32_t *depth_buf = c->depth_buf;
+	struct simd_quad_buffer *quads = c->quads;
+	/* Coarse pixel of the previous queued quad, 4x4 coarse pixels continue to the next quad of the row */
+	const uint32_t shading_rate = c->shading_rate;
+	const int32_t coarse_mask = (1 << shading_rate) - 1;
+	const float coarse_center = (float)coarse_mask * 0.5f;
+	struct simd_quad_buffer *coarse = c->coarse;
+	int32_t coarse_x = -1;
+	int32_t coarse_y = -1;
+	const struct rasterizer_shadow *shadow = c->shadow;
+	const bool depth_write = c->depth_write;
+	const bool depth_bounds_test = c->depth_bounds_test;
+	const bool stencil_test = c->stencil_test;
+	const __m128i step_size = c->step_size;
+	const __m128i xor_mask = _mm_set_epi32(~(uint32_t)0, ~(uint32_t)0, ~(uint32_t)0, ~(uint32_t)0);
+	const __m128i depth_mask = _mm_set_epi32(0x00ffffff, 0x00ffffff, 0x00ffffff, 0x00ffffff);
+#ifdef USE_RASTER_STATS
+	struct rasterizer_stats stats = { 0 };
 #endif
 
-	/* Sub-pixel constants */
+	const struct vec2_int min = tri->min;
+	const struct vec2_int max = tri->max;
 	const int32_t sub_multip = 1 << SUB_BITS;
 	const int32_t half_pixel = sub_multip >> 1;
-	const int32_t sub_mask = sub_multip - 1;
-
-	/* Reserve enough space for possible polys created by clipping */
-	struct vec2_int work_poly[7];
-	float work_z[7];
-	float work_w[7]; /* Note that this is actually the reciprocal of w */
-	struct vec2_float work_uv[7];
-	unsigned int work_vert_count = 3;
-	unsigned int work_index_count = 3;
-	unsigned int work_poly_indices[15];
+	const int32_t step_x_12 = tri->step_x_12;
+	const int32_t step_x_20 = tri->step_x_20;
+	const int32_t step_x_01 = tri->step_x_01;
+	const int32_t step_y_12 = tri->step_y_12;
+	const int32_t step_y_20 = tri->step_y_20;
+	const int32_t step_y_01 = tri->step_y_01;
+	const __m128i w0_step_x = _mm_set_epi32(step_x_12 * 2, step_x_12 * 2, step_x_12 * 2, step_x_12 * 2);
+	const __m128i w1_step_x = _mm_set_epi32(step_x_20 * 2, step_x_20 * 2, step_x_20 * 2, step_x_20 * 2);
+	const __m128i w2_step_x = _mm_set_epi32(step_x_01 * 2, step_x_01 * 2, step_x_01 * 2, step_x_01 * 2);
+	uint32_t pixel_index_row = tri->pixel_index_row;
+
+	__m128 z_row = tri->z_row;
+	const __m128i z_step_x = tri->z_step_x;
+	const __m128 z_step_y = tri->z_step_y;
+	const __m128i z_shift_right = tri->z_shift_right;
+	const __m128i z_shift_left = tri->z_shift_left;
+
+	int32_t w0_row[RASTERIZER_MSAA_SAMPLES];
+	int32_t w1_row[RASTERIZER_MSAA_SAMPLES];
+	int32_t w2_row[RASTERIZER_MSAA_SAMPLES];
+	__m128i z_sample_offset[RASTERIZER_MSAA_SAMPLES];
+	for (unsigned int sample = 0; sample < sample_count; ++sample)
+	{
+		w0_row[sample] = tri->w0_row[sample];
+		w1_row[sample] = tri->w1_row[sample];
+		w2_row[sample] = tri->w2_row[sample];
+		z_sample_offset[sample] = multisample ? tri->z_sample_offset[sample] : _mm_setzero_si128();
+	}
 
-	for (unsigned int i = 0; i < index_count; i += 3)
+	__m128 w_row = _mm_setzero_ps();
+	__m128 w_step_x = _mm_setzero_ps();
+	__m128 w_step_y = _mm_setzero_ps();
+	if (color_write)
 	{
-		/* Skip the tri if any of its vertices is outside the near/far planes.
-		 * A bit hacky but good enough for the time being. */
-		if (vert_buf[ind_buf[i]].z < 0.0f || vert_buf[ind_buf[i]].z > vert_buf[ind_buf[i]].w ||
-			vert_buf[ind_buf[i + 1]].z < 0.0f || vert_buf[ind_buf[i + 1]].z > vert_buf[ind_buf[i + 1]].w ||
-			vert_buf[ind_buf[i + 2]].z < 0.0f || vert_buf[ind_buf[i + 2]].z > vert_buf[ind_buf[i + 2]].w)
-			continue;
+		w_row = tri->w_row;
+		w_step_x = tri->w_step_x;
+		w_step_y = tri->w_step_y;
+	}
 
-		const int32_t half_width = target_size->x / 2;
-		const int32_t half_height = target_size->y / 2;
+	/* Texture coordinates multiplied by 1/w */
+	__m128 uw_row = _mm_setzero_ps();
+	__m128 uw_step_x = _mm_setzero_ps();
+	__m128 uw_step_y = _mm_setzero_ps();
+	__m128 vw_row = _mm_setzero_ps();
+	__m128 vw_step_x = _mm_setzero_ps();
+	__m128 vw_step_y = _mm_setzero_ps();
+	if (texturing)
+	{
+		uw_row = tri->varying_row[VARYING_UV];
+		uw_step_x = tri->varying_step_x[VARYING_UV];
+		uw_step_y = tri->varying_step_y[VARYING_UV];
+		vw_row = tri->varying_row[VARYING_UV + 1];
+		vw_step_x = tri->varying_step_x[VARYING_UV + 1];
+		vw_step_y = tri->varying_step_y[VARYING_UV + 1];
+	}
 
-		struct vec2_int rast_min;
-		rast_min.x = TO_FIXED(rasterize_area_min->x - half_width, sub_multip);
-		rast_min.y = TO_FIXED(rasterize_area_min->y - half_height, sub_multip);
-		struct vec2_int rast_max;
-		rast_max.x = TO_FIXED(rasterize_area_max->x - half_width, sub_multip);
-		rast_max.y = TO_FIXED(rasterize_area_max->y - half_height, sub_multip);
+	/* Light space position, x, y, z and w multiplied by 1/w */
+	__m128 light_row[4];
+	__m128 light_step_x[4];
+	__m128 light_step_y[4];
+	for (unsigned int j = 0; j < 4; ++j)
+	{
+		light_row[j] = shadow ? tri->varying_row[VARYING_LIGHT + j] : _mm_setzero_ps();
+		light_step_x[j] = shadow ? tri->varying_step_x[VARYING_LIGHT + j] : _mm_setzero_ps();
+		light_step_y[j] = shadow ? tri->varying_step_y[VARYING_LIGHT + j] : _mm_setzero_ps();
+	}
 
-		work_poly[0].x = TO_FIXED(vert_buf[ind_buf[i]].x / vert_buf[ind_buf[i]].w * half_width, sub_multip);
-		work_poly[0].y = TO_FIXED(vert_buf[ind_buf[i]].y / vert_buf[ind_buf[i]].w * half_height, sub_multip);
-		work_z[0] = vert_buf[ind_buf[i]].z / vert_buf[ind_buf[i]].w;
-		work_w[0] = 1.0f / vert_buf[ind_buf[i]].w;
-		work_poly[1].x = TO_FIXED(vert_buf[ind_buf[i + 1]].x / vert_buf[ind_buf[i + 1]].w * half_width, sub_multip);
-		work_poly[1].y = TO_FIXED(vert_buf[ind_buf[i + 1]].y / vert_buf[ind_buf[i + 1]].w * half_height, sub_multip);
-		work_z[1] = vert_buf[ind_buf[i + 1]].z / vert_buf[ind_buf[i + 1]].w;
-		work_w[1] = 1.0f / vert_buf[ind_buf[i + 1]].w;
-		work_poly[2].x = TO_FIXED(vert_buf[ind_buf[i + 2]].x / vert_buf[ind_buf[i + 2]].w * half_width, sub_multip);
-		work_poly[2].y = TO_FIXED(vert_buf[ind_buf[i + 2]].y / vert_buf[ind_buf[i + 2]].w * half_height, sub_multip);
-		work_z[2] = vert_buf[ind_buf[i + 2]].z / vert_buf[ind_buf[i + 2]].w;
-		work_w[2] = 1.0f / vert_buf[ind_buf[i + 2]].w;
-		work_poly_indices[0] = 0; work_poly_indices[1] = 1; work_poly_indices[2] = 2;
-		work_vert_count = 3;
-		work_index_count = 3;
-		
-		work_uv[0] = uv_buf[ind_buf[i]];
-		work_uv[1] = uv_buf[ind_buf[i + 1]];
-		work_uv[2] = uv_buf[ind_buf[i + 2]];
+	/* Attributes multiplied by 1/w */
+	__m128 attribute_row[RASTERIZER_MAX_ATTRIBUTES];
+	__m128 attribute_step_x[RASTERIZER_MAX_ATTRIBUTES];
+	__m128 attribute_step_y[RASTERIZER_MAX_ATTRIBUTES];
+	for (unsigned int j = 0; j < attribute_count; ++j)
+	{
+		attribute_row[j] = tri->varying_row[VARYING_ATTRIBUTES + j];
+		attribute_step_x[j] = tri->varying_step_x[VARYING_ATTRIBUTES + j];
+		attribute_step_y[j] = tri->varying_step_y[VARYING_ATTRIBUTES + j];
+	}
 
-		if (!clip(&(work_poly[0]), &(work_z[0]), &(work_w[0]), &(work_uv[0]),
-			&work_vert_count, &work_index_count, &(work_poly_indices[0]), &rast_min, &rast_max))
-			continue;
+	__m128i point_x;
+	__m128i point_y = _mm_set_epi32(min.y + sub_multip, min.y + sub_multip, min.y, min.y);
+	for (; ((int32_t *)&point_y)[0] <= max.y; point_y = _mm_add_epi32(point_y, step_size))
+	{
+		__m128i w0[RASTERIZER_MSAA_SAMPLES];
+		__m128i w1[RASTERIZER_MSAA_SAMPLES];
+		__m128i w2[RASTERIZER_MSAA_SAMPLES];
+		for (unsigned int sample = 0; sample < sample_count; ++sample)
+		{
+			w0[sample] = _mm_set_epi32(w0_row[sample] + step_y_12 + step_x_12, w0_row[sample] + step_y_12, w0_row[sample] + step_x_12, w0_row[sample]);
+			w1[sample] = _mm_set_epi32(w1_row[sample] + step_y_20 + step_x_20, w1_row[sample] + step_y_20, w1_row[sample] + step_x_20, w1_row[sample]);
+			w2[sample] = _mm_set_epi32(w2_row[sample] + step_y_01 + step_x_01, w2_row[sample] + step_y_01, w2_row[sample] + step_x_01, w2_row[sample]);
+		}
 
-		for (unsigned ind_i = 0; ind_i < work_index_count; ind_i += 3)
+		uint32_t pixel_index_start = pixel_index_row;
+
+		__m128i z = _mm_cvtps_epi32(z_row);
+		__m128 interp_w = w_row;
+		__m128 u_w = uw_row;
+		__m128 v_w = vw_row;
+		__m128 light[4];
+		light[0] = light_row[0];
+		light[1] = light_row[1];
+		light[2] = light_row[2];
+		light[3] = light_row[3];
+		__m128 attribute[RASTERIZER_MAX_ATTRIBUTES];
+		for (unsigned int j = 0; j < attribute_count; ++j)
+			attribute[j] = attribute_row[j];
+
+		point_x = _mm_set_epi32(min.x + sub_multip, min.x, min.x + sub_multip, min.x);
+		for (; ((int32_t *)&point_x)[0] <= max.x; point_x = _mm_add_epi32(point_x, step_size))
 		{
-			const unsigned int i0 = work_poly_indices[ind_i];
-			const unsigned int i1 = work_poly_indices[ind_i + 1];
-			const unsigned int i2 = work_poly_indices[ind_i + 2];
+			/* Covered samples
+			 * Compare for less than zero
+			 * (a0 < b0) ? 0xffffffff : 0x0
+			 * if anything is >= 0 then there will be 0x0 bytes */
+			__m128i sample_mask[RASTERIZER_MSAA_SAMPLES];
+			__m128i mask = _mm_setzero_si128();
+			for (unsigned int sample = 0; sample < sample_count; ++sample)
+			{
+				__m128i temp_mask = _mm_or_si128(w0[sample], w1[sample]);
+				temp_mask = _mm_cmplt_epi32(_mm_or_si128(temp_mask, w2[sample]), _mm_setzero_si128());
+				/* Invert with xor */
+				sample_mask[sample] = _mm_xor_si128(xor_mask, temp_mask);
+				mask = _mm_or_si128(mask, sample_mask[sample]);
+			}
+			RASTER_STATS_ADD(stats, quads_tested, 1);
+			/* Or all bits and check if any were set */
+			if (_mm_movemask_epi8(mask) != 0)
+			{
+				RASTER_STATS_ADD(stats, quads_covered, 1);
+				/* Only the samples which pass the tests are left in the masks */
+				mask = _mm_setzero_si128();
+				for (unsigned int sample = 0; sample < sample_count; ++sample)
+				{
+					if (multisample && _mm_movemask_epi8(sample_mask[sample]) == 0)
+						continue;
 
-			/* Bounding box */
-			struct vec2_int min;
-			struct vec2_int max;
+					/* Back to DEPTH_BITS, values at the edges can be slightly negative as they are extrapolated. */
+					__m128i z_depth = _mm_sll_epi32(_mm_sra_epi32(multisample ? _mm_add_epi32(z, z_sample_offset[sample]) : z, z_shift_right), z_shift_left);
+					z_depth = _mm_andnot_si128(_mm_srai_epi32(z_depth, 31), z_depth);
+
+					/* Samples outside of the depth bounds are dropped like uncovered ones, the depth buffer is not touched when none are left */
+					if (depth_bounds_test)
+					{
+						sample_mask[sample] = _mm_andnot_si128(_mm_or_si128(_mm_cmplt_epi32(z_depth, c->depth_bounds_min), _mm_cmpgt_epi32(z_depth, c->depth_bounds_max)),
+							sample_mask[sample]);
+						if (_mm_movemask_epi8(sample_mask[sample]) == 0)
+							continue;
+					}
+
+					/* The samples of a block follow each other */
+					const uint32_t sample_index = pixel_index_start * sample_count + sample * 4;
+					assert(sample_index + 3 < c->pixel_count * sample_count && "rasterize_triangle_simd: invalid pixel_index");
+					/* force the buffer to be aligned and change the load to _mm_load_si128 */
+					__m128i depth = _mm_loadu_si128((const __m128i *)&depth_buf[sample_index]);
+					__m128i old_depth = _mm_and_si128(depth, depth_mask);
+
+					__m128i temp_mask;
+					if (depth_test)
+					{
+						temp_mask = _mm_cmplt_epi32(z_depth, old_depth);
+					}
+					else
+					{
+						temp_mask = xor_mask;
+						/* z can be exactly 1 << DEPTH_BITS which would overflow to stencil */
+						z_depth = select_si128(_mm_cmpgt_epi32(z_depth, depth_mask), depth_mask, z_depth);
+					}
+
+					/* Lanes which update the depth buffer entry */
+					__m128i covered = sample_mask[sample];
+					__m128i buf_mask;
+					__m128i stencil_bits;
+					if (stencil_test)
+					{
+						/* Stencil shares the load with depth */
+						__m128i stencil = _mm_srli_epi32(depth, DEPTH_BITS);
+						__m128i stencil_mask = _mm_and_si128(covered,
+							stencil_test_passes_block(c->stencil_func, c->stencil_ref_masked, _mm_and_si128(stencil, c->stencil_read_mask)));
+						__m128i pass_mask = _mm_and_si128(stencil_mask, temp_mask);
+
+						__m128i new_stencil = select_si128(_mm_andnot_si128(stencil_mask, covered), stencil_op_block(c->stencil_fail_op, stencil, c->stencil_ref), stencil);
+						new_stencil = select_si128(_mm_andnot_si128(temp_mask, stencil_mask), stencil_op_block(c->depth_fail_op, stencil, c->stencil_ref), new_stencil);
+						new_stencil = select_si128(pass_mask, stencil_op_block(c->pass_op, stencil, c->stencil_ref), new_stencil);
+						new_stencil = select_si128(c->stencil_write_mask, new_stencil, stencil);
+						stencil_bits = _mm_slli_epi32(new_stencil, DEPTH_BITS);
+
+						buf_mask = covered;
+						covered = pass_mask;
+					}
+					else
+					{
+						stencil_bits = _mm_andnot_si128(depth_mask, depth);
+						covered = _mm_and_si128(covered, temp_mask);
+						buf_mask = depth_write ? covered : _mm_setzero_si128();
+					}
+
+					if (_mm_movemask_epi8(buf_mask) != 0x0)
+					{
+						if (depth_write)
+							depth = _mm_or_si128(stencil_bits, select_si128(covered, z_depth, old_depth));
+						else
+							depth = _mm_or_si128(stencil_bits, old_depth);
+
+						/* Lanes outside of buf_mask keep their old value.
+						 * The whole block is in the same rasterize area so no other thread writes to it. */
+						_mm_storeu_si128((__m128i *)&depth_buf[sample_index], depth);
+					}
+
+					sample_mask[sample] = covered;
+					mask = _mm_or_si128(mask, covered);
+				}
+
+				RASTER_STATS_ADD(stats, quads_depth_passed, _mm_movemask_epi8(mask) != 0x0);
+				RASTER_STATS_ADD(stats, pixels_written, block_pixel_counts[_mm_movemask_ps(_mm_castsi128_ps(mask))]);
+				if (color_write && _mm_movemask_epi8(mask) != 0x0)
+				{
+					/* Colored in a separate loop, only the values it needs are stored */
+					const uint32_t quad = quads->count;
+					quads->pixel_index[quad] = pixel_index_start;
+					const int32_t x = (((int32_t *)&point_x)[0] - half_pixel) / sub_multip + c->origin.x;
+					const int32_t y = (((int32_t *)&point_y)[0] - half_pixel) / sub_multip + c->origin.y;
+					quads->x[quad] = x;
+					quads->y[quad] = y;
+					for (unsigned int sample = 0; sample < sample_count; ++sample)
+						quads->mask[sample][quad] = sample_mask[sample];
+					if (shading_rate != 0)
+					{
+						const uint32_t coarse_count = quads->coarse_count;
+						if (coarse_count == 0 || (x >> shading_rate) != coarse_x || (y >> shading_rate) != coarse_y)
+						{
+							/* Like the scalar path the values are taken at the center of the coarse pixel if it is inside the tri,
+							 * so all the quads of a coarse pixel get the same values. Otherwise they are taken at the first covered pixel,
+							 * extrapolating outside of the tri could fetch texels the tri doesn't map.
+							 * The edge functions are at the bottom left pixel center (the average of its samples), offsets are in pixels from it. */
+							const uint32_t lane = coarse_first_lane[_mm_movemask_ps(_mm_castsi128_ps(mask))];
+							float offset_x = (float)(lane & 1);
+							float offset_y = (float)(lane >> 1);
+							float center_w0 = 0.0f;
+							float center_w1 = 0.0f;
+							for (unsigned int sample = 0; sample < sample_count; ++sample)
+							{
+								center_w0 += (float)_mm_cvtsi128_si32(w0[sample]);
+								center_w1 += (float)_mm_cvtsi128_si32(w1[sample]);
+							}
+							const float center_x = coarse_center - (float)(x & coarse_mask);
+							const float center_y = coarse_center - (float)(y & coarse_mask);
+							const float coarse_w0 = center_w0 / (float)sample_count + center_x * (float)step_x_12 + center_y * (float)step_y_12;
+							const float coarse_w1 = center_w1 / (float)sample_count + center_x * (float)step_x_20 + center_y * (float)step_y_20;
+							if (coarse_w0 >= 0.0f && coarse_w1 >= 0.0f && coarse_w0 + coarse_w1 <= (float)tri->double_area)
+							{
+								offset_x = center_x;
+								offset_y = center_y;
+							}
+
+							/* Steps are per block */
+							const __m128 block_offset_x = _mm_set_ss(offset_x * 0.5f);
+							const __m128 block_offset_y = _mm_set_ss(offset_y * 0.5f);
+							store_plane_value_at_offset(&((float *)coarse->w)[coarse_count], interp_w, w_step_x, w_step_y, block_offset_x, block_offset_y);
+							if (texturing)
+							{
+								store_plane_value_at_offset(&((float *)coarse->varyings[VARYING_UV])[coarse_count], u_w, uw_step_x, uw_step_y, block_offset_x, block_offset_y);
+								store_plane_value_at_offset(&((float *)coarse->varyings[VARYING_UV + 1])[coarse_count], v_w, vw_step_x, vw_step_y, block_offset_x, block_offset_y);
+							}
+							for (unsigned int j = 0; shadow && j < 4; ++j)
+								store_plane_value_at_offset(&((float *)coarse->varyings[VARYING_LIGHT + j])[coarse_count], light[j], light_step_x[j], light_step_y[j], block_offset_x, block_offset_y);
+							for (unsigned int j = 0; j < attribute_count; ++j)
+								store_plane_value_at_offset(&((float *)coarse->varyings[VARYING_ATTRIBUTES + j])[coarse_count], attribute[j], attribute_step_x[j], attribute_step_y[j], block_offset_x, block_offset_y);
+
+							coarse_x = x >> shading_rate;
+							coarse_y = y >> shading_rate;
+							quads->coarse_count = coarse_count + 1;
+						}
+						quads->coarse_index[quad] = quads->coarse_count - 1;
+					}
+					else
+					{
+						quads->w[quad] = interp_w;
+						if (texturing)
+						{
+							quads->varyings[VARYING_UV][quad] = u_w;
+							quads->varyings[VARYING_UV + 1][quad] = v_w;
+						}
+						if (shadow)
+						{
+							quads->varyings[VARYING_LIGHT][quad] = light[0];
+							quads->varyings[VARYING_LIGHT + 1][quad] = light[1];
+							quads->varyings[VARYING_LIGHT + 2][quad] = light[2];
+							quads->varyings[VARYING_LIGHT + 3][quad] = light[3];
+						}
+						for (unsigned int j = 0; j < attribute_count; ++j)
+							quads->varyings[VARYING_ATTRIBUTES + j][quad] = attribute[j];
+					}
+
+					if (++quads->count == SIMD_QUAD_BUFFER_SIZE)
+						c->color_quads(c);
+				}
+			}
+			for (unsigned int sample = 0; sample < sample_count; ++sample)
+			{
+				w0[sample] = _mm_add_epi32(w0[sample], w0_step_x);
+				w1[sample] = _mm_add_epi32(w1[sample], w1_step_x);
+				w2[sample] = _mm_add_epi32(w2[sample], w2_step_x);
+			}
+
+			z = _mm_add_epi32(z, z_step_x);
+			if (color_write)
+				interp_w = _mm_add_ps(interp_w, w_step_x);
+			if (texturing)
+			{
+				u_w = _mm_add_ps(u_w, uw_step_x);
+				v_w = _mm_add_ps(v_w, vw_step_x);
+			}
+			if (shadow)
+			{
+				light[0] = _mm_add_ps(light[0], light_step_x[0]);
+				light[1] = _mm_add_ps(light[1], light_step_x[1]);
+				light[2] = _mm_add_ps(light[2], light_step_x[2]);
+				light[3] = _mm_add_ps(light[3], light_step_x[3]);
+			}
+			for (unsigned int j = 0; j < attribute_count; ++j)
+				attribute[j] = _mm_add_ps(attribute[j], attribute_step_x[j]);
+
+			pixel_index_start += 4;
+		}
+
+		for (unsigned int sample = 0; sample < sample_count; ++sample)
+		{
+			w0_row[sample] += step_y_12 * 2;
+			w1_row[sample] += step_y_20 * 2;
+			w2_row[sample] += step_y_01 * 2;
+		}
+
+		z_row = _mm_add_ps(z_row, z_step_y);
+		if (color_write)
+			w_row = _mm_add_ps(w_row, w_step_y);
+		if (texturing)
+		{
+			uw_row = _mm_add_ps(uw_row, uw_step_y);
+			vw_row = _mm_add_ps(vw_row, vw_step_y);
+		}
+		if (shadow)
+		{
+			light_row[0] = _mm_add_ps(light_row[0], light_step_y[0]);
+			light_row[1] = _mm_add_ps(light_row[1], light_step_y[1]);
+			light_row[2] = _mm_add_ps(light_row[2], light_step_y[2]);
+			light_row[3] = _mm_add_ps(light_row[3], light_step_y[3]);
+		}
+		for (unsigned int j = 0; j < attribute_count; ++j)
+			attribute_row[j] = _mm_add_ps(attribute_row[j], attribute_step_y[j]);
+
+		pixel_index_row += c->pixel_row_step;
+	}
+
+#ifdef USE_RASTER_STATS
+	rasterizer_add_stats(&raster_stats, &stats);
+#endif
+}
+
+/* Fixed function color of the pixels of a quad in a buffer of queued quads or coarse pixels, w is 1/w of the pixels.
+ * The shader gets white when there is nothing else. */
+RPLNN_FORCE_INLINE __m128i shade_quad_simd(const struct simd_constants *c, const struct simd_quad_buffer *quads, const uint32_t quad, const __m128 w,
+	const bool texturing, const bool vertex_colors, const bool shading)
+{
+	assert(c && "shade_quad_simd: c is NULL");
+	assert(quads && "shade_quad_simd: quads is NULL");
+
+	const struct rasterizer_shadow *shadow = c->shadow;
+	const __m128i xor_mask = _mm_set_epi32(~(uint32_t)0, ~(uint32_t)0, ~(uint32_t)0, ~(uint32_t)0);
+	const __m128 one = _mm_set_ps(1.0f, 1.0f, 1.0f, 1.0f);
+	const __m128 depth_scale = _mm_set_ps((float)(1 << DEPTH_BITS), (float)(1 << DEPTH_BITS), (float)(1 << DEPTH_BITS), (float)(1 << DEPTH_BITS));
+
+	__m128i color = (shading && !texturing && !vertex_colors) ? xor_mask : _mm_setzero_si128();
+	if (texturing)
+	{
+		/* Clamp as the extrapolated values can go slightly out of range */
+		__m128 u = _mm_min_ps(_mm_max_ps(_mm_mul_ps(quads->varyings[VARYING_UV][quad], w), _mm_setzero_ps()), one);
+		__m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(quads->varyings[VARYING_UV + 1][quad], w), _mm_setzero_ps()), one);
+
+		__m128i texture_index = mul_epi32(_mm_cvttps_epi32(_mm_mul_ps(c->tex_coor_y_max, v)), c->texture_width);
+		texture_index = _mm_add_epi32(texture_index, _mm_cvttps_epi32(_mm_mul_ps(c->tex_coor_x_max, u)));
+		assert(((uint32_t *)&texture_index)[0] < c->texel_count && ((uint32_t *)&texture_index)[1] < c->texel_count
+			&& ((uint32_t *)&texture_index)[2] < c->texel_count && ((uint32_t *)&texture_index)[3] < c->texel_count
+			&& "shade_quad_simd: invalid texture_index");
+
+		/* Mipmapping should help with this,
+		 * currently especially small triangles can cause cache misses
+		 * by accessing the texture in the opposite ends of the array.*/
+		color = gather_epi32(c->texture, texture_index);
+	}
+
+	if (vertex_colors)
+	{
+		const __m128 *attribute = &quads->varyings[VARYING_ATTRIBUTES][quad];
+		__m128i vertex_color = pack_color_block(_mm_mul_ps(attribute[0], w), _mm_mul_ps(attribute[SIMD_QUAD_BUFFER_SIZE], w),
+			_mm_mul_ps(attribute[SIMD_QUAD_BUFFER_SIZE * 2], w), _mm_mul_ps(attribute[SIMD_QUAD_BUFFER_SIZE * 3], w));
+		color = texturing ? multiply_colors_block(color, vertex_color) : vertex_color;
+	}
+
+	if (shadow)
+	{
+		/* Project to the shadow map, the 1/w of the pass cancels out */
+		const __m128 *light = &quads->varyings[VARYING_LIGHT][quad];
+		const __m128 light_w = reciprocal(light[SIMD_QUAD_BUFFER_SIZE * 3]);
+		__m128i shadow_x = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(light[0], light_w), c->shadow_scale_x), c->shadow_offset_x));
+		__m128i shadow_y = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(light[SIMD_QUAD_BUFFER_SIZE], light_w), c->shadow_scale_y), c->shadow_offset_y));
+		__m128i shadow_z = _mm_cvtps_epi32(_mm_sub_ps(_mm_mul_ps(_mm_mul_ps(light[SIMD_QUAD_BUFFER_SIZE * 2], light_w), depth_scale), c->shadow_depth_offset));
+		__m128i lit = get_shadow_lit_count_block(shadow->map, shadow_x, shadow_y, shadow_z, c->shadow_max_x, c->shadow_max_y, c->shadow_width);
+
+		/* ambient + (1 - ambient) * lit / 4 */
+		__m128i factor = _mm_add_epi32(c->shadow_ambient, _mm_srli_epi32(_mm_mullo_epi16(c->shadow_light, lit), 2));
+		color = modulate_block(color, factor);
+	}
+
+	return color;
+}
+
+/* Colors the quads queued by rasterize_triangle_simd back to back and empties the buffer.
+ * With multisampling the color is written to each covered sample.
+ * Only called by the color functions generated below with compile time constant flags.
+ * With shading the colored quads are queued for the pixel shader, blending is done when the queue is flushed. */
+RPLNN_FORCE_INLINE void color_quads_simd(const struct simd_constants *c,
+	const bool texturing, const bool vertex_colors, const enum rasterizer_blend_mode blend_mode, const bool shading)
+{
+	assert(c && "color_quads_simd: c is NULL");
+
+	const bool blend = !shading && blend_mode != RASTERIZER_BLEND_NONE;
+	const unsigned int attribute_count = shading ? c->attribute_count : 0;
+
+	/* Local copies, the compiler would have to reload them after every write to the buffers */
+	uint32_t *render_target = c->render_target;
+	struct simd_quad_buffer *quads = c->quads;
+	const uint32_t quad_count = quads->count;
+	const uint32_t sample_count = c->sample_count;
+	const uint32_t shading_rate = c->shading_rate;
+
+	/* With coarse shading each coarse pixel is shaded once and the result is used for all of its quads.
+	 * The kernel packs their values 4 to a vector so shading 4 coarse pixels costs as much as shading a single quad. */
+	uint32_t coarse_colors[SIMD_QUAD_BUFFER_SIZE];
+	float coarse_attributes[RASTERIZER_MAX_ATTRIBUTES][SIMD_QUAD_BUFFER_SIZE];
+	if (shading_rate != 0)
+	{
+		struct simd_quad_buffer *coarse = c->coarse;
+		const uint32_t coarse_count = quads->coarse_count;
+
+		/* The unused lanes of the last vector get copies of the last coarse pixel */
+		for (uint32_t i = coarse_count; (i & 3) != 0; ++i)
+		{
+			((float *)coarse->w)[i] = ((float *)coarse->w)[coarse_count - 1];
+			for (unsigned int j = 0; j < VARYING_ATTRIBUTES + c->attribute_count; ++j)
+				((float *)coarse->varyings[j])[i] = ((float *)coarse->varyings[j])[coarse_count - 1];
+		}
+
+		for (uint32_t i = 0; i < coarse_count; i += 4)
+		{
+			const uint32_t vec = i / 4;
+			const __m128 w = reciprocal(coarse->w[vec]);
+			_mm_storeu_si128((__m128i *)&coarse_colors[i], shade_quad_simd(c, coarse, vec, w, texturing, vertex_colors, shading));
+			for (unsigned int j = 0; j < attribute_count; ++j)
+				_mm_storeu_ps(&coarse_attributes[j][i], _mm_mul_ps(coarse->varyings[VARYING_ATTRIBUTES + j][vec], w));
+		}
+
+		quads->coarse_count = 0;
+	}
+
+	for (uint32_t quad = 0; quad < quad_count; ++quad)
+	{
+		const uint32_t pixel_index = quads->pixel_index[quad];
+
+		__m128 w = _mm_setzero_ps();
+		__m128i color;
+		if (shading_rate != 0)
+		{
+			const uint32_t coarse_color = coarse_colors[quads->coarse_index[quad]];
+			color = _mm_set_epi32(coarse_color, coarse_color, coarse_color, coarse_color);
+		}
+		else
+		{
+			w = reciprocal(quads->w[quad]);
+			color = shade_quad_simd(c, quads, quad, w, texturing, vertex_colors, shading);
+		}
+
+		if (shading)
+		{
+			struct quad_queue *queue = c->queue;
+			struct rasterizer_quad_packet *packet = &queue->packet;
+			const uint32_t packet_quad = packet->quad_count;
+			packet->x[packet_quad] = quads->x[quad];
+			packet->y[packet_quad] = quads->y[quad];
+			uint32_t mask = 0;
+			uint32_t sample_mask = 0;
+			for (uint32_t sample = 0; sample < sample_count; ++sample)
+			{
+				const uint32_t pixels = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(quads->mask[sample][quad]));
+				mask |= pixels;
+				sample_mask |= pixels << (sample * 4);
+			}
+			packet->mask[packet_quad] = mask;
+			queue->pixel_index[packet_quad] = pixel_index;
+			queue->sample_mask[packet_quad] = sample_mask;
+			_mm_storeu_si128((__m128i *)&packet->colors[packet_quad * 4], color);
+			for (unsigned int j = 0; j < attribute_count; ++j)
+			{
+				__m128 attribute;
+				if (shading_rate != 0)
+				{
+					const float value = coarse_attributes[j][quads->coarse_index[quad]];
+					attribute = _mm_set_ps(value, value, value, value);
+				}
+				else
+					attribute = _mm_mul_ps(quads->varyings[VARYING_ATTRIBUTES + j][quad], w);
+				_mm_storeu_ps(&packet->attributes[j][packet_quad * 4], attribute);
+			}
+			if (++packet->quad_count == RASTERIZER_PACKET_QUADS)
+				flush_quad_queue(queue);
+		}
+		else
+		{
+			for (uint32_t sample = 0; sample < sample_count; ++sample)
+			{
+				const __m128i mask = quads->mask[sample][quad];
+				if (_mm_movemask_epi8(mask) == 0x0)
+					continue;
+
+				/* The pixels of a block are next to each other in the render target, the samples of the block follow them.
+				 * The uncovered ones are written back as they were. */
+				const uint32_t sample_index = pixel_index * sample_count + sample * 4;
+				assert(sample_index + 3 < c->pixel_count * sample_count && "color_quads_simd: invalid pixel_index");
+				const __m128i dst = _mm_loadu_si128((const __m128i *)&render_target[sample_index]);
+				__m128i sample_color = color;
+				if (blend)
+					sample_color = blend_block(color, dst, c->blend_alpha, blend_mode);
+				_mm_storeu_si128((__m128i *)&render_target[sample_index], select_si128(mask, sample_color, dst));
+			}
+		}
+	}
+
+	quads->count = 0;
+}
+
+typedef void(*simd_kernel)(const struct simd_constants *c, const struct simd_triangle *tri);
+
+/* Kernel variants, attributes is set when vertex colors or a pixel shader need the attributes */
+#define SIMD_KERNEL_NAME(multisample, depth_test, color_write, texturing, attributes) rasterize_triangle_simd_##multisample##depth_test##color_write##texturing##attributes
+
+#define DEFINE_SIMD_KERNEL(multisample, depth_test, color_write, texturing, attributes) \
+	void SIMD_KERNEL_NAME(multisample, depth_test, color_write, texturing, attributes)(const struct simd_constants *c, const struct simd_triangle *tri) \
+	{ \
+		rasterize_triangle_simd(c, tri, multisample, depth_test, color_write, texturing, attributes); \
+	}
+
+#define DEFINE_SIMD_KERNELS(multisample, depth_test) \
+	DEFINE_SIMD_KERNEL(multisample, depth_test, 0, 0, 0) \
+	DEFINE_SIMD_KERNEL(multisample, depth_test, 1, 0, 0) \
+	DEFINE_SIMD_KERNEL(multisample, depth_test, 1, 1, 0) \
+	DEFINE_SIMD_KERNEL(multisample, depth_test, 1, 0, 1) \
+	DEFINE_SIMD_KERNEL(multisample, depth_test, 1, 1, 1)
+
+#define SIMD_KERNELS(multisample, depth_test) \
+	{ SIMD_KERNEL_NAME(multisample, depth_test, 0, 0, 0), SIMD_KERNEL_NAME(multisample, depth_test, 1, 0, 0), SIMD_KERNEL_NAME(multisample, depth_test, 1, 1, 0), \
+	  SIMD_KERNEL_NAME(multisample, depth_test, 1, 0, 1), SIMD_KERNEL_NAME(multisample, depth_test, 1, 1, 1) }
+
+DEFINE_SIMD_KERNELS(0, 0)
+DEFINE_SIMD_KERNELS(0, 1)
+DEFINE_SIMD_KERNELS(1, 0)
+DEFINE_SIMD_KERNELS(1, 1)
+
+/* [multisample][depth_test][color_write ? 1 + texturing + attributes * 2 : 0] */
+const simd_kernel simd_kernels[2][2][5] =
+{
+	{ SIMD_KERNELS(0, 0), SIMD_KERNELS(0, 1) },
+	{ SIMD_KERNELS(1, 0), SIMD_KERNELS(1, 1) }
+};
+
+/* Color function variants, blend_mode is the value of enum rasterizer_blend_mode */
+#define SIMD_COLOR_NAME(texturing, vertex_colors, blend_mode) color_quads_simd_##texturing##vertex_colors##blend_mode
+
+#define DEFINE_SIMD_COLOR(texturing, vertex_colors, blend_mode) \
+	void SIMD_COLOR_NAME(texturing, vertex_colors, blend_mode)(const struct simd_constants *c) \
+	{ \
+		color_quads_simd(c, texturing, vertex_colors, (enum rasterizer_blend_mode)blend_mode, false); \
+	}
+
+/* Pixel shader variants, blending is done after the shader */
+#define SIMD_SHADER_COLOR_NAME(texturing, vertex_colors) color_quads_simd_shader_##texturing##vertex_colors
+
+#define DEFINE_SIMD_SHADER_COLOR(texturing, vertex_colors) \
+	void SIMD_SHADER_COLOR_NAME(texturing, vertex_colors)(const struct simd_constants *c) \
+	{ \
+		color_quads_simd(c, texturing, vertex_colors, RASTERIZER_BLEND_NONE, true); \
+	}
+
+#define DEFINE_SIMD_COLORS(texturing, vertex_colors) \
+	DEFINE_SIMD_COLOR(texturing, vertex_colors, 0) \
+	DEFINE_SIMD_COLOR(texturing, vertex_colors, 1) \
+	DEFINE_SIMD_COLOR(texturing, vertex_colors, 2) \
+	DEFINE_SIMD_COLOR(texturing, vertex_colors, 3)
+
+#define SIMD_COLORS(texturing, vertex_colors) \
+	{ SIMD_COLOR_NAME(texturing, vertex_colors, 0), SIMD_COLOR_NAME(texturing, vertex_colors, 1), \
+	  SIMD_COLOR_NAME(texturing, vertex_colors, 2), SIMD_COLOR_NAME(texturing, vertex_colors, 3), \
+	  SIMD_SHADER_COLOR_NAME(texturing, vertex_colors) }
+
+DEFINE_SIMD_COLORS(1, 0)
+DEFINE_SIMD_COLORS(0, 1)
+DEFINE_SIMD_COLORS(1, 1)
+DEFINE_SIMD_SHADER_COLOR(0, 0)
+DEFINE_SIMD_SHADER_COLOR(1, 0)
+DEFINE_SIMD_SHADER_COLOR(0, 1)
+DEFINE_SIMD_SHADER_COLOR(1, 1)
+
+/* [texturing | vertex_colors << 1][pixel_shader ? 4 : blend_mode]
+ * Without texturing and vertex colors there is always a pixel shader. */
+const simd_color_function simd_color_functions[4][5] =
+{
+	{ SIMD_SHADER_COLOR_NAME(0, 0), SIMD_SHADER_COLOR_NAME(0, 0), SIMD_SHADER_COLOR_NAME(0, 0), SIMD_SHADER_COLOR_NAME(0, 0), SIMD_SHADER_COLOR_NAME(0, 0) },
+	SIMD_COLORS(1, 0),
+	SIMD_COLORS(0, 1),
+	SIMD_COLORS(1, 1)
+};
+#endif
+
+void rasterizer_state_init(struct rasterizer_state *state)
+{
+	assert(state && "rasterizer_state_init: state is NULL");
+
+	state->cull_mode = RASTERIZER_CULL_BACK;
+	state->depth_test = true;
+	state->depth_write = true;
+	state->color_write = true;
+	state->texturing = true;
+	state->vertex_colors = false;
+	state->stencil_test = false;
+	state->stencil_func = RASTERIZER_COMPARE_ALWAYS;
+	state->stencil_ref = 0;
+	state->stencil_read_mask = 0xFF;
+	state->stencil_write_mask = 0xFF;
+	state->stencil_fail_op = RASTERIZER_STENCIL_KEEP;
+	state->depth_fail_op = RASTERIZER_STENCIL_KEEP;
+	state->pass_op = RASTERIZER_STENCIL_KEEP;
+	state->shadow = NULL;
+	state->blend_mode = RASTERIZER_BLEND_NONE;
+	state->blend_alpha = 0xFF;
+	state->pixel_shader = NULL;
+	state->pixel_shader_data = NULL;
+	state->multisample = false;
+	state->shading_rate = RASTERIZER_SHADING_RATE_1X1;
+	state->scissor_test = false;
+	state->scissor_min.x = 0;
+	state->scissor_min.y = 0;
+	state->scissor_max.x = 0;
+	state->scissor_max.y = 0;
+	state->depth_bounds_test = false;
+	state->depth_bounds_min = 0.0f;
+	state->depth_bounds_max = 1.0f;
+}
+
+void rasterizer_rasterize(uint32_t *render_target, uint32_t *depth_buf, const struct vec2_int *target_size, const struct vec2_int *rasterize_area_min, const struct vec2_int *rasterize_area_max,
+	const struct vec4_float *vert_buf, const struct vec2_float *uv_buf, const float *attribute_buf, const uint32_t attribute_count, const unsigned int *ind_buf, const unsigned int index_count, 
+	const uint32_t *texture, const struct vec2_int *texture_size, const struct rasterizer_state *state)
+{
+	assert(state && "rasterizer_rasterize: state is NULL");
+	assert((render_target || !state->color_write) && "rasterizer_rasterize: render_target is NULL");
+	assert(depth_buf && "rasterizer_rasterize: depth_buf is NULL");
+	assert(target_size && "rasterizer_rasterize: target_size is NULL");
+	assert(rasterize_area_min && "rasterizer_rasterize: rasterize_area_min is NULL");
+	assert(rasterize_area_max && "rasterizer_rasterize: rasterize_area_max is NULL");
+	assert(vert_buf && "rasterizer_rasterize: vert_buf is NULL");
+	assert((uv_buf || !state->color_write || !state->texturing) && "rasterizer_rasterize: uv_buf is NULL");
+	assert((attribute_buf || attribute_count == 0) && "rasterizer_rasterize: attribute_buf is NULL");
+	assert(attribute_count <= RASTERIZER_MAX_ATTRIBUTES && "rasterizer_rasterize: too many attributes");
+	assert(ind_buf && "rasterizer_rasterize: ind_buf is NULL");
+	assert((texture || !state->color_write || !state->texturing) && "rasterizer_rasterize: texture is NULL");
+	assert((texture_size || !state->color_write || !state->texturing) && "rasterizer_rasterize: texture_size is NULL");
+	assert((state->texturing || state->vertex_colors || state->pixel_shader || !state->color_write) && "rasterizer_rasterize: color_write needs texturing, vertex colors or a pixel shader");
+	assert((attribute_count >= 4 || !state->vertex_colors || !state->color_write) && "rasterizer_rasterize: vertex colors need 4 attributes");
+	assert(index_count % 3 == 0 && "rasterizer_rasterize: index count is not valid");
+	assert(rasterize_area_max->x - rasterize_area_min->x < MAX_AREA_SIZE && rasterize_area_max->y - rasterize_area_min->y < MAX_AREA_SIZE && "rasterizer_rasterize: rasterize area is too large");
+	assert(rasterize_area_min->x >= 0 && rasterize_area_min->y >= 0 && "rasterizer_rasterize: invalid rasterize_area_min");
+#ifndef USE_TILES
+	assert(rasterize_area_max->x < target_size->x && rasterize_area_max->y < target_size->y && "rasterizer_rasterize: invalid rasterize_are_max");
+#endif
+	assert(rasterize_area_min->x < rasterize_area_max->x && rasterize_area_min->y < rasterize_area_max->y && "rasterizer_rasterize: rasterize_area_min must be smaller than rasterize_area_max");
+#ifdef USE_SIMD
+	assert(rasterize_area_min->x % 2 == 0 && "rasterizer_rasterize: rasterize_area_min must be even");
+	assert(rasterize_area_min->y % 2 == 0 && "rasterizer_rasterize: rasterize_area_min must be even");
+	assert(rasterize_area_max->x % 2 == 1 && "rasterizer_rasterize: rasterize_area_max must be odd");
+	assert(rasterize_area_max->y % 2 == 1 && "rasterizer_rasterize: rasterize_area_max must be odd");
+#ifdef USE_TILES
+	assert(rasterize_area_min->x % TILE_SIZE == 0 && "rasterizer_rasterize: When using tiles rasterize areas must be aligned to tiles.");
+	assert(rasterize_area_min->y % TILE_SIZE == 0 && "rasterizer_rasterize: When using tiles rasterize areas must be aligned to tiles.");
+	assert(rasterize_area_max->x - rasterize_area_min->x == TILE_SIZE - 1 && "rasterizer_rasterize: When using tiles rasterize areas must be tile sized.");
+	assert(rasterize_area_max->y - rasterize_area_min->y == TILE_SIZE - 1 && "rasterizer_rasterize: When using tiles rasterize areas must be tile sized.");
+#endif
+#endif
+
+	/* Sub-pixel constants */
+	const int32_t sub_multip = 1 << SUB_BITS;
+	const int32_t half_pixel = sub_multip >> 1;
+	const int32_t sub_mask = sub_multip - 1;
+
+	const int32_t half_width = target_size->x / 2;
+	const int32_t half_height = target_size->y / 2;
+
+	/* All the fixed point math is done relative to the middle of the rasterize area.
+	 * This keeps the edge functions bounded no matter how large the render target is.
+	 * The origin has to be even so that 2x2 blocks stay aligned when using SIMD. */
+	struct vec2_int origin;
+	origin.x = rasterize_area_min->x + (((rasterize_area_max->x - rasterize_area_min->x + 1) / 2) & ~1);
+	origin.y = rasterize_area_min->y + (((rasterize_area_max->y - rasterize_area_min->y + 1) / 2) & ~1);
+
+	struct vec2_int rast_min;
+	rast_min.x = TO_FIXED(rasterize_area_min->x - origin.x, sub_multip);
+	rast_min.y = TO_FIXED(rasterize_area_min->y - origin.y, sub_multip);
+	/* The max is the center of the last pixel, the last column and row are covered by tris reaching past it */
+	struct vec2_int rast_max;
+	rast_max.x = TO_FIXED(rasterize_area_max->x - origin.x, sub_multip) + half_pixel;
+	rast_max.y = TO_FIXED(rasterize_area_max->y - origin.y, sub_multip) + half_pixel;
+
+	/* The verts are snapped to sub-pixels relative to the render target corner and then moved to the origin,
+	 * so their positions relative to each other are the same in every rasterize area. */
+	const int32_t origin_fixed_x = origin.x * sub_multip;
+	const int32_t origin_fixed_y = origin.y * sub_multip;
+
+	/* State */
+	const bool depth_test = state->depth_test;
+	const bool depth_write = state->depth_write;
+	const rasterizer_pixel_shader pixel_shader = state->color_write ? state->pixel_shader : NULL;
+	const bool color_write = state->color_write && (state->texturing || state->vertex_colors || pixel_shader);
+	const bool texturing = color_write && state->texturing;
+	const bool vertex_colors = color_write && state->vertex_colors;
+	const bool stencil_test = state->stencil_test;
+	const enum rasterizer_compare_func stencil_func = state->stencil_func;
+	const enum rasterizer_stencil_op stencil_fail_op = state->stencil_fail_op;
+	const enum rasterizer_stencil_op depth_fail_op = state->depth_fail_op;
+	const enum rasterizer_stencil_op pass_op = state->pass_op;
+	const uint32_t stencil_ref = state->stencil_ref;
+	const uint32_t stencil_read_mask = state->stencil_read_mask;
+	const uint32_t stencil_write_mask = state->stencil_write_mask;
+	const uint32_t stencil_ref_masked = stencil_ref & stencil_read_mask;
+	const struct rasterizer_shadow *shadow = color_write ? state->shadow : NULL;
+	assert((!shadow || (shadow->map && shadow->vert_buf)) && "rasterizer_rasterize: shadow map or vert buf is NULL");
+	/* Light left in shadowed pixels in 8bit fixed point */
+	const uint32_t shadow_ambient = shadow ? (uint32_t)(clamp(shadow->ambient, 0.0f, 1.0f) * 256.0f + 0.5f) : 0;
+	const enum rasterizer_blend_mode blend_mode = color_write ? state->blend_mode : RASTERIZER_BLEND_NONE;
+	assert(blend_mode <= RASTERIZER_BLEND_PREMULTIPLIED && "rasterizer_rasterize: invalid blend_mode");
+	const uint32_t blend_alpha = state->blend_alpha;
+	const bool multisample = state->multisample;
+	const uint32_t sample_count = multisample ? RASTERIZER_MSAA_SAMPLES : 1;
+	const uint32_t shading_rate = color_write ? (uint32_t)state->shading_rate : 0;
+	assert(shading_rate <= RASTERIZER_SHADING_RATE_4X4 && "rasterizer_rasterize: invalid shading_rate");
+	const bool depth_bounds_test = state->depth_bounds_test;
+	const float depth_bounds_min = state->depth_bounds_min;
+	const float depth_bounds_max = state->depth_bounds_max;
+	/* In DEPTH_BITS fixed point for the per sample test */
+	const uint32_t depth_bounds_min_fixed = (uint32_t)(clamp(depth_bounds_min, 0.0f, 1.0f) * (float)(1 << DEPTH_BITS) + 0.5f);
+	const uint32_t depth_bounds_max_fixed = (uint32_t)(clamp(depth_bounds_max, 0.0f, 1.0f) * (float)(1 << DEPTH_BITS) + 0.5f);
+	/* Attributes the state doesn't use are not interpolated */
+	const unsigned int varying_count = VARYING_ATTRIBUTES + (pixel_shader ? attribute_count : (vertex_colors ? 4 : 0));
+
+	/* The bounding boxes of the tris are clamped to the rasterize area intersected with the scissor rect */
+	struct vec2_int bbox_min = rast_min;
+	struct vec2_int bbox_max = rast_max;
+	if (state->scissor_test)
+	{
+#ifdef USE_SIMD
+		assert(state->scissor_min.x % 2 == 0 && state->scissor_min.y % 2 == 0 && "rasterizer_rasterize: scissor_min must be even");
+		assert(state->scissor_max.x % 2 == 1 && state->scissor_max.y % 2 == 1 && "rasterizer_rasterize: scissor_max must be odd");
+#endif
+		bbox_min.x = max(bbox_min.x, TO_FIXED(state->scissor_min.x - origin.x, sub_multip));
+		bbox_min.y = max(bbox_min.y, TO_FIXED(state->scissor_min.y - origin.y, sub_multip));
+		bbox_max.x = min(bbox_max.x, TO_FIXED(state->scissor_max.x - origin.x, sub_multip) + half_pixel);
+		bbox_max.y = min(bbox_max.y, TO_FIXED(state->scissor_max.y - origin.y, sub_multip) + half_pixel);
+
+		/* Nothing of this rasterize area is inside the scissor rect */
+		if (bbox_min.x > bbox_max.x || bbox_min.y > bbox_max.y)
+			return;
+	}
+
+	/* Quads are queued for the pixel shader, the queue is flushed when it is full and at the end of the draw */
+	struct quad_queue queue;
+	queue.packet.quad_count = 0;
+	queue.packet.attribute_count = attribute_count;
+	queue.render_target = render_target;
+	queue.pixel_shader = pixel_shader;
+	queue.pixel_shader_data = state->pixel_shader_data;
+	queue.blend_mode = blend_mode;
+	queue.blend_alpha = blend_alpha;
+	queue.sample_count = sample_count;
+
+	/* Sample positions in sub-pixels, without multisampling the only sample is at the pixel center */
+	struct vec2_int sample_offsets[RASTERIZER_MSAA_SAMPLES];
+	for (uint32_t sample = 0; sample < RASTERIZER_MSAA_SAMPLES; ++sample)
+	{
+		sample_offsets[sample].x = multisample ? msaa_sample_positions[sample].x << (SUB_BITS - 4) : 0;
+		sample_offsets[sample].y = multisample ? msaa_sample_positions[sample].y << (SUB_BITS - 4) : 0;
+	}
+
+#ifdef USE_SIMD
+	/* Constants shared by all tris */
+	struct simd_constants constants;
+	constants.render_target = render_target;
+	constants.depth_buf = depth_buf;
+	constants.texture = texture;
+	constants.shadow = shadow;
+	constants.queue = &queue;
+	constants.origin = origin;
+	constants.attribute_count = varying_count - VARYING_ATTRIBUTES;
+	constants.sample_count = sample_count;
+	constants.depth_write = depth_write;
+	constants.depth_bounds_test = depth_bounds_test;
+	constants.stencil_test = stencil_test;
+	constants.stencil_func = stencil_func;
+	constants.stencil_fail_op = stencil_fail_op;
+	constants.depth_fail_op = depth_fail_op;
+	constants.pass_op = pass_op;
+#ifdef USE_TILES
+	{
+		struct vec2_int padded_size;
+		rasterizer_get_padded_size(target_size, &padded_size);
+		constants.pixel_count = (uint32_t)(padded_size.x * padded_size.y);
+	}
+	constants.pixel_row_step = TILE_SIZE * 2;
+#else
+	constants.pixel_count = (uint32_t)(target_size->x * target_size->y);
+	constants.pixel_row_step = target_size->x * 2;
+#endif
+	constants.texel_count = texturing ? (uint32_t)(texture_size->x * texture_size->y) : 0;
+	constants.step_size = _mm_set_epi32(2 * sub_multip, 2 * sub_multip, 2 * sub_multip, 2 * sub_multip);
+	constants.stencil_ref = _mm_set_epi32(stencil_ref, stencil_ref, stencil_ref, stencil_ref);
+	constants.depth_bounds_min = _mm_set_epi32(depth_bounds_min_fixed, depth_bounds_min_fixed, depth_bounds_min_fixed, depth_bounds_min_fixed);
+	constants.depth_bounds_max = _mm_set_epi32(depth_bounds_max_fixed, depth_bounds_max_fixed, depth_bounds_max_fixed, depth_bounds_max_fixed);
+	constants.stencil_ref_masked = _mm_set_epi32(stencil_ref_masked, stencil_ref_masked, stencil_ref_masked, stencil_ref_masked);
+	constants.stencil_read_mask = _mm_set_epi32(stencil_read_mask, stencil_read_mask, stencil_read_mask, stencil_read_mask);
+	constants.stencil_write_mask = _mm_set_epi32(stencil_write_mask, stencil_write_mask, stencil_write_mask, stencil_write_mask);
+	constants.texture_width = _mm_setzero_si128();
+	constants.tex_coor_x_max = _mm_setzero_ps();
+	constants.tex_coor_y_max = _mm_setzero_ps();
+	float temp;
+	if (texturing)
+	{
+		constants.texture_width = _mm_set_epi32(texture_size->x, texture_size->x, texture_size->x, texture_size->x);
+		temp = (float)(texture_size->x - 1);
+		constants.tex_coor_x_max = _mm_set_ps(temp, temp, temp, temp);
+		temp = (float)(texture_size->y - 1);
+		constants.tex_coor_y_max = _mm_set_ps(temp, temp, temp, temp);
+	}
+
+	/* Shadow map lookups */
+	constants.shadow_scale_x = _mm_setzero_ps();
+	constants.shadow_scale_y = _mm_setzero_ps();
+	constants.shadow_offset_x = _mm_setzero_ps();
+	constants.shadow_offset_y = _mm_setzero_ps();
+	constants.shadow_depth_offset = _mm_setzero_ps();
+	constants.shadow_max_x = _mm_setzero_si128();
+	constants.shadow_max_y = _mm_setzero_si128();
+	constants.shadow_width = _mm_setzero_si128();
+	constants.shadow_ambient = _mm_setzero_si128();
+	constants.shadow_light = _mm_setzero_si128();
+	if (shadow)
+	{
+		/* Same mapping as the vertices get when the map is rendered, 
+		 * offset by half a texel to get the bottom left texel of the 2x2 block */
+		temp = (float)(shadow->map_size.x / 2);
+		constants.shadow_scale_x = _mm_set_ps(temp, temp, temp, temp);
+		temp -= 0.5f;
+		constants.shadow_offset_x = _mm_set_ps(temp, temp, temp, temp);
+		temp = (float)(shadow->map_size.y / 2);
+		constants.shadow_scale_y = _mm_set_ps(temp, temp, temp, temp);
+		temp -= 0.5f;
+		constants.shadow_offset_y = _mm_set_ps(temp, temp, temp, temp);
+		temp = shadow->bias * (float)(1 << DEPTH_BITS);
+		constants.shadow_depth_offset = _mm_set_ps(temp, temp, temp, temp);
+		constants.shadow_max_x = _mm_set_epi32(shadow->map_size.x - 1, shadow->map_size.x - 1, shadow->map_size.x - 1, shadow->map_size.x - 1);
+		constants.shadow_max_y = _mm_set_epi32(shadow->map_size.y - 1, shadow->map_size.y - 1, shadow->map_size.y - 1, shadow->map_size.y - 1);
+#ifdef USE_TILES
+		struct vec2_int shadow_padded_size;
+		rasterizer_get_padded_size(&shadow->map_size, &shadow_padded_size);
+		const int32_t shadow_tiles_x = shadow_padded_size.x / TILE_SIZE;
+		constants.shadow_width = _mm_set_epi32(shadow_tiles_x, shadow_tiles_x, shadow_tiles_x, shadow_tiles_x);
+#else
+		constants.shadow_width = _mm_set_epi32(shadow->map_size.x, shadow->map_size.x, shadow->map_size.x, shadow->map_size.x);
+#endif
+		constants.shadow_ambient = _mm_set_epi32(shadow_ambient, shadow_ambient, shadow_ambient, shadow_ambient);
+		constants.shadow_light = _mm_set_epi32(256 - shadow_ambient, 256 - shadow_ambient, 256 - shadow_ambient, 256 - shadow_ambient);
+	}
+
+	/* For 16bit channels */
+	const uint32_t blend_alpha16 = blend_alpha | (blend_alpha << 16);
+	constants.blend_alpha = _mm_set_epi32(blend_alpha16, blend_alpha16, blend_alpha16, blend_alpha16);
+	queue.blend_alpha_vec = constants.blend_alpha;
+
+	/* Plane equations are only set up for the varyings the kernel uses */
+	unsigned int used_varyings[VARYING_COUNT];
+	unsigned int used_varying_count = 0;
+	if (texturing)
+	{
+		used_varyings[used_varying_count++] = VARYING_UV;
+		used_varyings[used_varying_count++] = VARYING_UV + 1;
+	}
+	for (unsigned int j = 0; shadow && j < 4; ++j)
+		used_varyings[used_varying_count++] = VARYING_LIGHT + j;
+	for (unsigned int j = VARYING_ATTRIBUTES; j < varying_count; ++j)
+		used_varyings[used_varying_count++] = j;
+
+	/* Coverage and coloring are done in separate loops, the quads between them are buffered */
+	struct simd_quad_buffer quads;
+	quads.count = 0;
+	quads.coarse_count = 0;
+	constants.quads = &quads;
+	struct simd_quad_buffer coarse;
+	constants.coarse = &coarse;
+	constants.shading_rate = shading_rate;
+	constants.color_quads = simd_color_functions[(texturing ? 1 : 0) | (vertex_colors ? 2 : 0)][pixel_shader ? 4 : blend_mode];
+	const simd_kernel kernel = simd_kernels[multisample ? 1 : 0][depth_test ? 1 : 0][color_write ? 1 + (texturing ? 1 : 0) + (varying_count > VARYING_ATTRIBUTES ? 2 : 0) : 0];
+	struct simd_triangle tri;
+#else
+	const bool blend = blend_mode != RASTERIZER_BLEND_NONE;
+	const float tex_coor_x_max = texturing ? (float)(texture_size->x - 1) : 0.0f;
+	const float tex_coor_y_max = texturing ? (float)(texture_size->y - 1) : 0.0f;
+#endif
+
+	/* Reserve enough space for possible polys created by clipping */
+	struct vec2_int work_poly[7];
+	float work_z[7];
+	float work_w[7]; /* Note that this is actually the reciprocal of w */
+	float work_varyings[7][VARYING_COUNT];
+	unsigned int work_vert_count = 3;
+	unsigned int work_index_count = 3;
+	unsigned int work_poly_indices[15];
+
+	RASTER_STATS_ADD(raster_stats, triangles, index_count / 3);
+	RASTER_STATS_TIMER(stats_time);
+
+	for (unsigned int i = 0; i < index_count; i += 3)
+	{
+		/* Skip the tri if any of its vertices is outside the near/far planes.
+		 * A bit hacky but good enough for the time being. */
+		if (vert_buf[ind_buf[i]].z < 0.0f || vert_buf[ind_buf[i]].z > vert_buf[ind_buf[i]].w ||
+			vert_buf[ind_buf[i + 1]].z < 0.0f || vert_buf[ind_buf[i + 1]].z > vert_buf[ind_buf[i + 1]].w ||
+			vert_buf[ind_buf[i + 2]].z < 0.0f || vert_buf[ind_buf[i + 2]].z > vert_buf[ind_buf[i + 2]].w)
+		{
+			RASTER_STATS_ADD(raster_stats, near_far_rejects, 1);
+			continue;
+		}
+
+		work_poly[0].x = TO_FIXED(vert_buf[ind_buf[i]].x / vert_buf[ind_buf[i]].w * half_width + half_width, sub_multip) - origin_fixed_x;
+		work_poly[0].y = TO_FIXED(vert_buf[ind_buf[i]].y / vert_buf[ind_buf[i]].w * half_height + half_height, sub_multip) - origin_fixed_y;
+		work_z[0] = vert_buf[ind_buf[i]].z / vert_buf[ind_buf[i]].w;
+		work_w[0] = 1.0f / vert_buf[ind_buf[i]].w;
+		work_poly[1].x = TO_FIXED(vert_buf[ind_buf[i + 1]].x / vert_buf[ind_buf[i + 1]].w * half_width + half_width, sub_multip) - origin_fixed_x;
+		work_poly[1].y = TO_FIXED(vert_buf[ind_buf[i + 1]].y / vert_buf[ind_buf[i + 1]].w * half_height + half_height, sub_multip) - origin_fixed_y;
+		work_z[1] = vert_buf[ind_buf[i + 1]].z / vert_buf[ind_buf[i + 1]].w;
+		work_w[1] = 1.0f / vert_buf[ind_buf[i + 1]].w;
+		work_poly[2].x = TO_FIXED(vert_buf[ind_buf[i + 2]].x / vert_buf[ind_buf[i + 2]].w * half_width + half_width, sub_multip) - origin_fixed_x;
+		work_poly[2].y = TO_FIXED(vert_buf[ind_buf[i + 2]].y / vert_buf[ind_buf[i + 2]].w * half_height + half_height, sub_multip) - origin_fixed_y;
+		work_z[2] = vert_buf[ind_buf[i + 2]].z / vert_buf[ind_buf[i + 2]].w;
+		work_w[2] = 1.0f / vert_buf[ind_buf[i + 2]].w;
+		work_poly_indices[0] = 0; work_poly_indices[1] = 1; work_poly_indices[2] = 2;
+
+		/* Skip the tri if its depth range is outside of the depth bounds */
+		if (depth_bounds_test && (max3(work_z[0], work_z[1], work_z[2]) < depth_bounds_min || min3(work_z[0], work_z[1], work_z[2]) > depth_bounds_max))
+		{
+			RASTER_STATS_ADD(raster_stats, depth_bounds_rejects, 1);
+			continue;
+		}
+
+		work_vert_count = 3;
+		work_index_count = 3;
+
+		for (unsigned int j = 0; j < 3; ++j)
+		{
+			const unsigned int index = ind_buf[i + j];
+			float *varyings = &work_varyings[j][0];
+			varyings[VARYING_UV] = texturing ? uv_buf[index].x : 0.0f;
+			varyings[VARYING_UV + 1] = texturing ? uv_buf[index].y : 0.0f;
+			if (shadow)
+			{
+				varyings[VARYING_LIGHT] = shadow->vert_buf[index].x;
+				varyings[VARYING_LIGHT + 1] = shadow->vert_buf[index].y;
+				varyings[VARYING_LIGHT + 2] = shadow->vert_buf[index].z;
+				varyings[VARYING_LIGHT + 3] = shadow->vert_buf[index].w;
+			}
+			else
+			{
+				varyings[VARYING_LIGHT] = 0.0f;
+				varyings[VARYING_LIGHT + 1] = 0.0f;
+				varyings[VARYING_LIGHT + 2] = 0.0f;
+				varyings[VARYING_LIGHT + 3] = 1.0f;
+			}
+			for (unsigned int k = VARYING_ATTRIBUTES; k < varying_count; ++k)
+				varyings[k] = attribute_buf[index * attribute_count + k - VARYING_ATTRIBUTES];
+		}
+
+		if (!clip(&(work_poly[0]), &(work_z[0]), &(work_w[0]), work_varyings, varying_count,
+			&work_vert_count, &work_index_count, &(work_poly_indices[0]), &rast_min, &rast_max))
+		{
+			RASTER_STATS_ADD(raster_stats, view_rejects, 1);
+			continue;
+		}
+		RASTER_STATS_ADD(raster_stats, guard_band_clips, work_index_count != 3);
+
+		for (unsigned ind_i = 0; ind_i < work_index_count; ind_i += 3)
+		{
+			const unsigned int i0 = work_poly_indices[ind_i];
+			unsigned int i1 = work_poly_indices[ind_i + 1];
+			unsigned int i2 = work_poly_indices[ind_i + 2];
+
+			/* Culled and degenerate tris can't cover any pixels.
+			 * The rest of the pipeline wants CCW tris so the order is flipped for back faces when they are drawn. */
+			int32_t double_area = winding_2d(&work_poly[i0], &work_poly[i1], &work_poly[i2]);
+			if (state->cull_mode == RASTERIZER_CULL_FRONT || (state->cull_mode == RASTERIZER_CULL_NONE && double_area < 0))
+			{
+				const unsigned int temp_index = i1;
+				i1 = i2;
+				i2 = temp_index;
+				double_area = -double_area;
+			}
+			if (double_area <= 0)
+			{
+				RASTER_STATS_ADD(raster_stats, culled, 1);
+				continue;
+			}
+
+			/* Bounding box */
+			struct vec2_int min;
+			struct vec2_int max;
 			min.x = min3(work_poly[i0].x, work_poly[i1].x, work_poly[i2].x);
 			min.y = min3(work_poly[i0].y, work_poly[i1].y, work_poly[i2].y);
 			max.x = max3(work_poly[i0].x, work_poly[i1].x, work_poly[i2].x);
 			max.y = max3(work_poly[i0].y, work_poly[i1].y, work_poly[i2].y);
 
-			/* Clip to screen and round to pixel centers */
+			/* Clip to screen and the scissor rect, tris can be fully outside of the scissor rect */
+			min.x = max(min.x, bbox_min.x);
+			min.y = max(min.y, bbox_min.y);
+			max.x = min(max.x, bbox_max.x);
+			max.y = min(max.y, bbox_max.y);
+			if (min.x > max.x || min.y > max.y)
+			{
+				RASTER_STATS_ADD(raster_stats, scissor_rejects, 1);
+				continue;
+			}
+
+			/* Drop tris that fall between pixel centers before doing any setup,
+			 * these are common with dense meshes in the distance. */
+			if (!multisample && (((min.x - half_pixel + sub_mask) & ~sub_mask) > ((max.x - half_pixel) & ~sub_mask)
+				|| ((min.y - half_pixel + sub_mask) & ~sub_mask) > ((max.y - half_pixel) & ~sub_mask)))
+			{
+				RASTER_STATS_ADD(raster_stats, small_rejects, 1);
+				continue;
+			}
+
+			/* Round to pixel centers */
 #ifdef USE_SIMD
-			min.x = ((max(min.x, rast_min.x) & ~sub_mask) & ~sub_multip) + half_pixel;
-			min.y = ((max(min.y, rast_min.y) & ~sub_mask) & ~sub_multip) + half_pixel;
-			max.x = ((min(max.x, rast_max.x) & ~sub_mask) | sub_multip) + half_pixel;
-			max.y = ((min(max.y, rast_max.y) & ~sub_mask) | sub_multip) + half_pixel;
+			min.x = ((min.x & ~sub_mask) & ~sub_multip) + half_pixel;
+			min.y = ((min.y & ~sub_mask) & ~sub_multip) + half_pixel;
+			max.x = ((max.x & ~sub_mask) | sub_multip) + half_pixel;
+			max.y = ((max.y & ~sub_mask) | sub_multip) + half_pixel;
 #else
-			min.x = (max(min.x, rast_min.x) & ~sub_mask) + half_pixel;
-			min.y = (max(min.y, rast_min.y) & ~sub_mask) + half_pixel;
-			max.x = (min(max.x, rast_max.x) & ~sub_mask) + half_pixel;
-			max.y = (min(max.y, rast_max.y) & ~sub_mask) + half_pixel;
+			min.x = (min.x & ~sub_mask) + half_pixel;
+			min.y = (min.y & ~sub_mask) + half_pixel;
+			max.x = (max.x & ~sub_mask) + half_pixel;
+			max.y = (max.y & ~sub_mask) + half_pixel;
 #endif
 
-			/* Orient at min point
-			 * The top or left bias causes the weights to get offset by 1 sub-pixel.
-			 * Could correct for that to get everything depending on the weights just right
-			 * but I think I can live with an error of 1 sub pixel (1/16 pixel currently). */
-			int32_t w0_row = winding_2d(&work_poly[i1], &work_poly[i2], &min) + (is_top_or_left(&work_poly[i1], &work_poly[i2]) ? 0 : -1);
-			int32_t w1_row = winding_2d(&work_poly[i2], &work_poly[i0], &min) + (is_top_or_left(&work_poly[i2], &work_poly[i0]) ? 0 : -1);
-			int32_t w2_row = winding_2d(&work_poly[i0], &work_poly[i1], &min) + (is_top_or_left(&work_poly[i0], &work_poly[i1]) ? 0 : -1);
+			/* Orient at min point, each sample has its own edge functions */
+			int32_t w0_row[RASTERIZER_MSAA_SAMPLES];
+			int32_t w1_row[RASTERIZER_MSAA_SAMPLES];
+			int32_t w2_row[RASTERIZER_MSAA_SAMPLES];
+			for (uint32_t sample = 0; sample < sample_count; ++sample)
+			{
+				struct vec2_int sample_point;
+				sample_point.x = min.x + sample_offsets[sample].x;
+				sample_point.y = min.y + sample_offsets[sample].y;
+				w0_row[sample] = edge_function(&work_poly[i1], &work_poly[i2], &sample_point);
+				w1_row[sample] = edge_function(&work_poly[i2], &work_poly[i0], &sample_point);
+				w2_row[sample] = edge_function(&work_poly[i0], &work_poly[i1], &sample_point);
+			}
 
 			/* Calculate steps */
 			int32_t step_x_01 = work_poly[i0].y - work_poly[i1].y;
@@ -490,30 +2128,95 @@ void rasterizer_rasterize(uint32_t *render_target, uint32_t *depth_buf, const st
 			int32_t step_y_20 = work_poly[i0].x - work_poly[i2].x;
 
 #ifdef USE_SIMD
-			float temp = work_uv[i0].x * work_w[i0];
-			const __m128 uv0x = _mm_set_ps(temp, temp, temp, temp);
-			temp = work_uv[i0].y * work_w[i0];
-			const __m128 uv0y = _mm_set_ps(temp, temp, temp, temp);
-			temp = work_uv[i1].x * work_w[i1] - work_uv[i0].x * work_w[i0];
-			const __m128 uv10x = _mm_set_ps(temp, temp, temp, temp); 
-			temp = work_uv[i1].y * work_w[i1] - work_uv[i0].y * work_w[i0];
-			const __m128 uv10y = _mm_set_ps(temp, temp, temp, temp);
-			temp = work_uv[i2].x * work_w[i2] - work_uv[i0].x * work_w[i0];
-			const __m128 uv20x = _mm_set_ps(temp, temp, temp, temp); 
-			temp = work_uv[i2].y * work_w[i2] - work_uv[i0].y * work_w[i0];
-			const __m128 uv20y = _mm_set_ps(temp, temp, temp, temp);
-
-			temp = 1.0f / (float)winding_2d(&work_poly[i0], &work_poly[i1], &work_poly[i2]);
-			const __m128 one_over_double_area = _mm_set_ps(temp, temp, temp, temp);
-			temp = work_z[i1] - work_z[i0];
-			const __m128 z10 = _mm_set_ps(temp, temp, temp, temp);
-			temp = work_z[i2] - work_z[i0];
-			const __m128 z20 = _mm_set_ps(temp, temp, temp, temp);
-
-			temp = (float)(texture_size->x - 1);
-			const __m128 tex_coor_x_max = _mm_set_ps(temp, temp, temp, temp);
-			temp = (float)(texture_size->y - 1);
-			const __m128 tex_coor_y_max = _mm_set_ps(temp, temp, temp, temp);
+			/* Small tris often touch only a single 2x2 block,
+			 * check the coverage of the block before doing the full setup. */
+			if (!multisample && max.x - min.x == sub_multip && max.y - min.y == sub_multip
+				&& (w0_row[0] | w1_row[0] | w2_row[0]) < 0
+				&& ((w0_row[0] + step_x_12) | (w1_row[0] + step_x_20) | (w2_row[0] + step_x_01)) < 0
+				&& ((w0_row[0] + step_y_12) | (w1_row[0] + step_y_20) | (w2_row[0] + step_y_01)) < 0
+				&& ((w0_row[0] + step_y_12 + step_x_12) | (w1_row[0] + step_y_20 + step_x_20) | (w2_row[0] + step_y_01 + step_x_01)) < 0)
+			{
+				RASTER_STATS_ADD(raster_stats, small_rejects, 1);
+				continue;
+			}
+
+			/* Plane equations for the attributes, these are stepped incrementally for each 2x2 block.
+			 * Everything is in pixels relative to the raster origin. */
+			const float one_over_sub_multip = 1.0f / (float)sub_multip;
+			struct vec2_float p0;
+			p0.x = (float)work_poly[i0].x * one_over_sub_multip;
+			p0.y = (float)work_poly[i0].y * one_over_sub_multip;
+			struct vec2_float d10;
+			d10.x = (float)(work_poly[i1].x - work_poly[i0].x) * one_over_sub_multip;
+			d10.y = (float)(work_poly[i1].y - work_poly[i0].y) * one_over_sub_multip;
+			struct vec2_float d20;
+			d20.x = (float)(work_poly[i2].x - work_poly[i0].x) * one_over_sub_multip;
+			d20.y = (float)(work_poly[i2].y - work_poly[i0].y) * one_over_sub_multip;
+			/* The winding is A*2 in pixels scaled by sub_multip */
+			const float one_over_det = (float)sub_multip / (float)double_area;
+
+			struct plane_equation z_plane = get_plane_equation(&p0, &d10, &d20, one_over_det, work_z[i0], work_z[i1], work_z[i2]);
+
+			const float min_x_f = (float)min.x * one_over_sub_multip;
+			const float min_y_f = (float)min.y * one_over_sub_multip;
+			/* One block past the max as the steps are taken from there too */
+			const float max_x_f = (float)max.x * one_over_sub_multip + 2.0f;
+			const float max_y_f = (float)max.y * one_over_sub_multip + 2.0f;
+
+			/* Select the fixed point precision for depth, the samples can be up to half a pixel before the min */
+			const float range_min_x_f = multisample ? min_x_f - 0.5f : min_x_f;
+			const float range_min_y_f = multisample ? min_y_f - 0.5f : min_y_f;
+			float z_max_abs = fabsf(plane_equation_get_value(&z_plane, range_min_x_f, range_min_y_f));
+			z_max_abs = max(z_max_abs, fabsf(plane_equation_get_value(&z_plane, max_x_f, range_min_y_f)));
+			z_max_abs = max(z_max_abs, fabsf(plane_equation_get_value(&z_plane, range_min_x_f, max_y_f)));
+			z_max_abs = max(z_max_abs, fabsf(plane_equation_get_value(&z_plane, max_x_f, max_y_f)));
+			int32_t z_fract_bits = Z_MAX_FRACT_BITS;
+			while (z_fract_bits > Z_MIN_FRACT_BITS && z_max_abs * (float)(1 << (DEPTH_BITS + z_fract_bits)) >= (float)(1 << 30))
+				--z_fract_bits;
+			assert(z_max_abs * (float)(1 << (DEPTH_BITS + z_fract_bits)) < (float)(1 << 30) && "rasterizer_rasterize: depth range too large for fixed point");
+			tri.z_shift_right = _mm_cvtsi32_si128(max(z_fract_bits, 0));
+			tri.z_shift_left = _mm_cvtsi32_si128(max(-z_fract_bits, 0));
+
+			const float z_scale = (float)(1 << (DEPTH_BITS + z_fract_bits));
+			z_plane.a *= z_scale;
+			z_plane.b *= z_scale;
+			z_plane.c *= z_scale;
+
+			const int32_t z_step = (int32_t)floorf(z_plane.a * 2.0f + 0.5f);
+			tri.z_step_x = _mm_set_epi32(z_step, z_step, z_step, z_step);
+			temp = z_plane.b * 2.0f;
+			tri.z_step_y = _mm_set_ps(temp, temp, temp, temp);
+			tri.z_row = plane_equation_get_block(&z_plane, min_x_f, min_y_f);
+			for (uint32_t sample = 0; multisample && sample < sample_count; ++sample)
+			{
+				const int32_t z_offset = (int32_t)floorf(z_plane.a * (float)sample_offsets[sample].x * one_over_sub_multip
+					+ z_plane.b * (float)sample_offsets[sample].y * one_over_sub_multip + 0.5f);
+				tri.z_sample_offset[sample] = _mm_set_epi32(z_offset, z_offset, z_offset, z_offset);
+			}
+
+			/* Only depth is needed when not writing color */
+			if (color_write)
+			{
+				const struct plane_equation w_plane = get_plane_equation(&p0, &d10, &d20, one_over_det, work_w[i0], work_w[i1], work_w[i2]);
+				tri.w_row = plane_equation_get_block(&w_plane, min_x_f, min_y_f);
+				temp = w_plane.a * 2.0f;
+				tri.w_step_x = _mm_set_ps(temp, temp, temp, temp);
+				temp = w_plane.b * 2.0f;
+				tri.w_step_y = _mm_set_ps(temp, temp, temp, temp);
+			}
+
+			/* Varyings multiplied by 1/w */
+			for (unsigned int j = 0; j < used_varying_count; ++j)
+			{
+				const unsigned int varying = used_varyings[j];
+				const struct plane_equation plane = get_plane_equation(&p0, &d10, &d20, one_over_det,
+					work_varyings[i0][varying] * work_w[i0], work_varyings[i1][varying] * work_w[i1], work_varyings[i2][varying] * work_w[i2]);
+				tri.varying_row[varying] = plane_equation_get_block(&plane, min_x_f, min_y_f);
+				temp = plane.a * 2.0f;
+				tri.varying_step_x[varying] = _mm_set_ps(temp, temp, temp, temp);
+				temp = plane.b * 2.0f;
+				tri.varying_step_y[varying] = _mm_set_ps(temp, temp, temp, temp);
+			}
 
 #ifdef USE_TILES
 			unsigned int pixel_index_row;
@@ -523,203 +2226,270 @@ void rasterizer_rasterize(uint32_t *render_target, uint32_t *depth_buf, const st
 				pixel_index_row = TILE_SIZE * TILE_SIZE * 
 					((padded_size.x / TILE_SIZE) * (rasterize_area_min->y / TILE_SIZE) + (rasterize_area_min->x / TILE_SIZE)); /* tile index */
 				pixel_index_row += TILE_SIZE 
-					* ((((min.y - half_pixel) / sub_multip) + half_height) - rasterize_area_min->y) /* y */
-					+ (((((min.x - half_pixel) / sub_multip) + half_width) - rasterize_area_min->x) * 2); /* x */
+					* ((((min.y - half_pixel) / sub_multip) + origin.y) - rasterize_area_min->y) /* y */
+					+ (((((min.x - half_pixel) / sub_multip) + origin.x) - rasterize_area_min->x) * 2); /* x */
 
 			}
 #else
 			unsigned int pixel_index_row = target_size->x
-				* (((min.y - half_pixel) / sub_multip) + half_height) /* y */
-				+ ((((min.x - half_pixel) / sub_multip) + half_width) * 2); /* x */
+				* (((min.y - half_pixel) / sub_multip) + origin.y) /* y */
+				+ ((((min.x - half_pixel) / sub_multip) + origin.x) * 2); /* x */
 #endif
 
-			const __m128i step_size = _mm_set_epi32(2 * sub_multip, 2 * sub_multip, 2 * sub_multip, 2 * sub_multip);
-			const __m128i xor_mask = _mm_set_epi32(~(uint32_t)0, ~(uint32_t)0, ~(uint32_t)0, ~(uint32_t)0);
-			const __m128 work_w0 = _mm_set_ps(work_w[i0], work_w[i0], work_w[i0], work_w[i0]);
-			const __m128 work_w1 = _mm_set_ps(work_w[i1], work_w[i1], work_w[i1], work_w[i1]);
-			const __m128 work_w2 = _mm_set_ps(work_w[i2], work_w[i2], work_w[i2], work_w[i2]);
-
-			/* Rasterize */
-			__m128i point_x;
-			__m128i point_y = _mm_set_epi32(min.y + sub_multip, min.y + sub_multip, min.y, min.y);
-			for (; ((int32_t *)&point_y)[0] <= max.y; point_y = _mm_add_epi32(point_y, step_size))
+			tri.min = min;
+			tri.max = max;
+			for (uint32_t sample = 0; sample < sample_count; ++sample)
 			{
-				__m128i w0 = _mm_set_epi32(w0_row + step_y_12 + step_x_12, w0_row + step_y_12, w0_row + step_x_12, w0_row);
-				__m128i w1 = _mm_set_epi32(w1_row + step_y_20 + step_x_20, w1_row + step_y_20, w1_row + step_x_20, w1_row);
-				__m128i w2 = _mm_set_epi32(w2_row + step_y_01 + step_x_01, w2_row + step_y_01, w2_row + step_x_01, w2_row);
-
-				uint32_t pixel_index_start = pixel_index_row;
-
-				point_x = _mm_set_epi32(min.x + sub_multip, min.x, min.x + sub_multip, min.x);
-				for (; ((int32_t *)&point_x)[0] <= max.x; point_x = _mm_add_epi32(point_x, step_size))
-				{
-					__m128i mask = _mm_or_si128(w0, w1);
-					mask = _mm_or_si128(mask, w2);
-
-					/* Compare for less than zero
-					* (a0 < b0) ? 0xffffffff : 0x0
-					* if anything is >= 0 then there will be 0x0 bytes */
-					__m128i temp_mask = _mm_cmplt_epi32(mask, _mm_setzero_si128());
-					/* Invert with xor */
-					mask = _mm_xor_si128(xor_mask, temp_mask);
-					/* Or all bits and check if any were set */
-					if (_mm_movemask_epi8(mask) != 0)
-					{
-						__m128 one = _mm_set_ps(1.0f, 1.0f, 1.0f, 1.0f);
-						__m128 w0_f = _mm_min_ps(_mm_mul_ps(_mm_cvtepi32_ps(w0), one_over_double_area), one);
-						__m128 w1_f = _mm_min_ps(_mm_mul_ps(_mm_cvtepi32_ps(w1), one_over_double_area), one);
-						__m128 w2_f = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(one, w0_f), w1_f), _mm_setzero_ps());
-
-						__m128i z = _mm_cvttps_epi32(
-							_mm_mul_ps(_mm_set_ps((1 << DEPTH_BITS), (1 << DEPTH_BITS), (1 << DEPTH_BITS), (1 << DEPTH_BITS)),
-								_mm_add_ps(_mm_set_ps(work_z[i0], work_z[i0], work_z[i0], work_z[i0]),
-									_mm_add_ps(_mm_mul_ps(w1_f, z10), _mm_mul_ps(w2_f, z20)))));
-
-						/* force the buffer to be aligned and change the load to _mm_load_si128 */
-						__m128i depth = _mm_loadu_si128((const __m128i *)&depth_buf[pixel_index_start]);
-
-						__m128i depth_mask = _mm_set_epi32(0x00ffffff, 0x00ffffff, 0x00ffffff, 0x00ffffff);
-						temp_mask = _mm_cmplt_epi32(z, _mm_and_si128(depth, depth_mask));
-						mask = _mm_and_si128(mask, temp_mask);
-
-						if (_mm_movemask_epi8(mask) != 0x0)
-						{
-							__m128 interp_w = _mm_add_ps(_mm_add_ps(
-								_mm_mul_ps(work_w0, w0_f),
-								_mm_mul_ps(work_w1, w1_f)),
-								_mm_mul_ps(work_w2, w2_f));
-
-							__m128 u = _mm_div_ps(
-								_mm_add_ps(uv0x,
-									_mm_add_ps(_mm_mul_ps(w1_f, uv10x),
-										_mm_mul_ps(w2_f, uv20x))), interp_w);
-
-							__m128 v = _mm_div_ps(
-								_mm_add_ps(uv0y,
-									_mm_add_ps(_mm_mul_ps(w1_f, uv10y),
-										_mm_mul_ps(w2_f, uv20y))), interp_w);
-
-							__m128i texture_index = mul_epi32(_mm_cvttps_epi32(_mm_mul_ps(tex_coor_y_max, v)), _mm_set_epi32(texture_size->x, texture_size->x, texture_size->x, texture_size->x));
-							texture_index = _mm_add_epi32(texture_index, _mm_cvttps_epi32(_mm_mul_ps(tex_coor_x_max, u)));
-
-							for (unsigned int pixel = 0; pixel < 4; ++pixel)
-							{
-								if (((int32_t *)&mask)[pixel] == 0)
-									continue;
-#ifdef USE_TILES
-#if RPLNN_BUILD_TYPE == RPLNN_DEBUG
-								struct vec2_int padded_size;
-								rasterizer_get_padded_size(target_size, &padded_size);
-								assert(pixel_index_start + pixel < (unsigned)(padded_size.x * padded_size.y) && "rasterizer_rasterize: invalid pixel_index");
-#endif
-#else
-								assert(pixel_index_start + pixel < (unsigned)(target_size->x * target_size->y) && "rasterizer_rasterize: invalid pixel_index");
-#endif
-								assert(((uint32_t *)&texture_index)[pixel] < (unsigned)(texture_size->x * texture_size->y) && "rasterizer_rasterize: invalid texture_index");
-
-								/* There must be a better way to do this */
-								depth_buf[pixel_index_start + pixel] = ((int32_t *)&z)[pixel];
-								/* Mipmapping should help with this,
-								 * currently especially small triangles can cause cache misses
-								 * by accessing the texture in the opposite ends of the array.*/
-								render_target[pixel_index_start + pixel] = texture[((int32_t *)&texture_index)[pixel]];
-							}
-						}
-					}
-					uint32_t double_step = step_x_12 * 2;
-					w0 = _mm_add_epi32(w0, _mm_set_epi32(double_step, double_step, double_step, double_step));
-					double_step = step_x_20 * 2;
-					w1 = _mm_add_epi32(w1, _mm_set_epi32(double_step, double_step, double_step, double_step));
-					double_step = step_x_01 * 2;
-					w2 = _mm_add_epi32(w2, _mm_set_epi32(double_step, double_step, double_step, double_step));
-
-					pixel_index_start += 4;
-				}
+				tri.w0_row[sample] = w0_row[sample];
+				tri.w1_row[sample] = w1_row[sample];
+				tri.w2_row[sample] = w2_row[sample];
+			}
+			tri.step_x_12 = step_x_12;
+			tri.step_x_20 = step_x_20;
+			tri.step_x_01 = step_x_01;
+			tri.step_y_12 = step_y_12;
+			tri.step_y_20 = step_y_20;
+			tri.step_y_01 = step_y_01;
+			tri.double_area = double_area;
+			tri.pixel_index_row = pixel_index_row;
+
+			RASTER_STATS_ADD(raster_stats, triangles_rasterized, 1);
+			RASTER_STATS_ADD(raster_stats, bbox_pixels, (uint64_t)((max.x - min.x) / sub_multip + 1) * (uint64_t)((max.y - min.y) / sub_multip + 1));
+			RASTER_STATS_LAP(raster_stats, setup_cycles, stats_time);
 
-				w0_row += step_y_12 * 2;
-				w1_row += step_y_20 * 2;
-				w2_row += step_y_01 * 2;
-#ifdef USE_TILES
-				pixel_index_row += TILE_SIZE * 2;
+			/* Rasterize */
+			kernel(&constants, &tri);
 #else
-				pixel_index_row += target_size->x * 2;
-#endif
+			/* Varyings multiplied by 1/w, relative to the first vertex */
+			float varying0[VARYING_COUNT];
+			float varying10[VARYING_COUNT];
+			float varying20[VARYING_COUNT];
+			for (unsigned int j = 0; j < varying_count; ++j)
+			{
+				varying0[j] = work_varyings[i0][j] * work_w[i0];
+				varying10[j] = work_varyings[i1][j] * work_w[i1] - varying0[j];
+				varying20[j] = work_varyings[i2][j] * work_w[i2] - varying0[j];
 			}
-#else
-			struct vec2_float uv0;
-			uv0.x = work_uv[i0].x * work_w[i0]; uv0.y = work_uv[i0].y * work_w[i0];
-			struct vec2_float uv10;
-			uv10.x = work_uv[i1].x * work_w[i1] - work_uv[i0].x * work_w[i0];
-			uv10.y = work_uv[i1].y * work_w[i1] - work_uv[i0].y * work_w[i0];
-			struct vec2_float uv20;
-			uv20.x = work_uv[i2].x * work_w[i2] - work_uv[i0].x * work_w[i0];
-			uv20.y = work_uv[i2].y * work_w[i2] - work_uv[i0].y * work_w[i0];
 
 			float z10 = work_z[i1] - work_z[i0];
 			float z20 = work_z[i2] - work_z[i0];
 			
-			float one_over_double_area = 1.0f / (float)winding_2d(&work_poly[i0], &work_poly[i1], &work_poly[i2]);
-
-			const float tex_coor_x_max = (float)(texture_size->x - 1);
-			const float tex_coor_y_max = (float)(texture_size->y - 1);
+			float one_over_double_area = 1.0f / (float)double_area;
 
 			unsigned int pixel_index_row = target_size->x
-				* (((min.y - half_pixel) / sub_multip) + half_height) /* y */
-				+ (((min.x - half_pixel) / sub_multip) + half_width); /* x */
+				* (((min.y - half_pixel) / sub_multip) + origin.y) /* y */
+				+ (((min.x - half_pixel) / sub_multip) + origin.x); /* x */
+
+			/* The last shaded coarse pixel, with coarse shading its results are used for its other pixels in the same row */
+			int32_t shaded_x = -1;
+			int32_t shaded_y = -1;
+			const int32_t coarse_mask = (1 << shading_rate) - 1;
+			const float coarse_center = (float)coarse_mask * 0.5f;
+			uint32_t color = 0;
+			float varyings_w[VARYING_COUNT];
+			float interp_w = 0.0f;
+
+			RASTER_STATS_ADD(raster_stats, triangles_rasterized, 1);
+			RASTER_STATS_ADD(raster_stats, bbox_pixels, (uint64_t)((max.x - min.x) / sub_multip + 1) * (uint64_t)((max.y - min.y) / sub_multip + 1));
+			RASTER_STATS_LAP(raster_stats, setup_cycles, stats_time);
 
 			/* Rasterize */
 			struct vec2_int point;
 			for (point.y = min.y; point.y <= max.y; point.y += sub_multip)
 			{
-				int32_t w0 = w0_row;
-				int32_t w1 = w1_row;
-				int32_t w2 = w2_row;
+				int32_t w0[RASTERIZER_MSAA_SAMPLES];
+				int32_t w1[RASTERIZER_MSAA_SAMPLES];
+				int32_t w2[RASTERIZER_MSAA_SAMPLES];
+				for (uint32_t sample = 0; sample < sample_count; ++sample)
+				{
+					w0[sample] = w0_row[sample];
+					w1[sample] = w1_row[sample];
+					w2[sample] = w2_row[sample];
+				}
 
 				unsigned int pixel_index = pixel_index_row;
 				for (point.x = min.x; point.x <= max.x; point.x += sub_multip)
 				{
-					if ((w0 | w1 | w2) >= 0)
+					RASTER_STATS_ADD(raster_stats, quads_tested, 1);
+					RASTER_STATS_ADD(raster_stats, quads_covered, pixel_covered(w0, w1, w2, sample_count));
+
+					/* Samples which pass the tests, same bits as the quad queue uses */
+					uint32_t sample_mask = 0;
+					for (uint32_t sample = 0; sample < sample_count; ++sample)
 					{
-						float w0_f = min((float)w0 * one_over_double_area, 1.0f);
-						float w1_f = min((float)w1 * one_over_double_area, 1.0f);
+						if ((w0[sample] | w1[sample] | w2[sample]) < 0)
+							continue;
+
+						float w0_f = min((float)w0[sample] * one_over_double_area, 1.0f);
+						float w1_f = min((float)w1[sample] * one_over_double_area, 1.0f);
 						float w2_f = max(1.0f - w0_f - w1_f, 0.0f);
 
 						uint32_t z = (uint32_t)((work_z[i0] + (w1_f * z10) + (w2_f * z20)) * (1 << DEPTH_BITS));
 						assert(z < ((1 << DEPTH_BITS) + 1) && "rasterizer_rasterize: z value is too large");
-						if (z < depth_buf[pixel_index])
+						z = min(z, 0x00FFFFFF);
+						if (depth_bounds_test && (z < depth_bounds_min_fixed || z > depth_bounds_max_fixed))
+							continue;
+
+						/* The samples of a pixel are next to each other */
+						const unsigned int sample_index = pixel_index * sample_count + sample;
+						bool pass = !depth_test || z < (depth_buf[sample_index] & 0x00FFFFFF);
+						if (stencil_test)
 						{
-							depth_buf[pixel_index] = z;
-
-							float interp_w = work_w[i0] * w0_f + work_w[i1] * w1_f + work_w[i2] * w2_f;
-							float u = uv0.x + (w1_f * uv10.x) + (w2_f * uv20.x);
-							u /= interp_w;
-							float v = uv0.y + (w1_f * uv10.y) + (w2_f * uv20.y);
-							v /= interp_w;
-
-							const unsigned int texture_index = (unsigned)(tex_coor_y_max * v) * (unsigned)texture_size->x
-								+ (unsigned)(tex_coor_x_max * u);
-							assert(pixel_index < (unsigned)(target_size->x * target_size->y) && "rasterizer_rasterize: invalid pixel_index");
-							assert(texture_index < (unsigned)(texture_size->x * texture_size->y) && "rasterizer_rasterize: invalid texture_index");
-							render_target[pixel_index] = texture[texture_index];
+							const uint32_t stencil = depth_buf[sample_index] >> DEPTH_BITS;
+							const bool stencil_pass = stencil_test_passes(stencil_func, stencil_ref_masked, stencil & stencil_read_mask);
+							uint32_t new_stencil = stencil_op(stencil_pass ? (pass ? pass_op : depth_fail_op) : stencil_fail_op, stencil, stencil_ref);
+							new_stencil = (stencil & ~stencil_write_mask) | (new_stencil & stencil_write_mask);
+							depth_buf[sample_index] = (depth_buf[sample_index] & 0x00FFFFFF) | (new_stencil << DEPTH_BITS);
+							pass = pass && stencil_pass;
 						}
+
+						if (pass && depth_write)
+							depth_buf[sample_index] = (depth_buf[sample_index] & 0xFF000000) | z;
+
+						if (pass)
+							sample_mask |= 1 << (sample * 4);
 					}
 
-					w0 += step_x_12;
-					w1 += step_x_20;
-					w2 += step_x_01;
+					RASTER_STATS_ADD(raster_stats, quads_depth_passed, sample_mask != 0);
+					RASTER_STATS_ADD(raster_stats, pixels_written, sample_mask != 0);
+					if (sample_mask != 0 && color_write)
+					{
+						const int32_t x = (point.x - half_pixel) / sub_multip + origin.x;
+						const int32_t y = (point.y - half_pixel) / sub_multip + origin.y;
+						assert(pixel_index < (unsigned)(target_size->x * target_size->y) && "rasterizer_rasterize: invalid pixel_index");
+						if ((x >> shading_rate) != shaded_x || (y >> shading_rate) != shaded_y)
+						{
+							shaded_x = x >> shading_rate;
+							shaded_y = y >> shading_rate;
+
+							/* Colored once at the pixel center. With multisampling it is the average of the samples,
+							 * the center can be outside of the tri so the weights are extrapolated. */
+							float center_w0 = multisample ? ((float)w0[0] + (float)w0[1] + (float)w0[2] + (float)w0[3]) * 0.25f : (float)w0[0];
+							float center_w1 = multisample ? ((float)w1[0] + (float)w1[1] + (float)w1[2] + (float)w1[3]) * 0.25f : (float)w1[0];
+							if (shading_rate != 0)
+							{
+								/* With coarse shading at the center of the coarse pixel if it is inside the tri */
+								const float offset_x = coarse_center - (float)(x & coarse_mask);
+								const float offset_y = coarse_center - (float)(y & coarse_mask);
+								const float coarse_w0 = center_w0 + offset_x * (float)step_x_12 + offset_y * (float)step_y_12;
+								const float coarse_w1 = center_w1 + offset_x * (float)step_x_20 + offset_y * (float)step_y_20;
+								if (coarse_w0 >= 0.0f && coarse_w1 >= 0.0f && coarse_w0 + coarse_w1 <= (float)double_area)
+								{
+									center_w0 = coarse_w0;
+									center_w1 = coarse_w1;
+								}
+							}
+							float w0_f = center_w0 * one_over_double_area;
+							float w1_f = center_w1 * one_over_double_area;
+							float w2_f = 1.0f - w0_f - w1_f;
+							if (!multisample)
+							{
+								w0_f = min(w0_f, 1.0f);
+								w1_f = min(w1_f, 1.0f);
+								w2_f = max(1.0f - w0_f - w1_f, 0.0f);
+							}
+
+							/* Varyings multiplied by 1/w at the pixel */
+							for (unsigned int j = 0; j < varying_count; ++j)
+								varyings_w[j] = varying0[j] + (w1_f * varying10[j]) + (w2_f * varying20[j]);
+							interp_w = work_w[i0] * w0_f + work_w[i1] * w1_f + work_w[i2] * w2_f;
+
+							color = 0xFFFFFFFF;
+							if (texturing)
+							{
+								/* Clamp as the pixel center can be outside of the tri with multisampling */
+								const float u = clamp(varyings_w[VARYING_UV] / interp_w, 0.0f, 1.0f);
+								const float v = clamp(varyings_w[VARYING_UV + 1] / interp_w, 0.0f, 1.0f);
+								const unsigned int texture_index = (unsigned)(tex_coor_y_max * v) * (unsigned)texture_size->x
+									+ (unsigned)(tex_coor_x_max * u);
+								assert(texture_index < (unsigned)(texture_size->x * texture_size->y) && "rasterizer_rasterize: invalid texture_index");
+								color = texture[texture_index];
+							}
+							if (vertex_colors)
+							{
+								const uint32_t vertex_color = pack_color(varyings_w[VARYING_ATTRIBUTES] / interp_w, varyings_w[VARYING_ATTRIBUTES + 1] / interp_w,
+									varyings_w[VARYING_ATTRIBUTES + 2] / interp_w, varyings_w[VARYING_ATTRIBUTES + 3] / interp_w);
+								color = texturing ? multiply_colors(color, vertex_color) : vertex_color;
+							}
+							if (shadow)
+							{
+								/* Project to the shadow map, the 1/w of the pass cancels out */
+								const float one_over_light_w = 1.0f / varyings_w[VARYING_LIGHT + 3];
+								const float shadow_x = varyings_w[VARYING_LIGHT] * one_over_light_w;
+								const float shadow_y = varyings_w[VARYING_LIGHT + 1] * one_over_light_w;
+								const float shadow_z = varyings_w[VARYING_LIGHT + 2] * one_over_light_w;
+								const uint32_t lit = get_shadow_lit_count(shadow->map, &shadow->map_size, 
+									(int32_t)(shadow_x * (float)(shadow->map_size.x / 2) + (float)(shadow->map_size.x / 2) - 0.5f),
+									(int32_t)(shadow_y * (float)(shadow->map_size.y / 2) + (float)(shadow->map_size.y / 2) - 0.5f),
+									(uint32_t)max((shadow_z - shadow->bias) * (float)(1 << DEPTH_BITS) + 0.5f, 0.0f));
+								color = modulate_color(color, shadow_ambient + (((256 - shadow_ambient) * lit) >> 2));
+							}
+						}
+
+						if (pixel_shader)
+						{
+							struct rasterizer_quad_packet *packet = &queue.packet;
+							const uint32_t quad = packet->quad_count;
+							packet->x[quad] = x;
+							packet->y[quad] = y;
+							packet->mask[quad] = 1;
+							queue.pixel_index[quad] = pixel_index;
+							queue.sample_mask[quad] = sample_mask;
+							packet->colors[quad * 4] = color;
+							for (unsigned int j = 0; j < attribute_count; ++j)
+								packet->attributes[j][quad * 4] = varyings_w[VARYING_ATTRIBUTES + j] / interp_w;
+							if (++packet->quad_count == RASTERIZER_PACKET_QUADS)
+								flush_quad_queue(&queue);
+						}
+						else
+						{
+							for (uint32_t sample = 0; sample < sample_count; ++sample)
+							{
+								if ((sample_mask & (1 << (sample * 4))) == 0)
+									continue;
+
+								const unsigned int sample_index = pixel_index * sample_count + sample;
+								uint32_t sample_color = color;
+								if (blend)
+									sample_color = blend_color(color, render_target[sample_index], blend_alpha, blend_mode);
+								render_target[sample_index] = sample_color;
+							}
+						}
+					}
+
+					for (uint32_t sample = 0; sample < sample_count; ++sample)
+					{
+						w0[sample] += step_x_12;
+						w1[sample] += step_x_20;
+						w2[sample] += step_x_01;
+					}
 
 					++pixel_index;
 				}
 
-				w0_row += step_y_12;
-				w1_row += step_y_20;
-				w2_row += step_y_01;
+				for (uint32_t sample = 0; sample < sample_count; ++sample)
+				{
+					w0_row[sample] += step_y_12;
+					w1_row[sample] += step_y_20;
+					w2_row[sample] += step_y_01;
+				}
 
 				pixel_index_row += target_size->x;
 			}
 #endif		
+			RASTER_STATS_LAP(raster_stats, raster_cycles, stats_time);
 		}
 	}
+
+	/* The dropped tris after the last rasterized one */
+	RASTER_STATS_LAP(raster_stats, setup_cycles, stats_time);
+#ifdef USE_SIMD
+	if (color_write)
+		constants.color_quads(&constants);
+#endif
+	if (pixel_shader)
+		flush_quad_queue(&queue);
+	RASTER_STATS_LAP(raster_stats, raster_cycles, stats_time);
 }
 
 void rasterizer_clear_depth_buffer(uint32_t *depth_buf, const struct vec2_int *buf_size)
@@ -731,6 +2501,301 @@ void rasterizer_clear_depth_buffer(uint32_t *depth_buf, const struct vec2_int *b
 		depth_buf[i] |= 0x00FFFFFF;
 }
 
+void rasterizer_clear_stencil_buffer(uint32_t *depth_buf, const struct vec2_int *buf_size, const uint8_t value)
+{
+	assert(depth_buf && "rasterizer_clear_stencil_buffer: depth_buf is NULL");
+	assert(buf_size && "rasterizer_clear_stencil_buffer: buf_size is NULL");
+
+	const uint32_t stencil = (uint32_t)value << DEPTH_BITS;
+	for (int i = 0; i < buf_size->x * buf_size->y; ++i)
+		depth_buf[i] = (depth_buf[i] & 0x00FFFFFF) | stencil;
+}
+
+void rasterizer_resolve(uint32_t *render_target, const uint32_t *samples, const struct vec2_int *buf_size)
+{
+	assert(render_target && "rasterizer_resolve: render_target is NULL");
+	assert(samples && "rasterizer_resolve: samples is NULL");
+	assert(buf_size && "rasterizer_resolve: buf_size is NULL");
+
+	const int pixel_count = buf_size->x * buf_size->y;
+#ifdef USE_SIMD
+	/* The samples of a 2x2 block follow each other, each sample is one load for the whole block.
+	 * Channels are summed as 16bit and rounded. */
+	const __m128i rounding = _mm_set_epi16(2, 2, 2, 2, 2, 2, 2, 2);
+	for (int i = 0; i < pixel_count; i += 4)
+	{
+		const __m128i *block = (const __m128i *)&samples[i * RASTERIZER_MSAA_SAMPLES];
+		__m128i sum_lo = rounding;
+		__m128i sum_hi = rounding;
+		for (uint32_t sample = 0; sample < RASTERIZER_MSAA_SAMPLES; ++sample)
+		{
+			const __m128i sample_color = _mm_loadu_si128(&block[sample]);
+			sum_lo = _mm_add_epi16(sum_lo, _mm_unpacklo_epi8(sample_color, _mm_setzero_si128()));
+			sum_hi = _mm_add_epi16(sum_hi, _mm_unpackhi_epi8(sample_color, _mm_setzero_si128()));
+		}
+		/* Divide by the 4 samples */
+		_mm_storeu_si128((__m128i *)&render_target[i], _mm_packus_epi16(_mm_srli_epi16(sum_lo, 2), _mm_srli_epi16(sum_hi, 2)));
+	}
+#else
+	/* The samples of a pixel are next to each other */
+	for (int i = 0; i < pixel_count; ++i)
+	{
+		const uint32_t *pixel_samples = &samples[i * RASTERIZER_MSAA_SAMPLES];
+		uint32_t color = 0;
+		for (uint32_t shift = 0; shift < 32; shift += 8)
+		{
+			uint32_t sum = 2;
+			for (uint32_t sample = 0; sample < RASTERIZER_MSAA_SAMPLES; ++sample)
+				sum += (pixel_samples[sample] >> shift) & 0xFF;
+			color |= (sum >> 2) << shift;
+		}
+		render_target[i] = color;
+	}
+#endif
+}
+
+void rasterizer_draw_sprites(uint32_t *render_target, const struct vec2_int *target_size, const struct vec2_int *rasterize_area_min, const struct vec2_int *rasterize_area_max,
+	const struct rasterizer_sprite *sprites, const uint32_t sprite_count, const uint32_t *texture, const struct vec2_int *texture_size,
+	const enum rasterizer_texture_filter filter, const enum rasterizer_blend_mode blend_mode, const uint8_t blend_alpha)
+{
+	assert(render_target && "rasterizer_draw_sprites: render_target is NULL");
+	assert(target_size && "rasterizer_draw_sprites: target_size is NULL");
+	assert(rasterize_area_min && "rasterizer_draw_sprites: rasterize_area_min is NULL");
+	assert(rasterize_area_max && "rasterizer_draw_sprites: rasterize_area_max is NULL");
+	assert((sprites || sprite_count == 0) && "rasterizer_draw_sprites: sprites is NULL");
+	assert(texture && "rasterizer_draw_sprites: texture is NULL");
+	assert(texture_size && "rasterizer_draw_sprites: texture_size is NULL");
+	assert(blend_mode <= RASTERIZER_BLEND_PREMULTIPLIED && "rasterizer_draw_sprites: invalid blend_mode");
+	assert(rasterize_area_min->x >= 0 && rasterize_area_min->y >= 0 && "rasterizer_draw_sprites: invalid rasterize_area_min");
+#ifndef USE_TILES
+	assert(rasterize_area_max->x < target_size->x && rasterize_area_max->y < target_size->y && "rasterizer_draw_sprites: invalid rasterize_are_max");
+#endif
+#ifdef USE_SIMD
+	assert(rasterize_area_min->x % 2 == 0 && rasterize_area_min->y % 2 == 0 && "rasterizer_draw_sprites: rasterize_area_min must be even");
+	assert(rasterize_area_max->x % 2 == 1 && rasterize_area_max->y % 2 == 1 && "rasterizer_draw_sprites: rasterize_area_max must be odd");
+#ifdef USE_TILES
+	assert(rasterize_area_min->x % TILE_SIZE == 0 && rasterize_area_min->y % TILE_SIZE == 0 && "rasterizer_draw_sprites: When using tiles rasterize areas must be aligned to tiles.");
+	assert(rasterize_area_max->x - rasterize_area_min->x == TILE_SIZE - 1 && rasterize_area_max->y - rasterize_area_min->y == TILE_SIZE - 1
+		&& "rasterizer_draw_sprites: When using tiles rasterize areas must be tile sized.");
+#endif
+#endif
+
+	const bool bilinear = filter == RASTERIZER_FILTER_BILINEAR;
+	const bool blend = blend_mode != RASTERIZER_BLEND_NONE;
+	const int32_t texture_width = texture_size->x;
+	const float texture_width_f = (float)texture_size->x;
+	const float texture_height_f = (float)texture_size->y;
+	const int32_t texel_max_x = texture_size->x - 1;
+	const int32_t texel_max_y = texture_size->y - 1;
+
+#ifdef USE_SIMD
+	/* Index of the first pixel of each block row, blocks of a row follow each other */
+#ifdef USE_TILES
+	struct vec2_int padded_size;
+	rasterizer_get_padded_size(target_size, &padded_size);
+	const uint32_t area_index = TILE_SIZE * TILE_SIZE * ((padded_size.x / TILE_SIZE) * (rasterize_area_min->y / TILE_SIZE) + (rasterize_area_min->x / TILE_SIZE));
+	const uint32_t row_width = TILE_SIZE;
+	const struct vec2_int area_origin = *rasterize_area_min;
+#else
+	const uint32_t area_index = 0;
+	const uint32_t row_width = (uint32_t)target_size->x;
+	const struct vec2_int area_origin = { .x = 0, .y = 0 };
+#endif
+
+	const uint32_t blend_alpha16 = blend_alpha | (blend_alpha << 16);
+	const __m128i blend_alpha_vec = _mm_set_epi32(blend_alpha16, blend_alpha16, blend_alpha16, blend_alpha16);
+	const __m128 filter_scale = _mm_set_ps(128.0f, 128.0f, 128.0f, 128.0f);
+	const __m128 texel_max_x_f = _mm_set_ps((float)texel_max_x, (float)texel_max_x, (float)texel_max_x, (float)texel_max_x);
+	const __m128 texel_max_y_f = _mm_set_ps((float)texel_max_y, (float)texel_max_y, (float)texel_max_y, (float)texel_max_y);
+	const __m128i texel_max_x_vec = _mm_set_epi32(texel_max_x, texel_max_x, texel_max_x, texel_max_x);
+	const __m128i texel_max_y_vec = _mm_set_epi32(texel_max_y, texel_max_y, texel_max_y, texel_max_y);
+	const __m128i texture_width_vec = _mm_set_epi32(texture_width, texture_width, texture_width, texture_width);
+	const __m128i two = _mm_set_epi32(2, 2, 2, 2);
+#endif
+
+	for (uint32_t i = 0; i < sprite_count; ++i)
+	{
+		const struct rasterizer_sprite *sprite = &sprites[i];
+
+		/* Clip to the rasterize area */
+		const int32_t min_x = max(sprite->min.x, rasterize_area_min->x);
+		const int32_t min_y = max(sprite->min.y, rasterize_area_min->y);
+		const int32_t max_x = min(sprite->max.x, rasterize_area_max->x);
+		const int32_t max_y = min(sprite->max.y, rasterize_area_max->y);
+		if (min_x > max_x || min_y > max_y)
+			continue;
+
+		/* Texel coordinates are linear in the pixel coordinates, taken at the pixel centers.
+		 * They are relative to the first pixel of the sprite so the results don't depend on the rasterize area.
+		 * Bilinear filtering is relative to the texel centers. */
+		const struct vec2_int origin = sprite->min;
+		const float step_u = (sprite->uv_max.x - sprite->uv_min.x) * texture_width_f / (float)(sprite->max.x - origin.x + 1);
+		const float step_v = (sprite->uv_max.y - sprite->uv_min.y) * texture_height_f / (float)(sprite->max.y - origin.y + 1);
+		const float filter_offset = bilinear ? 0.5f : 0.0f;
+		const float start_u = sprite->uv_min.x * texture_width_f + 0.5f * step_u - filter_offset;
+		const float start_v = sprite->uv_min.y * texture_height_f + 0.5f * step_v - filter_offset;
+		const uint32_t color = sprite->color;
+		const bool modulate = color != 0xFFFFFFFF;
+
+		/* A texel per pixel inside of the texture, the rows are copied as they are */
+		const int32_t copy_x = (int32_t)floorf(start_u) - origin.x;
+		const int32_t copy_y = (int32_t)floorf(start_v) - origin.y;
+		const bool copy = !bilinear && fabsf(step_u - 1.0f) < 0.0001f && fabsf(step_v - 1.0f) < 0.0001f
+			&& copy_x + min_x >= 0 && copy_y + min_y >= 0 && copy_x + max_x <= texel_max_x && copy_y + max_y <= texel_max_y;
+
+#ifdef USE_SIMD
+		/* Whole 2x2 blocks, the pixels outside of the sprite keep their old color */
+		const int32_t block_min_x = min_x & ~1;
+		const int32_t block_min_y = min_y & ~1;
+		const __m128i color_vec = _mm_set_epi32(color, color, color, color);
+		const __m128i lane_min_x = _mm_set_epi32(min_x, min_x, min_x, min_x);
+		const __m128i lane_max_x = _mm_set_epi32(max_x, max_x, max_x, max_x);
+		const __m128i origin_x = _mm_set_epi32(origin.x, origin.x, origin.x, origin.x);
+		const __m128 start_u_vec = _mm_set_ps(start_u, start_u, start_u, start_u);
+		const __m128 step_u_vec = _mm_set_ps(step_u, step_u, step_u, step_u);
+		uint32_t pixel_index_row = area_index + row_width * (uint32_t)(block_min_y - area_origin.y) + (uint32_t)(block_min_x - area_origin.x) * 2;
+		for (int32_t y = block_min_y; y <= max_y; y += 2, pixel_index_row += row_width * 2)
+		{
+			const __m128i lane_y = _mm_set_epi32(y + 1, y + 1, y, y);
+			const __m128i row_mask = _mm_andnot_si128(_mm_or_si128(_mm_cmplt_epi32(lane_y, _mm_set_epi32(min_y, min_y, min_y, min_y)),
+				_mm_cmpgt_epi32(lane_y, _mm_set_epi32(max_y, max_y, max_y, max_y))), _mm_set_epi32(~0, ~0, ~0, ~0));
+			const bool full_rows = y >= min_y && y + 1 <= max_y;
+
+			/* The texture rows of the block rows and the vertical filter weight */
+			const float v0 = start_v + (float)(y - origin.y) * step_v;
+			const float v1 = start_v + (float)(y + 1 - origin.y) * step_v;
+			const __m128 v = _mm_min_ps(_mm_max_ps(_mm_set_ps(v1, v1, v0, v0), _mm_setzero_ps()), texel_max_y_f);
+			const __m128i texel_y = _mm_cvttps_epi32(v);
+			const __m128i row0 = mul_epi32(texel_y, texture_width_vec);
+			const __m128i row1 = mul_epi32(_mm_sub_epi32(texel_y, _mm_cmplt_epi32(texel_y, texel_max_y_vec)), texture_width_vec);
+			const __m128i weight_y = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(v, _mm_cvtepi32_ps(texel_y)), filter_scale));
+			const int32_t copy_row = (copy_y + y) * texture_width + copy_x;
+
+			uint32_t pixel_index = pixel_index_row;
+			__m128i lane_x = _mm_set_epi32(block_min_x + 1, block_min_x, block_min_x + 1, block_min_x);
+			for (int32_t x = block_min_x; x <= max_x; x += 2, pixel_index += 4)
+			{
+				__m128i texel;
+				if (copy && full_rows && x >= min_x && x + 1 <= max_x)
+				{
+					texel = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)&texture[copy_row + x]),
+						_mm_loadl_epi64((const __m128i *)&texture[copy_row + texture_width + x]));
+				}
+				else
+				{
+					const __m128 u = _mm_add_ps(start_u_vec, _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(lane_x, origin_x)), step_u_vec));
+					const __m128 clamped_u = _mm_min_ps(_mm_max_ps(u, _mm_setzero_ps()), texel_max_x_f);
+					const __m128i texel_x = _mm_cvttps_epi32(clamped_u);
+					texel = gather_epi32(texture, _mm_add_epi32(row0, texel_x));
+					if (bilinear)
+					{
+						const __m128i texel_x1 = _mm_sub_epi32(texel_x, _mm_cmplt_epi32(texel_x, texel_max_x_vec));
+						const __m128i weight_x = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(clamped_u, _mm_cvtepi32_ps(texel_x)), filter_scale));
+						const __m128i top = lerp_colors_block(gather_epi32(texture, _mm_add_epi32(row1, texel_x)), gather_epi32(texture, _mm_add_epi32(row1, texel_x1)), weight_x);
+						texel = lerp_colors_block(lerp_colors_block(texel, gather_epi32(texture, _mm_add_epi32(row0, texel_x1)), weight_x), top, weight_y);
+					}
+				}
+				if (modulate)
+					texel = multiply_colors_block(texel, color_vec);
+
+				const __m128i mask = _mm_andnot_si128(_mm_or_si128(_mm_cmplt_epi32(lane_x, lane_min_x), _mm_cmpgt_epi32(lane_x, lane_max_x)), row_mask);
+#ifdef USE_TILES
+				assert(pixel_index + 3 < (uint32_t)(padded_size.x * padded_size.y) && "rasterizer_draw_sprites: invalid pixel_index");
+#else
+				assert(pixel_index + 3 < (uint32_t)(target_size->x * target_size->y) && "rasterizer_draw_sprites: invalid pixel_index");
+#endif
+				__m128i *target = (__m128i *)&render_target[pixel_index];
+				if (blend || _mm_movemask_epi8(mask) != 0xFFFF)
+				{
+					const __m128i dst = _mm_loadu_si128(target);
+					if (blend)
+						texel = blend_block(texel, dst, blend_alpha_vec, blend_mode);
+					texel = select_si128(mask, texel, dst);
+				}
+				_mm_storeu_si128(target, texel);
+
+				lane_x = _mm_add_epi32(lane_x, two);
+			}
+		}
+#else
+		for (int32_t y = min_y; y <= max_y; ++y)
+		{
+			uint32_t *target = &render_target[y * target_size->x];
+			if (copy && !modulate && !blend)
+			{
+				memcpy(&target[min_x], &texture[(copy_y + y) * texture_width + copy_x + min_x], (size_t)(max_x - min_x + 1) * sizeof(uint32_t));
+				continue;
+			}
+
+			const float v = clamp(start_v + (float)(y - origin.y) * step_v, 0.0f, (float)texel_max_y);
+			const int32_t texel_y = (int32_t)v;
+			const uint32_t *row0 = &texture[texel_y * texture_width];
+			const uint32_t *row1 = &texture[min(texel_y + 1, texel_max_y) * texture_width];
+			const int32_t weight_y = (int32_t)((v - (float)texel_y) * 128.0f);
+			for (int32_t x = min_x; x <= max_x; ++x)
+			{
+				const float u = clamp(start_u + (float)(x - origin.x) * step_u, 0.0f, (float)texel_max_x);
+				const int32_t texel_x = (int32_t)u;
+				uint32_t texel = row0[texel_x];
+				if (bilinear)
+				{
+					const int32_t texel_x1 = min(texel_x + 1, texel_max_x);
+					const int32_t weight_x = (int32_t)((u - (float)texel_x) * 128.0f);
+					texel = lerp_colors(lerp_colors(texel, row0[texel_x1], weight_x), lerp_colors(row1[texel_x], row1[texel_x1], weight_x), weight_y);
+				}
+				if (modulate)
+					texel = multiply_colors(texel, color);
+				target[x] = blend ? blend_color(texel, target[x], blend_alpha, blend_mode) : texel;
+			}
+		}
+#endif
+	}
+}
+
+void rasterizer_collect_stats(struct rasterizer_stats *out)
+{
+	assert(out && "rasterizer_collect_stats: out is NULL");
+
+#ifdef USE_RASTER_STATS
+	rasterizer_add_stats(out, &raster_stats);
+	memset(&raster_stats, 0, sizeof(raster_stats));
+#else
+	(void)out;
+#endif
+}
+
+void rasterizer_add_stats(struct rasterizer_stats *dst, const struct rasterizer_stats *src)
+{
+	assert(dst && "rasterizer_add_stats: dst is NULL");
+	assert(src && "rasterizer_add_stats: src is NULL");
+
+	dst->triangles += src->triangles;
+	dst->near_far_rejects += src->near_far_rejects;
+	dst->depth_bounds_rejects += src->depth_bounds_rejects;
+	dst->view_rejects += src->view_rejects;
+	dst->guard_band_clips += src->guard_band_clips;
+	dst->culled += src->culled;
+	dst->scissor_rejects += src->scissor_rejects;
+	dst->small_rejects += src->small_rejects;
+	dst->triangles_rasterized += src->triangles_rasterized;
+	dst->bbox_pixels += src->bbox_pixels;
+	dst->quads_tested += src->quads_tested;
+	dst->quads_covered += src->quads_covered;
+	dst->quads_depth_passed += src->quads_depth_passed;
+	dst->pixels_written += src->pixels_written;
+	dst->setup_cycles += src->setup_cycles;
+	dst->raster_cycles += src->raster_cycles;
+}
+
+bool rasterizer_uses_stats(void)
+{
+#ifdef USE_RASTER_STATS
+	return true;
+#else
+	return false;
+#endif
+}
+
 bool rasterizer_uses_simd(void)
 {
 #ifdef USE_SIMD
@@ -754,6 +2819,11 @@ uint32_t rasterizer_get_tile_size(void)
 	return TILE_SIZE;
 }
 
+uint32_t rasterizer_get_max_area_size(void)
+{
+	return MAX_AREA_SIZE;
+}
+
 void rasterizer_get_padded_size(const struct vec2_int *target_size, struct vec2_int *out_padded_size)
 {
 	assert(target_size && "rasterizer_get_padded_size: target_size is NULL");
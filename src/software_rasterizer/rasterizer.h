@@ -1,17 +1,245 @@
 #ifndef RPLNN_RASTERIZER_H
 #define RPLNN_RASTERIZER_H
 
+/* Max amount of float attributes per vertex */
+#define RASTERIZER_MAX_ATTRIBUTES 8
+/* Samples per pixel when multisampling */
+#define RASTERIZER_MSAA_SAMPLES 4
+
+enum rasterizer_cull_mode
+{
+	RASTERIZER_CULL_BACK = 0,
+	RASTERIZER_CULL_FRONT,
+	RASTERIZER_CULL_NONE
+};
+
+enum rasterizer_compare_func
+{
+	RASTERIZER_COMPARE_NEVER = 0,
+	RASTERIZER_COMPARE_LESS,
+	RASTERIZER_COMPARE_EQUAL,
+	RASTERIZER_COMPARE_LESS_EQUAL,
+	RASTERIZER_COMPARE_GREATER,
+	RASTERIZER_COMPARE_NOT_EQUAL,
+	RASTERIZER_COMPARE_GREATER_EQUAL,
+	RASTERIZER_COMPARE_ALWAYS
+};
+
+enum rasterizer_stencil_op
+{
+	RASTERIZER_STENCIL_KEEP = 0,
+	RASTERIZER_STENCIL_ZERO,
+	RASTERIZER_STENCIL_REPLACE,
+	RASTERIZER_STENCIL_INCR, /* Clamps to 255 */
+	RASTERIZER_STENCIL_DECR, /* Clamps to 0 */
+	RASTERIZER_STENCIL_INVERT,
+	RASTERIZER_STENCIL_INCR_WRAP,
+	RASTERIZER_STENCIL_DECR_WRAP
+};
+
+/* Source alpha is the alpha of the color multiplied with blend_alpha (a below), channels are in [0, 1].
+ * Additive and premultiplied results are saturated. */
+enum rasterizer_blend_mode
+{
+	RASTERIZER_BLEND_NONE = 0, /* src */
+	RASTERIZER_BLEND_ALPHA, /* src * a + dst * (1 - a) */
+	RASTERIZER_BLEND_ADDITIVE, /* dst + src * a */
+	RASTERIZER_BLEND_PREMULTIPLIED /* src * blend_alpha + dst * (1 - a), texture colors are premultiplied */
+};
+
+/* Size of the coarse pixels, the value is log2 of the size.
+ * Coarse pixels are aligned to the render target, for example 2x2 coarse pixels start at even x and y. */
+enum rasterizer_shading_rate
+{
+	RASTERIZER_SHADING_RATE_1X1 = 0,
+	RASTERIZER_SHADING_RATE_2X2,
+	RASTERIZER_SHADING_RATE_4X4
+};
+
+/* Shadow mapping for a textured pass.
+ * map is a depth buffer rendered from the light, for example with color_write disabled.
+ * It uses the same layout as the other buffers (see rasterizer_uses_simd and rasterizer_uses_tiles).
+ * vert_buf has the same vertices as the vert_buf of the pass but transformed to the light's clip space.
+ * bias is in depth buffer units [0, 1], ambient is the amount of light left in fully shadowed pixels [0, 1].
+ * Lookups are filtered with 2x2 percentage closer filtering. */
+struct rasterizer_shadow
+{
+	const uint32_t *map;
+	struct vec2_int map_size;
+	const struct vec4_float *vert_buf;
+	float bias;
+	float ambient;
+};
+
+/* Covered 2x2 quads of a draw, given to a pixel shader in packets of up to RASTERIZER_PACKET_QUADS.
+ * Per pixel values are in structure of arrays form, 4 values per quad in the order
+ * (x, y), (x + 1, y), (x, y + 1), (x + 1, y + 1) where x, y is the bottom left pixel of the quad.
+ * mask has a bit per pixel in the same order, only the covered pixels that passed the depth and stencil tests are set.
+ * attributes are the vertex attributes of the draw interpolated with perspective correction.
+ * colors are the fixed function result (texture and vertex colors, shadows) or white if neither is used,
+ * the shader replaces them with its output. The outputs are blended and written after the shader returns.
+ * Without SIMD each quad has a single pixel (mask is 1).
+ * With multisampling a pixel is in the mask when any of its samples is covered, the output is written to the covered samples. */
+#define RASTERIZER_PACKET_QUADS 16
+
+struct rasterizer_quad_packet
+{
+	uint32_t quad_count;
+	uint32_t attribute_count;
+	int32_t x[RASTERIZER_PACKET_QUADS];
+	int32_t y[RASTERIZER_PACKET_QUADS];
+	uint32_t mask[RASTERIZER_PACKET_QUADS];
+	float attributes[RASTERIZER_MAX_ATTRIBUTES][RASTERIZER_PACKET_QUADS * 4];
+	uint32_t colors[RASTERIZER_PACKET_QUADS * 4];
+};
+
+/* Called once per packet, data is the pixel_shader_data of the state.
+ * With threading the same shader can be called from multiple threads at once. */
+typedef void(*rasterizer_pixel_shader)(struct rasterizer_quad_packet *packet, const void *data);
+
+/* Per draw state, rasterizer_state_init sets the defaults
+ * (back face culling, depth test and write, color write, texturing, no vertex colors, no stencil test, no shadows, no blending, no pixel shader, no multisampling,
+ *  1x1 shading rate, no scissor test, no depth bounds test). 
+ * Depth test is always less.
+ * Stencil test passes when (stencil_ref & stencil_read_mask) stencil_func (stencil & stencil_read_mask).
+ * The color is the texture multiplied with the vertex color, color_write needs at least one of them or a pixel shader.
+ * When color_write is false render_target is not used and can be NULL.
+ * When color_write or texturing is false uv_buf, texture and texture_size are not used and can be NULL.
+ * Multisampling tests coverage, depth and stencil for RASTERIZER_MSAA_SAMPLES samples per pixel but colors each pixel once,
+ * all draws to the same buffers must use the same multisample setting (see rasterizer_rasterize and rasterizer_resolve).
+ * With a coarser shading_rate the color (texture, vertex colors and shadows) and the attributes given to the pixel shader
+ * are computed once per coarse pixel and used for all of its covered pixels, coverage, depth and stencil stay per pixel.
+ * They are computed at the center of the coarse pixel or, when that is outside of the tri, at a covered pixel close to it.
+ * The rate is per draw, a different rate per rasterize area (tile) can be used by giving the areas their own states.
+ * The scissor test limits the draw to the pixels in [scissor_min, scissor_max] (inclusive, render target pixels like the rasterize area).
+ * It is intersected with the rasterize area so the bounding boxes of the tris are clamped to it before any per pixel work.
+ * When using SIMD scissor_min must be even and scissor_max must be odd because of 2x2 blocks.
+ * The depth bounds test drops tris and samples whose depth is outside [depth_bounds_min, depth_bounds_max] (in [0, 1])
+ * before the depth and stencil tests, for example to skip the parts of a light volume outside of the light's depth range.
+ * multisample, depth_test, texturing, vertex_colors, blend_mode and pixel_shader select a SIMD kernel specialized for them,
+ * the rest of the state is checked in the kernel.
+ * Blending depends on the draw order. To keep the results deterministic when threading
+ * each pixel must be rasterized by a single thread which does the draws in submission order,
+ * for example by giving each thread its own set of rasterize areas (tiles).
+ * The areas must also be the same with any number of threads, interpolated values can differ in the lowest bits between splits. */
+struct rasterizer_state
+{
+	enum rasterizer_cull_mode cull_mode;
+	bool depth_test;
+	bool depth_write;
+	bool color_write;
+	bool texturing;
+	bool vertex_colors; /* Attributes 0-3 are used as rgba [0, 1], needs attribute_count >= 4 */
+	bool stencil_test;
+	enum rasterizer_compare_func stencil_func;
+	uint8_t stencil_ref;
+	uint8_t stencil_read_mask;
+	uint8_t stencil_write_mask;
+	enum rasterizer_stencil_op stencil_fail_op;
+	enum rasterizer_stencil_op depth_fail_op;
+	enum rasterizer_stencil_op pass_op;
+	const struct rasterizer_shadow *shadow; /* NULL disables shadows, only used with color_write */
+	enum rasterizer_blend_mode blend_mode; /* Only used with color_write */
+	uint8_t blend_alpha;
+	rasterizer_pixel_shader pixel_shader; /* NULL disables, only used with color_write */
+	const void *pixel_shader_data;
+	bool multisample;
+	enum rasterizer_shading_rate shading_rate; /* Only used with color_write */
+	bool scissor_test;
+	struct vec2_int scissor_min;
+	struct vec2_int scissor_max;
+	bool depth_bounds_test;
+	float depth_bounds_min;
+	float depth_bounds_max;
+};
+
+void rasterizer_state_init(struct rasterizer_state *state);
+
 /* Left handed coordinate system. Tris wanted as CCW. 
- * Depth buffer stores the depth in the first 24bits and the rest 8 are reserved for future use (stencil). 
+ * Depth buffer stores the depth in the first 24bits and the stencil in the last 8bits. 
  * Rasterize area is in inclusive pixel values for min >= 0 && max < target_size && min < max.
+ * A single rasterize area can be at most rasterizer_get_max_area_size() pixels wide and high, larger render targets must be split to multiple areas.
+ * Coverage doesn't depend on how the render target is split to areas, interpolated values (depth, colors) can differ in the lowest bits.
  * When using SIMD rasterize area min must be even and rasterize area max must be odd because of 2x2 blocks.
  * When using SIMD + tiles the render target and depth buffer must be padded to a multiple of the tile size.
  * When using SIMD + tiles raster areas must be tile_size x tile_size and aligned to the tiles.
- * Render target and depth buffer must have their 0,0 at bottom left corner. */
+ * Render target and depth buffer must have their 0,0 at bottom left corner.
+ * Texture and render target colors are 0xAARRGGBB.
+ * attribute_buf has attribute_count (<= RASTERIZER_MAX_ATTRIBUTES) floats per vertex, they are interpolated with perspective correction.
+ * attribute_buf can be NULL when attribute_count is 0.
+ * With multisampling render target and depth buffer have RASTERIZER_MSAA_SAMPLES entries per pixel, target_size is still in pixels.
+ * Clear them with a buf_size of x * RASTERIZER_MSAA_SAMPLES and get the final image with rasterizer_resolve. */
 void rasterizer_rasterize(uint32_t *render_target, uint32_t *depth_buf, const struct vec2_int *target_size, const struct vec2_int *rasterize_area_min, const struct vec2_int *rasterize_area_max,
-	const struct vec4_float *vert_buf, const struct vec2_float *uv_buf, const unsigned int *ind_buf, const unsigned int index_count, 
-	const uint32_t *texture, const struct vec2_int *texture_size);
+	const struct vec4_float *vert_buf, const struct vec2_float *uv_buf, const float *attribute_buf, const uint32_t attribute_count, const unsigned int *ind_buf, const unsigned int index_count, 
+	const uint32_t *texture, const struct vec2_int *texture_size, const struct rasterizer_state *state);
+/* Clears only the depth bits, stencil is left as is. */
 void rasterizer_clear_depth_buffer(uint32_t *depth_buf, const struct vec2_int *buf_size);
+/* Clears only the stencil bits, depth is left as is. */
+void rasterizer_clear_stencil_buffer(uint32_t *depth_buf, const struct vec2_int *buf_size, const uint8_t value);
+/* Averages the samples of a multisampled render target to render_target.
+ * buf_size is the size of render_target (padded when using tiles), samples has RASTERIZER_MSAA_SAMPLES times as many entries. */
+void rasterizer_resolve(uint32_t *render_target, const uint32_t *samples, const struct vec2_int *buf_size);
+/* Screen aligned textured rectangle for rasterizer_draw_sprites.
+ * min and max are inclusive render target pixels, uv_min is at the min edges of the rect and uv_max at the max edges.
+ * The uvs are interpolated linearly (no perspective), a uv_min larger than uv_max flips the sprite.
+ * color is multiplied with the texture, 0xFFFFFFFF keeps the texture as is. */
+struct rasterizer_sprite
+{
+	struct vec2_int min;
+	struct vec2_int max;
+	struct vec2_float uv_min;
+	struct vec2_float uv_max;
+	uint32_t color;
+};
+
+enum rasterizer_texture_filter
+{
+	RASTERIZER_FILTER_NEAREST = 0,
+	RASTERIZER_FILTER_BILINEAR
+};
+
+/* Draws screen aligned sprites in order without the tri setup, for UI, particles and text.
+ * There is no depth or stencil test, blending works as with rasterizer_rasterize.
+ * The render target, rasterize area and threading rules are the same as with rasterizer_rasterize, the sprites are clipped to the area.
+ * With multisampling draw them to the resolved render target.
+ * Texture coordinates are clamped to the edges of the texture.
+ * Sprites with a texel per pixel and nearest filtering copy the texture rows as they are. */
+void rasterizer_draw_sprites(uint32_t *render_target, const struct vec2_int *target_size, const struct vec2_int *rasterize_area_min, const struct vec2_int *rasterize_area_max,
+	const struct rasterizer_sprite *sprites, const uint32_t sprite_count, const uint32_t *texture, const struct vec2_int *texture_size,
+	const enum rasterizer_texture_filter filter, const enum rasterizer_blend_mode blend_mode, const uint8_t blend_alpha);
+/* Per stage counters and timers of rasterizer_rasterize, only collected when USE_RASTER_STATS is defined in rasterizer.c.
+ * Each thread accumulates its own, nothing is shared between the threads.
+ * The tri counters are in the order the tris are dropped, tris split by clipping are counted once per part from culled on.
+ * With SIMD the quads are 2x2 blocks, without SIMD each quad is a single pixel.
+ * bbox_pixels is the area of the bounding boxes the coverage loops step through (rounded to blocks with SIMD).
+ * Cycles are from the time stamp counter, setup is everything up to the coverage loop including the dropped tris,
+ * raster is the coverage loop and coloring. */
+struct rasterizer_stats
+{
+	uint64_t triangles;
+	uint64_t near_far_rejects;
+	uint64_t depth_bounds_rejects;
+	uint64_t view_rejects; /* Fully outside of the rasterize area */
+	uint64_t guard_band_clips;
+	uint64_t culled; /* Back/front faces and degenerate tris */
+	uint64_t scissor_rejects;
+	uint64_t small_rejects; /* No pixel centers (or the single block) covered */
+	uint64_t triangles_rasterized;
+	uint64_t bbox_pixels;
+	uint64_t quads_tested;
+	uint64_t quads_covered;
+	uint64_t quads_depth_passed; /* Depth, stencil and depth bounds */
+	uint64_t pixels_written; /* Depth only draws count the pixels that passed */
+	uint64_t setup_cycles;
+	uint64_t raster_cycles;
+};
+
+/* Adds the stats of the calling thread to out and clears them, out is left as is when the stats are not collected.
+ * For example call it from each worker thread after its draws. */
+void rasterizer_collect_stats(struct rasterizer_stats *out);
+/* Adds each counter of src to dst, for example to sum the stats of the threads */
+void rasterizer_add_stats(struct rasterizer_stats *dst, const struct rasterizer_stats *src);
+bool rasterizer_uses_stats(void);
 /* When SIMD is used the render target and depth buffer will use blocks.
  * They are tiled to 2x2 pixel blocks bottom two pixels first followed by the top two pixels. */
 bool rasterizer_uses_simd(void);
@@ -20,6 +248,8 @@ bool rasterizer_uses_simd(void);
  * They are tiled to tile_size x tile_size tiles of 2x2 blocks, left to right, bottom to top. */
 bool rasterizer_uses_tiles(void);
 uint32_t rasterizer_get_tile_size(void);
+/* 4092 with 4bit sub-pixel precision, 2044 with 8bit */
+uint32_t rasterizer_get_max_area_size(void);
 void rasterizer_get_padded_size(const struct vec2_int *target_size, struct vec2_int *out_padded_size);
 
 #endif /* RPLNN_RASTERIZER_H */
@@ -0,0 +1,544 @@
+#include "software_rasterizer/precompiled.h"
+
+#include "software_rasterizer/rasterizer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Coverage and coarse shading tests for the rasterizer, prints the failed checks and returns the number of them.
+ * Coverage is counted with the stencil buffer (incremented for each covered pixel) and
+ * the tris are identified by flat vertex colors, so the results don't depend on attribute interpolation. */
+
+/* A jittered grid of quads covering the whole target, every pixel must be covered by exactly one tri.
+ * The jitter (in cells) is small enough to keep the quads convex. */
+#define SEAM_TARGET_SIZE 512
+#define SEAM_GRID_SIZE 200
+#define SEAM_GRID_JITTER 0.2f
+
+struct test_target
+{
+	uint32_t *render_target;
+	uint32_t *depth_buf;
+	struct vec2_int size;
+	struct vec2_int buffer_size; /* Padded with tiles */
+};
+
+/* Non-indexed tris with a flat color each */
+struct test_mesh
+{
+	struct vec4_float *verts;
+	float *colors;
+	unsigned int *indices;
+	unsigned int tri_count;
+};
+
+bool test_target_init(struct test_target *target, const int width, const int height);
+void test_target_deinit(struct test_target *target);
+void test_target_clear(struct test_target *target);
+uint32_t test_target_get_index(const struct test_target *target, const int x, const int y);
+uint32_t test_target_get_stencil(const struct test_target *target, const int x, const int y);
+
+bool test_mesh_init(struct test_mesh *mesh, const unsigned int tri_count);
+void test_mesh_deinit(struct test_mesh *mesh);
+void test_mesh_set_tri(struct test_mesh *mesh, const unsigned int tri, const struct vec2_float *p0, const struct vec2_float *p1, const struct vec2_float *p2,
+	const struct vec2_int *target_size);
+
+void draw_area(struct test_target *target, const struct test_mesh *mesh, const struct vec2_int *area_min, const struct vec2_int *area_max);
+void draw_split(struct test_target *target, const struct test_mesh *mesh, const int area_size);
+uint32_t count_coverage_errors(const struct test_target *target);
+
+unsigned int test_seams(void);
+unsigned int test_area_edges(void);
+unsigned int test_max_area_size(void);
+unsigned int test_coarse_shading(void);
+
+int main(void)
+{
+	unsigned int failures = 0;
+	failures += test_seams();
+	failures += test_area_edges();
+	failures += test_max_area_size();
+	failures += test_coarse_shading();
+
+	printf("simd %d, tiles %d: %u failed\n", rasterizer_uses_simd(), rasterizer_uses_tiles(), failures);
+	return (int)failures;
+}
+
+bool test_target_init(struct test_target *target, const int width, const int height)
+{
+	assert(target && "test_target_init: target is NULL");
+
+	target->size.x = width;
+	target->size.y = height;
+	target->buffer_size = target->size;
+	if (rasterizer_uses_simd() && rasterizer_uses_tiles())
+		rasterizer_get_padded_size(&target->size, &target->buffer_size);
+
+	const size_t pixel_count = (size_t)target->buffer_size.x * (size_t)target->buffer_size.y;
+	target->render_target = malloc(pixel_count * sizeof(uint32_t));
+	target->depth_buf = malloc(pixel_count * sizeof(uint32_t));
+	if (!target->render_target || !target->depth_buf)
+	{
+		test_target_deinit(target);
+		return false;
+	}
+
+	test_target_clear(target);
+	return true;
+}
+
+void test_target_deinit(struct test_target *target)
+{
+	assert(target && "test_target_deinit: target is NULL");
+
+	free(target->render_target);
+	free(target->depth_buf);
+	target->render_target = NULL;
+	target->depth_buf = NULL;
+}
+
+void test_target_clear(struct test_target *target)
+{
+	assert(target && "test_target_clear: target is NULL");
+
+	memset(target->render_target, 0, (size_t)target->buffer_size.x * (size_t)target->buffer_size.y * sizeof(uint32_t));
+	rasterizer_clear_depth_buffer(target->depth_buf, &target->buffer_size);
+	rasterizer_clear_stencil_buffer(target->depth_buf, &target->buffer_size, 0);
+}
+
+/* Index of a pixel in the block (and tile) layout of the rasterizer, see rasterizer.h */
+uint32_t test_target_get_index(const struct test_target *target, const int x, const int y)
+{
+	assert(target && "test_target_get_index: target is NULL");
+	assert(x >= 0 && y >= 0 && x < target->buffer_size.x && y < target->buffer_size.y && "test_target_get_index: pixel outside of the target");
+
+	if (!rasterizer_uses_simd())
+		return (uint32_t)(y * target->size.x + x);
+
+	uint32_t row_width = (uint32_t)target->size.x;
+	uint32_t index = 0;
+	int local_x = x;
+	int local_y = y;
+	if (rasterizer_uses_tiles())
+	{
+		const int tile_size = (int)rasterizer_get_tile_size();
+		row_width = (uint32_t)tile_size;
+		index = (uint32_t)(tile_size * tile_size * ((target->buffer_size.x / tile_size) * (y / tile_size) + x / tile_size));
+		local_x = x % tile_size;
+		local_y = y % tile_size;
+	}
+
+	return index + row_width * (uint32_t)(local_y & ~1) + (uint32_t)(local_x & ~1) * 2 + (uint32_t)(local_x & 1) + (uint32_t)(local_y & 1) * 2;
+}
+
+uint32_t test_target_get_stencil(const struct test_target *target, const int x, const int y)
+{
+	assert(target && "test_target_get_stencil: target is NULL");
+
+	return target->depth_buf[test_target_get_index(target, x, y)] >> 24;
+}
+
+bool test_mesh_init(struct test_mesh *mesh, const unsigned int tri_count)
+{
+	assert(mesh && "test_mesh_init: mesh is NULL");
+
+	mesh->verts = malloc(tri_count * 3 * sizeof(struct vec4_float));
+	mesh->colors = malloc(tri_count * 3 * 4 * sizeof(float));
+	mesh->indices = malloc(tri_count * 3 * sizeof(unsigned int));
+	mesh->tri_count = tri_count;
+	if (!mesh->verts || !mesh->colors || !mesh->indices)
+	{
+		test_mesh_deinit(mesh);
+		return false;
+	}
+
+	for (unsigned int i = 0; i < tri_count * 3; ++i)
+		mesh->indices[i] = i;
+
+	return true;
+}
+
+void test_mesh_deinit(struct test_mesh *mesh)
+{
+	assert(mesh && "test_mesh_deinit: mesh is NULL");
+
+	free(mesh->verts);
+	free(mesh->colors);
+	free(mesh->indices);
+	memset(mesh, 0, sizeof(struct test_mesh));
+}
+
+/* Positions are in pixels, the color of the tri is its index + 1 */
+void test_mesh_set_tri(struct test_mesh *mesh, const unsigned int tri, const struct vec2_float *p0, const struct vec2_float *p1, const struct vec2_float *p2,
+	const struct vec2_int *target_size)
+{
+	assert(mesh && "test_mesh_set_tri: mesh is NULL");
+	assert(tri < mesh->tri_count && "test_mesh_set_tri: too big tri");
+	assert(tri < 0xFFFFFF && "test_mesh_set_tri: tri can't be stored to a color");
+
+	const struct vec2_float *points[3];
+	points[0] = p0;
+	points[1] = p1;
+	points[2] = p2;
+	const uint32_t id = tri + 1;
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		struct vec4_float *pos = &mesh->verts[tri * 3 + i];
+		pos->x = points[i]->x / (float)target_size->x * 2.0f - 1.0f;
+		pos->y = points[i]->y / (float)target_size->y * 2.0f - 1.0f;
+		pos->z = 0.5f;
+		pos->w = 1.0f;
+
+		float *color = &mesh->colors[(tri * 3 + i) * 4];
+		color[0] = (float)((id >> 16) & 0xFF) / 255.0f;
+		color[1] = (float)((id >> 8) & 0xFF) / 255.0f;
+		color[2] = (float)(id & 0xFF) / 255.0f;
+		color[3] = 1.0f;
+	}
+}
+
+/* Every covered pixel gets the color of its tri and increments the stencil */
+void draw_area(struct test_target *target, const struct test_mesh *mesh, const struct vec2_int *area_min, const struct vec2_int *area_max)
+{
+	assert(target && "draw_area: target is NULL");
+	assert(mesh && "draw_area: mesh is NULL");
+
+	struct rasterizer_state state;
+	rasterizer_state_init(&state);
+	state.depth_test = false;
+	state.depth_write = false;
+	state.texturing = false;
+	state.vertex_colors = true;
+	state.stencil_test = true;
+	state.stencil_func = RASTERIZER_COMPARE_ALWAYS;
+	state.pass_op = RASTERIZER_STENCIL_INCR;
+
+	rasterizer_rasterize(target->render_target, target->depth_buf, &target->size, area_min, area_max, mesh->verts, NULL, mesh->colors, 4,
+		mesh->indices, mesh->tri_count * 3, NULL, NULL, &state);
+}
+
+/* With tiles the areas are always the tiles */
+void draw_split(struct test_target *target, const struct test_mesh *mesh, const int area_size)
+{
+	assert(target && "draw_split: target is NULL");
+	assert(mesh && "draw_split: mesh is NULL");
+
+	const int size = rasterizer_uses_simd() && rasterizer_uses_tiles() ? (int)rasterizer_get_tile_size() : area_size;
+	struct vec2_int area_min;
+	struct vec2_int area_max;
+	for (area_min.y = 0; area_min.y < target->buffer_size.y; area_min.y += size)
+	{
+		for (area_min.x = 0; area_min.x < target->buffer_size.x; area_min.x += size)
+		{
+			area_max.x = min(area_min.x + size, target->buffer_size.x) - 1;
+			area_max.y = min(area_min.y + size, target->buffer_size.y) - 1;
+			draw_area(target, mesh, &area_min, &area_max);
+		}
+	}
+}
+
+/* Pixels of the target not covered exactly once */
+uint32_t count_coverage_errors(const struct test_target *target)
+{
+	assert(target && "count_coverage_errors: target is NULL");
+
+	uint32_t errors = 0;
+	for (int y = 0; y < target->size.y; ++y)
+	{
+		for (int x = 0; x < target->size.x; ++x)
+			errors += test_target_get_stencil(target, x, y) != 1;
+	}
+
+	return errors;
+}
+
+/* A mesh covering the whole target has no holes or overlaps and the same tri covers each pixel no matter how the target is split */
+unsigned int test_seams(void)
+{
+	struct test_target target;
+	struct test_mesh mesh;
+	struct vec2_float *grid = malloc((SEAM_GRID_SIZE + 1) * (SEAM_GRID_SIZE + 1) * sizeof(struct vec2_float));
+	if (!grid || !test_target_init(&target, SEAM_TARGET_SIZE, SEAM_TARGET_SIZE) || !test_mesh_init(&mesh, SEAM_GRID_SIZE * SEAM_GRID_SIZE * 2))
+	{
+		printf("test_seams: out of memory\n");
+		return 1;
+	}
+
+	/* The grid reaches a cell past the target so the border pixels are covered too */
+	const float cell_size = (float)(SEAM_TARGET_SIZE + 2) / (float)(SEAM_GRID_SIZE - 2);
+	uint32_t seed = 0x2545F491;
+	for (int y = 0; y <= SEAM_GRID_SIZE; ++y)
+	{
+		for (int x = 0; x <= SEAM_GRID_SIZE; ++x)
+		{
+			struct vec2_float *point = &grid[y * (SEAM_GRID_SIZE + 1) + x];
+			seed = seed * 1664525u + 1013904223u;
+			const float jitter_x = ((float)(seed >> 8) / (float)(1 << 24) - 0.5f) * 2.0f * SEAM_GRID_JITTER;
+			seed = seed * 1664525u + 1013904223u;
+			const float jitter_y = ((float)(seed >> 8) / (float)(1 << 24) - 0.5f) * 2.0f * SEAM_GRID_JITTER;
+			point->x = ((float)(x - 1) + jitter_x) * cell_size - 1.0f;
+			point->y = ((float)(y - 1) + jitter_y) * cell_size - 1.0f;
+		}
+	}
+
+	for (int y = 0; y < SEAM_GRID_SIZE; ++y)
+	{
+		for (int x = 0; x < SEAM_GRID_SIZE; ++x)
+		{
+			const struct vec2_float *p00 = &grid[y * (SEAM_GRID_SIZE + 1) + x];
+			const struct vec2_float *p10 = p00 + 1;
+			const struct vec2_float *p01 = p00 + SEAM_GRID_SIZE + 1;
+			const struct vec2_float *p11 = p01 + 1;
+			const unsigned int tri = (unsigned int)(y * SEAM_GRID_SIZE + x) * 2;
+			test_mesh_set_tri(&mesh, tri, p00, p10, p11, &target.size);
+			test_mesh_set_tri(&mesh, tri + 1, p00, p11, p01, &target.size);
+		}
+	}
+	free(grid);
+
+	unsigned int failures = 0;
+	const size_t pixel_count = (size_t)target.buffer_size.x * (size_t)target.buffer_size.y;
+	uint32_t *reference = malloc(pixel_count * sizeof(uint32_t));
+	/* Odd area sizes move the area origins around, the first one is the whole target */
+	const int area_sizes[] = { SEAM_TARGET_SIZE, 128, 96, 64, 38 };
+	for (unsigned int i = 0; reference && i < sizeof(area_sizes) / sizeof(area_sizes[0]); ++i)
+	{
+		test_target_clear(&target);
+		draw_split(&target, &mesh, area_sizes[i]);
+
+		const uint32_t errors = count_coverage_errors(&target);
+		if (errors != 0)
+		{
+			printf("test_seams: %u pixels not covered exactly once with %dx%d areas\n", errors, area_sizes[i], area_sizes[i]);
+			++failures;
+		}
+
+		if (i == 0)
+		{
+			memcpy(reference, target.render_target, pixel_count * sizeof(uint32_t));
+			continue;
+		}
+
+		uint32_t differences = 0;
+		for (size_t j = 0; j < pixel_count; ++j)
+			differences += reference[j] != target.render_target[j];
+		if (differences != 0)
+		{
+			printf("test_seams: %u pixels covered by a different tri with %dx%d areas than with a single area\n", differences, area_sizes[i], area_sizes[i]);
+			++failures;
+		}
+	}
+
+	if (!reference)
+	{
+		printf("test_seams: out of memory\n");
+		++failures;
+	}
+
+	free(reference);
+	test_mesh_deinit(&mesh);
+	test_target_deinit(&target);
+	return failures;
+}
+
+/* Tris covering only the pixel centers of the first or the last column or row of an area are rasterized by that area */
+unsigned int test_area_edges(void)
+{
+	const int size = rasterizer_uses_simd() && rasterizer_uses_tiles() ? (int)rasterizer_get_tile_size() : 256;
+	struct test_target target;
+	struct test_mesh mesh;
+	if (!test_target_init(&target, size, size) || !test_mesh_init(&mesh, 1))
+	{
+		printf("test_area_edges: out of memory\n");
+		return 1;
+	}
+
+	const struct vec2_int area_min = { .x = 0, .y = 0 };
+	struct vec2_int area_max;
+	area_max.x = size - 1;
+	area_max.y = size - 1;
+	const struct
+	{
+		const char *name;
+		bool column;
+		bool last;
+	} edges[] = { { "first column", true, false }, { "last column", true, true }, { "first row", false, false }, { "last row", false, true } };
+
+	unsigned int failures = 0;
+	for (unsigned int i = 0; i < sizeof(edges) / sizeof(edges[0]); ++i)
+	{
+		/* A thin tri around the pixel centers of the line, 0.3 pixels to both sides.
+		 * Along the line it covers the pixel centers 10.5 - 19.5 (and 20.5 at its tip). */
+		const int line = edges[i].last ? size - 1 : 0;
+		const float center = (float)line + 0.5f;
+		struct vec2_float p0;
+		struct vec2_float p1;
+		struct vec2_float p2;
+		if (edges[i].column)
+		{
+			p0.x = center - 0.3f; p0.y = 10.2f;
+			p1.x = center + 0.3f; p1.y = 10.2f;
+			p2.x = center; p2.y = 20.8f;
+		}
+		else
+		{
+			p0.x = 10.2f; p0.y = center - 0.3f;
+			p1.x = 20.8f; p1.y = center;
+			p2.x = 10.2f; p2.y = center + 0.3f;
+		}
+		test_mesh_set_tri(&mesh, 0, &p0, &p1, &p2, &target.size);
+
+		test_target_clear(&target);
+		draw_area(&target, &mesh, &area_min, &area_max);
+
+		uint32_t covered = 0;
+		for (int j = 10; j < 20; ++j)
+			covered += edges[i].column ? test_target_get_stencil(&target, line, j) : test_target_get_stencil(&target, j, line);
+		if (covered != 10)
+		{
+			printf("test_area_edges: %u of 10 pixels covered on the %s\n", covered, edges[i].name);
+			++failures;
+		}
+	}
+
+	test_mesh_deinit(&mesh);
+	test_target_deinit(&target);
+	return failures;
+}
+
+/* A single area of the max size is covered to its edges, also by tris clipped to the guard band */
+unsigned int test_max_area_size(void)
+{
+	/* Tiles are always tile sized */
+	if (rasterizer_uses_simd() && rasterizer_uses_tiles())
+		return 0;
+
+	const int width = (int)rasterizer_get_max_area_size();
+	const int height = 16;
+	struct test_target target;
+	struct test_mesh mesh;
+	if (!test_target_init(&target, width, height) || !test_mesh_init(&mesh, 2))
+	{
+		printf("test_max_area_size: out of memory\n");
+		return 1;
+	}
+
+	/* A quad reaching far outside of the guard band on both sides */
+	const float reach = (float)width * 20.0f;
+	struct vec2_float p00;
+	p00.x = -reach; p00.y = -1.0f;
+	struct vec2_float p10;
+	p10.x = (float)width + reach; p10.y = -1.0f;
+	struct vec2_float p01;
+	p01.x = -reach; p01.y = (float)height + 1.0f;
+	struct vec2_float p11;
+	p11.x = (float)width + reach; p11.y = (float)height + 1.0f;
+	test_mesh_set_tri(&mesh, 0, &p00, &p10, &p11, &target.size);
+	test_mesh_set_tri(&mesh, 1, &p00, &p11, &p01, &target.size);
+
+	const struct vec2_int area_min = { .x = 0, .y = 0 };
+	struct vec2_int area_max;
+	area_max.x = width - 1;
+	area_max.y = height - 1;
+	draw_area(&target, &mesh, &area_min, &area_max);
+
+	unsigned int failures = 0;
+	const uint32_t errors = count_coverage_errors(&target);
+	if (errors != 0)
+	{
+		printf("test_max_area_size: %u pixels not covered exactly once with a %dx%d area\n", errors, width, height);
+		++failures;
+	}
+
+	test_mesh_deinit(&mesh);
+	test_target_deinit(&target);
+	return failures;
+}
+
+/* With coarse shading all the pixels of a coarse pixel get the same color when its center is inside the tri.
+ * A single tri covers the whole target with vertex colors changing several levels per pixel,
+ * the colors of a coarse pixel may only differ by the rounding of the interpolation. */
+unsigned int test_coarse_shading(void)
+{
+	const int size = rasterizer_uses_simd() && rasterizer_uses_tiles() ? (int)rasterizer_get_tile_size() : 64;
+	struct test_target target;
+	struct test_mesh mesh;
+	if (!test_target_init(&target, size, size) || !test_mesh_init(&mesh, 1))
+	{
+		printf("test_coarse_shading: out of memory\n");
+		return 1;
+	}
+
+	struct vec2_float p0;
+	p0.x = -(float)size; p0.y = -(float)size;
+	struct vec2_float p1;
+	p1.x = (float)size * 3.0f; p1.y = -(float)size;
+	struct vec2_float p2;
+	p2.x = -(float)size; p2.y = (float)size * 3.0f;
+	test_mesh_set_tri(&mesh, 0, &p0, &p1, &p2, &target.size);
+	/* Red along x and green along y, 4 levels per pixel from 0 at the target corner (clamped to 255 past it) */
+	const float level_step = 4.0f / 255.0f;
+	struct vec2_float *points[3];
+	points[0] = &p0;
+	points[1] = &p1;
+	points[2] = &p2;
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		float *color = &mesh.colors[i * 4];
+		color[0] = points[i]->x * level_step;
+		color[1] = points[i]->y * level_step;
+		color[2] = 0.0f;
+	}
+
+	const struct vec2_int area_min = { .x = 0, .y = 0 };
+	struct vec2_int area_max;
+	area_max.x = size - 1;
+	area_max.y = size - 1;
+	const enum rasterizer_shading_rate rates[] = { RASTERIZER_SHADING_RATE_2X2, RASTERIZER_SHADING_RATE_4X4 };
+
+	unsigned int failures = 0;
+	for (unsigned int i = 0; i < sizeof(rates) / sizeof(rates[0]); ++i)
+	{
+		struct rasterizer_state state;
+		rasterizer_state_init(&state);
+		state.depth_test = false;
+		state.depth_write = false;
+		state.texturing = false;
+		state.vertex_colors = true;
+		state.shading_rate = rates[i];
+
+		test_target_clear(&target);
+		rasterizer_rasterize(target.render_target, target.depth_buf, &target.size, &area_min, &area_max, mesh.verts, NULL, mesh.colors, 4,
+			mesh.indices, 3, NULL, NULL, &state);
+
+		const int coarse_size = 1 << rates[i];
+		uint32_t errors = 0;
+		for (int y = 0; y < size; ++y)
+		{
+			for (int x = 0; x < size; ++x)
+			{
+				const uint32_t color = target.render_target[test_target_get_index(&target, x, y)];
+				const uint32_t coarse_color = target.render_target[test_target_get_index(&target, x & ~(coarse_size - 1), y & ~(coarse_size - 1))];
+				for (uint32_t shift = 0; shift < 24; shift += 8)
+				{
+					const int diff = (int)((color >> shift) & 0xFF) - (int)((coarse_color >> shift) & 0xFF);
+					if (diff < -1 || diff > 1)
+					{
+						++errors;
+						break;
+					}
+				}
+			}
+		}
+
+		if (errors != 0)
+		{
+			printf("test_coarse_shading: %u pixels differ from their %dx%d coarse pixel\n", errors, coarse_size, coarse_size);
+			++failures;
+		}
+	}
+
+	test_mesh_deinit(&mesh);
+	test_target_deinit(&target);
+	return failures;
+}
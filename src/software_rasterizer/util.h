@@ -6,5 +6,27 @@
 
 #define min3(a, b, c) min(min((a), (b)), (c))
 #define max3(a, b, c) max(max((a), (b)), (c))
+#define clamp(val, min_val, max_val) min(max((val), (min_val)), (max_val))
+
+/* Parses a decimal number which fits to 32 bits, out_value is only set on success */
+RPLNN_INLINE bool parse_uint(const char *str, uint32_t *out_value)
+{
+	assert(str && "parse_uint: str is NULL");
+	assert(out_value && "parse_uint: out_value is NULL");
+
+	uint64_t value = 0;
+	for (const char *c = str; *c; ++c)
+	{
+		if (*c < '0' || *c > '9')
+			return false;
+
+		value = value * 10 + (uint64_t)(*c - '0');
+		if (value > UINT32_MAX)
+			return false;
+	}
+
+	*out_value = (uint32_t)value;
+	return *str != '\0';
+}
 
 #endif /* RPLNN_UTIL_H */